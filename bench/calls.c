@@ -0,0 +1,78 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  Measures what a call from C into Scheme costs through the C API, by
+  calling a Scheme procedure which adds its two arguments many times, and
+  a native through the same path, which shows the cost of the call alone.
+  Usage: calls [count]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/ecsi.h"
+
+static Value add(int argCount, Value *args) {
+    (void)argCount;
+    return NUMBER_VAL(AS_NUMBER(args[0]) + AS_NUMBER(args[1]));
+}
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Calls the global name count times, and prints the time of each call.
+static void timeCalls(char const *name, long count) {
+    Value procedure;
+    if (!ecsiGetGlobal(name, &procedure)) exit(70);
+    EcsiHandle handle = ecsiRetain(procedure);
+
+    double sum = 0;
+    double start = now();
+    for (long i = 0; i < count; i++) {
+        Value result;
+        ecsiPush(ecsiHandleValue(handle));
+        ecsiPush(NUMBER_VAL((double)i));
+        ecsiPush(NUMBER_VAL(1));
+        if (INTERPRET_OK != ecsiCall(2, &result)) exit(70);
+        sum += AS_NUMBER(result);
+    }
+    double seconds = now() - start;
+
+    printf("%s: %.1f ns per call (sum %.0f)\n", name, seconds / count * 1e9,
+           sum);
+    ecsiRelease(handle);
+}
+
+int main(int argc, char *argv[]) {
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+
+    ecsiOpen();
+    ecsiDefineNative("native-add", add, 2);
+    if (INTERPRET_OK != ecsiRun("(define (scheme-add a b) (+ a b))")) {
+        return 65;
+    }
+    timeCalls("scheme-add", count);
+    timeCalls("native-add", count);
+    ecsiClose();
+    return 0;
+}
@@ -0,0 +1,21 @@
+; Upvalues, globals and case.
+(define (make-counter)
+  (let ((n 0)) (lambda () (set! n (+ n 1)) n)))
+(define counter (make-counter))
+(define (count k)
+  (let loop ((i 0)) (if (< i k) (begin (counter) (loop (+ i 1))) (counter))))
+(define (classify x)
+  (case x ((0) 'zero) ((1 2 3) 'small) ((4 5 6) 'medium) (else 'big)))
+(define (count-small n)
+  (let loop ((i 0) (k 0))
+    (if (= i n)
+        k
+        (loop (+ i 1) (if (eq? (classify (- i 3)) 'small) (+ k 1) k)))))
+(define start (clock))
+(display (count 1000000))
+(newline)
+(display (count-small 500000))
+(newline)
+(display "closures: ")
+(display (- (clock) start))
+(newline)
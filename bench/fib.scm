@@ -0,0 +1,8 @@
+; Non-tail recursion: mostly calls and returns.
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(define start (clock))
+(display (fib 30))
+(newline)
+(display "fib: ")
+(display (- (clock) start))
+(newline)
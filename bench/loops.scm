@@ -0,0 +1,16 @@
+; Named let and do loops: arithmetic on locals, with no calls.
+(define (sum-to n)
+  (let loop ((i 0) (acc 0))
+    (if (> i n) acc (loop (+ i 1) (+ acc i)))))
+(define (nested n)
+  (do ((i 0 (+ i 1))
+       (t 0 (+ t (do ((j 0 (+ j 1)) (s 0 (+ s (* i j)))) ((= j n) s)))))
+      ((= i n) t)))
+(define start (clock))
+(display (sum-to 3000000))
+(newline)
+(display (nested 1500))
+(newline)
+(display "loops: ")
+(display (- (clock) start))
+(newline)
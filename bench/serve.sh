@@ -0,0 +1,63 @@
+#!/bin/sh
+# Copyright 2025 Evan Cooney
+
+# This file is part of Ecsi.
+
+# Ecsi is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation, either version 3 of the License, or (at your option) any later
+# version.
+
+# Ecsi is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License along with
+# Ecsi. If not, see <https://www.gnu.org/licenses/>.
+
+# Compares the latency of running a short script by starting ecsi for it
+# against sending it to a fork server which has already loaded the prelude.
+# Usage: serve.sh ecsi ecsi_client [runs]
+
+ECSI=$1
+CLIENT=$2
+RUNS=${3:-200}
+WORK=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+
+# The prelude is a stand-in for a standard library.
+i=0
+while [ $i -lt 300 ]; do
+    echo "(define (f$i x) (if (< x 2) x (+ (f$i (- x 1)) $i)))"
+    i=$((i + 1))
+done > "$WORK/prelude.scm"
+echo "(display (f299 3))" > "$WORK/script.scm"
+cat "$WORK/prelude.scm" "$WORK/script.scm" > "$WORK/cold.scm"
+
+"$ECSI" --serve "$WORK/socket" "$WORK/prelude.scm" &
+SERVER=$!
+# Give the server up to 10 seconds to start listening.
+tries=0
+while [ ! -S "$WORK/socket" ]; do
+    tries=$((tries + 1))
+    if [ $tries -gt 1000 ]; then
+        echo "The server didn't start." >&2
+        exit 1
+    fi
+    sleep 0.01
+done
+
+# Prints how long each of RUNS runs of the command took, on average.
+time_runs() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$@" > /dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$(((end - start) / RUNS / 1000)) us per script"
+}
+
+echo "cold start:  $(time_runs "$ECSI" "$WORK/cold.scm")"
+echo "fork server: $(time_runs "$CLIENT" "$WORK/socket" "$WORK/script.scm")"
@@ -0,0 +1,9 @@
+; Calls with several arguments, which are computed from locals.
+(define (tak x y z)
+  (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z))
+(define start (clock))
+(display (tak 24 16 8))
+(newline)
+(display "tak: ")
+(display (- (clock) start))
+(newline)
@@ -0,0 +1,110 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  Runs the benchmark programs on 1, 2, 4 and so on threads, up to the
+  number of cores, with a VM for each thread. Every thread runs every
+  program once. It prints how many runs of the programs were done per
+  second, and that rate over the rate of one thread times the number of
+  threads, which stays near 1 while the VMs share nothing. The programs'
+  own output goes to standard output, and the rates to standard error.
+  Usage: threads program...
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/memory.h"
+#include "../src/vm.h"
+
+static char **sources;
+static int sourceCount;
+
+static char *readSource(char const *path) {
+    FILE *file = fopen(path, "rb");
+    if (NULL == file) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+    fseek(file, 0L, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    rewind(file);
+
+    char *source = checkedMalloc(size + 1);
+    source[fread(source, 1, size, file)] = '\0';
+    fclose(file);
+    return source;
+}
+
+static void *runPrograms(void *unused) {
+    (void)unused;
+    initVM();
+    for (int i = 0; i < sourceCount; i++) {
+        if (INTERPRET_OK != interpret(sources[i])) exit(70);
+    }
+    freeVM();
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// Returns how many runs of the programs threadCount threads do a second.
+static double runThreads(int threadCount) {
+    pthread_t *threads = checkedMalloc(sizeof(pthread_t) * threadCount);
+    double start = now();
+    for (int i = 0; i < threadCount; i++) {
+        if (0 != pthread_create(&threads[i], NULL, runPrograms, NULL)) {
+            fputs("Could not start a thread.\n", stderr);
+            exit(71);
+        }
+    }
+    for (int i = 0; i < threadCount; i++) pthread_join(threads[i], NULL);
+    double seconds = now() - start;
+    free(threads);
+    return threadCount / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fputs("Usage: threads program...\n", stderr);
+        return 64;
+    }
+    sourceCount = argc - 1;
+    sources = checkedMalloc(sizeof(char *) * sourceCount);
+    for (int i = 0; i < sourceCount; i++) sources[i] = readSource(argv[i + 1]);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    double single = runThreads(1);
+    fprintf(stderr, "1 thread: %.2f runs/s\n", single);
+    for (int threadCount = 2; threadCount <= cores; threadCount *= 2) {
+        double rate = runThreads(threadCount);
+        fprintf(stderr, "%d threads: %.2f runs/s, %.2f of linear\n",
+                threadCount, rate, rate / (single * threadCount));
+    }
+
+    for (int i = 0; i < sourceCount; i++) free(sources[i]);
+    free(sources);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  The client of ecsi --serve. It sends the script at path, or standard
+  input if there is no path, to the server on socket, which runs it and
+  writes to the client's standard output and standard error. It exits
+  with the exit status ecsi would have.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "server.h"
+
+int main(int argc, char const *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: ecsi_client socket [path]\n");
+        return 64;
+    }
+
+    int script = STDIN_FILENO;
+    if (3 == argc && -1 == (script = open(argv[2], O_RDONLY))) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[2]);
+        return 74;
+    }
+
+    int status = submitScript(argv[1], script, STDOUT_FILENO, STDERR_FILENO);
+    if (-1 == status) {
+        fprintf(stderr, "The server on \"%s\" didn't run the script.\n",
+                argv[1]);
+        return 70;
+    }
+    return status;
+}
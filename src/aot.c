@@ -0,0 +1,224 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "aot.h"
+
+#include <string.h>
+
+#include "memory.h"
+#include "table.h"
+
+// The index on the stack of the function which is being built.
+static _Thread_local int building = -1;
+
+static ObjFunction *functionBeingBuilt(void);
+
+bool enterAot(CallFrame *frame) {
+    for (;;) {
+        AotFunction run = frame->closure->function->aotCode;
+        if (NULL == run) return true;
+
+        switch (run(frame)) {
+            case AOT_EXIT:
+                return true;
+            case AOT_ERROR:
+                return false;
+            default:
+                // The frame was reused by a tail call, so run that too.
+                break;
+        }
+    }
+}
+
+int aotMain(void (*build)(void)) {
+    initVM();
+    build();
+
+    ObjFunction *script = AS_FUNCTION(vm.stackTop[-1]);
+    InterpretResult result = interpretFunction(script);
+    freeVM();
+
+    return INTERPRET_RUNTIME_ERROR == result ? 70 : 0;
+}
+
+void aotBeginFunction(char const *name, int arity, Parameters parameters,
+                      int upvalueCount, int maxStack, int callSiteCount,
+                      AotFunction run, uint8_t const *code,
+                      unsigned const *lines, size_t count) {
+    ObjFunction *function = newFunction();
+    push(OBJ_VAL(function));
+    building = (int)(vm.stackTop - vm.stack) - 1;
+
+    function->arity = arity;
+    function->parameters = parameters;
+    function->upvalueCount = upvalueCount;
+    function->maxStack = maxStack;
+    function->aotCode = run;
+    function->tier = NULL == run ? TIER_INTERPRETED : TIER_NATIVE;
+    for (size_t i = 0; i < count; i++) {
+        writeChunk(&(function->chunk), code[i], lines[i]);
+    }
+    if (NULL != name) function->name = newSymbol(name, (int)strlen(name));
+
+    function->callSiteCount = callSiteCount;
+    if (callSiteCount > 0) {
+        function->callCaches = ALLOCATE(CallCache, callSiteCount);
+        for (int i = 0; i < callSiteCount; i++) {
+            function->callCaches[i] = (CallCache){.function = NULL,
+                                                  .code = NULL};
+        }
+    }
+}
+
+void aotAddConstant(void) {
+    addConstant(&(functionBeingBuilt()->chunk), vm.stackTop[-1]);
+    pop();
+}
+
+void aotEndFunction(void) {
+    // The function stays on the stack, where aotPushFunction() finds it.
+    building = -1;
+}
+
+void aotPushFunction(int index) { push(vm.stack[index]); }
+
+void aotPushSymbol(char const *chars, int length, bool interned) {
+    ObjSymbol *symbol = newSymbol(chars, length);
+    if (!interned) {
+        push(OBJ_VAL(symbol));
+        symbol = newUninternedSymbol(symbol);
+        pop();
+    }
+    push(OBJ_VAL(symbol));
+}
+
+void aotPushString(char const *chars, int length) {
+    push(OBJ_VAL(copyString(chars, length)));
+}
+
+void aotCons(void) {
+    ObjPair *pair = newPair(vm.stackTop[-2], vm.stackTop[-1]);
+    pop();
+    pop();
+    push(OBJ_VAL(pair));
+}
+
+void aotVector(int count) {
+    ObjVector *vector = newVector();
+    push(OBJ_VAL(vector));
+    Value *elements = vm.stackTop - 1 - count;
+    for (int i = 0; i < count; i++) vectorAppend(vector, elements[i]);
+
+    vm.stackTop = elements;
+    push(OBJ_VAL(vector));
+}
+
+void aotSwitch(int defaultOffset, int count, int const *offsets) {
+    ObjSwitch *table = newSwitch();
+    push(OBJ_VAL(table));
+    table->defaultOffset = defaultOffset;
+    Value *keys = vm.stackTop - 1 - count;
+    for (int i = 0; i < count; i++) switchAddCase(table, keys[i], offsets[i]);
+    switchMakeDense(table);
+
+    vm.stackTop = keys;
+    push(OBJ_VAL(table));
+}
+
+static ObjFunction *functionBeingBuilt(void) {
+    return AS_FUNCTION(vm.stack[building]);
+}
+
+// Returns the constant at index in the constants of frame's function.
+static Value constantAt(CallFrame *frame, int index) {
+    return getValueArrayAt(&(frame->closure->function->chunk.constants),
+                           index);
+}
+
+bool aotGetGlobal(CallFrame *frame, int index) {
+    ObjSymbol *name = AS_SYMBOL(constantAt(frame, index));
+    Value value;
+    if (!tableGet(&vm.globals, name, &value)) {
+        runtimeError("Undefined variable '%s'.", name->chars);
+        return false;
+    }
+    push(value);
+    return true;
+}
+
+bool aotSetGlobal(CallFrame *frame, int index) {
+    ObjSymbol *name = AS_SYMBOL(constantAt(frame, index));
+    if (tableSet(&vm.globals, name, vm.stackTop[-1])) {
+        tableDelete(&vm.globals, name);
+        runtimeError("Undefined variable '%s'.", name->chars);
+        return false;
+    }
+    return true;
+}
+
+void aotDefineGlobal(CallFrame *frame, int index) {
+    tableSet(&vm.globals, AS_SYMBOL(constantAt(frame, index)),
+             vm.stackTop[-1]);
+    pop();
+}
+
+void aotClosure(CallFrame *frame, int offset) {
+    uint8_t *ip = getChunkCode(&(frame->closure->function->chunk)) + offset;
+    ObjClosure *closure = newClosure(AS_FUNCTION(constantAt(frame, ip[1])));
+    push(OBJ_VAL(closure));
+    for (int i = 0; i < closure->upvalueCount; i++) {
+        uint8_t isLocal = ip[2 + 2 * i];
+        uint8_t index = ip[3 + 2 * i];
+        closure->upvalues[i] = isLocal ? captureUpvalue(frame->slots + index)
+                                       : frame->closure->upvalues[index];
+    }
+}
+
+void aotCloseScope(CallFrame *frame, int slot, int keep) {
+    Value *scope = frame->slots + slot;
+    closeUpvalues(scope);
+    memmove(scope, vm.stackTop - keep, keep * sizeof(Value));
+    vm.stackTop = scope + keep;
+}
+
+AotStatus aotOperandError(CallFrame *frame, uint8_t *ip) {
+    frame->ip = ip;
+    runtimeError("Operands must be numbers.");
+    return AOT_ERROR;
+}
+
+bool aotTailCall(CallFrame *frame, int argCount) {
+    Value callee = vm.stackTop[-1 - argCount];
+    if (!IS_CLOSURE(callee) ||
+        argCount != AS_CLOSURE(callee)->function->arity) {
+        return false;
+    }
+
+    // The callee and its arguments take the place of the caller's frame.
+    closeUpvalues(frame->slots);
+    memmove(frame->slots, vm.stackTop - 1 - argCount,
+            (argCount + 1) * sizeof(Value));
+    vm.stackTop = frame->slots + argCount + 1;
+
+    ObjClosure *closure = AS_CLOSURE(callee);
+    closure->function->callCount++;
+    frame->closure = closure;
+    frame->ip = getChunkCode(&(closure->function->chunk));
+    reserveFrame(frame);
+    return true;
+}
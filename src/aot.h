@@ -0,0 +1,149 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  The runtime of programs which ecsi --compile-to-c translated to C. The
+  generated C builds the program's functions with the aotBuild functions,
+  and gives every function a C function which does the work of its
+  bytecode. Calls and returns still go through run(), which acts as the
+  trampoline between the C functions, so the C stack never grows with the
+  Scheme one.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chunk.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// What the C code of a function returns.
+typedef enum {
+    AOT_EXIT,       // frame->ip is the next instruction for run().
+    AOT_ERROR,      // A runtime error was reported.
+    AOT_TAIL_CALL,  // frame now runs the function it tail called.
+} AotStatus;
+
+/*
+  Runs frame with the C code of its function, and of every function it
+  tail calls. Returns false if there was a runtime error.
+*/
+bool enterAot(CallFrame *frame);
+
+/*
+  Builds the program with build, whose last function is the script, and
+  runs it. Returns the exit status of the program.
+*/
+int aotMain(void (*build)(void));
+
+/*
+  Starts building a function. The functions built so far stay on the
+  stack, so that later functions can refer to them by index.
+*/
+void aotBeginFunction(char const *name, int arity, Parameters parameters,
+                      int upvalueCount, int maxStack, int callSiteCount,
+                      AotFunction run, uint8_t const *code,
+                      unsigned const *lines, size_t count);
+
+// Adds the value on top of the stack to the constants of the function.
+void aotAddConstant(void);
+
+// Finishes the function which is being built.
+void aotEndFunction(void);
+
+// Pushes the function which was built index'th.
+void aotPushFunction(int index);
+
+void aotPushSymbol(char const *chars, int length, bool interned);
+void aotPushString(char const *chars, int length);
+
+// Replaces the car and cdr on top of the stack with a pair of them.
+void aotCons(void);
+
+// Replaces the top count values on the stack with a vector of them.
+void aotVector(int count);
+
+/*
+  Replaces the top count values on the stack with an OP_SWITCH table, which
+  maps each of them to its offset in offsets.
+*/
+void aotSwitch(int defaultOffset, int count, int const *offsets);
+
+bool aotGetGlobal(CallFrame *frame, int index);
+bool aotSetGlobal(CallFrame *frame, int index);
+void aotDefineGlobal(CallFrame *frame, int index);
+void aotClosure(CallFrame *frame, int offset);
+void aotCloseScope(CallFrame *frame, int slot, int keep);
+
+// Reports that the operands of the instruction before ip aren't numbers.
+AotStatus aotOperandError(CallFrame *frame, uint8_t *ip);
+
+/*
+  Replaces frame with a call of the closure under the top argCount values
+  of the stack, when that needs no checks. Returns false if the call must
+  be made normally.
+*/
+bool aotTailCall(CallFrame *frame, int argCount);
+
+/*
+  Does the arithmetic or comparison opcode on the top two values of the
+  stack. Returns false, leaving them there, if they aren't both numbers.
+*/
+static inline bool aotBinaryOp(OpCode opcode) {
+    Value *operands = vm.stackTop - 2;
+    if (!IS_NUMBER(operands[0]) || !IS_NUMBER(operands[1])) return false;
+
+    double a = AS_NUMBER(operands[0]);
+    double b = AS_NUMBER(operands[1]);
+    switch (opcode) {
+        case OP_ADD:
+            operands[0] = NUMBER_VAL(a + b);
+            break;
+        case OP_SUBTRACT:
+            operands[0] = NUMBER_VAL(a - b);
+            break;
+        case OP_MULTIPLY:
+            operands[0] = NUMBER_VAL(a * b);
+            break;
+        case OP_DIVIDE:
+            operands[0] = NUMBER_VAL(a / b);
+            break;
+        case OP_NUMBER_EQUAL:
+            operands[0] = BOOL_VAL(a == b);
+            break;
+        case OP_LESS:
+            operands[0] = BOOL_VAL(a < b);
+            break;
+        case OP_LESS_EQUAL:
+            operands[0] = BOOL_VAL(a <= b);
+            break;
+        case OP_GREATER:
+            operands[0] = BOOL_VAL(a > b);
+            break;
+        default:
+            operands[0] = BOOL_VAL(a >= b);
+            break;
+    }
+    vm.stackTop--;
+    return true;
+}
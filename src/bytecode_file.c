@@ -0,0 +1,530 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bytecode_file.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "line_number.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "smart_array.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+  A file is a FileHeader, then a FunctionRecord for each function, the
+  script first, then the data of the functions. Every offset in a record
+  is from the start of the record, so that a function can be found from
+  any constant which refers to it without knowing where the file is.
+*/
+typedef struct {
+    char magic[4];  // "ECSC"
+    uint32_t version;
+    uint64_t sourceHash;
+    uint32_t optimizationLevel;
+    uint32_t functionCount;
+    uint64_t size;  // Of the whole file.
+} FileHeader;
+
+typedef struct {
+    int64_t name;  // Of the encoded name, or 0 if the function has none.
+    int64_t code;
+    int64_t lines;
+    int64_t constants;
+    uint32_t codeCount;
+    uint32_t lineCount;
+    int32_t arity;
+    int32_t requiredCount;
+    int32_t optionalCount;
+    int32_t hasRest;
+    int32_t upvalueCount;
+    int32_t maxStack;
+    int32_t callSiteCount;
+} FunctionRecord;
+
+/*
+  The tag which starts each encoded constant. Constants are encoded in
+  the file's byte order, with no padding.
+*/
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_TRUE,
+    CONSTANT_FALSE,
+    CONSTANT_NUMBER,     // The 8 bytes of the double.
+    CONSTANT_CHARACTER,  // One byte.
+    CONSTANT_STRING,     // A uint32_t length, then the characters.
+    CONSTANT_SYMBOL,     // Like a string, then whether it is interned.
+    CONSTANT_PAIR,       // The car, then the cdr.
+    CONSTANT_VECTOR,     // A uint32_t count, then the elements.
+    CONSTANT_FUNCTION,   // An int64_t offset from here to its record.
+    /*
+      The int32_t default offset, a uint32_t count, then each key followed
+      by the int32_t offset it goes to.
+    */
+    CONSTANT_SWITCH,
+} ConstantTag;
+
+// The file being written, and the functions in it, the script first.
+static _Thread_local SmartArray bytes;
+static _Thread_local SmartArray functions;
+
+static void collectFunctions(ObjFunction const *function);
+static int functionIndex(ObjFunction const *function);
+static size_t recordOffset(int index);
+static void writeBytes(void const *data, size_t size);
+static void writeByte(uint8_t byte);
+static void writeUint32(uint32_t number);
+static void align(void);
+static void setOffset(int index, size_t fieldOffset, size_t position);
+static bool writeFunction(int index);
+static void encodeConstant(Value value);
+static ObjFunction *loadFunction(FunctionRecord const *record);
+static Value decodeConstant(uint8_t const **cursor);
+static uint32_t readUint32(uint8_t const **cursor);
+
+uint64_t hashSource(char const *source, size_t length) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+char *bytecodeFilePath(char const *path) {
+    char const *base = strrchr(path, '/');
+    base = NULL == base ? path : base + 1;
+    char const *extension = strrchr(base, '.');
+    // A leading dot starts a hidden file's name, not its extension.
+    size_t length = NULL == extension || extension == base
+                        ? strlen(path)
+                        : (size_t)(extension - path);
+
+    char *result = checkedMalloc(length + sizeof(".ecsc"));
+    memcpy(result, path, length);
+    strcpy(result + length, ".ecsc");
+    return result;
+}
+
+bool writeBytecodeFile(char const *path, ObjFunction *script,
+                       uint64_t sourceHash) {
+    initSmartArray(&bytes, smartArrayCheckedRealloc, sizeof(uint8_t));
+    initSmartArray(&functions, smartArrayCheckedRealloc,
+                   sizeof(ObjFunction const *));
+    push(OBJ_VAL(script));
+    collectFunctions(script);
+    int const COUNT = (int)getSmartArrayCount(&functions);
+
+    FileHeader header = {.magic = {'E', 'C', 'S', 'C'},
+                         .version = BYTECODE_FILE_VERSION,
+                         .sourceHash = sourceHash,
+                         .optimizationLevel = optimizerOptions.level,
+                         .functionCount = COUNT};
+    writeBytes(&header, sizeof(header));
+    for (int i = 0; i < COUNT; i++) {
+        writeBytes(&(FunctionRecord){0}, sizeof(FunctionRecord));
+    }
+
+    bool written = true;
+    for (int i = 0; i < COUNT && written; i++) written = writeFunction(i);
+
+    if (written) {
+        uint64_t size = getSmartArrayCount(&bytes);
+        memcpy((uint8_t *)bytes.data + offsetof(FileHeader, size), &size,
+               sizeof(size));
+
+        // Written beside it and renamed, so no one maps half a file.
+        size_t const LENGTH = strlen(path);
+        char *temporary = checkedMalloc(LENGTH + sizeof(".tmp"));
+        memcpy(temporary, path, LENGTH);
+        strcpy(temporary + LENGTH, ".tmp");
+
+        FILE *file = fopen(temporary, "wb");
+        written = NULL != file && size == fwrite(bytes.data, 1, size, file);
+        if (NULL != file && 0 != fclose(file)) written = false;
+        if (written && 0 != rename(temporary, path)) written = false;
+        if (!written) remove(temporary);
+        free(temporary);
+    }
+
+    freeSmartArray(&bytes);
+    freeSmartArray(&functions);
+    pop();
+    return written;
+}
+
+// Adds function, then every function in its constants, to functions.
+static void collectFunctions(ObjFunction const *function) {
+    smartArrayAppend(&functions, &function);
+    ValueArray const *constants = &(function->chunk.constants);
+    for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+        Value constant = getValueArrayAt(constants, i);
+        if (IS_FUNCTION(constant)) collectFunctions(AS_FUNCTION(constant));
+    }
+}
+
+static int functionIndex(ObjFunction const *function) {
+    for (size_t i = 0; i < getSmartArrayCount(&functions); i++) {
+        if (function == SMART_ARRAY_AT(&functions, i, ObjFunction const *)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Returns where the record of the index'th function is in the file.
+static size_t recordOffset(int index) {
+    return sizeof(FileHeader) + (size_t)index * sizeof(FunctionRecord);
+}
+
+static void writeBytes(void const *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        smartArrayAppend(&bytes, (uint8_t const *)data + i);
+    }
+}
+
+static void writeByte(uint8_t byte) { smartArrayAppend(&bytes, &byte); }
+
+static void writeUint32(uint32_t number) {
+    writeBytes(&number, sizeof(number));
+}
+
+// Pads the file so that what is written next is 8 byte aligned.
+static void align(void) {
+    while (0 != getSmartArrayCount(&bytes) % sizeof(uint64_t)) writeByte(0);
+}
+
+/*
+  Sets the offset at fieldOffset in the record of the index'th function to
+  point to position in the file.
+*/
+static void setOffset(int index, size_t fieldOffset, size_t position) {
+    int64_t offset = (int64_t)position - (int64_t)recordOffset(index);
+    memcpy((uint8_t *)bytes.data + recordOffset(index) + fieldOffset,
+           &offset, sizeof(offset));
+}
+
+// Writes the data of the index'th function, and fills in its record.
+static bool writeFunction(int index) {
+    ObjFunction const *function =
+        SMART_ARRAY_AT(&functions, index, ObjFunction const *);
+    if (NULL != function->lazyBody) return false;
+
+    Chunk const *chunk = &(function->chunk);
+    FunctionRecord record = {
+        .codeCount = (uint32_t)getChunkCount(chunk),
+        .lineCount = (uint32_t)getSmartArrayCount(&(chunk->lines)),
+        .arity = function->arity,
+        .requiredCount = function->parameters.requiredCount,
+        .optionalCount = function->parameters.optionalCount,
+        .hasRest = function->parameters.hasRest,
+        .upvalueCount = function->upvalueCount,
+        .maxStack = function->maxStack,
+        .callSiteCount = function->callSiteCount};
+    memcpy((uint8_t *)bytes.data + recordOffset(index), &record,
+           sizeof(record));
+
+    align();
+    setOffset(index, offsetof(FunctionRecord, code),
+              getSmartArrayCount(&bytes));
+    writeBytes(getChunkCode(chunk), record.codeCount);
+
+    align();
+    setOffset(index, offsetof(FunctionRecord, lines),
+              getSmartArrayCount(&bytes));
+    for (uint32_t i = 0; i < record.lineCount; i++) {
+        LineNumber line = getLineNumberArrayAt(&(chunk->lines), i);
+        writeBytes(&line, sizeof(line));
+    }
+
+    if (NULL != function->name) {
+        setOffset(index, offsetof(FunctionRecord, name),
+                  getSmartArrayCount(&bytes));
+        encodeConstant(OBJ_VAL(function->name));
+    }
+
+    setOffset(index, offsetof(FunctionRecord, constants),
+              getSmartArrayCount(&bytes));
+    ValueArray const *constants = &(chunk->constants);
+    writeUint32((uint32_t)getValueArrayCount(constants));
+    for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+        encodeConstant(getValueArrayAt(constants, i));
+    }
+    return true;
+}
+
+static void encodeConstant(Value value) {
+    if (IS_NIL(value)) {
+        writeByte(CONSTANT_NIL);
+    } else if (IS_BOOL(value)) {
+        writeByte(AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE);
+    } else if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        writeByte(CONSTANT_NUMBER);
+        writeBytes(&number, sizeof(number));
+    } else if (IS_CHARACTER(value)) {
+        writeByte(CONSTANT_CHARACTER);
+        writeByte((uint8_t)AS_CHARACTER(value));
+    } else if (IS_SYMBOL(value) || IS_STRING(value)) {
+        ObjString const *string = AS_STRING(value);
+        writeByte(IS_SYMBOL(value) ? CONSTANT_SYMBOL : CONSTANT_STRING);
+        writeUint32((uint32_t)string->length);
+        writeBytes(string->chars, string->length);
+        if (IS_SYMBOL(value)) writeByte(symbolIsInterned(AS_SYMBOL(value)));
+    } else if (IS_PAIR(value)) {
+        writeByte(CONSTANT_PAIR);
+        encodeConstant(CAR(value));
+        encodeConstant(CDR(value));
+    } else if (IS_VECTOR(value)) {
+        ValueArray const *elements = &(AS_VECTOR(value)->array);
+        writeByte(CONSTANT_VECTOR);
+        writeUint32((uint32_t)getValueArrayCount(elements));
+        for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+            encodeConstant(getValueArrayAt(elements, i));
+        }
+    } else if (IS_FUNCTION(value)) {
+        writeByte(CONSTANT_FUNCTION);
+        int64_t offset =
+            (int64_t)recordOffset(functionIndex(AS_FUNCTION(value))) -
+            (int64_t)getSmartArrayCount(&bytes);
+        writeBytes(&offset, sizeof(offset));
+    } else {
+        assert(IS_SWITCH(value));
+        ObjSwitch const *table = AS_SWITCH(value);
+        int const CAPACITY =
+            table->integerCount + table->characterCount + table->capacity;
+        Value *keys = ALLOCATE(Value, CAPACITY);
+        int *offsets = ALLOCATE(int, CAPACITY);
+        int count = switchCases(table, keys, offsets);
+
+        writeByte(CONSTANT_SWITCH);
+        int32_t defaultOffset = table->defaultOffset;
+        writeBytes(&defaultOffset, sizeof(defaultOffset));
+        writeUint32((uint32_t)count);
+        for (int i = 0; i < count; i++) {
+            encodeConstant(keys[i]);
+            int32_t offset = offsets[i];
+            writeBytes(&offset, sizeof(offset));
+        }
+
+        FREE_ARRAY(Value, keys, CAPACITY);
+        FREE_ARRAY(int, offsets, CAPACITY);
+    }
+}
+
+ObjFunction *readBytecodeFile(char const *path, uint64_t sourceHash) {
+    size_t size;
+    void *address = mapFile(path, &size);
+    if (NULL == address) return NULL;
+
+    FileHeader const *header = address;
+    bool valid = sizeof(FileHeader) <= size &&
+                 0 == memcmp(header->magic, "ECSC", sizeof(header->magic)) &&
+                 BYTECODE_FILE_VERSION == header->version &&
+                 sourceHash == header->sourceHash &&
+                 (uint32_t)optimizerOptions.level ==
+                     header->optimizationLevel &&
+                 size == header->size && header->functionCount > 0 &&
+                 recordOffset(header->functionCount) <= size;
+
+    FunctionRecord const *records =
+        (FunctionRecord const *)((uint8_t const *)address + sizeof(FileHeader));
+    for (uint32_t i = 0; valid && i < header->functionCount; i++) {
+        FunctionRecord const *record = &records[i];
+        int64_t const AT = (int64_t)recordOffset(i);
+        valid = AT + record->code >= 0 &&
+                (uint64_t)(AT + record->code) + record->codeCount <= size &&
+                AT + record->lines >= 0 &&
+                (uint64_t)(AT + record->lines) +
+                        record->lineCount * sizeof(LineNumber) <=
+                    size &&
+                AT + record->constants >= 0 &&
+                (uint64_t)(AT + record->constants) + sizeof(uint32_t) <= size;
+    }
+
+    if (!valid) {
+        unmapFile(address);
+        return NULL;
+    }
+    return loadFunction(records);
+}
+
+void loadCachedConstants(ObjFunction *function) {
+    uint8_t const *cursor = function->cachedConstants;
+    function->cachedConstants = NULL;
+
+    uint32_t count = readUint32(&cursor);
+    for (uint32_t i = 0; i < count; i++) {
+        addConstant(&(function->chunk), decodeConstant(&cursor));
+    }
+}
+
+/*
+  Makes the function whose record is record. Its constants wait for its
+  first call.
+*/
+static ObjFunction *loadFunction(FunctionRecord const *record) {
+    uint8_t const *base = (uint8_t const *)record;
+    ObjFunction *function = newFunction();
+    push(OBJ_VAL(function));
+
+    function->arity = record->arity;
+    function->parameters =
+        (Parameters){.requiredCount = record->requiredCount,
+                     .optionalCount = record->optionalCount,
+                     .hasRest = record->hasRest};
+    function->upvalueCount = record->upvalueCount;
+    function->maxStack = record->maxStack;
+
+    Chunk *chunk = &(function->chunk);
+    chunk->code = (SmartArray){.count = record->codeCount,
+                               .capacity = record->codeCount,
+                               .elementSize = sizeof(uint8_t),
+                               .reallocater = mappedReallocate,
+                               .data = (void *)(base + record->code)};
+    chunk->lines = (LineNumberArray){.count = record->lineCount,
+                                     .capacity = record->lineCount,
+                                     .elementSize = sizeof(LineNumber),
+                                     .reallocater = mappedReallocate,
+                                     .data = (void *)(base + record->lines)};
+    function->cachedConstants = base + record->constants;
+
+    if (0 != record->name) {
+        uint8_t const *cursor = base + record->name;
+        function->name = AS_SYMBOL(decodeConstant(&cursor));
+    }
+
+    function->callSiteCount = record->callSiteCount;
+    if (function->callSiteCount > 0) {
+        function->callCaches = ALLOCATE(CallCache, function->callSiteCount);
+        for (int i = 0; i < function->callSiteCount; i++) {
+            function->callCaches[i] = (CallCache){.function = NULL,
+                                                  .code = NULL};
+        }
+    }
+
+    pop();
+    return function;
+}
+
+/*
+  Decodes the constant at *cursor, and moves *cursor past it. The parts of
+  a constant stay on the stack while the rest of it is made.
+*/
+static Value decodeConstant(uint8_t const **cursor) {
+    ConstantTag tag = *(*cursor)++;
+    switch (tag) {
+        case CONSTANT_NIL:
+            return NIL_VAL;
+        case CONSTANT_TRUE:
+            return BOOL_VAL(true);
+        case CONSTANT_FALSE:
+            return BOOL_VAL(false);
+        case CONSTANT_NUMBER: {
+            double number;
+            memcpy(&number, *cursor, sizeof(number));
+            *cursor += sizeof(number);
+            return NUMBER_VAL(number);
+        }
+        case CONSTANT_CHARACTER:
+            return CHARACTER_VAL((char)*(*cursor)++);
+        case CONSTANT_STRING:
+        case CONSTANT_SYMBOL: {
+            uint32_t length = readUint32(cursor);
+            char const *chars = (char const *)*cursor;
+            *cursor += length;
+            if (CONSTANT_STRING == tag) {
+                return OBJ_VAL(copyString(chars, (int)length));
+            }
+
+            ObjSymbol *symbol = newSymbol(chars, (int)length);
+            if (!*(*cursor)++) {
+                push(OBJ_VAL(symbol));
+                symbol = newUninternedSymbol(symbol);
+                pop();
+            }
+            return OBJ_VAL(symbol);
+        }
+        case CONSTANT_PAIR: {
+            push(decodeConstant(cursor));
+            push(decodeConstant(cursor));
+            ObjPair *pair = newPair(vm.stackTop[-2], vm.stackTop[-1]);
+            pop();
+            pop();
+            return OBJ_VAL(pair);
+        }
+        case CONSTANT_VECTOR: {
+            uint32_t count = readUint32(cursor);
+            ObjVector *vector = newVector();
+            push(OBJ_VAL(vector));
+            for (uint32_t i = 0; i < count; i++) {
+                push(decodeConstant(cursor));
+                vectorAppend(vector, vm.stackTop[-1]);
+                pop();
+            }
+            pop();
+            return OBJ_VAL(vector);
+        }
+        case CONSTANT_FUNCTION: {
+            int64_t offset;
+            memcpy(&offset, *cursor, sizeof(offset));
+            FunctionRecord const *record =
+                (FunctionRecord const *)(*cursor + offset);
+            *cursor += sizeof(offset);
+            return OBJ_VAL(loadFunction(record));
+        }
+        case CONSTANT_SWITCH: {
+            ObjSwitch *table = newSwitch();
+            push(OBJ_VAL(table));
+            int32_t defaultOffset;
+            memcpy(&defaultOffset, *cursor, sizeof(defaultOffset));
+            *cursor += sizeof(defaultOffset);
+            table->defaultOffset = defaultOffset;
+
+            // The keys stay on the stack until the table is dense.
+            uint32_t count = readUint32(cursor);
+            for (uint32_t i = 0; i < count; i++) {
+                push(decodeConstant(cursor));
+                int32_t offset;
+                memcpy(&offset, *cursor, sizeof(offset));
+                *cursor += sizeof(offset);
+                switchAddCase(table, vm.stackTop[-1], offset);
+            }
+            switchMakeDense(table);
+            vm.stackTop -= count + 1;
+            return OBJ_VAL(table);
+        }
+    }
+
+    assert(!"A bytecode file has a constant of an unknown kind.");
+    return NIL_VAL;
+}
+
+static uint32_t readUint32(uint8_t const **cursor) {
+    uint32_t number;
+    memcpy(&number, *cursor, sizeof(number));
+    *cursor += sizeof(number);
+    return number;
+}
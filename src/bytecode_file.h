@@ -0,0 +1,71 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  Bytecode files, which cache the compiled form of a script next to its
+  source, with the extension .ecsc, so that running it again skips the
+  scanner, parser and compiler. A file holds the whole tree of functions:
+  their code, line numbers and constants. It is only used for the source
+  whose hash it records, and for the same optimization level.
+
+  A file is mapped into memory, and the code and line numbers of its
+  functions are used where they lie. Their constants are only decoded
+  when the function is first called.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "object.h"
+
+/*
+  Changes whenever the format or the meaning of the bytecode does, so
+  that old files are ignored.
+*/
+#define BYTECODE_FILE_VERSION 2
+
+// Hashes the length bytes at source, for telling whether a file is stale.
+uint64_t hashSource(char const *source, size_t length);
+
+/*
+  Returns the path of the bytecode file of the source file at path, which
+  the caller must free().
+*/
+char *bytecodeFilePath(char const *path);
+
+/*
+  Writes script, and every function in it, to the file at path. Returns
+  false if it couldn't, or if any function's body hasn't been compiled.
+*/
+bool writeBytecodeFile(char const *path, ObjFunction *script,
+                       uint64_t sourceHash);
+
+/*
+  Maps the file at path and returns its script. Returns NULL if there is
+  no such file, or it isn't one for the source with sourceHash.
+*/
+ObjFunction *readBytecodeFile(char const *path, uint64_t sourceHash);
+
+/*
+  Decodes the constants of function, which was read from a bytecode file,
+  before its first call.
+*/
+void loadCachedConstants(ObjFunction *function);
@@ -0,0 +1,455 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "c_backend.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "smart_array.h"
+#include "value.h"
+#include "vm.h"
+
+// Every function of the program, with each one after the ones it contains.
+static _Thread_local SmartArray functions;
+static _Thread_local FILE *out;
+
+static void collectFunctions(ObjFunction *function);
+static int functionIndex(ObjFunction const *function);
+static void writeCString(char const *chars, int length);
+static void writeFunctionData(int index);
+static void writeFunction(int index);
+static void writeInstruction(ObjFunction *function, int offset);
+static char const *binaryOpName(uint8_t opcode);
+static void writeSwitch(ObjSwitch const *table, int index, int end);
+static void writeBuild(void);
+static void writePushValue(Value value);
+
+bool compileToC(char const *source, char const *sourceName, FILE *output) {
+    // Every function is translated, so none can wait for its first call.
+    compilerOptions.lazy = false;
+    ObjFunction *script = compile(source);
+    if (NULL == script) return false;
+
+    push(OBJ_VAL(script));
+    out = output;
+    initSmartArray(&functions, smartArrayCheckedRealloc,
+                   sizeof(ObjFunction *));
+    collectFunctions(script);
+
+    fprintf(out, "/*\n  Generated by ecsi --compile-to-c from %s.\n*/\n\n",
+            sourceName);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    for (size_t i = 0; i < getSmartArrayCount(&functions); i++) {
+        writeFunctionData((int)i);
+    }
+    for (size_t i = 0; i < getSmartArrayCount(&functions); i++) {
+        writeFunction((int)i);
+    }
+    writeBuild();
+    fprintf(out, "int main(void) { return aotMain(build); }\n");
+
+    freeSmartArray(&functions);
+    pop();
+    return true;
+}
+
+static void collectFunctions(ObjFunction *function) {
+    ValueArray *constants = &(function->chunk.constants);
+    for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+        Value constant = getValueArrayAt(constants, i);
+        if (IS_FUNCTION(constant)) collectFunctions(AS_FUNCTION(constant));
+    }
+    smartArrayAppend(&functions, &function);
+}
+
+static int functionIndex(ObjFunction const *function) {
+    for (size_t i = 0; i < getSmartArrayCount(&functions); i++) {
+        if (function == SMART_ARRAY_AT(&functions, i, ObjFunction *)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Writes chars as a C string literal, escaping everything but letters.
+static void writeCString(char const *chars, int length) {
+    fputc('"', out);
+    for (int i = 0; i < length; i++) {
+        unsigned char c = chars[i];
+        if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ' ' == c) {
+            fputc(c, out);
+        } else {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputc('"', out);
+}
+
+// Writes the bytecode and line numbers of the index'th function.
+static void writeFunctionData(int index) {
+    ObjFunction *function = SMART_ARRAY_AT(&functions, index, ObjFunction *);
+    Chunk *chunk = &(function->chunk);
+    size_t const COUNT = getChunkCount(chunk);
+
+    fprintf(out, "// %s\n",
+            NULL == function->name ? "script" : function->name->chars);
+    fprintf(out, "static uint8_t const code%d[] = {", index);
+    for (size_t i = 0; i < COUNT; i++) {
+        fprintf(out, "%s%d,", 0 == i % 16 ? "\n    " : " ",
+                getChunkAt(chunk, i));
+    }
+    fprintf(out, "\n};\n");
+
+    fprintf(out, "static unsigned const lines%d[] = {", index);
+    for (size_t i = 0; i < COUNT; i++) {
+        fprintf(out, "%s%d,", 0 == i % 16 ? "\n    " : " ",
+                getLine(chunk, (int)i));
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+/*
+  Writes the C function of the index'th function. It starts with a switch
+  to the label of whichever instruction run() leaves it at.
+*/
+static void writeFunction(int index) {
+    ObjFunction *function = SMART_ARRAY_AT(&functions, index, ObjFunction *);
+    Chunk *chunk = &(function->chunk);
+    int const COUNT = (int)getChunkCount(chunk);
+
+    fprintf(out, "static int function%d(CallFrame *frame) {\n", index);
+    fprintf(out,
+            "    uint8_t *code = getChunkCode(&(frame->closure->function->"
+            "chunk));\n"
+            "    ValueArray *constants = "
+            "&(frame->closure->function->chunk.constants);\n"
+            "    (void)constants;\n\n"
+            "    switch (frame->ip - code) {\n");
+    for (int offset = 0; offset < COUNT;
+         offset += instructionLength(chunk, offset)) {
+        fprintf(out, "        case %d: goto at%d;\n", offset, offset);
+    }
+    fprintf(out, "    }\n    return AOT_EXIT;\n\n");
+
+    for (int offset = 0; offset < COUNT;
+         offset += instructionLength(chunk, offset)) {
+        fprintf(out, "at%d:\n", offset);
+        writeInstruction(function, offset);
+    }
+    fprintf(out, "}\n\n");
+}
+
+// Returns the operand of two bytes after the first byte of operands.
+static int readShort(uint8_t const *operands) {
+    return (operands[0] << 8) | operands[1];
+}
+
+static void writeInstruction(ObjFunction *function, int offset) {
+    Chunk *chunk = &(function->chunk);
+    uint8_t const *ip = getChunkCode(chunk) + offset;
+    int const END = offset + instructionLength(chunk, offset);
+
+    switch (ip[0]) {
+        case OP_CONSTANT:
+            fprintf(out, "    push(getValueArrayAt(constants, %d));\n", ip[1]);
+            break;
+        case OP_CONSTANT_LONG:
+            fprintf(out, "    push(getValueArrayAt(constants, %d));\n",
+                    (ip[1] << 16) | readShort(ip + 2));
+            break;
+        case OP_NIL:
+            fprintf(out, "    push(NIL_VAL);\n");
+            break;
+        case OP_TRUE:
+            fprintf(out, "    push(BOOL_VAL(true));\n");
+            break;
+        case OP_FALSE:
+            fprintf(out, "    push(BOOL_VAL(false));\n");
+            break;
+        case OP_POP:
+            fprintf(out, "    pop();\n");
+            break;
+        case OP_GET_LOCAL:
+            fprintf(out, "    push(frame->slots[%d]);\n", ip[1]);
+            break;
+        case OP_GET_LOCAL_2:
+            fprintf(out, "    push(frame->slots[%d]);\n", ip[1]);
+            fprintf(out, "    push(frame->slots[%d]);\n", ip[2]);
+            break;
+        case OP_SET_LOCAL:
+            fprintf(out, "    frame->slots[%d] = vm.stackTop[-1];\n", ip[1]);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            fprintf(out,
+                    "    frame->ip = code + %d;\n"
+                    "    if (!aot%sGlobal(frame, %d)) return AOT_ERROR;\n",
+                    END, OP_GET_GLOBAL == ip[0] ? "Get" : "Set", ip[1]);
+            break;
+        case OP_DEFINE_GLOBAL:
+            fprintf(out, "    aotDefineGlobal(frame, %d);\n", ip[1]);
+            break;
+        case OP_GET_UPVALUE:
+            fprintf(out,
+                    "    push(*frame->closure->upvalues[%d]->location);\n",
+                    ip[1]);
+            break;
+        case OP_SET_UPVALUE:
+            fprintf(out,
+                    "    *frame->closure->upvalues[%d]->location = "
+                    "vm.stackTop[-1];\n",
+                    ip[1]);
+            break;
+        case OP_JUMP:
+            fprintf(out, "    goto at%d;\n", END + readShort(ip + 1));
+            break;
+        case OP_LOOP:
+            fprintf(out, "    goto at%d;\n", END - readShort(ip + 1));
+            break;
+        case OP_JUMP_IF_FALSE:
+            fprintf(out, "    if (isFalsey(vm.stackTop[-1])) goto at%d;\n",
+                    END + readShort(ip + 1));
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            fprintf(out, "    if (isFalsey(pop())) goto at%d;\n",
+                    END + readShort(ip + 1));
+            break;
+        case OP_CLOSURE:
+            fprintf(out, "    aotClosure(frame, %d);\n", offset);
+            break;
+        case OP_CLOSE_UPVALUE:
+            fprintf(out, "    closeUpvalues(vm.stackTop - 1);\n    pop();\n");
+            break;
+        case OP_CLOSE_SCOPE:
+            fprintf(out, "    aotCloseScope(frame, %d, %d);\n", ip[1], ip[2]);
+            break;
+        case OP_CLOSE_SCOPE_LOOP:
+            fprintf(out, "    aotCloseScope(frame, %d, %d);\n    goto at%d;\n",
+                    ip[1], ip[2], END - readShort(ip + 3));
+            break;
+        case OP_SWITCH:
+            writeSwitch(AS_SWITCH(getValueArrayAt(&(chunk->constants), ip[1])),
+                        ip[1], END);
+            break;
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+            fprintf(out, "    push(getValueArrayAt(constants, %d));\n", ip[1]);
+            fprintf(out,
+                    "    if (!aotBinaryOp(%s)) {\n"
+                    "        return aotOperandError(frame, code + %d);\n"
+                    "    }\n",
+                    OP_ADD_CONSTANT == ip[0] ? "OP_ADD" : "OP_SUBTRACT", END);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NUMBER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+            fprintf(out,
+                    "    if (!aotBinaryOp(%s)) {\n"
+                    "        return aotOperandError(frame, code + %d);\n"
+                    "    }\n",
+                    binaryOpName(ip[0]), END);
+            break;
+        case OP_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE:
+            // A call in tail position reuses the frame, so that loops
+            // written as tail calls run in constant space.
+            if (END < (int)getChunkCount(chunk) &&
+                OP_RETURN == getChunkAt(chunk, END)) {
+                fprintf(out,
+                        "    if (aotTailCall(frame, %d)) return "
+                        "AOT_TAIL_CALL;\n",
+                        ip[1]);
+            }
+            fprintf(out, "    frame->ip = code + %d;\n    return AOT_EXIT;\n",
+                    offset);
+            break;
+        default:
+            // Returns change frames, so run() does them.
+            fprintf(out, "    frame->ip = code + %d;\n    return AOT_EXIT;\n",
+                    offset);
+            break;
+    }
+}
+
+static char const *binaryOpName(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD:
+            return "OP_ADD";
+        case OP_SUBTRACT:
+            return "OP_SUBTRACT";
+        case OP_MULTIPLY:
+            return "OP_MULTIPLY";
+        case OP_DIVIDE:
+            return "OP_DIVIDE";
+        case OP_NUMBER_EQUAL:
+            return "OP_NUMBER_EQUAL";
+        case OP_LESS:
+            return "OP_LESS";
+        case OP_LESS_EQUAL:
+            return "OP_LESS_EQUAL";
+        case OP_GREATER:
+            return "OP_GREATER";
+        default:
+            return "OP_GREATER_EQUAL";
+    }
+}
+
+/*
+  Writes OP_SWITCH, whose table is the constant at index and which ends at
+  end, as a C switch over the places it can go to.
+*/
+static void writeSwitch(ObjSwitch const *table, int index, int end) {
+    int const CAPACITY = table->integerCount + table->characterCount +
+                         table->capacity;
+    Value *keys = ALLOCATE(Value, CAPACITY);
+    int *offsets = ALLOCATE(int, CAPACITY + 1);
+    int count = switchCases(table, keys, offsets);
+    offsets[count++] = table->defaultOffset;
+
+    fprintf(out, "    {\n        int target = switchLookup(\n"
+                 "            AS_SWITCH(getValueArrayAt(constants, %d)), "
+                 "pop());\n"
+                 "        switch (target) {\n",
+            index);
+    for (int i = 0; i < count; i++) {
+        bool seen = false;
+        for (int j = 0; j < i; j++) seen = seen || offsets[j] == offsets[i];
+        if (!seen) {
+            fprintf(out, "            case %d: goto at%d;\n", offsets[i],
+                    end + offsets[i]);
+        }
+    }
+    fprintf(out, "        }\n        frame->ip = code + %d + target;\n"
+                 "        return AOT_EXIT;\n    }\n",
+            end);
+
+    FREE_ARRAY(Value, keys, CAPACITY);
+    FREE_ARRAY(int, offsets, CAPACITY + 1);
+}
+
+// Writes the function which builds every function of the program.
+static void writeBuild(void) {
+    fprintf(out, "static void build(void) {\n");
+    for (size_t i = 0; i < getSmartArrayCount(&functions); i++) {
+        ObjFunction *function = SMART_ARRAY_AT(&functions, i, ObjFunction *);
+        fprintf(out, "    aotBeginFunction(");
+        if (NULL == function->name) {
+            fprintf(out, "NULL");
+        } else {
+            writeCString(function->name->chars, function->name->length);
+        }
+        Parameters const *parameters = &(function->parameters);
+        fprintf(out, ", %d, (Parameters){%d, %d, %s},\n", function->arity,
+                parameters->requiredCount, parameters->optionalCount,
+                parameters->hasRest ? "true" : "false");
+        fprintf(out, "                     %d, %d, %d, function%zu, code%zu,\n",
+                function->upvalueCount, function->maxStack,
+                function->callSiteCount, i, i);
+        fprintf(out, "                     lines%zu, sizeof(code%zu));\n", i,
+                i);
+
+        ValueArray *constants = &(function->chunk.constants);
+        for (size_t j = 0; j < getValueArrayCount(constants); j++) {
+            writePushValue(getValueArrayAt(constants, j));
+            fprintf(out, "    aotAddConstant();\n");
+        }
+        fprintf(out, "    aotEndFunction();\n");
+    }
+    fprintf(out, "}\n\n");
+}
+
+// Writes code which pushes a copy of value onto the stack.
+static void writePushValue(Value value) {
+    if (IS_NIL(value)) {
+        fprintf(out, "    push(NIL_VAL);\n");
+    } else if (IS_BOOL(value)) {
+        fprintf(out, "    push(BOOL_VAL(%s));\n",
+                AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (isnan(number)) {
+            fprintf(out, "    push(NUMBER_VAL(NAN));\n");
+        } else if (isinf(number)) {
+            fprintf(out, "    push(NUMBER_VAL(%sHUGE_VAL));\n",
+                    number < 0 ? "-" : "");
+        } else {
+            // Hexadecimal floating point is exact.
+            fprintf(out, "    push(NUMBER_VAL(%a));\n", number);
+        }
+    } else if (IS_CHARACTER(value)) {
+        fprintf(out, "    push(CHARACTER_VAL((char)%d));\n",
+                AS_CHARACTER(value));
+    } else if (IS_SYMBOL(value)) {
+        ObjSymbol *symbol = AS_SYMBOL(value);
+        fprintf(out, "    aotPushSymbol(");
+        writeCString(symbol->chars, symbol->length);
+        fprintf(out, ", %d, %s);\n", symbol->length,
+                symbolIsInterned(symbol) ? "true" : "false");
+    } else if (IS_STRING(value)) {
+        ObjString *string = AS_STRING(value);
+        fprintf(out, "    aotPushString(");
+        writeCString(string->chars, string->length);
+        fprintf(out, ", %d);\n", string->length);
+    } else if (IS_PAIR(value)) {
+        writePushValue(CAR(value));
+        writePushValue(CDR(value));
+        fprintf(out, "    aotCons();\n");
+    } else if (IS_VECTOR(value)) {
+        ValueArray *elements = &(AS_VECTOR(value)->array);
+        for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+            writePushValue(getValueArrayAt(elements, i));
+        }
+        fprintf(out, "    aotVector(%zu);\n", getValueArrayCount(elements));
+    } else if (IS_FUNCTION(value)) {
+        fprintf(out, "    aotPushFunction(%d);\n",
+                functionIndex(AS_FUNCTION(value)));
+    } else if (IS_SWITCH(value)) {
+        ObjSwitch const *table = AS_SWITCH(value);
+        int const CAPACITY = table->integerCount + table->characterCount +
+                             table->capacity;
+        Value *keys = ALLOCATE(Value, CAPACITY);
+        int *offsets = ALLOCATE(int, CAPACITY);
+        int count = switchCases(table, keys, offsets);
+
+        for (int i = 0; i < count; i++) writePushValue(keys[i]);
+        fprintf(out, "    aotSwitch(%d, %d, (int const[]){", table->defaultOffset,
+                count);
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "%s%d", 0 == i ? "" : ", ", offsets[i]);
+        }
+        fprintf(out, "%s});\n", 0 == count ? "0" : "");
+
+        FREE_ARRAY(Value, keys, CAPACITY);
+        FREE_ARRAY(int, offsets, CAPACITY);
+    } else {
+        fprintf(out, "#error \"A constant can't be written as C.\"\n");
+    }
+}
@@ -0,0 +1,170 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "checkpoint.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "bytecode_file.h"
+#include "closure_engine.h"
+#include "compiler.h"
+#include "memory.h"
+#include "smart_array.h"
+#include "table.h"
+#include "vm.h"
+
+// A write into an old object, which restoreVM() undoes.
+typedef struct {
+    Value *slot;
+    Value value;  // What slot held before the write.
+} SlotWrite;
+
+// A call cache in an old function, which was filled after the checkpoint.
+typedef struct {
+    CallCache *cache;
+    CallCache value;  // What cache held before it was filled.
+} CacheFill;
+
+static _Thread_local bool hasCheckpoint = false;
+static _Thread_local Table globals;  // vm.globals as it was at the checkpoint.
+static _Thread_local SmartArray slotWrites;
+static _Thread_local SmartArray cacheFills;
+
+static void compileLazyBodies(void);
+static void copyTable(Table *to, Table const *from);
+static void forgetNewPromotions(void);
+
+void checkpointVM(void) {
+    assert(0 == vm.frameCount && NULL == vm.openUpvalues);
+    bool wasCollecting = vm.gcState.isOn;
+    turnOffGarbageCollector();
+
+    compileLazyBodies();
+    for (Obj *object = vm.objects; NULL != object; object = object->next) {
+        object->isOld = true;
+    }
+
+    freeCheckpoint();
+    initTable(&globals);
+    copyTable(&globals, &vm.globals);
+    initSmartArray(&slotWrites, smartArrayCheckedRealloc, sizeof(SlotWrite));
+    initSmartArray(&cacheFills, smartArrayCheckedRealloc, sizeof(CacheFill));
+    checkpointClosureEngine();
+    hasCheckpoint = true;
+
+    if (wasCollecting) turnOnGarbageCollector();
+}
+
+void restoreVM(void) {
+    if (!hasCheckpoint) return;
+    bool wasCollecting = vm.gcState.isOn;
+    turnOffGarbageCollector();
+    resetStack();
+
+    // Later writes to a slot are undone first, so the first one wins.
+    for (size_t i = getSmartArrayCount(&slotWrites); i > 0; i--) {
+        SlotWrite const *write = &SMART_ARRAY_AT(&slotWrites, i - 1, SlotWrite);
+        *write->slot = write->value;
+    }
+    smartArrayTruncate(&slotWrites, 0);
+    for (size_t i = getSmartArrayCount(&cacheFills); i > 0; i--) {
+        CacheFill const *fill = &SMART_ARRAY_AT(&cacheFills, i - 1, CacheFill);
+        *fill->cache = fill->value;
+    }
+    smartArrayTruncate(&cacheFills, 0);
+
+    copyTable(&vm.globals, &globals);
+    forgetNewPromotions();
+    restoreClosureEngine();
+    freeNewObjects();
+
+    if (wasCollecting) turnOnGarbageCollector();
+}
+
+void freeCheckpoint(void) {
+    if (!hasCheckpoint) return;
+    freeTable(&globals);
+    freeSmartArray(&slotWrites);
+    freeSmartArray(&cacheFills);
+    hasCheckpoint = false;
+}
+
+void rememberSlot(Value *slot) {
+    SlotWrite write = {.slot = slot, .value = *slot};
+    smartArrayAppend(&slotWrites, &write);
+}
+
+void rememberCallCache(CallCache *cache) {
+    CacheFill fill = {.cache = cache, .value = *cache};
+    smartArrayAppend(&cacheFills, &fill);
+}
+
+/*
+  Compiles every lambda body which was left until the lambda's first
+  call, and decodes the constants of functions from a bytecode file.
+  Compiling a body makes the functions of the lambdas in it, which go
+  around again. A body which doesn't compile is left to report its
+  error when it is called.
+*/
+static void compileLazyBodies(void) {
+    bool compiled = true;
+    while (compiled) {
+        compiled = false;
+        for (Obj *object = vm.objects; NULL != object; object = object->next) {
+            if (OBJ_FUNCTION != object->type) continue;
+            ObjFunction *function = (ObjFunction *)object;
+            if (NULL != function->cachedConstants) {
+                loadCachedConstants(function);
+            }
+            if (NULL != function->lazyBody && compileLazyBody(function)) {
+                compiled = true;
+            }
+        }
+    }
+}
+
+/*
+  Makes to a copy of from. This costs as much as the table of globals,
+  which is far smaller than the heap, and saves logging every define.
+*/
+static void copyTable(Table *to, Table const *from) {
+    if (to->capacity != from->capacity) {
+        FREE_ARRAY(Entry, to->entries, to->capacity);
+        to->entries = ALLOCATE(Entry, from->capacity);
+        to->capacity = from->capacity;
+    }
+    if (0 != from->capacity) {
+        memcpy(to->entries, from->entries, sizeof(Entry) * from->capacity);
+    }
+    to->count = from->count;
+}
+
+// Drops the functions which are about to be freed from the promoted ones.
+static void forgetNewPromotions(void) {
+    size_t kept = 0;
+    for (size_t i = 0; i < getSmartArrayCount(&vm.promotedFunctions); i++) {
+        ObjFunction *function =
+            SMART_ARRAY_AT(&vm.promotedFunctions, i, ObjFunction *);
+        if (function->obj.isOld) {
+            SMART_ARRAY_AT(&vm.promotedFunctions, kept++, ObjFunction *) =
+                function;
+        }
+    }
+    smartArrayTruncate(&vm.promotedFunctions, kept);
+}
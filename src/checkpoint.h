@@ -0,0 +1,67 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  Checkpoints let one VM serve many requests, going back after each of
+  them to how it was once its prelude had run, without freeing and
+  setting up the whole VM again.
+
+  checkpointVM() marks every object in the heap as old. New objects are
+  put at the head of vm.objects, and the GC keeps the order of the list,
+  so everything allocated after the checkpoint lies in front of the first
+  old object. The GC never frees an old object while there is a
+  checkpoint, so restoreVM() frees just that front part of the list. A
+  write into an old object is remembered in an undo log, which
+  restoreVM() plays backwards. Its cost depends on what was done since
+  the checkpoint, not on the size of the heap.
+*/
+
+#pragma once
+
+#include "object.h"
+#include "value.h"
+
+/*
+  Makes the VM as it is now the one restoreVM() goes back to. Nothing may
+  be running. Bodies of lambdas which haven't been compiled yet are
+  compiled now, so that later calls don't put new objects in old ones.
+*/
+void checkpointVM(void);
+
+/*
+  Puts the VM back to how it was at the last checkpointVM(): frees every
+  object allocated since, undoes the writes into old objects, puts back
+  the globals, and empties the stack. Does nothing without a checkpoint.
+  Handles to values made since the checkpoint must be released first.
+*/
+void restoreVM(void);
+
+// Forgets the checkpoint. Called by freeVM().
+void freeCheckpoint(void);
+
+// Remembers what slot, a field of an old object, holds before a write.
+void rememberSlot(Value *slot);
+
+// Remembers what cache, in an old function, holds before it is filled.
+void rememberCallCache(CallCache *cache);
+
+// Stores value in slot, which is a field of owner.
+static inline void writeSlot(Obj *owner, Value *slot, Value value) {
+    if (owner->isOld) rememberSlot(slot);
+    *slot = value;
+}
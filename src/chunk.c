@@ -25,6 +25,7 @@
 
 #include "line_number.h"
 #include "memory.h"
+#include "object.h"
 #include "smart_array.h"
 #include "value.h"
 #include "vm.h"
@@ -57,6 +58,12 @@ size_t getChunkCount(Chunk const *chunk) {
     return getSmartArrayCount(&(chunk->code));
 }
 
+void truncateChunk(Chunk *chunk, size_t count) {
+    assert(count <= getChunkCount(chunk));
+    smartArrayTruncate(&(chunk->code), count);
+    truncateLineNumberArray(&(chunk->lines), count);
+}
+
 void freeChunk(Chunk *chunk) {
     freeSmartArray(&(chunk->code));
     freeLineNumberArray(&(chunk->lines));
@@ -68,14 +75,63 @@ int addConstant(Chunk *chunk, Value value) {
     push(value);
     writeValueArray(&(chunk->constants), value);
     pop();
-    return getValueArrayCount(&(chunk->constants) - 1);
+    return getValueArrayCount(&(chunk->constants)) - 1;
+}
+
+int instructionLength(Chunk const *chunk, size_t offset) {
+    uint8_t const *code = getChunkCode(chunk);
+    switch (code[offset]) {
+        case OP_WIDE: {
+            if (OP_CLOSURE != code[offset + 1]) {
+                // Every operand byte of the instruction is doubled.
+                return 2 * instructionLength(chunk, offset + 1);
+            }
+            size_t index = (code[offset + 2] << 8) | code[offset + 3];
+            Value function = getValueArrayAt(&(chunk->constants), index);
+            return 4 + 4 * AS_FUNCTION(function)->upvalueCount;
+        }
+        case OP_CONSTANT_LONG:
+            return 4;
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_DEFINE_GLOBAL:
+        case OP_SWITCH:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_CLOSE_SCOPE:
+        case OP_GET_LOCAL_2:
+            return 3;
+        case OP_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE:
+            return 4;
+        case OP_CLOSE_SCOPE_LOOP:
+            return 5;
+        case OP_CLOSURE: {
+            Value function =
+                getValueArrayAt(&(chunk->constants), code[offset + 1]);
+            return 2 + 2 * AS_FUNCTION(function)->upvalueCount;
+        }
+        default:
+            return 1;
+    }
 }
 
 int getLine(Chunk *chunk, int offset) {
     // TODO: Change offset to a size_t
     assert(offset >= 0);
 
-    size_t entriesCount = numberOfEntries(&(chunk->lines));
+    size_t entriesCount = getSmartArrayCount(&(chunk->lines));
     /*
       No entries indicates no data in the chunk, and that's a
       chunk state that getLine shouldn't be called in, so we return
@@ -89,14 +145,15 @@ int getLine(Chunk *chunk, int offset) {
     for (LineNumber currentEntry; entryIndex < entriesCount; entryIndex++) {
         currentEntry = getLineNumberArrayAt(&(chunk->lines), entryIndex);
 
-        if (counter + currentEntry.repeats >= (size_t)offset) {
+        if (counter + currentEntry.repeats > (size_t)offset) {
             return currentEntry.lineNumber;
         } else {
             counter += currentEntry.repeats;
         }
     }
 
-    return getLineNumberArrayAt(&(chunk->lines), entryIndex).lineNumber;
+    // Past the end of the code, use the line of the last instruction.
+    return getLineNumberArrayAt(&(chunk->lines), entriesCount - 1).lineNumber;
 }
 
 void writeConstant(Chunk *chunk, Value value, int line) {
@@ -55,11 +55,103 @@ typedef enum OpCode {
     OP_DEFINE_GLOBAL,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+
+    // Jumps backwards by the 16 bit offset in the next 2 bytes.
     OP_LOOP,
+
+    /*
+      OP_CALL argCount cache
+      Calls the value below the argCount arguments on top of the stack.
+      The 2 byte operand cache is the index of the call site's CallCache
+      in its function.
+    */
     OP_CALL,
+
+    /*
+      Quickened forms of OP_CALL, which the VM rewrites an OP_CALL into
+      once it has run, specialized for the kind of callee it saw. They
+      have the same operands. If the callee isn't of the kind they expect,
+      they turn themselves back into an OP_CALL.
+    */
+
+    // Calls a closure, straight from the cache if it has its function.
+    OP_CALL_CLOSURE,
+
+    // Calls a native function.
+    OP_CALL_NATIVE,
+
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
+
+    /*
+      Closes the scope whose first local lives in the slot given by the
+      next byte. Every upvalue at or above that slot is closed, then the
+      number of values given by the byte after that are moved from the top
+      of the stack down into the scope's first slots, and everything above
+      them is discarded.
+
+      With a count of 1 this leaves a let's result where its locals were.
+      The back edge of a loop uses it to rebind the loop variables to the
+      values of the next iteration.
+    */
+    OP_CLOSE_SCOPE,
+
+    /*
+      OP_SWITCH constant
+      Pops a key and jumps forward by the offset which the ObjSwitch in
+      constant gives for it, in constant time. Used for case.
+    */
+    OP_SWITCH,
+
+    // Arithmetic and comparison on the top two values of the stack, which
+    // must both be numbers. Pops both and pushes the result.
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_NUMBER_EQUAL,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+
+    /*
+      Superinstructions, which the peephole optimizer fuses from pairs of
+      instructions that often run one after the other. Each does what the
+      pair does, with one dispatch instead of two.
+    */
+
+    // OP_GET_LOCAL_2 first second: two OP_GET_LOCALs.
+    OP_GET_LOCAL_2,
+
+    // OP_ADD_CONSTANT constant: an OP_CONSTANT with a number, and OP_ADD.
+    OP_ADD_CONSTANT,
+
+    // OP_SUBTRACT_CONSTANT constant: like OP_ADD_CONSTANT but subtracts.
+    OP_SUBTRACT_CONSTANT,
+
+    /*
+      OP_POP_JUMP_IF_FALSE offset: pops the value on top of the stack, and
+      jumps if it is false. It is an OP_JUMP_IF_FALSE followed by OP_POP,
+      where the OP_POP which starts the other branch is skipped.
+    */
+    OP_POP_JUMP_IF_FALSE,
+
+    // OP_CLOSE_SCOPE_LOOP slot count offset: the back edge of a loop.
+    OP_CLOSE_SCOPE_LOOP,
+
     OP_RETURN,
+
+    /*
+      OP_WIDE instruction operands...
+      Doubles the width of every operand of the next instruction, for the
+      rare operands which don't fit: byte operands take 2 bytes and 2 byte
+      operands take 4. The compiler only emits it before OP_GET_LOCAL,
+      OP_SET_LOCAL, the global and upvalue instructions, OP_JUMP,
+      OP_JUMP_IF_FALSE, OP_LOOP, OP_CALL, OP_CLOSURE, OP_CLOSE_SCOPE and
+      OP_SWITCH. A wide OP_CALL is never quickened.
+    */
+    OP_WIDE,
 } OpCode;
 
 // A "chunk" of opcodes.
@@ -84,6 +176,9 @@ uint8_t *getChunkCode(Chunk const *chunk);
 
 size_t getChunkCount(Chunk const *chunk);
 
+// Discards every byte of chunk's code from index count onwards.
+void truncateChunk(Chunk *chunk, size_t count);
+
 /*
   Frees the memory associated with the chunk at chunk. Does not free the data
   directly at chunk, so it is safe to use on chunks that are stored on the
@@ -91,6 +186,9 @@ size_t getChunkCount(Chunk const *chunk);
 */
 void freeChunk(Chunk *chunk);
 
+// Returns the number of bytes in the instruction at offset in chunk's code.
+int instructionLength(Chunk const *chunk, size_t offset);
+
 // Adds value to chunk's constants array, and returns the index it was placed at.
 int addConstant(Chunk *chunk, Value value);
 
@@ -0,0 +1,1939 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "closure_engine.h"
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "common.h"
+#include "ffi.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "scanner.h"
+#include "smart_array.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+// The most non-tail calls which can be running at once.
+#define DEPTH_MAX 1024
+
+// The most values the engine can have on the VM's stack.
+#define VALUES_MAX (DEPTH_MAX * UINT8_COUNT)
+
+// Bytes in a block of nodes, unless one node needs more.
+#define BLOCK_SIZE (64 * 1024)
+
+#define EVAL(node, frame) ((node)->eval((node), (frame)))
+
+typedef struct Node Node;
+typedef struct Frame Frame;
+
+// Runs node in frame and returns its value.
+typedef Value (*Evaluator)(Node const *node, Frame *frame);
+
+struct Lambda {
+    ObjSymbol *name;  // NULL if it is anonymous or a top level form.
+    int arity;        // Or VARIADIC_ARITY, as for an ObjFunction.
+    Parameters parameters;
+    int slotCount;  // Its parameters, then every variable of its body.
+
+    // True if lambdas inside of it can close over its variables, which
+    // then live in an environment on the heap instead of on the stack.
+    bool isCaptured;
+    Node *body;
+};
+
+// A running call of a lambda.
+struct Frame {
+    Frame *caller;
+    Lambda const *lambda;
+    Value *variables;            // The lambda's slots.
+    ObjEnvironment *enclosing;   // The environment of the procedure.
+    ObjEnvironment *environment;  // Holds variables if lambda->isCaptured.
+    size_t line;  // The line of the call being made, for stack traces.
+};
+
+struct Node {
+    Evaluator eval;
+    size_t line;
+    union {
+        Value constant;
+
+        // A variable of the lambda, or depth lambdas out from it.
+        struct {
+            int depth;
+            int slot;
+            Node *value;  // The new value, for a set! or definition.
+        } variable;
+
+        struct {
+            ObjSymbol *name;
+            Node *value;
+        } global;
+
+        struct {
+            Node *test;
+            Node *consequent;
+            Node *alternative;
+        } branch;
+
+        // begin, and, or and bodies.
+        struct {
+            Node **nodes;
+            int count;
+        } sequence;
+
+        struct {
+            Node *callee;
+            Node **arguments;
+            int count;
+        } call;
+
+        // An arithmetic or comparison primitive.
+        struct {
+            Node *left;
+            Node *right;
+            double number;  // right, if it is a number constant.
+            int slot;       // left, if it is a variable of the lambda.
+        } binary;
+
+        Lambda *lambda;
+
+        // case, which chooses a clause with a jump table.
+        struct {
+            Node *key;
+            ObjSwitch *table;
+            Node **clauses;
+            int slot;  // Where the key is kept for => clauses, or -1.
+        } dispatch;
+
+        // A cond clause with =>, which calls call with the test's value.
+        struct {
+            Node *test;
+            Node *call;
+            Node *alternative;
+            int slot;  // Where the test's value is kept for call.
+        } arrow;
+
+        // A do loop, which runs in its lambda's frame.
+        struct {
+            Node **initials;
+            Node **steps;  // NULL for variables without a step.
+            int firstSlot;
+            int count;
+            Node *test;
+            Node *result;
+            Node *body;  // The commands, or NULL.
+        } loop;
+    } as;
+};
+
+// Nodes and lambdas are allocated in blocks, which are freed together.
+typedef struct Block {
+    struct Block *next;
+    size_t used;
+    size_t capacity;
+    max_align_t data[];
+} Block;
+
+typedef struct {
+    ObjSymbol *name;  // NULL while it can't be referred to.
+    int slot;
+} Variable;
+
+typedef struct LambdaCompiler {
+    struct LambdaCompiler *enclosing;
+    Lambda *lambda;
+    Variable *variables;
+    int variableCount;
+    int variableCapacity;
+    int scopeDepth;
+    ObjSyntax *syntax;  // The expression being compiled.
+} LambdaCompiler;
+
+// Compiles a special form. syntax is the whole form.
+typedef Node *(*SpecialFormFn)(ObjSyntax *syntax, bool isTail);
+
+typedef struct {
+    char const *name;
+    SpecialFormFn compile;
+} SpecialForm;
+
+// An arithmetic or comparison procedure which compiles to its own node.
+typedef struct {
+    char const *name;
+    Evaluator eval;
+    Evaluator evalNumber;       // When the right operand is a number.
+    Evaluator evalLocalNumber;  // And the left one is a local variable.
+    bool isComparison;
+} Primitive;
+
+ClosureOptions closureOptions = {.enabled = false};
+
+static _Thread_local Block *blocks = NULL;
+
+// The values which nodes refer to, which the GC must not free.
+static _Thread_local ValueArray constants;
+
+// How much had been compiled at the VM's checkpoint.
+static _Thread_local Block *checkpointBlock = NULL;
+static _Thread_local size_t checkpointUsed = 0;
+static _Thread_local size_t checkpointConstants = 0;
+
+static _Thread_local LambdaCompiler *current = NULL;
+
+// The number of lambdas compiled so far.
+static _Thread_local int lambdaCount = 0;
+
+// Where runtime errors go back to.
+static _Thread_local jmp_buf errorJump;
+
+static _Thread_local Value *stackLimit = NULL;
+static _Thread_local int depth = 0;
+
+// Whether the stack has been reserved for a run, which may not move it.
+static _Thread_local bool isRunning = false;
+
+// The frame which called the native that is running, if there is one.
+static _Thread_local Frame *nativeCaller = NULL;
+
+/*
+  Set by a call in tail position, which leaves its callee and arguments on
+  top of the stack for apply() to call in place of the current procedure.
+*/
+static _Thread_local bool tailCall = false;
+static _Thread_local int tailCallArgCount = 0;
+
+static Node *compileExpression(Value syntax, bool isTail);
+static Node *compileBody(ObjSyntax *form, Value body, bool isTail);
+static Node *compileLambda(ObjSymbol *name, ObjSyntax *form, Value parameters,
+                           Value body);
+
+static void *allocateInBlock(size_t size) {
+    size_t const ALIGNMENT = sizeof(max_align_t);
+    size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+    if (NULL == blocks || blocks->used + size > blocks->capacity) {
+        size_t capacity = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+        Block *block = checkedMalloc(sizeof(Block) + capacity);
+        block->next = blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        blocks = block;
+    }
+
+    void *memory = (char *)blocks->data + blocks->used;
+    blocks->used += size;
+    return memory;
+}
+
+/*
+  Reports a runtime error at line, which frame is running, and the calls
+  that its callers are making, then abandons the program.
+*/
+_Noreturn static void fail(Frame *frame, size_t line, char const *format,
+                           ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    if (NULL != frame) frame->line = line;
+    for (; NULL != frame; frame = frame->caller) {
+        fprintf(stderr, "[line %zu] in ", frame->line);
+        if (NULL == frame->lambda->name) {
+            fprintf(stderr, "script\n");
+        } else {
+            fprintf(stderr, "%s()\n", frame->lambda->name->chars);
+        }
+    }
+
+    vm.hadError = true;
+    longjmp(errorJump, 1);
+}
+
+// The line frame is at, if the call comes from a procedure.
+static size_t lineOf(Frame const *frame) {
+    return NULL == frame ? 0 : frame->line;
+}
+
+/*
+  Calls the callee at base with the argCount arguments after it, pops them
+  and returns the result. While the body of the callee ends in a tail
+  call, the next callee and its arguments replace them and it goes around
+  again, so tail calls don't nest.
+*/
+static Value apply(Frame *caller, Value *base, int argCount) {
+    for (;;) {
+        Value callee = *base;
+        if (IS_NATIVE(callee)) {
+            ObjNative *native = AS_NATIVE(callee);
+            char message[128];
+            if (needsArgumentCheck(native, argCount) &&
+                !checkNativeArguments(&native->descriptor, argCount, base + 1,
+                                      message, sizeof(message))) {
+                fail(caller, lineOf(caller), "%s", message);
+            }
+            Frame *enclosingCaller = nativeCaller;
+            nativeCaller = caller;
+            Value result = native->descriptor.function(argCount, base + 1);
+            nativeCaller = enclosingCaller;
+
+            // The error was reported by a procedure the native called.
+            if (vm.hadError) longjmp(errorJump, 1);
+            vm.stackTop = base;
+            return result;
+        }
+
+        if (IS_FOREIGN(callee)) {
+            Value result;
+            char message[128];
+            if (!callForeign(AS_FOREIGN(callee), argCount, base + 1, &result,
+                             message, sizeof(message))) {
+                fail(caller, lineOf(caller), "%s", message);
+            }
+            vm.stackTop = base;
+            return result;
+        }
+
+        if (IS_CASE_LAMBDA(callee)) {
+            ObjCaseLambda const *caseLambda = AS_CASE_LAMBDA(callee);
+            int clause = caseLambdaClause(caseLambda, argCount);
+            if (-1 == clause) {
+                fail(caller, lineOf(caller),
+                     "No clause of case-lambda takes %d arguments.",
+                     argCount);
+            }
+            *base = caseLambda->clauses[clause];
+            continue;
+        }
+
+        if (!IS_PROCEDURE(callee)) {
+            fail(caller, lineOf(caller),
+                 "Can only call functions and classes.");
+        }
+
+        ObjProcedure *procedure = AS_PROCEDURE(callee);
+        Lambda const *lambda = procedure->lambda;
+        if (DEPTH_MAX == depth || base + 1 + lambda->slotCount > stackLimit) {
+            fail(caller, lineOf(caller), "Stack overflow.");
+        }
+        if (argCount != lambda->arity) {
+            char message[128];
+            if (!bindArguments(&lambda->parameters, argCount, message,
+                               sizeof(message))) {
+                fail(caller, lineOf(caller), "%s", message);
+            }
+            argCount = parameterCount(&lambda->parameters);
+        }
+
+        Frame frame = {
+            .caller = caller,
+            .lambda = lambda,
+            .variables = base + 1,
+            .enclosing = procedure->environment,
+            .environment = NULL,
+            .line = 0,
+        };
+
+        if (lambda->isCaptured) {
+            frame.environment =
+                newEnvironment(procedure->environment, lambda->slotCount);
+            memcpy(frame.environment->slots, base + 1,
+                   sizeof(Value) * argCount);
+            frame.variables = frame.environment->slots;
+
+            // The environment keeps everything the procedure did alive.
+            *base = OBJ_VAL(frame.environment);
+            vm.stackTop = base + 1;
+        } else {
+            vm.stackTop = base + 1 + lambda->slotCount;
+            for (Value *slot = base + 1 + argCount; slot < vm.stackTop;
+                 slot++) {
+                *slot = NIL_VAL;
+            }
+        }
+
+        depth++;
+        Value result = EVAL(lambda->body, &frame);
+        depth--;
+
+        if (!tailCall) {
+            vm.stackTop = base;
+            return result;
+        }
+
+        tailCall = false;
+        argCount = tailCallArgCount;
+        memmove(base, vm.stackTop - argCount - 1,
+                sizeof(Value) * (argCount + 1));
+        vm.stackTop = base + argCount + 1;
+    }
+}
+
+static Value evalConstant(Node const *node, Frame *frame) {
+    (void)frame;
+    return node->as.constant;
+}
+
+static Value evalLocal(Node const *node, Frame *frame) {
+    return frame->variables[node->as.variable.slot];
+}
+
+// Returns the environment of the lambda depth lambdas out from frame's.
+static ObjEnvironment *outerEnvironment(Frame const *frame, int depth) {
+    ObjEnvironment *environment = frame->enclosing;
+    for (; depth > 1; depth--) environment = environment->enclosing;
+    return environment;
+}
+
+static Value evalOuter(Node const *node, Frame *frame) {
+    ObjEnvironment *environment =
+        outerEnvironment(frame, node->as.variable.depth);
+    return environment->slots[node->as.variable.slot];
+}
+
+static Value evalGlobal(Node const *node, Frame *frame) {
+    Value value = NIL_VAL;
+    if (!tableGet(&vm.globals, node->as.global.name, &value)) {
+        fail(frame, node->line, "Undefined variable '%s'.",
+             node->as.global.name->chars);
+    }
+    return value;
+}
+
+static Value evalSetLocal(Node const *node, Frame *frame) {
+    Value value = EVAL(node->as.variable.value, frame);
+    frame->variables[node->as.variable.slot] = value;
+    return value;
+}
+
+static Value evalSetOuter(Node const *node, Frame *frame) {
+    Value value = EVAL(node->as.variable.value, frame);
+    ObjEnvironment *environment =
+        outerEnvironment(frame, node->as.variable.depth);
+    writeSlot(&environment->obj, &environment->slots[node->as.variable.slot],
+              value);
+    return value;
+}
+
+static Value evalSetGlobal(Node const *node, Frame *frame) {
+    ObjSymbol *name = node->as.global.name;
+    push(EVAL(node->as.global.value, frame));
+    if (tableSet(&vm.globals, name, vm.stackTop[-1])) {
+        tableDelete(&vm.globals, name);
+        fail(frame, node->line, "Undefined variable '%s'.", name->chars);
+    }
+    return pop();
+}
+
+static Value evalDefineGlobal(Node const *node, Frame *frame) {
+    push(EVAL(node->as.global.value, frame));
+    tableSet(&vm.globals, node->as.global.name, vm.stackTop[-1]);
+    pop();
+    return NIL_VAL;
+}
+
+static Value evalIf(Node const *node, Frame *frame) {
+    if (isFalsey(EVAL(node->as.branch.test, frame))) {
+        return EVAL(node->as.branch.alternative, frame);
+    }
+    return EVAL(node->as.branch.consequent, frame);
+}
+
+static Value evalSequence(Node const *node, Frame *frame) {
+    Node *const *nodes = node->as.sequence.nodes;
+    int last = node->as.sequence.count - 1;
+    for (int i = 0; i < last; i++) EVAL(nodes[i], frame);
+    return EVAL(nodes[last], frame);
+}
+
+static Value evalAnd(Node const *node, Frame *frame) {
+    Node *const *nodes = node->as.sequence.nodes;
+    int last = node->as.sequence.count - 1;
+    for (int i = 0; i < last; i++) {
+        Value value = EVAL(nodes[i], frame);
+        if (isFalsey(value)) return value;
+    }
+    return EVAL(nodes[last], frame);
+}
+
+static Value evalOr(Node const *node, Frame *frame) {
+    Node *const *nodes = node->as.sequence.nodes;
+    int last = node->as.sequence.count - 1;
+    for (int i = 0; i < last; i++) {
+        Value value = EVAL(nodes[i], frame);
+        if (!isFalsey(value)) return value;
+    }
+    return EVAL(nodes[last], frame);
+}
+
+static Value evalLambda(Node const *node, Frame *frame) {
+    Lambda *lambda = node->as.lambda;
+    return OBJ_VAL(newProcedure(lambda, lambda->name, frame->environment));
+}
+
+/*
+  Pushes the callee and the arguments of the call node, and returns where
+  the callee is.
+*/
+static Value *pushOperands(Node const *node, Frame *frame) {
+    Value *callee = vm.stackTop;
+    if (callee + node->as.call.count + 1 > stackLimit) {
+        fail(frame, node->line, "Stack overflow.");
+    }
+
+    Value value = EVAL(node->as.call.callee, frame);
+    *vm.stackTop++ = value;
+    for (int i = 0; i < node->as.call.count; i++) {
+        value = EVAL(node->as.call.arguments[i], frame);
+        *vm.stackTop++ = value;
+    }
+    return callee;
+}
+
+static Value evalCall(Node const *node, Frame *frame) {
+    Value *callee = pushOperands(node, frame);
+    frame->line = node->line;
+    return apply(frame, callee, node->as.call.count);
+}
+
+static Value evalTailCall(Node const *node, Frame *frame) {
+    pushOperands(node, frame);
+    frame->line = node->line;
+    tailCallArgCount = node->as.call.count;
+    tailCall = true;
+    return NIL_VAL;
+}
+
+_Noreturn static void operandError(Node const *node, Frame *frame) {
+    fail(frame, node->line, "Operands must be numbers.");
+}
+
+/*
+  Defines the evaluators of a primitive: one for any operands, one for when
+  the right operand is a number, and one for when the left operand is
+  also a local variable.
+*/
+#define BINARY_EVALUATORS(name, valueType, op)                           \
+    static Value eval##name(Node const *node, Frame *frame) {            \
+        Value a = EVAL(node->as.binary.left, frame);                     \
+        Value b = EVAL(node->as.binary.right, frame);                    \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) operandError(node, frame);   \
+        return valueType(AS_NUMBER(a) op AS_NUMBER(b));                  \
+    }                                                                    \
+                                                                         \
+    static Value eval##name##Number(Node const *node, Frame *frame) {    \
+        Value a = EVAL(node->as.binary.left, frame);                     \
+        if (!IS_NUMBER(a)) operandError(node, frame);                    \
+        return valueType(AS_NUMBER(a) op node->as.binary.number);        \
+    }                                                                    \
+                                                                         \
+    static Value eval##name##LocalNumber(Node const *node, Frame *frame) { \
+        Value a = frame->variables[node->as.binary.slot];                \
+        if (!IS_NUMBER(a)) operandError(node, frame);                    \
+        return valueType(AS_NUMBER(a) op node->as.binary.number);        \
+    }
+
+BINARY_EVALUATORS(Add, NUMBER_VAL, +)
+BINARY_EVALUATORS(Subtract, NUMBER_VAL, -)
+BINARY_EVALUATORS(Multiply, NUMBER_VAL, *)
+BINARY_EVALUATORS(Divide, NUMBER_VAL, /)
+BINARY_EVALUATORS(NumberEqual, BOOL_VAL, ==)
+BINARY_EVALUATORS(Less, BOOL_VAL, <)
+BINARY_EVALUATORS(LessEqual, BOOL_VAL, <=)
+BINARY_EVALUATORS(Greater, BOOL_VAL, >)
+BINARY_EVALUATORS(GreaterEqual, BOOL_VAL, >=)
+
+#undef BINARY_EVALUATORS
+
+static Value evalCase(Node const *node, Frame *frame) {
+    Value key = EVAL(node->as.dispatch.key, frame);
+    if (node->as.dispatch.slot >= 0) {
+        frame->variables[node->as.dispatch.slot] = key;
+    }
+    int clause = switchLookup(node->as.dispatch.table, key);
+    return EVAL(node->as.dispatch.clauses[clause], frame);
+}
+
+static Value evalArrow(Node const *node, Frame *frame) {
+    Value test = EVAL(node->as.arrow.test, frame);
+    if (isFalsey(test)) return EVAL(node->as.arrow.alternative, frame);
+    frame->variables[node->as.arrow.slot] = test;
+    return EVAL(node->as.arrow.call, frame);
+}
+
+static Value evalLoop(Node const *node, Frame *frame) {
+    int firstSlot = node->as.loop.firstSlot;
+    int count = node->as.loop.count;
+    for (int i = 0; i < count; i++) {
+        Value value = EVAL(node->as.loop.initials[i], frame);
+        frame->variables[firstSlot + i] = value;
+    }
+
+    for (;;) {
+        if (!isFalsey(EVAL(node->as.loop.test, frame))) {
+            return EVAL(node->as.loop.result, frame);
+        }
+        if (NULL != node->as.loop.body) EVAL(node->as.loop.body, frame);
+
+        // Every step is evaluated before any variable changes.
+        Value *steps = vm.stackTop;
+        if (steps + count > stackLimit) {
+            fail(frame, node->line, "Stack overflow.");
+        }
+        for (int i = 0; i < count; i++) {
+            Node *step = node->as.loop.steps[i];
+            if (NULL == step) continue;
+            Value value = EVAL(step, frame);
+            *vm.stackTop++ = value;
+        }
+
+        Value *step = steps;
+        for (int i = 0; i < count; i++) {
+            if (NULL != node->as.loop.steps[i]) {
+                frame->variables[firstSlot + i] = *step++;
+            }
+        }
+        vm.stackTop = steps;
+    }
+}
+
+static Node *newNode(Evaluator eval) {
+    Node *node = allocateInBlock(sizeof(Node));
+    node->eval = eval;
+    node->line = NULL == current->syntax ? 0 : current->syntax->location.line;
+    return node;
+}
+
+static Node **newNodes(int count) {
+    return allocateInBlock(sizeof(Node *) * (count > 0 ? count : 1));
+}
+
+static Node *constantNode(Value value) {
+    if (IS_OBJ(value)) writeValueArray(&constants, value);
+    Node *node = newNode(evalConstant);
+    node->as.constant = value;
+    return node;
+}
+
+// Returns a node which runs nodes in order, and has the value of the last.
+static Node *sequenceNode(Node **nodes, int count) {
+    if (0 == count) return constantNode(NIL_VAL);
+    if (1 == count) return nodes[0];
+    Node *node = newNode(evalSequence);
+    node->as.sequence.nodes = nodes;
+    node->as.sequence.count = count;
+    return node;
+}
+
+static Node *ifNode(Node *test, Node *consequent, Node *alternative) {
+    Node *node = newNode(evalIf);
+    node->as.branch.test = test;
+    node->as.branch.consequent = consequent;
+    node->as.branch.alternative = alternative;
+    return node;
+}
+
+static Node *callNode(Node *callee, Node **arguments, int count,
+                      bool isTail) {
+    Node *node = newNode(isTail ? evalTailCall : evalCall);
+    node->as.call.callee = callee;
+    node->as.call.arguments = arguments;
+    node->as.call.count = count;
+    return node;
+}
+
+static Node *localNode(int slot) {
+    Node *node = newNode(evalLocal);
+    node->as.variable.depth = 0;
+    node->as.variable.slot = slot;
+    return node;
+}
+
+static Node *setLocalNode(int slot, Node *value) {
+    Node *node = newNode(evalSetLocal);
+    node->as.variable.depth = 0;
+    node->as.variable.slot = slot;
+    node->as.variable.value = value;
+    return node;
+}
+
+static void compileError(ObjSyntax const *syntax, char const *format, ...) {
+    if (parser.panicMode) return;
+    parser.panicMode = true;
+
+    // Only show the first line of the offending code.
+    char const *start = syntax->location.start;
+    size_t length = syntax->location.length;
+    char const *newline = memchr(start, '\n', length);
+    if (NULL != newline) length = newline - start;
+
+    fprintf(stderr, "[line %zu] Error at '%.*s': ", syntax->location.line,
+            (int)length, start);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    parser.hadError = true;
+}
+
+// Reports an error at the expression being compiled, and returns a node.
+static Node *error(char const *message) {
+    compileError(current->syntax, "%s", message);
+    return constantNode(NIL_VAL);
+}
+
+// Returns the value wrapped by syntax, or syntax itself if it isn't wrapped.
+static Value unwrap(Value syntax) {
+    return IS_SYNTAX(syntax) ? AS_SYNTAX(syntax)->value : syntax;
+}
+
+// Returns the symbol that syntax stands for, or NULL if it isn't a symbol.
+static ObjSymbol *asSymbol(Value syntax) {
+    Value value = unwrap(syntax);
+    return IS_SYMBOL(value) ? AS_SYMBOL(value) : NULL;
+}
+
+// Returns the number of elements in list, or -1 if it isn't a proper list.
+static int properListLength(Value list) {
+    int length = 0;
+    for (; IS_PAIR(list); list = CDR(list)) length++;
+    return IS_NIL(list) ? length : -1;
+}
+
+// Strips the syntax objects from syntax, returning the plain datum.
+static Value syntaxToDatum(Value syntax) {
+    Value value = unwrap(syntax);
+
+    if (IS_PAIR(value)) {
+        return OBJ_VAL(
+            newPair(syntaxToDatum(CAR(value)), syntaxToDatum(CDR(value))));
+    }
+
+    if (IS_VECTOR(value)) {
+        ObjVector *vector = newVector();
+        ValueArray *elements = &(AS_VECTOR(value)->array);
+        for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+            vectorAppend(vector, syntaxToDatum(getValueArrayAt(elements, i)));
+        }
+        return OBJ_VAL(vector);
+    }
+
+    return value;
+}
+
+static void beginLambda(LambdaCompiler *compiler, ObjSymbol *name) {
+    // The new lambda can close over the variables of the current one.
+    if (NULL != current) current->lambda->isCaptured = true;
+
+    Lambda *lambda = allocateInBlock(sizeof(Lambda));
+    lambda->name = name;
+    lambda->arity = 0;
+    lambda->parameters =
+        (Parameters){.requiredCount = 0, .optionalCount = 0, .hasRest = false};
+    lambda->slotCount = 0;
+    lambda->isCaptured = false;
+    lambda->body = NULL;
+    if (NULL != name) writeValueArray(&constants, OBJ_VAL(name));
+
+    compiler->enclosing = current;
+    compiler->lambda = lambda;
+    compiler->variables = NULL;
+    compiler->variableCount = 0;
+    compiler->variableCapacity = 0;
+    compiler->scopeDepth = 1;
+    compiler->syntax = NULL == current ? NULL : current->syntax;
+    current = compiler;
+    lambdaCount++;
+}
+
+static Lambda *endLambda(void) {
+    Lambda *lambda = current->lambda;
+    FREE_ARRAY(Variable, current->variables, current->variableCapacity);
+    current = current->enclosing;
+    return lambda;
+}
+
+static void beginScope(void) { current->scopeDepth++; }
+
+static void endScope(int variableCount) {
+    current->scopeDepth--;
+    current->variableCount = variableCount;
+}
+
+/*
+  Adds a variable called name to the current scope, in a new slot of the
+  lambda, and returns its index in variables.
+*/
+static int addVariable(ObjSymbol *name) {
+    if (UINT16_COUNT == current->variableCount) {
+        error("Too many local variables in function.");
+        return current->variableCount - 1;
+    }
+
+    if (current->variableCount == current->variableCapacity) {
+        int capacity = current->variableCapacity;
+        current->variableCapacity = GROW_CAPACITY(capacity);
+        current->variables = GROW_ARRAY(Variable, current->variables, capacity,
+                                        current->variableCapacity);
+    }
+
+    Variable *variable = &current->variables[current->variableCount];
+    variable->name = name;
+    variable->slot = current->lambda->slotCount++;
+    return current->variableCount++;
+}
+
+static int slotOf(int variable) { return current->variables[variable].slot; }
+
+/*
+  Finds the variable called name, in the current lambda if *depth is set
+  to 0, or *depth lambdas out. Returns false if it is a global.
+*/
+static bool resolve(ObjSymbol *name, int *depth, int *slot) {
+    *depth = 0;
+    for (LambdaCompiler *compiler = current; NULL != compiler;
+         compiler = compiler->enclosing, (*depth)++) {
+        for (int i = compiler->variableCount - 1; i >= 0; i--) {
+            if (name == compiler->variables[i].name) {
+                *slot = compiler->variables[i].slot;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool isLexicallyBound(ObjSymbol *name) {
+    int depth = 0;
+    int slot = 0;
+    return resolve(name, &depth, &slot);
+}
+
+// Returns true if syntax is the symbol called name, and isn't shadowed.
+static bool isKeyword(Value syntax, char const *name) {
+    ObjSymbol *symbol = asSymbol(syntax);
+    return NULL != symbol && textOfSymbolEqualToString(symbol, name) &&
+           !isLexicallyBound(symbol);
+}
+
+static Node *compileVariable(ObjSymbol *name) {
+    int depth = 0;
+    int slot = 0;
+    if (!resolve(name, &depth, &slot)) {
+        writeValueArray(&constants, OBJ_VAL(name));
+        Node *node = newNode(evalGlobal);
+        node->as.global.name = name;
+        return node;
+    }
+
+    Node *node = newNode(0 == depth ? evalLocal : evalOuter);
+    node->as.variable.depth = depth;
+    node->as.variable.slot = slot;
+    return node;
+}
+
+// Returns a node which sets the variable called name to value.
+static Node *assignmentNode(ObjSymbol *name, Node *value) {
+    int depth = 0;
+    int slot = 0;
+    if (!resolve(name, &depth, &slot)) {
+        writeValueArray(&constants, OBJ_VAL(name));
+        Node *node = newNode(evalSetGlobal);
+        node->as.global.name = name;
+        node->as.global.value = value;
+        return node;
+    }
+
+    Node *node = newNode(0 == depth ? evalSetLocal : evalSetOuter);
+    node->as.variable.depth = depth;
+    node->as.variable.slot = slot;
+    node->as.variable.value = value;
+    return node;
+}
+
+static Node *compileQuote(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    if (2 != properListLength(list)) {
+        return error("quote takes exactly one datum.");
+    }
+    return constantNode(syntaxToDatum(CADR(list)));
+}
+
+static Node *compileIf(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    int length = properListLength(list);
+    if (3 != length && 4 != length) {
+        return error(
+            "if takes a test, a consequent and an optional alternative.");
+    }
+
+    Node *test = compileExpression(CADR(list), false);
+    Node *consequent = compileExpression(CADDR(list), isTail);
+    Node *alternative = 4 == length
+                            ? compileExpression(CAR(CDDDR(list)), isTail)
+                            : constantNode(NIL_VAL);
+    return ifNode(test, consequent, alternative);
+}
+
+// Returns true if syntax is a (define ...) form.
+static bool isDefinition(Value syntax) {
+    Value value = unwrap(syntax);
+    if (properListLength(value) < 2) return false;
+    return isKeyword(CAR(value), "define");
+}
+
+/*
+  Compiles syntax as the value of a variable called name. Lambdas are given
+  the variable's name, so that error messages can mention it.
+*/
+static Node *compileNamedValue(ObjSymbol *name, Value syntax) {
+    Value value = unwrap(syntax);
+    if (IS_PAIR(value) && isKeyword(CAR(value), "lambda") &&
+        properListLength(value) >= 3) {
+        ObjSyntax *enclosing = current->syntax;
+        current->syntax = AS_SYNTAX(syntax);
+        Node *node =
+            compileLambda(name, current->syntax, CADR(value), CDDR(value));
+        current->syntax = enclosing;
+        return node;
+    }
+    return compileExpression(syntax, false);
+}
+
+/*
+  Compiles the value of a definition, and sets *name to the variable being
+  defined, or NULL if the definition is malformed.
+*/
+static Node *compileDefinitionValue(ObjSyntax *form, ObjSymbol **name) {
+    Value list = form->value;
+    *name = NULL;
+    if (properListLength(list) < 2) {
+        return error("define takes a variable and a value.");
+    }
+
+    Value target = unwrap(CADR(list));
+
+    // (define (name . parameters) body ...)
+    if (IS_PAIR(target)) {
+        *name = asSymbol(CAR(target));
+        if (NULL == *name) return error("Expect procedure name.");
+        return compileLambda(*name, form, CDR(target), CDDR(list));
+    }
+
+    // (define name value)
+    *name = asSymbol(target);
+    if (NULL == *name || properListLength(list) != 3) {
+        *name = NULL;
+        return error("define takes a variable and a value.");
+    }
+    return compileNamedValue(*name, CADDR(list));
+}
+
+static Node *compileDefine(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+
+    // Internal definitions are handled by compileBody.
+    if (current->scopeDepth > 0) {
+        return error("define is only allowed at the start of a body.");
+    }
+
+    ObjSymbol *name = NULL;
+    Node *value = compileDefinitionValue(form, &name);
+    if (NULL == name) return value;
+
+    writeValueArray(&constants, OBJ_VAL(name));
+    Node *node = newNode(evalDefineGlobal);
+    node->as.global.name = name;
+    node->as.global.value = value;
+    return node;
+}
+
+static Node *compileSet(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    ObjSymbol *name =
+        3 == properListLength(list) ? asSymbol(CADR(list)) : NULL;
+    if (NULL == name) return error("set! takes a variable and a value.");
+
+    return assignmentNode(name, compileExpression(CADDR(list), false));
+}
+
+static Node *compileLambda(ObjSymbol *name, ObjSyntax *form, Value parameters,
+                           Value body) {
+    LambdaCompiler compiler;
+    beginLambda(&compiler, name);
+    Lambda *lambda = compiler.lambda;
+
+    // The parameters after #!optional are optional, as in compiler.c.
+    bool isOptional = false;
+    Value parameter = unwrap(parameters);
+    for (; IS_PAIR(parameter); parameter = unwrap(CDR(parameter))) {
+        ObjSymbol *parameterName = asSymbol(CAR(parameter));
+        if (NULL == parameterName) {
+            error("Expect parameter name.");
+            break;
+        }
+        if (!isOptional &&
+            textOfSymbolEqualToString(parameterName, "#!optional")) {
+            isOptional = true;
+            continue;
+        }
+
+        if (isOptional) {
+            lambda->parameters.optionalCount++;
+        } else {
+            lambda->parameters.requiredCount++;
+        }
+        if (parameterCount(&lambda->parameters) > UINT16_MAX) {
+            error("Can't have more than 65535 parameters.");
+        }
+        addVariable(parameterName);
+    }
+
+    if (IS_SYMBOL(parameter)) {
+        lambda->parameters.hasRest = true;
+        addVariable(AS_SYMBOL(parameter));
+    } else if (!IS_NIL(parameter) && !parser.hadError) {
+        error("Expect parameter name.");
+    }
+    lambda->arity = 0 == lambda->parameters.optionalCount &&
+                            !lambda->parameters.hasRest
+                        ? lambda->parameters.requiredCount
+                        : VARIADIC_ARITY;
+
+    lambda->body = compileBody(form, body, true);
+    endLambda();
+
+    Node *node = newNode(evalLambda);
+    node->as.lambda = lambda;
+    return node;
+}
+
+static Node *compileLambdaForm(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    if (properListLength(list) < 3) {
+        return error("lambda takes parameters and a body.");
+    }
+    return compileLambda(NULL, form, CADR(list), CDDR(list));
+}
+
+/*
+  Compiles (case-lambda (parameters body ...) ...) as a call of the
+  %case-lambda native with a lambda of each clause, as compiler.c does.
+*/
+static Node *compileCaseLambda(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value clauses = CDR(form->value);
+    int count = properListLength(clauses);
+    if (count < 0) return error("case-lambda takes a list of clauses.");
+
+    Node **lambdas = newNodes(count);
+    for (int i = 0; i < count; i++, clauses = CDR(clauses)) {
+        Value clause = unwrap(CAR(clauses));
+        if (properListLength(clause) < 2) {
+            return error("Each clause of case-lambda takes parameters and a "
+                         "body.");
+        }
+        lambdas[i] = compileLambda(NULL, AS_SYNTAX(CAR(clauses)), CAR(clause),
+                                   CDR(clause));
+    }
+
+    ObjSymbol *native = newSymbol("%case-lambda", 12);
+    writeValueArray(&constants, OBJ_VAL(native));
+    Node *callee = newNode(evalGlobal);
+    callee->as.global.name = native;
+    return callNode(callee, lambdas, count, false);
+}
+
+/*
+  Compiles a sequence of expressions, with the value of the last one. If
+  sequence is empty the value is unspecified.
+*/
+static Node *compileSequence(Value sequence, bool isTail) {
+    int count = properListLength(sequence);
+    Node **nodes = newNodes(count);
+    for (int i = 0; i < count; i++, sequence = CDR(sequence)) {
+        nodes[i] = compileExpression(CAR(sequence), isTail && i == count - 1);
+    }
+    return sequenceNode(nodes, count < 0 ? 0 : count);
+}
+
+/*
+  Compiles the body of a lambda or let. Definitions at the start of the
+  body become variables of the innermost scope, with letrec* semantics.
+*/
+static Node *compileBody(ObjSyntax *form, Value body, bool isTail) {
+    int length = properListLength(body);
+    if (length < 1) {
+        compileError(form, "Expect a body.");
+        return constantNode(NIL_VAL);
+    }
+
+    // Declare every definition first so they can refer to each other.
+    int firstDefinition = current->variableCount;
+    int definitionCount = 0;
+    Value expressions = body;
+    for (; IS_PAIR(expressions) && isDefinition(CAR(expressions));
+         expressions = CDR(expressions)) {
+        Value target = unwrap(CADR(unwrap(CAR(expressions))));
+        addVariable(asSymbol(IS_PAIR(target) ? CAR(target) : target));
+        definitionCount++;
+    }
+
+    Node **nodes = newNodes(definitionCount + 1);
+    for (int i = 0; i < definitionCount; i++, body = CDR(body)) {
+        ObjSyntax *enclosing = current->syntax;
+        current->syntax = AS_SYNTAX(CAR(body));
+        ObjSymbol *name = NULL;
+        Node *value = compileDefinitionValue(current->syntax, &name);
+        nodes[i] = setLocalNode(slotOf(firstDefinition + i), value);
+        current->syntax = enclosing;
+    }
+
+    nodes[definitionCount] = compileSequence(expressions, isTail);
+    return sequenceNode(nodes, definitionCount + 1);
+}
+
+static Node *compileBegin(ObjSyntax *form, bool isTail) {
+    return compileSequence(CDR(form->value), isTail);
+}
+
+// Returns true if bindings is a list of (variable value) bindings.
+static bool checkBindings(Value bindings) {
+    if (properListLength(bindings) < 0) {
+        error("Expect a list of bindings.");
+        return false;
+    }
+
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        Value list = unwrap(CAR(binding));
+        if (!IS_PAIR(list) || NULL == asSymbol(CAR(list)) ||
+            properListLength(list) < 2) {
+            error("Expect a binding of a variable to a value.");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+  Compiles the initializers of let style bindings into nodes which set new
+  variables of the current scope, and stores them in nodes. If
+  sequential, each binding can see the ones before it, like in let*.
+*/
+static void compileBindings(Value bindings, bool sequential, Node **nodes) {
+    int firstVariable = current->variableCount;
+    int i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        Value list = unwrap(CAR(binding));
+        Node *value = compileExpression(CADR(list), false);
+        int variable = addVariable(sequential ? asSymbol(CAR(list)) : NULL);
+        nodes[i] = setLocalNode(slotOf(variable), value);
+    }
+
+    if (!sequential) {
+        int variable = firstVariable;
+        for (Value binding = bindings; IS_PAIR(binding);
+             binding = CDR(binding)) {
+            current->variables[variable++].name =
+                asSymbol(CAR(unwrap(CAR(binding))));
+        }
+    }
+}
+
+// Compiles a let or let*, after the bindings are checked.
+static Node *compileLetBody(ObjSyntax *form, Value bindings, bool sequential,
+                            bool isTail) {
+    int count = properListLength(bindings);
+    int variableCount = current->variableCount;
+    beginScope();
+
+    Node **nodes = newNodes(count + 1);
+    compileBindings(bindings, sequential, nodes);
+    nodes[count] = compileBody(form, CDDR(form->value), isTail);
+
+    endScope(variableCount);
+    return sequenceNode(nodes, count + 1);
+}
+
+/*
+  Compiles a named let as a procedure bound to its name which is called
+  with the initial values.
+*/
+static Node *compileNamedLet(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 4) {
+        return error("Named let takes a name, bindings and a body.");
+    }
+
+    ObjSymbol *name = asSymbol(CADR(list));
+    Value bindings = unwrap(CADDR(list));
+    if (!checkBindings(bindings)) return constantNode(NIL_VAL);
+
+    Value parameters = NIL_VAL;
+    ObjPair *lastParameter = NULL;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        ObjPair *parameter = newPair(CAR(unwrap(CAR(binding))), NIL_VAL);
+        if (NULL == lastParameter) {
+            parameters = OBJ_VAL(parameter);
+        } else {
+            lastParameter->cdr = OBJ_VAL(parameter);
+        }
+        lastParameter = parameter;
+    }
+
+    int variableCount = current->variableCount;
+    beginScope();
+    int procedure = addVariable(name);
+    Node *set = setLocalNode(
+        slotOf(procedure),
+        compileLambda(name, form, parameters, CDDDR(list)));
+
+    // The initial values can't see the procedure.
+    current->variables[procedure].name = NULL;
+
+    int count = properListLength(bindings);
+    Node **arguments = newNodes(count);
+    int i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        arguments[i] = compileExpression(CADR(unwrap(CAR(binding))), false);
+    }
+
+    Node **nodes = newNodes(2);
+    nodes[0] = set;
+    nodes[1] = callNode(localNode(slotOf(procedure)), arguments, count,
+                        isTail);
+    endScope(variableCount);
+    return sequenceNode(nodes, 2);
+}
+
+static Node *compileLet(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) >= 2 && NULL != asSymbol(CADR(list))) {
+        return compileNamedLet(form, isTail);
+    }
+
+    if (properListLength(list) < 3) {
+        return error("let takes bindings and a body.");
+    }
+    Value bindings = unwrap(CADR(list));
+    if (!checkBindings(bindings)) return constantNode(NIL_VAL);
+    return compileLetBody(form, bindings, false, isTail);
+}
+
+static Node *compileLetStar(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 3) {
+        return error("let* takes bindings and a body.");
+    }
+    Value bindings = unwrap(CADR(list));
+    if (!checkBindings(bindings)) return constantNode(NIL_VAL);
+    return compileLetBody(form, bindings, true, isTail);
+}
+
+// Compiles both letrec and letrec*, which are the same for us.
+static Node *compileLetrec(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    Value bindings = properListLength(list) >= 3 ? unwrap(CADR(list)) : NIL_VAL;
+    if (properListLength(list) < 3 || properListLength(bindings) < 0) {
+        return error("letrec takes bindings and a body.");
+    }
+    if (!checkBindings(bindings)) return constantNode(NIL_VAL);
+
+    int variableCount = current->variableCount;
+    beginScope();
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        addVariable(asSymbol(CAR(unwrap(CAR(binding)))));
+    }
+
+    int count = properListLength(bindings);
+    Node **nodes = newNodes(count + 1);
+    int i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        Value pair = unwrap(CAR(binding));
+        int variable = variableCount + i;
+        Node *value =
+            compileNamedValue(current->variables[variable].name, CADR(pair));
+        nodes[i] = setLocalNode(slotOf(variable), value);
+    }
+    nodes[count] = compileBody(form, CDDR(list), isTail);
+
+    endScope(variableCount);
+    return sequenceNode(nodes, count + 1);
+}
+
+/*
+  Compiles (do ((variable init step) ...) (test expression ...) command ...)
+  into a loop which runs in the frame of the current lambda.
+*/
+static Node *compileDoLoop(Value list, bool isTail) {
+    Value bindings = unwrap(CADR(list));
+    Value exit = unwrap(CADDR(list));
+    int count = properListLength(bindings);
+
+    Node *node = newNode(evalLoop);
+    node->as.loop.initials = newNodes(count);
+    node->as.loop.steps = newNodes(count);
+    node->as.loop.count = count;
+
+    int variableCount = current->variableCount;
+    beginScope();
+    int i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        node->as.loop.initials[i] =
+            compileExpression(CADR(unwrap(CAR(binding))), false);
+    }
+
+    node->as.loop.firstSlot = current->lambda->slotCount;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        addVariable(asSymbol(CAR(unwrap(CAR(binding)))));
+    }
+
+    node->as.loop.test = compileExpression(CAR(exit), false);
+    node->as.loop.result = compileSequence(CDR(exit), isTail);
+    Value commands = CDDDR(list);
+    node->as.loop.body =
+        IS_NIL(commands) ? NULL : compileSequence(commands, false);
+
+    i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        Value variable = unwrap(CAR(binding));
+        node->as.loop.steps[i] =
+            3 == properListLength(variable)
+                ? compileExpression(CADDR(variable), false)
+                : NULL;
+    }
+
+    endScope(variableCount);
+    return node;
+}
+
+/*
+  Compiles a do loop as a procedure which calls itself for each iteration,
+  so that the lambdas made by each iteration see their own variables.
+*/
+static Node *compileDoProcedure(Value list, bool isTail) {
+    Value bindings = unwrap(CADR(list));
+    Value exit = unwrap(CADDR(list));
+    int count = properListLength(bindings);
+
+    int variableCount = current->variableCount;
+    beginScope();
+    int procedure = addVariable(NULL);
+    int procedureSlot = slotOf(procedure);
+
+    LambdaCompiler compiler;
+    beginLambda(&compiler, NULL);
+    Lambda *lambda = compiler.lambda;
+    lambda->arity = count;
+    lambda->parameters.requiredCount = count;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        addVariable(asSymbol(CAR(unwrap(CAR(binding)))));
+    }
+
+    Node *test = compileExpression(CAR(exit), false);
+    Node *result = compileSequence(CDR(exit), true);
+
+    int commandCount = properListLength(CDDDR(list));
+    Node **nodes = newNodes(commandCount + 1);
+    int i = 0;
+    for (Value command = CDDDR(list); IS_PAIR(command);
+         command = CDR(command), i++) {
+        nodes[i] = compileExpression(CAR(command), false);
+    }
+
+    Node **steps = newNodes(count);
+    i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        Value variable = unwrap(CAR(binding));
+        steps[i] = 3 == properListLength(variable)
+                       ? compileExpression(CADDR(variable), false)
+                       : localNode(slotOf(i));
+    }
+
+    Node *self = newNode(evalOuter);
+    self->as.variable.depth = 1;
+    self->as.variable.slot = procedureSlot;
+    nodes[commandCount] = callNode(self, steps, count, true);
+    lambda->body = ifNode(test, result, sequenceNode(nodes, commandCount + 1));
+    endLambda();
+
+    Node *lambdaNode = newNode(evalLambda);
+    lambdaNode->as.lambda = lambda;
+
+    Node **initials = newNodes(count);
+    i = 0;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), i++) {
+        initials[i] = compileExpression(CADR(unwrap(CAR(binding))), false);
+    }
+
+    Node **sequence = newNodes(2);
+    sequence[0] = setLocalNode(procedureSlot, lambdaNode);
+    sequence[1] = callNode(localNode(procedureSlot), initials, count, isTail);
+    endScope(variableCount);
+    return sequenceNode(sequence, 2);
+}
+
+static Node *compileDo(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    Value exit = properListLength(list) >= 3 ? unwrap(CADDR(list)) : NIL_VAL;
+    if (properListLength(exit) < 1) {
+        return error("do takes bindings, a test and commands.");
+    }
+
+    Value bindings = unwrap(CADR(list));
+    if (properListLength(bindings) < 0) {
+        return error("Expect a list of bindings.");
+    }
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        Value variable = unwrap(CAR(binding));
+        int length = properListLength(variable);
+        if ((2 != length && 3 != length) || NULL == asSymbol(CAR(variable))) {
+            return error("Expect a variable, an initial value and a step.");
+        }
+    }
+
+    int lambdas = lambdaCount;
+    Node *loop = compileDoLoop(list, isTail);
+    if (lambdas == lambdaCount) return loop;
+
+    // Compile it again, now that we know that it makes procedures.
+    return compileDoProcedure(list, isTail);
+}
+
+// Compiles and, or or, which is the value of an empty form.
+static Node *compileLogical(ObjSyntax *form, bool isTail, Evaluator eval,
+                            bool empty) {
+    Value operands = CDR(form->value);
+    int count = properListLength(operands);
+    if (count < 0) return error("Expect a list of operands.");
+    if (0 == count) return constantNode(BOOL_VAL(empty));
+
+    Node **nodes = newNodes(count);
+    for (int i = 0; i < count; i++, operands = CDR(operands)) {
+        nodes[i] = compileExpression(CAR(operands), isTail && i == count - 1);
+    }
+    if (1 == count) return nodes[0];
+
+    Node *node = newNode(eval);
+    node->as.sequence.nodes = nodes;
+    node->as.sequence.count = count;
+    return node;
+}
+
+static Node *compileAnd(ObjSyntax *form, bool isTail) {
+    return compileLogical(form, isTail, evalAnd, true);
+}
+
+static Node *compileOr(ObjSyntax *form, bool isTail) {
+    return compileLogical(form, isTail, evalOr, false);
+}
+
+// Compiles when, or unless if isUnless.
+static Node *compileConditionalSequence(ObjSyntax *form, bool isTail,
+                                        bool isUnless) {
+    Value list = form->value;
+    if (properListLength(list) < 3) return error("Expect a test and a body.");
+
+    Node *test = compileExpression(CADR(list), false);
+    Node *body = compileSequence(CDDR(list), isTail);
+    Node *nothing = constantNode(NIL_VAL);
+    return isUnless ? ifNode(test, nothing, body) : ifNode(test, body, nothing);
+}
+
+static Node *compileWhen(ObjSyntax *form, bool isTail) {
+    return compileConditionalSequence(form, isTail, false);
+}
+
+static Node *compileUnless(ObjSyntax *form, bool isTail) {
+    return compileConditionalSequence(form, isTail, true);
+}
+
+/*
+  Returns true if a key can be found with the jump table of a case. Other
+  datums are never eqv? to a key.
+*/
+static bool isSwitchKey(Value datum) {
+    return IS_NUMBER(datum) || IS_CHARACTER(datum) || IS_SYMBOL(datum) ||
+           IS_BOOL(datum) || IS_NIL(datum);
+}
+
+// Returns a node which calls the procedure that syntax evaluates to with
+// the value in slot.
+static Node *compileArrowCall(Value syntax, int slot, bool isTail) {
+    Node **arguments = newNodes(1);
+    arguments[0] = localNode(slot);
+    return callNode(compileExpression(syntax, false), arguments, 1, isTail);
+}
+
+/*
+  Compiles a case, which finds the clause to run in a jump table. Each of
+  the clauses is ((datum ...) expression ...), ((datum ...) => expression),
+  (else expression ...) or (else => expression).
+*/
+static Node *compileCase(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 2) {
+        return error("case takes a key and clauses.");
+    }
+
+    Value clauses = CDDR(list);
+    int count = properListLength(clauses);
+    bool needsKey = false;
+    for (Value clause = clauses; IS_PAIR(clause); clause = CDR(clause)) {
+        Value clauseList = unwrap(CAR(clause));
+        if (properListLength(clauseList) < 2) {
+            return error("Expect a case clause.");
+        }
+
+        bool isElse = isKeyword(CAR(clauseList), "else");
+        if (isElse && IS_PAIR(CDR(clause))) {
+            return error("The else clause must be the last clause.");
+        }
+        if (!isElse && properListLength(unwrap(CAR(clauseList))) < 0) {
+            return error("Expect a list of datums.");
+        }
+
+        // The procedure after => is called with the key.
+        if (isKeyword(CADR(clauseList), "=>")) needsKey = true;
+    }
+
+    int variableCount = current->variableCount;
+    beginScope();
+
+    Node *node = newNode(evalCase);
+    node->as.dispatch.key = compileExpression(CADR(list), false);
+    node->as.dispatch.slot = needsKey ? slotOf(addVariable(NULL)) : -1;
+    node->as.dispatch.table = newSwitch();
+    writeValueArray(&constants, OBJ_VAL(node->as.dispatch.table));
+
+    // The last clause is run when no key matches and there is no else.
+    Node **nodes = newNodes(count + 1);
+    nodes[count] = constantNode(NIL_VAL);
+    node->as.dispatch.table->defaultOffset = count;
+    node->as.dispatch.clauses = nodes;
+
+    int i = 0;
+    for (Value clause = clauses; IS_PAIR(clause); clause = CDR(clause), i++) {
+        Value clauseList = unwrap(CAR(clause));
+        if (isKeyword(CAR(clauseList), "else")) {
+            node->as.dispatch.table->defaultOffset = i;
+        } else {
+            for (Value datum = unwrap(CAR(clauseList)); IS_PAIR(datum);
+                 datum = CDR(datum)) {
+                Value key = syntaxToDatum(CAR(datum));
+                if (isSwitchKey(key)) {
+                    switchAddCase(node->as.dispatch.table, key, i);
+                }
+            }
+        }
+
+        if (isKeyword(CADR(clauseList), "=>")) {
+            if (3 != properListLength(clauseList)) {
+                error("Expect one expression after =>.");
+            }
+            nodes[i] = compileArrowCall(CADDR(clauseList),
+                                        node->as.dispatch.slot, isTail);
+        } else {
+            nodes[i] = compileSequence(CDR(clauseList), isTail);
+        }
+    }
+
+    switchMakeDense(node->as.dispatch.table);
+    endScope(variableCount);
+    return node;
+}
+
+static Node *compileCondClauses(Value clauses, bool isTail) {
+    if (!IS_PAIR(clauses)) return constantNode(NIL_VAL);
+
+    Value list = unwrap(CAR(clauses));
+    int length = properListLength(list);
+    if (length < 1) return error("Expect a cond clause.");
+
+    if (isKeyword(CAR(list), "else")) {
+        if (IS_PAIR(CDR(clauses))) {
+            error("The else clause must be the last clause.");
+        }
+        return compileSequence(CDR(list), isTail);
+    }
+
+    // (test): the value of the test is the value of the cond.
+    if (1 == length) {
+        Node **nodes = newNodes(2);
+        nodes[0] = compileExpression(CAR(list), false);
+        nodes[1] = compileCondClauses(CDR(clauses), isTail);
+        Node *node = newNode(evalOr);
+        node->as.sequence.nodes = nodes;
+        node->as.sequence.count = 2;
+        return node;
+    }
+
+    // (test => procedure): the procedure is called with the test's value.
+    if (isKeyword(CADR(list), "=>")) {
+        if (3 != length) error("Expect one expression after =>.");
+
+        int variableCount = current->variableCount;
+        beginScope();
+        Node *node = newNode(evalArrow);
+        node->as.arrow.slot = slotOf(addVariable(NULL));
+        node->as.arrow.test = compileExpression(CAR(list), false);
+        node->as.arrow.call =
+            compileArrowCall(CADDR(list), node->as.arrow.slot, isTail);
+        node->as.arrow.alternative = compileCondClauses(CDR(clauses), isTail);
+        endScope(variableCount);
+        return node;
+    }
+
+    Node *test = compileExpression(CAR(list), false);
+    Node *consequent = compileSequence(CDR(list), isTail);
+    return ifNode(test, consequent, compileCondClauses(CDR(clauses), isTail));
+}
+
+static Node *compileCond(ObjSyntax *form, bool isTail) {
+    Value clauses = CDR(form->value);
+    if (properListLength(clauses) < 0) {
+        return error("Expect a list of cond clauses.");
+    }
+    return compileCondClauses(clauses, isTail);
+}
+
+static SpecialForm const specialForms[] = {
+    {"quote", compileQuote},   {"if", compileIf},
+    {"define", compileDefine}, {"set!", compileSet},
+    {"lambda", compileLambdaForm}, {"begin", compileBegin},
+    {"let", compileLet},       {"let*", compileLetStar},
+    {"letrec", compileLetrec}, {"letrec*", compileLetrec},
+    {"do", compileDo},         {"and", compileAnd},
+    {"or", compileOr},         {"when", compileWhen},
+    {"unless", compileUnless}, {"case", compileCase},
+    {"cond", compileCond},     {"case-lambda", compileCaseLambda},
+};
+
+#define PRIMITIVE(name, evaluator, isComparison)                     \
+    {name, eval##evaluator, eval##evaluator##Number,                 \
+     eval##evaluator##LocalNumber, isComparison}
+
+static Primitive const primitives[] = {
+    PRIMITIVE("+", Add, false),         PRIMITIVE("-", Subtract, false),
+    PRIMITIVE("*", Multiply, false),    PRIMITIVE("/", Divide, false),
+    PRIMITIVE("=", NumberEqual, true),  PRIMITIVE("<", Less, true),
+    PRIMITIVE("<=", LessEqual, true),   PRIMITIVE(">", Greater, true),
+    PRIMITIVE(">=", GreaterEqual, true),
+};
+
+#undef PRIMITIVE
+
+// Returns the node of primitive applied to left and right.
+static Node *binaryNode(Primitive const *primitive, Node *left, Node *right) {
+    Node *node = newNode(primitive->eval);
+    node->as.binary.left = left;
+    node->as.binary.right = right;
+
+    if (evalConstant == right->eval && IS_NUMBER(right->as.constant)) {
+        node->eval = primitive->evalNumber;
+        node->as.binary.number = AS_NUMBER(right->as.constant);
+        if (evalLocal == left->eval) {
+            node->eval = primitive->evalLocalNumber;
+            node->as.binary.slot = left->as.variable.slot;
+        }
+    }
+    return node;
+}
+
+/*
+  Compiles a call of a primitive into its node. Returns NULL if the call
+  can't be compiled that way, so it must be a normal call.
+*/
+static Node *compilePrimitive(Primitive const *primitive, Value operands,
+                              int count) {
+    if (primitive->isComparison) {
+        if (2 != count) return NULL;
+        Node *left = compileExpression(CAR(operands), false);
+        return binaryNode(primitive, left,
+                          compileExpression(CADR(operands), false));
+    }
+
+    bool isAdd = evalAdd == primitive->eval;
+    bool isMultiply = evalMultiply == primitive->eval;
+    switch (count) {
+        case 0:
+            // (+) and (*) are the identities of their operations.
+            if (isAdd) return constantNode(NUMBER_VAL(0));
+            if (isMultiply) return constantNode(NUMBER_VAL(1));
+            return NULL;
+        case 1: {
+            // (- x) negates x and (/ x) is its reciprocal.
+            Node *operand = compileExpression(CAR(operands), false);
+            if (isAdd || isMultiply) return operand;
+            double identity = evalSubtract == primitive->eval ? 0 : 1;
+            return binaryNode(primitive, constantNode(NUMBER_VAL(identity)),
+                              operand);
+        }
+        default: {
+            Node *node = compileExpression(CAR(operands), false);
+            for (operands = CDR(operands); IS_PAIR(operands);
+                 operands = CDR(operands)) {
+                node = binaryNode(primitive, node,
+                                  compileExpression(CAR(operands), false));
+            }
+            return node;
+        }
+    }
+}
+
+static Node *compileCall(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    int argCount = properListLength(list) - 1;
+    if (argCount < 0) {
+        return error("Expect a proper list for a procedure call.");
+    }
+    if (argCount > UINT16_MAX) {
+        return error("Can't have more than 65535 arguments.");
+    }
+
+    Node *callee = compileExpression(CAR(list), false);
+    Node **arguments = newNodes(argCount);
+    Value argument = CDR(list);
+    for (int i = 0; i < argCount; i++, argument = CDR(argument)) {
+        arguments[i] = compileExpression(CAR(argument), false);
+    }
+    return callNode(callee, arguments, argCount, isTail);
+}
+
+// Compiles a list, which is either a special form or a procedure call.
+static Node *compileCombination(ObjSyntax *form, bool isTail) {
+    ObjSymbol *operator = asSymbol(CAR(form->value));
+
+    if (NULL != operator && !isLexicallyBound(operator)) {
+        for (size_t i = 0; i < sizeof(specialForms) / sizeof(*specialForms);
+             i++) {
+            if (textOfSymbolEqualToString(operator, specialForms[i].name)) {
+                return specialForms[i].compile(form, isTail);
+            }
+        }
+
+        // A program which defines or sets a primitive calls its own.
+        int count = properListLength(form->value) - 1;
+        for (size_t i = 0; i < sizeof(primitives) / sizeof(*primitives) &&
+                           !operator->isAssigned;
+             i++) {
+            if (textOfSymbolEqualToString(operator, primitives[i].name)) {
+                Node *node =
+                    compilePrimitive(&primitives[i], CDR(form->value), count);
+                if (NULL != node) return node;
+                break;
+            }
+        }
+    }
+
+    return compileCall(form, isTail);
+}
+
+/*
+  Compiles the expression syntax into a node. isTail is true if nothing is
+  left to do in the enclosing lambda once the expression is evaluated.
+*/
+static Node *compileExpression(Value syntax, bool isTail) {
+    ObjSyntax *enclosing = current->syntax;
+    current->syntax = AS_SYNTAX(syntax);
+
+    Node *node = NULL;
+    Value value = current->syntax->value;
+    if (IS_SYMBOL(value)) {
+        node = compileVariable(AS_SYMBOL(value));
+    } else if (IS_PAIR(value)) {
+        node = compileCombination(current->syntax, isTail);
+    } else if (IS_NIL(value)) {
+        node = error("Expect an expression, but got an empty combination.");
+    } else {
+        node = constantNode(syntaxToDatum(syntax));
+    }
+
+    current->syntax = enclosing;
+    return node;
+}
+
+// Compiles a top level form into a lambda without parameters.
+static Lambda *compileForm(Value form) {
+    LambdaCompiler compiler;
+    beginLambda(&compiler, NULL);
+    compiler.scopeDepth = 0;
+    compiler.lambda->body = compileExpression(form, false);
+    return endLambda();
+}
+
+// Runs each of the compiled top level forms in order.
+static void runForms(Lambda *const *forms, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Value *base = vm.stackTop;
+        push(OBJ_VAL(newProcedure(forms[i], NULL, NULL)));
+        apply(NULL, base, 0);
+    }
+}
+
+static InterpretResult run(Lambda *const *forms, size_t count) {
+    size_t height = vm.stackTop - vm.stack;
+    reserveStack(height + VALUES_MAX);
+    stackLimit = vm.stack + height + VALUES_MAX;
+    isRunning = true;
+    vm.hadError = false;
+
+    if (setjmp(errorJump)) {
+        vm.stackTop = vm.stack + height;
+        depth = 0;
+        tailCall = false;
+        isRunning = false;
+        nativeCaller = NULL;
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    runForms(forms, count);
+    isRunning = false;
+    return INTERPRET_OK;
+}
+
+Parameters const *procedureParameters(ObjProcedure const *procedure) {
+    return &procedure->lambda->parameters;
+}
+
+InterpretResult callWithClosures(int argCount) {
+    bool const WAS_RUNNING = isRunning;
+    if (!WAS_RUNNING) {
+        size_t height = vm.stackTop - vm.stack;
+        reserveStack(height + VALUES_MAX);
+        stackLimit = vm.stack + height + VALUES_MAX;
+        isRunning = true;
+    }
+
+    Value *base = vm.stackTop - argCount - 1;
+    Frame *caller = nativeCaller;
+    int const DEPTH = depth;
+    jmp_buf enclosingJump;
+    memcpy(enclosingJump, errorJump, sizeof(jmp_buf));
+
+    if (setjmp(errorJump)) {
+        memcpy(errorJump, enclosingJump, sizeof(jmp_buf));
+        vm.stackTop = base;
+        depth = DEPTH;
+        tailCall = false;
+        isRunning = WAS_RUNNING;
+        nativeCaller = caller;
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    Value result = apply(caller, base, argCount);
+    memcpy(errorJump, enclosingJump, sizeof(jmp_buf));
+    isRunning = WAS_RUNNING;
+    push(result);
+    return INTERPRET_OK;
+}
+
+void initClosureEngine(void) {
+    blocks = NULL;
+    initValueArray(&constants);
+    checkpointBlock = NULL;
+    checkpointUsed = 0;
+    checkpointConstants = 0;
+}
+
+void freeClosureEngine(void) {
+    while (NULL != blocks) {
+        Block *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+    freeValueArray(&constants);
+}
+
+InterpretResult interpretWithClosures(char const *source) {
+    initScanner(source);
+    initParser();
+
+    ObjSyntaxPointerArray ast = parseAllTokens();
+    if (parser.hadError) {
+        freeAST(&ast);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    size_t count = getSmartArrayCount(&ast);
+    Lambda **forms = allocateInBlock(sizeof(Lambda *) * (count + 1));
+    for (size_t i = 0; i < count; i++) {
+        noteAssignedGlobals(OBJ_VAL(SMART_ARRAY_AT(&ast, i, ObjSyntax *)));
+    }
+    for (size_t i = 0; i < count; i++) {
+        Value form = optimize(OBJ_VAL(SMART_ARRAY_AT(&ast, i, ObjSyntax *)));
+        forms[i] = compileForm(form);
+
+        // Report the first error in every top level form.
+        parser.panicMode = false;
+    }
+
+    // Freeing the AST runs the garbage collector, which keeps the
+    // constants of the nodes.
+    freeAST(&ast);
+
+    if (parser.hadError) return INTERPRET_COMPILE_ERROR;
+    return run(forms, count);
+}
+
+void checkpointClosureEngine(void) {
+    checkpointBlock = blocks;
+    checkpointUsed = NULL == blocks ? 0 : blocks->used;
+    checkpointConstants = getValueArrayCount(&constants);
+}
+
+void restoreClosureEngine(void) {
+    while (checkpointBlock != blocks) {
+        Block *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+    if (NULL != blocks) blocks->used = checkpointUsed;
+    smartArrayTruncate(&constants, checkpointConstants);
+}
+
+void markClosureEngineRoots(void) {
+    for (size_t i = 0; i < getValueArrayCount(&constants); i++) {
+        markValue(getValueArrayAt(&constants, i));
+    }
+}
@@ -0,0 +1,71 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "vm.h"
+
+/*
+  The closure engine runs programs without bytecode. Each expression is
+  compiled into a node, which is a C function bound to the nodes of its
+  subexpressions and to the slots of the variables it uses, so running a
+  node is a chain of direct calls instead of a dispatch loop.
+*/
+
+// Settings of the closure engine, which are set by command line flags.
+typedef struct {
+    bool enabled;  // interpret() runs programs with the closure engine.
+} ClosureOptions;
+
+extern ClosureOptions closureOptions;
+
+// The compiled code of a lambda. Its layout is private.
+typedef struct Lambda Lambda;
+
+void initClosureEngine(void);
+
+// Frees every lambda and node that the closure engine compiled.
+void freeClosureEngine(void);
+
+// Compiles source into nodes and runs it with the closure engine.
+InterpretResult interpretWithClosures(char const *source);
+
+/*
+  Calls the procedure under the argCount values on top of the stack, which
+  it replaces with the result, as callProcedure() does for closures. A
+  native may call it while the closure engine is running it.
+*/
+InterpretResult callWithClosures(int argCount);
+
+// Returns the parameters of the lambda of procedure.
+Parameters const *procedureParameters(ObjProcedure const *procedure);
+
+// Remembers what has been compiled, for restoreClosureEngine().
+void checkpointClosureEngine(void);
+
+/*
+  Frees the lambdas and nodes compiled since checkpointClosureEngine(),
+  and forgets their constants.
+*/
+void restoreClosureEngine(void);
+
+// Marks the constants of the compiled nodes.
+void markClosureEngineRoots(void);
@@ -53,7 +53,15 @@
 // If defined, the VM will print the stack whenever the stack is changed.
 // #define DEBUG_STACK
 
+/*
+  If defined, run() and the register VM count the instructions they run,
+  which --stats prints. Counting slows down dispatch, so it is off unless
+  the benchmarks ask for it.
+*/
+// #define COUNT_INSTRUCTIONS
+
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #define ERROR(...)                                                     \
     do {                                                               \
@@ -19,6 +19,7 @@
 
 #include "compiler.h"
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,9 +29,14 @@
 #include "common.h"
 #include "memory.h"
 #include "object.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "peephole.h"
 #include "scanner.h"
+#include "smart_array.h"
+#include "table.h"
 #include "value.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -39,50 +45,155 @@
 #define UNINITIALIZED_LOCAL -1
 
 typedef struct {
-    Token name;
+    ObjSymbol *name;  // NULL while the local's initializer is compiled.
     int depth;
+    int slot;  // Index of the local's value in its call frame.
     bool isCaptured;
 } Local;
 
 typedef struct {
-    uint8_t index;
+    uint16_t index;
     bool isLocal;
+    ObjSymbol *name;  // The variable captured, kept for lazy bodies.
 } Upvalue;
 
 typedef enum {
     TYPE_FUNCTION,
-    TYPE_INITIALIZER,
-    TYPE_METHOD,
     TYPE_SCRIPT,
 } FunctionType;
 
+/*
+  The constants of the chunk being compiled, hashed by value, so that each
+  is only added once. Literals are immutable, so equal strings, lists and
+  vectors share one constant too, however often they are quoted.
+*/
+typedef struct {
+    int count;
+    int capacity;
+    int *indexes;  // Indexes into the chunk's constants, -1 when empty.
+} ConstantTable;
+
+/*
+  A named let or do loop which is being compiled into a backward jump
+  inside of the current function, instead of into a procedure.
+*/
+typedef struct Loop {
+    struct Loop *enclosing;
+    ObjSymbol *name;    // The name of a named let, NULL for a do loop.
+    int start;          // Offset of the first instruction of the body.
+    int firstSlot;      // Slot of the first loop variable.
+    int firstLocal;     // Index of the first loop variable in locals.
+    int variableCount;  // Number of loop variables.
+    bool isTail;        // True if the loop itself is in tail position.
+
+    // Set when the loop's name is used in a way that needs a real
+    // procedure, like a call that isn't in tail position.
+    bool failed;
+} Loop;
+
 typedef struct Compiler {
     struct Compiler *enclosing;
     ObjFunction *function;
     FunctionType type;
 
-    Local locals[UINT8_COUNT];
+    Local *locals;
     int localCount;
-    Upvalue upvalues[UINT8_COUNT];
+    int localCapacity;
+    Upvalue *upvalues;
+    int upvalueCapacity;
     int scopeDepth;
 
-    Value ast;
+    // The number of values the function has on the stack at the current
+    // point of the code, including its locals and temporaries.
+    int stackDepth;
+
+    ConstantTable constants;
+
+    Loop *loop;          // The innermost loop being compiled, or NULL.
+    ObjSyntax *syntax;  // The expression being compiled.
+
+    // The lazy body being compiled, if the function's enclosing functions
+    // were compiled before it. Its upvalues are found by name in it.
+    LazyBody *lazyBody;
+
+    // Whether forward jumps are emitted with OP_WIDE, and whether one
+    // without it couldn't reach its target, so the code must be compiled
+    // again with it.
+    bool wideJumps;
+    bool jumpOverflowed;
 } Compiler;
 
-typedef struct ClassCompiler {
-    struct ClassCompiler *enclosing;
-    bool hasSuperclass;
-} ClassCompiler;
+// Compiles a special form. syntax is the whole form.
+typedef void (*SpecialFormFn)(ObjSyntax *syntax, bool isTail);
+
+typedef struct {
+    char const *name;
+    SpecialFormFn compile;
+} SpecialForm;
+
+// An arithmetic or comparison procedure which compiles to an instruction.
+typedef struct {
+    char const *name;
+    OpCode op;
+    bool isComparison;
+} Primitive;
+
+_Thread_local Compiler *current = NULL;
 
-Compiler *current = NULL;
-ClassCompiler *currentClass = NULL;
+_Thread_local Chunk *compilingChunk;
 
-Chunk *compilingChunk;
+CompilerOptions compilerOptions = {.lazy = true};
+
+/*
+  The text of the script being compiled, and the copy of it which the
+  lazy bodies made from it point into, since the text itself is freed
+  once it has run.
+*/
+static _Thread_local struct {
+    char const *start;  // NULL while compiling a lazy body.
+    size_t length;
+    ObjString *copy;  // NULL until a lazy body needs it.
+} sourceText;
+
+static int addLocal(void);
+static void compileExpression(Value syntax, bool isTail);
+static void compileBody(ObjSyntax *form, Value body, bool isTail);
+static void compileLambda(ObjSymbol *name, ObjSyntax *form, Value parameters,
+                          Value body);
 
 static Chunk *currentChunk(void) { return &current->function->chunk; }
 
+static void compileError(ObjSyntax const *syntax, char const *format, ...) {
+    if (parser.panicMode) return;
+    parser.panicMode = true;
+
+    // Only show the first line of the offending code.
+    char const *start = syntax->location.start;
+    size_t length = syntax->location.length;
+    char const *newline = memchr(start, '\n', length);
+    if (NULL != newline) length = newline - start;
+
+    fprintf(stderr, "[line %zu] Error at '%.*s': ", syntax->location.line,
+            (int)length, start);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    parser.hadError = true;
+}
+
+// Report an error at the expression currently being compiled.
+static void error(char const *message) {
+    compileError(current->syntax, "%s", message);
+}
+
 static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, tokenGetLine(&(parser.previous)));
+    unsigned int line =
+        NULL == current->syntax ? 0 : current->syntax->location.line;
+    writeChunk(currentChunk(), byte, line);
 }
 
 static void emit2Bytes(uint8_t byte1, uint8_t byte2) {
@@ -90,36 +201,244 @@ static void emit2Bytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte2);
 }
 
-/*
-static void emitLoop(int loopStart) {
-  emitByte(OP_LOOP);
+static void emitShort(int operand) {
+    emit2Bytes((operand >> 8) & 0xff, operand & 0xff);
+}
 
-  int offset = currentChunk()->count - loopStart + 2;
-  if (offset > UINT16_MAX) error("Loop body to large.");
+static void emitInt(uint32_t operand) {
+    emitShort((int)(operand >> 16));
+    emitShort((int)(operand & 0xffff));
+}
 
-  emitByte((offset >> 8) & 0xff);
-  emitByte(offset & 0xff);
+/*
+  Emits an instruction with a single operand, prefixed with OP_WIDE if the
+  operand doesn't fit in a byte.
+*/
+static void emitWithOperand(uint8_t instruction, int operand) {
+    if (operand <= UINT8_MAX) {
+        emit2Bytes(instruction, (uint8_t)operand);
+    } else {
+        emit2Bytes(OP_WIDE, instruction);
+        emitShort(operand);
+    }
 }
+
+/*
+  Emits a call with argCount arguments, and gives it an inline cache. Calls
+  with too many arguments, or once the caches run out, go without, and
+  are always generic. Otherwise the call is instruction, which is OP_CALL
+  or one of the calls it is quickened into.
 */
+static void emitCall(int argCount, OpCode instruction) {
+    int cache = current->function->callSiteCount;
+    if (argCount > UINT8_MAX || cache > UINT16_MAX) {
+        emit2Bytes(OP_WIDE, OP_CALL);
+        emitShort(argCount);
+        emitInt(0);
+        return;
+    }
+
+    current->function->callSiteCount++;
+    emit2Bytes(instruction, (uint8_t)argCount);
+    emitShort(cache);
+}
+
+// Emits an OP_CLOSE_SCOPE which keeps keep values in place of slot and up.
+static void emitCloseScope(int slot, int keep) {
+    if (slot <= UINT8_MAX && keep <= UINT8_MAX) {
+        emitByte(OP_CLOSE_SCOPE);
+        emit2Bytes((uint8_t)slot, (uint8_t)keep);
+    } else {
+        emit2Bytes(OP_WIDE, OP_CLOSE_SCOPE);
+        emitShort(slot);
+        emitShort(keep);
+    }
+}
+
+static void emitLoop(int loopStart) {
+    int offset = getChunkCount(currentChunk()) - loopStart + 3;
+    if (offset <= UINT16_MAX) {
+        emitByte(OP_LOOP);
+        emitShort(offset);
+    } else {
+        emit2Bytes(OP_WIDE, OP_LOOP);
+        emitInt((uint32_t)offset + 3);
+    }
+}
 
 static int emitJump(uint8_t instruction) {
+    if (current->wideJumps) {
+        emit2Bytes(OP_WIDE, instruction);
+        emitInt(UINT32_MAX);
+        return getChunkCount(currentChunk()) - 4;
+    }
+
     emitByte(instruction);
-    emitByte(0xff);
-    emitByte(0xff);
+    emitShort(UINT16_MAX);
     return getChunkCount(currentChunk()) - 2;
 }
 
-static void emitReturn(void) {
-    if (current->type == TYPE_INITIALIZER) {
-        emit2Bytes(OP_GET_LOCAL, 0);
-    } else {
-        emitByte(OP_NIL);
+// Record that the stack is depth values high after the code emitted so far.
+static void setStackDepth(int depth) {
+    current->stackDepth = depth;
+    if (depth > current->function->maxStack) {
+        current->function->maxStack = depth;
     }
+}
+
+// Record that the code emitted since the last call changed the height of
+// the stack by delta values.
+static void adjustStack(int delta) {
+    setStackDepth(current->stackDepth + delta);
+}
+
+static void emitReturn(void) {
+    emitByte(OP_NIL);
+    adjustStack(1);
     emitByte(OP_RETURN);
 }
 
+// Emit an instruction which pushes exactly one value, with no operands.
+static void emitPush(uint8_t instruction) {
+    emitByte(instruction);
+    adjustStack(1);
+}
+
+static void emitPop(void) {
+    emitByte(OP_POP);
+    adjustStack(-1);
+}
+
+// Returns a hash of value which is the same for constants which are equal.
+static uint32_t hashConstant(Value value) {
+    uint32_t hash = 2166136261u;
+    for (;;) {
+        uint32_t part;
+        if (IS_NUMBER(value)) {
+            double number = AS_NUMBER(value);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            part = (uint32_t)(bits ^ (bits >> 32));
+        } else if (IS_CHARACTER(value)) {
+            part = (unsigned char)AS_CHARACTER(value);
+        } else if (IS_BOOL(value)) {
+            part = AS_BOOL(value) ? 1 : 2;
+        } else if (!IS_OBJ(value)) {
+            part = 3;
+        } else if (IS_STRING(value) || IS_SYMBOL(value)) {
+            part = AS_STRING(value)->hash;
+        } else if (IS_VECTOR(value)) {
+            ValueArray *elements = &(AS_VECTOR(value)->array);
+            part = (uint32_t)getValueArrayCount(elements);
+            for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+                part = part * 31 + hashConstant(getValueArrayAt(elements, i));
+            }
+        } else if (IS_PAIR(value)) {
+            // Walk down the list instead of recursing on long ones.
+            hash = (hash ^ hashConstant(CAR(value))) * 16777619;
+            value = CDR(value);
+            continue;
+        } else {
+            part = (uint32_t)((uintptr_t)AS_OBJ(value) >> 3);
+        }
+        return (hash ^ part) * 16777619;
+    }
+}
+
+/*
+  Returns true if a and b can share a constant: they are eqv?, or they
+  are strings, lists or vectors with equal contents.
+*/
+static bool constantsEqual(Value a, Value b) {
+    for (;;) {
+        if (IS_NUMBER(a) || IS_NUMBER(b)) {
+            // Unlike =, eqv? tells 0.0 and -0.0 apart.
+            if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+            double x = AS_NUMBER(a);
+            double y = AS_NUMBER(b);
+            return 0 == memcmp(&x, &y, sizeof(double));
+        }
+        if (!IS_OBJ(a) || !IS_OBJ(b)) return valuesEqual(a, b);
+        if (AS_OBJ(a) == AS_OBJ(b)) return true;
+        if (OBJ_TYPE(a) != OBJ_TYPE(b)) return false;
+
+        switch (OBJ_TYPE(a)) {
+            case OBJ_STRING:
+                return AS_STRING(a)->length == AS_STRING(b)->length &&
+                       0 == memcmp(AS_STRING(a)->chars, AS_STRING(b)->chars,
+                                   AS_STRING(a)->length);
+            case OBJ_VECTOR: {
+                ValueArray *x = &(AS_VECTOR(a)->array);
+                ValueArray *y = &(AS_VECTOR(b)->array);
+                if (getValueArrayCount(x) != getValueArrayCount(y)) {
+                    return false;
+                }
+                for (size_t i = 0; i < getValueArrayCount(x); i++) {
+                    if (!constantsEqual(getValueArrayAt(x, i),
+                                        getValueArrayAt(y, i))) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case OBJ_PAIR:
+                if (!constantsEqual(CAR(a), CAR(b))) return false;
+                a = CDR(a);
+                b = CDR(b);
+                break;
+            default:
+                return false;
+        }
+    }
+}
+
+/*
+  Returns the slot of constants where value's index is, or the empty
+  slot where it belongs.
+*/
+static int *findConstant(int *indexes, int capacity, Value value) {
+    ValueArray *constants = &(currentChunk()->constants);
+    uint32_t index = hashConstant(value) & (capacity - 1);
+    for (;;) {
+        int *slot = &indexes[index];
+        if (-1 == *slot ||
+            constantsEqual(getValueArrayAt(constants, *slot), value)) {
+            return slot;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void growConstantTable(ConstantTable *table) {
+    int capacity = GROW_CAPACITY(table->capacity);
+    int *indexes = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++) indexes[i] = -1;
+
+    ValueArray *constants = &(currentChunk()->constants);
+    for (int i = 0; i < table->capacity; i++) {
+        if (-1 == table->indexes[i]) continue;
+        Value value = getValueArrayAt(constants, table->indexes[i]);
+        *findConstant(indexes, capacity, value) = table->indexes[i];
+    }
+
+    FREE_ARRAY(int, table->indexes, table->capacity);
+    table->indexes = indexes;
+    table->capacity = capacity;
+}
+
+// Returns the index of value in the chunk's constants, adding it if needed.
 static int makeConstant(Value value) {
-    return addConstant(currentChunk(), value);
+    ConstantTable *table = &current->constants;
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+        growConstantTable(table);
+    }
+
+    int *slot = findConstant(table->indexes, table->capacity, value);
+    if (-1 == *slot) {
+        *slot = addConstant(currentChunk(), value);
+        table->count++;
+    }
+    return *slot;
 }
 
 static void emitConstant(Value value) {
@@ -127,69 +446,136 @@ static void emitConstant(Value value) {
 #define READ_BYTE(number, n) ((number >> (8 * n)) & 0xFF)
 
     int constantIndex = makeConstant(value);
-    if (constantIndex < UINT8_MAX) {
+    if (constantIndex <= UINT8_MAX) {
         emit2Bytes(OP_CONSTANT, (uint8_t)constantIndex);
     } else if (constantIndex < OP_CONSTANT_LONG_MAX_INDEX) {
         emitByte(OP_CONSTANT_LONG);
-        emitByte(READ_BYTE(constantIndex, 1));
         emitByte(READ_BYTE(constantIndex, 2));
-        emitByte(READ_BYTE(constantIndex, 3));
+        emitByte(READ_BYTE(constantIndex, 1));
+        emitByte(READ_BYTE(constantIndex, 0));
     } else {
-        emit2Bytes(OP_CONSTANT, 0);
+        error("Too many constants in one chunk.");
     }
+    adjustStack(1);
 
 #undef OP_CONSTANT_LONG_MAX_INDEX
 #undef READ_BYTE
 }
 
-/*
 static void patchJump(int offset) {
+    if (current->wideJumps) {
+        uint32_t jump = getChunkCount(currentChunk()) - offset - 4;
+        for (int i = 0; i < 4; i++) {
+            uint8_t byte = (jump >> (24 - 8 * i)) & 0xff;
+            setChunkAt(currentChunk(), offset + i, byte);
+        }
+        return;
+    }
+
     // -2 to adjust for the bytecode for the jump offset itself
-    int jump = currentChunk()->count - offset - 2;
+    int jump = getChunkCount(currentChunk()) - offset - 2;
 
-    if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");
-    }
+    // The code is compiled again with wide jumps.
+    if (jump > UINT16_MAX) current->jumpOverflowed = true;
+
+    setChunkAt(currentChunk(), offset, (jump >> 8) & 0xff);
+    setChunkAt(currentChunk(), offset + 1, jump & 0xff);
+}
 
-    currentChunk()->code[offset] = (jump >> 8) & 0xff;
-    currentChunk()->code[offset + 1] = jump & 0xff;
+// The point before some code which may need to be compiled again.
+typedef struct {
+    size_t start;
+    int callSiteCount;
+    int localCount;
+    int stackDepth;
+    int scopeDepth;
+} CodeMark;
+
+// Marks the current point of the code, which starts with narrow jumps.
+static CodeMark markCode(void) {
+    current->wideJumps = false;
+    current->jumpOverflowed = false;
+    return (CodeMark){.start = getChunkCount(currentChunk()),
+                      .callSiteCount = current->function->callSiteCount,
+                      .localCount = current->localCount,
+                      .stackDepth = current->stackDepth,
+                      .scopeDepth = current->scopeDepth};
 }
+
+/*
+  Returns true if a forward jump in the code since mark couldn't reach its
+  target, after throwing the code away so that it can be compiled again
+  with wide jumps.
 */
+static bool needsWideJumps(CodeMark const *mark) {
+    if (!current->jumpOverflowed || current->wideJumps || parser.hadError) {
+        return false;
+    }
+
+    truncateChunk(currentChunk(), mark->start);
+    current->function->callSiteCount = mark->callSiteCount;
+    current->localCount = mark->localCount;
+    current->stackDepth = mark->stackDepth;
+    current->scopeDepth = mark->scopeDepth;
+    current->wideJumps = true;
+    return true;
+}
 
-static void initCompiler(Compiler *compiler, FunctionType type, Value ast) {
+// Starts compiling the code of function, which must have no code yet.
+static void beginFunction(Compiler *compiler, FunctionType type,
+                          ObjFunction *function) {
     compiler->enclosing = current;
-    compiler->function = NULL;
+    compiler->function = function;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
-    compiler->function = newFunction();
+    compiler->constants =
+        (ConstantTable){.count = 0, .capacity = 0, .indexes = NULL};
+    compiler->loop = NULL;
+    compiler->syntax = NULL == current ? NULL : current->syntax;
+    compiler->lazyBody = NULL;
+    compiler->wideJumps = false;
+    compiler->jumpOverflowed = false;
     current = compiler;
-    if (type != TYPE_SCRIPT) {
-        current->function->name =
-            copyString(tokenGetStart(&(parser.previous)),
-                       tokenGetLength(&(parser.previous)));
-    }
 
-    Local *local = &current->locals[current->localCount++];
-    local->depth = 0;
-    local->isCaptured = false;
-    if (type != TYPE_FUNCTION) {
-        local->name.location.start = "this";
-        local->name.location.length = 4;
-    } else {
-        local->name.location.start = "";
-        local->name.location.length = 0;
-    }
+    // Slot zero holds the closure being called.
+    compiler->stackDepth = 0;
+    function->maxStack = 0;
+    addLocal();
+    setStackDepth(1);
+}
 
-    compiler->ast = ast;
+static void initCompiler(Compiler *compiler, FunctionType type,
+                         ObjSymbol *name) {
+    ObjFunction *function = newFunction();
+    function->name = name;
+    beginFunction(compiler, type, function);
 }
 
 static ObjFunction *endCompiler(void) {
-    emitReturn();
     ObjFunction *function = current->function;
+    // The upvalues are freed once the closure is emitted, in compileLambda.
+    FREE_ARRAY(Local, current->locals, current->localCapacity);
+    FREE_ARRAY(int, current->constants.indexes, current->constants.capacity);
+
+    if (optimizerOptions.level > 0 && !parser.hadError) {
+        optimizeChunk(currentChunk());
+    }
+
+    if (function->callSiteCount > 0) {
+        function->callCaches = ALLOCATE(CallCache, function->callSiteCount);
+        for (int i = 0; i < function->callSiteCount; i++) {
+            function->callCaches[i] = (CallCache){.function = NULL,
+                                                  .code = NULL};
+        }
+    }
 
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
+    if (!parser.hadError && NULL == function->lazyBody) {
         disassembleChunk(currentChunk(), function->name != NULL
                                              ? function->name->chars
                                              : "<script>");
@@ -202,380 +588,1693 @@ static ObjFunction *endCompiler(void) {
 
 static void beginScope(void) { current->scopeDepth++; }
 
+/*
+  Ends the innermost scope of an expression whose value is on top of the
+  stack, so that the value is left in place of the scope's locals.
+*/
 static void endScope(void) {
     current->scopeDepth--;
+
+    int firstSlot = -1;
     while (current->localCount > 0 &&
            current->locals[current->localCount - 1].depth >
                current->scopeDepth) {
-        if (current->locals[current->localCount - 1].isCaptured) {
-            emitByte(OP_CLOSE_UPVALUE);
-        } else {
-            emitByte(OP_POP);
-        }
+        firstSlot = current->locals[current->localCount - 1].slot;
         current->localCount--;
     }
+
+    if (-1 == firstSlot) return;
+
+    emitCloseScope(firstSlot, 1);
+    setStackDepth(firstSlot + 1);
 }
-/*
 
-static uint8_t argumentList() {
-  uint8_t argCount = 0;
-  if (!check(TOKEN_RIGHT_PAREN)) {
-    do {
-      expression();
-      if (argCount == 255) {
-        error("Can't have more than 255 arguments.");
-      }
-      argCount++;
-    } while (parserMatch(TOKEN_COMMA));
-  }
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
-  return argCount;
+// Returns the value wrapped by syntax, or syntax itself if it isn't wrapped.
+static Value unwrap(Value syntax) {
+    return IS_SYNTAX(syntax) ? AS_SYNTAX(syntax)->value : syntax;
+}
+
+// Returns the symbol that syntax stands for, or NULL if it isn't a symbol.
+static ObjSymbol *asSymbol(Value syntax) {
+    Value value = unwrap(syntax);
+    return IS_SYMBOL(value) ? AS_SYMBOL(value) : NULL;
+}
+
+// Returns the number of elements in list, or -1 if it isn't a proper list.
+static int properListLength(Value list) {
+    int length = 0;
+    for (; IS_PAIR(list); list = CDR(list)) length++;
+    return IS_NIL(list) ? length : -1;
 }
 
-static void call(bool canAssign) {
-  uint8_t argCount = argumentList();
-  emit2Bytes(OP_CALL, argCount);
+// Returns the nth element of list, which must have more than n elements.
+static Value listRef(Value list, int n) {
+    for (; n > 0; n--) list = CDR(list);
+    return CAR(list);
 }
 
-static uint8_t identifierConstant(Token *name) {
-  return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+/*
+  Strips the syntax objects from syntax, returning the plain datum
+  which it represents.
+*/
+static Value syntaxToDatum(Value syntax) {
+    Value value = unwrap(syntax);
+
+    if (IS_PAIR(value)) {
+        return OBJ_VAL(
+            newPair(syntaxToDatum(CAR(value)), syntaxToDatum(CDR(value))));
+    }
+
+    if (IS_VECTOR(value)) {
+        ObjVector *vector = newVector();
+        ValueArray *elements = &(AS_VECTOR(value)->array);
+        for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+            vectorAppend(vector, syntaxToDatum(getValueArrayAt(elements, i)));
+        }
+        return OBJ_VAL(vector);
+    }
+
+    return value;
 }
 
-static void literal(bool canAssign) {
-  switch (parser.previous->type) {
-    case TOKEN_BOOLEAN:
-      emitByte(booleanTokenToBool(parser.previous) ? OP_TRUE : OP_FALSE);
-    default:
-      return;  // Unreachable
-  }
+static void emitDatum(Value datum) {
+    if (IS_NIL(datum)) {
+        emitPush(OP_NIL);
+    } else if (IS_BOOL(datum)) {
+        emitPush(AS_BOOL(datum) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(datum);
+    }
 }
 
-static bool identifiersEqual(Token *a, Token *b) {
-  if (a->length != b->length) return false;
-  return memcmp(a->start, b->start, a->length) == 0;
+// Adds a constant for an instruction which takes its index as an operand.
+static int operandConstant(Value value) {
+    int constant = makeConstant(value);
+    if (constant > UINT16_MAX) {
+        error("Too many constants in one chunk.");
+        return 0;
+    }
+    return constant;
 }
 
-static int resolveLocal(Compiler *compiler, Token *name) {
-  for (int i = compiler->localCount - 1; i >= 0; i--) {
-    Local *local = &compiler->locals[i];
-    if (identifiersEqual(name, &local->name)) {
-      if (local->depth == UNINITIALIZED_LOCAL) {
-        error("Can't read local variable in its own initializer.");
-      }
-      return i;
+// Returns the index in compiler's locals of the local called name, or -1.
+static int resolveLocal(Compiler *compiler, ObjSymbol *name) {
+    for (int i = compiler->localCount - 1; i >= 0; i--) {
+        Local *local = &compiler->locals[i];
+        if (name == local->name) {
+            if (local->depth == UNINITIALIZED_LOCAL) {
+                error("Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
     }
-  }
 
-  return -1;
+    return -1;
 }
 
-static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal) {
-  int upvalueCount = compiler->function->upvalueCount;
+static int addUpvalue(Compiler *compiler, uint16_t index, bool isLocal) {
+    int upvalueCount = compiler->function->upvalueCount;
+
+    for (int i = 0; i < upvalueCount; i++) {
+        Upvalue *upvalue = &compiler->upvalues[i];
+        if (upvalue->index == index && upvalue->isLocal == isLocal) {
+            return i;
+        }
+    }
 
-  for (int i = 0; i < upvalueCount; i++) {
-    Upvalue *upvalue = &compiler->upvalues[i];
-    if (upvalue->index == index && upvalue->isLocal == isLocal) {
-      return i;
+    if (upvalueCount == UINT16_COUNT) {
+        error("Too many closure variables in function.");
+        return 0;
     }
-  }
 
-  if (upvalueCount == UINT8_COUNT) {
-    error("Too many closure variables in function.");
-    return 0;
-  }
+    if (upvalueCount == compiler->upvalueCapacity) {
+        int capacity = compiler->upvalueCapacity;
+        compiler->upvalueCapacity = GROW_CAPACITY(capacity);
+        compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, capacity,
+                                        compiler->upvalueCapacity);
+    }
 
-  compiler->upvalues[upvalueCount].isLocal = isLocal;
-  compiler->upvalues[upvalueCount].index = index;
-  return compiler->function->upvalueCount++;
+    compiler->upvalues[upvalueCount].isLocal = isLocal;
+    compiler->upvalues[upvalueCount].index = index;
+    compiler->upvalues[upvalueCount].name = NULL;
+    return compiler->function->upvalueCount++;
 }
 
-static int resolveUpvalue(Compiler *compiler, Token *name) {
-  if (compiler->enclosing == NULL) return -1;
+static int resolveUpvalue(Compiler *compiler, ObjSymbol *name) {
+    if (NULL != compiler->lazyBody) {
+        for (int i = 0; i < compiler->function->upvalueCount; i++) {
+            if (name == compiler->lazyBody->upvalueNames[i]) return i;
+        }
+        return -1;
+    }
+
+    if (compiler->enclosing == NULL) return -1;
 
-  int local = resolveLocal(compiler->enclosing, name);
-  if (local != -1) {
-    compiler->enclosing->locals[local].isCaptured = true;
-    return addUpvalue(compiler, (uint8_t)local, true);
-  }
+    int local = resolveLocal(compiler->enclosing, name);
+    if (local != -1) {
+        compiler->enclosing->locals[local].isCaptured = true;
+        return addUpvalue(compiler,
+                          (uint16_t)compiler->enclosing->locals[local].slot,
+                          true);
+    }
 
-  int upvalue = resolveUpvalue(compiler->enclosing, name);
-  if (upvalue != -1) {
-    return addUpvalue(compiler, (uint8_t)upvalue, false);
-  }
+    int upvalue = resolveUpvalue(compiler->enclosing, name);
+    if (upvalue != -1) {
+        return addUpvalue(compiler, (uint16_t)upvalue, false);
+    }
 
-  return -1;
+    return -1;
 }
 
-static void addLocal(Token name) {
-  if (current->localCount == UINT8_COUNT) {
-    error("Too many local variables in function.");
-    return;
-  }
+/*
+  Returns the innermost loop of compiler called name, unless a local
+  declared inside of that loop shadows it.
+*/
+static Loop *findLoop(Compiler *compiler, ObjSymbol *name) {
+    for (Loop *loop = compiler->loop; loop != NULL; loop = loop->enclosing) {
+        if (name != loop->name) continue;
 
-  Local *local = &current->locals[current->localCount++];
-  local->name = name;
-  local->depth = UNINITIALIZED_LOCAL;
-  local->isCaptured = false;
+        for (int i = compiler->localCount - 1; i >= loop->firstLocal; i--) {
+            if (name == compiler->locals[i].name) return NULL;
+        }
+        return loop;
+    }
+    return NULL;
 }
 
-static void declareVariable() {
-  if (current->scopeDepth == 0) return;
+/*
+  If name refers to an in-frame loop, marks the loop as failed and returns
+  true. Used for every reference to a variable which isn't a self tail
+  call of its loop.
+*/
+static bool referencesLoop(ObjSymbol *name) {
+    for (Compiler *compiler = current; compiler != NULL;
+         compiler = compiler->enclosing) {
+        Loop *loop = findLoop(compiler, name);
+        int local = -1;
+        for (int i = compiler->localCount - 1; i >= 0; i--) {
+            if (name == compiler->locals[i].name) {
+                local = i;
+                break;
+            }
+        }
+
+        if (NULL != loop && local < loop->firstLocal) {
+            loop->failed = true;
+            return true;
+        }
+        if (-1 != local) return false;
+    }
+    return false;
+}
 
-  Token *name = parser.previous;
+// Returns true if name refers to a local variable, upvalue or loop.
+static bool isLexicallyBound(ObjSymbol *name) {
+    for (Compiler *compiler = current; compiler != NULL;
+         compiler = compiler->enclosing) {
+        if (NULL != findLoop(compiler, name)) return true;
+        for (int i = compiler->localCount - 1; i >= 0; i--) {
+            if (name == compiler->locals[i].name) return true;
+        }
+        if (NULL != compiler->lazyBody) {
+            return -1 != resolveUpvalue(compiler, name);
+        }
+    }
+    return false;
+}
 
-  for (int i = current->localCount - 1; i >= 0; i--) {
-    Local *local = &current->locals[i];
-    if (local->depth != -1 && local->depth < current->scopeDepth) {
-      break;
+/*
+  Adds a local whose value will be in the next free slot of the stack. Its
+  name isn't visible until it is named with nameLocal.
+*/
+static int addLocal(void) {
+    if (current->localCount == UINT16_COUNT ||
+        current->stackDepth > UINT16_MAX) {
+        error("Too many local variables in function.");
+        return 0;
     }
 
-    if (identifiersEqual(name, &local->name)) {
-      error("Already a variable with this name in this scope.");
+    if (current->localCount == current->localCapacity) {
+        int capacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(capacity);
+        current->locals = GROW_ARRAY(Local, current->locals, capacity,
+                                     current->localCapacity);
     }
-  }
 
-  addLocal(*name);
+    Local *local = &current->locals[current->localCount];
+    local->name = NULL;
+    local->depth = current->scopeDepth;
+    local->slot = current->stackDepth;
+    local->isCaptured = false;
+    return current->localCount++;
 }
 
-static uint8_t parseVariable(const char *errorMessage) {
-  consume(TOKEN_IDENTIFIER, errorMessage);
-
-  declareVariable();
-  if (current->scopeDepth > 0) return 0;
+static void nameLocal(int local, ObjSymbol *name) {
+    current->locals[local].name = name;
+}
 
-  return identifierConstant(parser.previous);
+static void emitGetLocal(int local) {
+    emitWithOperand(OP_GET_LOCAL, current->locals[local].slot);
+    adjustStack(1);
 }
 
-static void markInitialized() {
-  if (current->scopeDepth == 0) return;
-  current->locals[current->localCount - 1].depth = current->scopeDepth;
+// Emit an instruction which stores the top of the stack in local.
+static void emitSetLocal(int local) {
+    emitWithOperand(OP_SET_LOCAL, current->locals[local].slot);
 }
 
-static void defineVariable(uint8_t global) {
-  if (current->scopeDepth > 0) {
-    markInitialized();
-    return;
-  }
+static void compileVariable(ObjSymbol *name) {
+    if (referencesLoop(name)) {
+        // The loop will be compiled again as a procedure.
+        emitPush(OP_NIL);
+        return;
+    }
+
+    int arg = resolveLocal(current, name);
+    if (arg != -1) {
+        emitGetLocal(arg);
+    } else if ((arg = resolveUpvalue(current, name)) != -1) {
+        emitWithOperand(OP_GET_UPVALUE, arg);
+        adjustStack(1);
+    } else {
+        emitWithOperand(OP_GET_GLOBAL, operandConstant(OBJ_VAL(name)));
+        adjustStack(1);
+    }
+}
 
-  emit2Bytes(OP_DEFINE_GLOBAL, global);
+static void compileQuote(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    if (2 != properListLength(list)) {
+        error("quote takes exactly one datum.");
+        emitPush(OP_NIL);
+        return;
+    }
+    emitDatum(syntaxToDatum(CADR(list)));
 }
-*/
 
-/*
-static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+static void compileIf(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    int length = properListLength(list);
+    if (3 != length && 4 != length) {
+        error("if takes a test, a consequent and an optional alternative.");
+        emitPush(OP_NIL);
+        return;
+    }
 
-  if (parserMatch(TOKEN_EQUAL)) {
-    expression();
-  } else {
-    emitByte(OP_NIL);
-  }
-  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+    compileExpression(listRef(list, 1), false);
+
+    int thenJump = emitJump(OP_JUMP_IF_FALSE);
+    emitPop();
+    compileExpression(listRef(list, 2), isTail);
+
+    int elseJump = emitJump(OP_JUMP);
+    patchJump(thenJump);
+    emitPop();
+
+    if (4 == length) {
+        compileExpression(listRef(list, 3), isTail);
+    } else {
+        emitPush(OP_NIL);
+    }
+    patchJump(elseJump);
+}
 
-  defineVariable(global);
+// Returns true if syntax is a (define ...) form.
+static bool isDefinition(Value syntax) {
+    Value value = unwrap(syntax);
+    if (properListLength(value) < 2) return false;
+    ObjSymbol *head = asSymbol(CAR(value));
+    return NULL != head && textOfSymbolEqualToString(head, "define") &&
+           !isLexicallyBound(head);
 }
-*/
 
 /*
-static void expressionStatement() {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-  emitByte(OP_POP);
-}
+  Compiles syntax as the value of a variable called name. Lambdas are given
+  the variable's name, so that error messages can mention it.
 */
+static void compileNamedValue(ObjSymbol *name, Value syntax) {
+    Value value = unwrap(syntax);
+    ObjSymbol *head = IS_PAIR(value) ? asSymbol(CAR(value)) : NULL;
+    if (NULL != head && textOfSymbolEqualToString(head, "lambda") &&
+        properListLength(value) >= 3 && !isLexicallyBound(head)) {
+        ObjSyntax *enclosing = current->syntax;
+        current->syntax = AS_SYNTAX(syntax);
+        compileLambda(name, current->syntax, CADR(value), CDDR(value));
+        current->syntax = enclosing;
+    } else {
+        compileExpression(syntax, false);
+    }
+}
 
 /*
-static void statement();
-static void declaration();
+  Compiles the value of a definition, leaving it on top of the stack, and
+  returns the name of the variable being defined.
 */
+static ObjSymbol *compileDefinitionValue(ObjSyntax *form) {
+    Value list = form->value;
+    if (properListLength(list) < 2) {
+        error("define takes a variable and a value.");
+        emitPush(OP_NIL);
+        return NULL;
+    }
 
-/*
-static void synchronize() {
-  parser.panicMode = false;
+    Value target = unwrap(CADR(list));
+
+    // (define (name . parameters) body ...)
+    if (IS_PAIR(target)) {
+        ObjSymbol *name = asSymbol(CAR(target));
+        if (NULL == name) {
+            error("Expect procedure name.");
+            emitPush(OP_NIL);
+            return NULL;
+        }
+        compileLambda(name, form, CDR(target), CDDR(list));
+        return name;
+    }
+
+    // (define name value)
+    ObjSymbol *name = asSymbol(target);
+    if (NULL == name || properListLength(list) != 3) {
+        error("define takes a variable and a value.");
+        emitPush(OP_NIL);
+        return NULL;
+    }
 
-  while (parser.current->type != TOKEN_EOF) {
-    if (parser.previous->type == TOKEN_SEMICOLON) return;
-    switch (parser.current->type) {
-      case TOKEN_CLASS:
-      case TOKEN_FUN:
-      case TOKEN_VAR:
-      case TOKEN_FOR:
-      case TOKEN_IF:
-      case TOKEN_WHILE:
-      case TOKEN_PRINT:
-      case TOKEN_RETURN:
+    compileNamedValue(name, CADDR(list));
+    return name;
+}
+
+static void compileDefine(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+
+    // Internal definitions are handled by compileBody.
+    if (current->scopeDepth > 0) {
+        error("define is only allowed at the start of a body.");
+        emitPush(OP_NIL);
         return;
+    }
+
+    ObjSymbol *name = compileDefinitionValue(form);
+    if (NULL == name) return;
+
+    emitWithOperand(OP_DEFINE_GLOBAL, operandConstant(OBJ_VAL(name)));
+    adjustStack(-1);
+
+    // Definitions have no value, but every expression leaves one.
+    emitPush(OP_NIL);
+}
 
-      default:;  // Do nothing;
+static void compileSet(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    ObjSymbol *name =
+        3 == properListLength(list) ? asSymbol(CADR(list)) : NULL;
+    if (NULL == name) {
+        error("set! takes a variable and a value.");
+        emitPush(OP_NIL);
+        return;
     }
 
-    parserAdvance();
-  }
+    compileExpression(CADDR(list), false);
+
+    if (referencesLoop(name)) return;
+
+    int arg = resolveLocal(current, name);
+    if (arg != -1) {
+        emitSetLocal(arg);
+    } else if ((arg = resolveUpvalue(current, name)) != -1) {
+        emitWithOperand(OP_SET_UPVALUE, arg);
+    } else {
+        emitWithOperand(OP_SET_GLOBAL, operandConstant(OBJ_VAL(name)));
+    }
 }
-*/
 
-/*
-static void block() {
-  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-    declaration();
-  }
+// Declares a parameter called name as the next local of the function.
+static void declareParameter(ObjSymbol *name) {
+    if (parameterCount(&current->function->parameters) > UINT16_MAX) {
+        error("Can't have more than 65535 parameters.");
+    }
 
-  consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    nameLocal(addLocal(), name);
+    adjustStack(1);
 }
-*/
 
 /*
-static void function(FunctionType type) {
-  Compiler compiler;
-  initCompiler(&compiler, type);
-  beginScope();
+  Declares parameters as the locals of the function being compiled. The
+  ones after #!optional are optional, and a symbol in place of the rest
+  of the list is a rest parameter.
+*/
+static void declareParameters(Value parameters) {
+    ObjFunction *function = current->function;
+    function->parameters =
+        (Parameters){.requiredCount = 0, .optionalCount = 0, .hasRest = false};
+
+    bool isOptional = false;
+    Value parameter = unwrap(parameters);
+    for (; IS_PAIR(parameter); parameter = unwrap(CDR(parameter))) {
+        ObjSymbol *parameterName = asSymbol(CAR(parameter));
+        if (NULL == parameterName) {
+            error("Expect parameter name.");
+            break;
+        }
+        if (!isOptional &&
+            textOfSymbolEqualToString(parameterName, "#!optional")) {
+            isOptional = true;
+            continue;
+        }
 
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
-  if (!check(TOKEN_RIGHT_PAREN)) {
-    do {
-      current->function->arity++;
-      if (current->function->arity > 255) {
-        errorAtCurrent("Can't have more than 255 parameters.");
-      }
-      uint8_t constant = parseVariable("Expect parameter name.");
-      defineVariable(constant);
-    } while (parserMatch(TOKEN_COMMA));
-  }
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
-  consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-  block();
-
-  ObjFunction *function = endCompiler();
-  emit2Bytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
-
-  for (int i = 0; i < function->upvalueCount; i++) {
-    emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-    emitByte(compiler.upvalues[i].index);
-  }
-}
-*/
-
-/*
-static void namedVariable(Token name, bool canAssign) {
-  uint8_t getOp, setOp;
-  int arg = resolveLocal(current, &name);
-  if (arg != -1) {
-    getOp = OP_GET_LOCAL;
-    setOp = OP_SET_LOCAL;
-  } else if ((arg = resolveUpvalue(current, &name)) != -1) {
-    getOp = OP_GET_UPVALUE;
-    setOp = OP_SET_UPVALUE;
-  } else {
-    arg = identifierConstant(&name);
-    getOp = OP_GET_GLOBAL;
-    setOp = OP_SET_GLOBAL;
-  }
-
-  if (canAssign && parserMatch(TOKEN_EQUAL)) {
-    expression();
-    emit2Bytes(setOp, (uint8_t)arg);
-  } else {
-    emit2Bytes(getOp, (uint8_t)arg);
-  }
-}
-*/
-
-/*
-static void variable(bool canAssign) {
-  namedVariable(parser.previous, canAssign);
-}
-*/
-
-static Token syntheticToken(char const *text) {
-    Token token = {
-        .type = TOKEN_IDENTIFIER,
-        .location =
-            {
-                .start = text,
-                .length = strlen(text),
-                .line = 0,
-            },
-    };
-    return token;
+        if (isOptional) {
+            function->parameters.optionalCount++;
+        } else {
+            function->parameters.requiredCount++;
+        }
+        declareParameter(parameterName);
+    }
+
+    if (IS_SYMBOL(parameter)) {
+        function->parameters.hasRest = true;
+        declareParameter(AS_SYMBOL(parameter));
+    } else if (!IS_NIL(parameter) && !parser.hadError) {
+        error("Expect parameter name.");
+    }
+
+    // Only functions that take one number of arguments have an arity.
+    function->arity = 0 == function->parameters.optionalCount &&
+                              !function->parameters.hasRest
+                          ? function->parameters.requiredCount
+                          : VARIADIC_ARITY;
 }
 
 /*
-static void funDeclaration() {
-  uint8_t global = parseVariable("Expect function name.");
-  markInitialized();
-  function(TYPE_FUNCTION);
-  defineVariable(global);
-}
+  Captures every variable of the enclosing functions which syntax, part of
+  the body of the function being compiled, may refer to. Symbols which are
+  quoted or shadowed inside of the body are captured too, which only costs
+  an unused upvalue.
 */
+static void captureVariables(Value syntax) {
+    for (;;) {
+        Value value = unwrap(syntax);
+        if (IS_SYMBOL(value)) {
+            ObjSymbol *name = AS_SYMBOL(value);
+            // Loops are compiled again as procedures if they are used.
+            if (referencesLoop(name) || -1 != resolveLocal(current, name)) {
+                return;
+            }
+
+            int upvalue = resolveUpvalue(current, name);
+            if (-1 != upvalue) current->upvalues[upvalue].name = name;
+            return;
+        }
+        if (!IS_PAIR(value)) return;
 
-static void expression(void) { return; }
+        captureVariables(CAR(value));
+        syntax = CDR(value);
+    }
+}
 
 /*
-static void statement() {
-  if (parserMatch(TOKEN_LEFT_BRACE)) {
-    beginScope();
-    block();
-    endScope();
-  } else {
-    expressionStatement();
-  }
-}
+  Saves body in the function being compiled, which is compiled when it's
+  first called. Only its upvalues are resolved now, since the closures
+  of the function need them.
 */
+static void deferBody(ObjSyntax *form, Value parameters, Value body) {
+    captureVariables(body);
 
-/*
-static void grouping(bool canAssign) {
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
+    if (NULL == sourceText.copy) {
+        sourceText.copy = copyString(sourceText.start, (int)sourceText.length);
+    }
+
+    ObjFunction *function = current->function;
+    LazyBody *lazyBody = ALLOCATE(LazyBody, 1);
+    lazyBody->form = form;
+    lazyBody->parameters = parameters;
+    lazyBody->body = body;
+    lazyBody->upvalueNames = ALLOCATE(ObjSymbol *, function->upvalueCount);
+    for (int i = 0; i < function->upvalueCount; i++) {
+        lazyBody->upvalueNames[i] = current->upvalues[i].name;
+    }
+    lazyBody->source = sourceText.copy;
+    function->lazyBody = lazyBody;
 }
-*/
 
 /*
-static void number(bool canAssign) {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
-}
+  Compiles body as the whole code of the function being compiled, once
+  more with wide jumps if a jump couldn't reach.
 */
+static void compileFunctionBody(ObjSyntax *form, Value body) {
+    CodeMark mark = markCode();
+    do {
+        compileBody(form, body, true);
+        emitByte(OP_RETURN);
+    } while (needsWideJumps(&mark));
+}
 
 /*
-static void string(bool canAssign) {
-  emitConstant(OBJ_VAL(
-      copyString(parser.previous.start + 1, parser.previous.length - 2)));
-}
+  Compiles a lambda with parameters and body, and emits the code to create
+  a closure of it.
 */
+static void compileLambda(ObjSymbol *name, ObjSyntax *form, Value parameters,
+                          Value body) {
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_FUNCTION, name);
+    beginScope();
+    declareParameters(parameters);
+
+    if (compilerOptions.lazy && !parser.hadError) {
+        deferBody(form, parameters, body);
+    } else {
+        compileFunctionBody(form, body);
+    }
+
+    ObjFunction *function = endCompiler();
+
+    int constant = operandConstant(OBJ_VAL(function));
+    bool isWide = constant > UINT8_MAX;
+    for (int i = 0; i < function->upvalueCount; i++) {
+        if (compiler.upvalues[i].index > UINT8_MAX) isWide = true;
+    }
+
+    if (isWide) {
+        emit2Bytes(OP_WIDE, OP_CLOSURE);
+        emitShort(constant);
+    } else {
+        emit2Bytes(OP_CLOSURE, (uint8_t)constant);
+    }
+    adjustStack(1);
+
+    for (int i = 0; i < function->upvalueCount; i++) {
+        Upvalue const *upvalue = &compiler.upvalues[i];
+        if (isWide) {
+            emitShort(upvalue->isLocal ? 1 : 0);
+            emitShort(upvalue->index);
+        } else {
+            emitByte(upvalue->isLocal ? 1 : 0);
+            emitByte((uint8_t)upvalue->index);
+        }
+    }
+    FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
+}
+
+static void compileLambdaForm(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value list = form->value;
+    if (properListLength(list) < 3) {
+        error("lambda takes parameters and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+    compileLambda(NULL, form, CADR(list), CDDR(list));
+}
+
+/*
+  Compiles (case-lambda (parameters body ...) ...) as a call of the
+  %case-lambda native with a lambda of each clause, which makes the
+  procedure that dispatches on the number of arguments.
+*/
+static void compileCaseLambda(ObjSyntax *form, bool isTail) {
+    (void)isTail;
+    Value clauses = CDR(form->value);
+    int count = properListLength(clauses);
+    if (count < 0) {
+        error("case-lambda takes a list of clauses.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    ObjSymbol *native = newSymbol("%case-lambda", 12);
+    emitWithOperand(OP_GET_GLOBAL, operandConstant(OBJ_VAL(native)));
+    adjustStack(1);
+    for (; IS_PAIR(clauses); clauses = CDR(clauses)) {
+        Value clause = unwrap(CAR(clauses));
+        if (properListLength(clause) < 2) {
+            error("Each clause of case-lambda takes parameters and a body.");
+            emitPush(OP_NIL);
+            continue;
+        }
+        compileLambda(NULL, AS_SYNTAX(CAR(clauses)), CAR(clause),
+                      CDR(clause));
+    }
+
+    if (count > UINT16_MAX) error("Can't have more than 65535 clauses.");
+    emitCall(count, OP_CALL_NATIVE);
+    adjustStack(-count);
+}
+
+/*
+  Compiles a sequence of expressions, leaving the value of the last one.
+  If sequence is empty the value is unspecified.
+*/
+static void compileSequence(Value sequence, bool isTail) {
+    if (IS_NIL(sequence)) {
+        emitPush(OP_NIL);
+        return;
+    }
+
+    for (; IS_PAIR(sequence); sequence = CDR(sequence)) {
+        bool isLast = !IS_PAIR(CDR(sequence));
+        compileExpression(CAR(sequence), isLast && isTail);
+        if (!isLast) emitPop();
+    }
+}
+
+/*
+  Compiles the body of a lambda or let. Definitions at the start of the
+  body become locals of the innermost scope, with letrec* semantics.
+*/
+static void compileBody(ObjSyntax *form, Value body, bool isTail) {
+    if (properListLength(body) < 1) {
+        compileError(form, "Expect a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    // Declare every definition first so they can refer to each other.
+    Value expressions = body;
+    int firstDefinition = current->localCount;
+    int definitionCount = 0;
+    for (; IS_PAIR(expressions) && isDefinition(CAR(expressions));
+         expressions = CDR(expressions)) {
+        Value target = unwrap(CADR(unwrap(CAR(expressions))));
+        nameLocal(addLocal(), asSymbol(IS_PAIR(target) ? CAR(target) : target));
+        emitPush(OP_NIL);
+        definitionCount++;
+    }
+
+    for (int i = 0; i < definitionCount; i++, body = CDR(body)) {
+        ObjSyntax *enclosing = current->syntax;
+        current->syntax = AS_SYNTAX(CAR(body));
+        compileDefinitionValue(current->syntax);
+        emitSetLocal(firstDefinition + i);
+        emitPop();
+        current->syntax = enclosing;
+    }
+
+    compileSequence(expressions, isTail);
+}
+
+static void compileBegin(ObjSyntax *form, bool isTail) {
+    compileSequence(CDR(form->value), isTail);
+}
+
+/*
+  Compiles the initializers of let style bindings into new locals of the
+  current scope, and returns the index of the first one. If sequential,
+  each binding can see the ones before it, like in let*.
+*/
+static int compileBindings(Value bindings, bool sequential) {
+    int firstLocal = current->localCount;
+    if (properListLength(bindings) < 0) {
+        error("Expect a list of bindings.");
+        return firstLocal;
+    }
+
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        Value list = unwrap(CAR(binding));
+        ObjSymbol *name = IS_PAIR(list) ? asSymbol(CAR(list)) : NULL;
+        if (NULL == name || properListLength(list) < 2) {
+            error("Expect a binding of a variable to a value.");
+            return firstLocal;
+        }
+
+        int local = addLocal();
+        compileExpression(CADR(list), false);
+        if (sequential) nameLocal(local, name);
+    }
+
+    if (!sequential) {
+        int local = firstLocal;
+        for (Value binding = bindings; IS_PAIR(binding);
+             binding = CDR(binding)) {
+            nameLocal(local++, asSymbol(CAR(unwrap(CAR(binding)))));
+        }
+    }
+
+    return firstLocal;
+}
+
+// Returns true if a tail call in the current loop body is a tail call of
+// loop's body too.
+static bool isTailOfLoop(Loop const *loop) {
+    for (Loop *inner = current->loop; inner != loop; inner = inner->enclosing) {
+        if (!inner->isTail) return false;
+    }
+    return true;
+}
+
+/*
+  Compiles a self tail call of an in-frame loop: the arguments become the
+  values of the loop variables and control jumps back to the start of the
+  loop's body, without touching the call machinery.
+*/
+static void compileLoopCall(Loop const *loop, Value arguments) {
+    int stackDepth = current->stackDepth;
+
+    for (; IS_PAIR(arguments); arguments = CDR(arguments)) {
+        compileExpression(CAR(arguments), false);
+    }
+
+    emitCloseScope(loop->firstSlot, loop->variableCount);
+    emitLoop(loop->start);
+
+    // Control never gets past the jump, but the call is still an
+    // expression as far as the code around it is concerned.
+    setStackDepth(stackDepth + 1);
+}
+
+/*
+  Compiles a named let as a loop inside of the current function. Returns
+  false if the loop's name is used as anything but a self tail call, in
+  which case the code is useless and the loop needs to be a procedure.
+*/
+static bool compileLoop(ObjSyntax *form, ObjSymbol *name, Value bindings,
+                        Value body, bool isTail) {
+    beginScope();
+    int firstSlot = current->stackDepth;
+    int firstLocal = compileBindings(bindings, false);
+
+    Loop loop = {
+        .enclosing = current->loop,
+        .name = name,
+        .start = getChunkCount(currentChunk()),
+        .firstSlot = firstSlot,
+        .firstLocal = firstLocal,
+        .variableCount = current->localCount - firstLocal,
+        .isTail = isTail,
+        .failed = false,
+    };
+
+    current->loop = &loop;
+    compileBody(form, body, true);
+    current->loop = loop.enclosing;
+
+    endScope();
+    return !loop.failed;
+}
+
+/*
+  Compiles a named let as a procedure bound to its name which is called
+  with the initial values. This is what the named let means in general.
+*/
+static void compileLoopProcedure(ObjSyntax *form, ObjSymbol *name,
+                                 Value bindings, Value body) {
+    Value parameters = NIL_VAL;
+    ObjPair *lastParameter = NULL;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        ObjPair *parameter = newPair(CAR(unwrap(CAR(binding))), NIL_VAL);
+        if (NULL == lastParameter) {
+            parameters = OBJ_VAL(parameter);
+        } else {
+            lastParameter->cdr = OBJ_VAL(parameter);
+        }
+        lastParameter = parameter;
+    }
+
+    beginScope();
+    int procedure = addLocal();
+    emitPush(OP_NIL);
+    nameLocal(procedure, name);
+
+    compileLambda(name, form, parameters, body);
+    emitSetLocal(procedure);
+    emitPop();
+
+    // The initial values can't see the procedure.
+    emitGetLocal(procedure);
+    nameLocal(procedure, NULL);
+
+    int argCount = 0;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        compileExpression(CADR(unwrap(CAR(binding))), false);
+        argCount++;
+    }
+
+    emitCall(argCount, OP_CALL);
+    adjustStack(-argCount);
+    endScope();
+}
+
+static void compileNamedLet(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 4) {
+        error("Named let takes a name, bindings and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    ObjSymbol *name = asSymbol(CADR(list));
+    Value bindings = unwrap(CADDR(list));
+    Value body = CDDDR(list);
+
+    size_t start = getChunkCount(currentChunk());
+    int callSiteCount = current->function->callSiteCount;
+    int localCount = current->localCount;
+    int stackDepth = current->stackDepth;
+
+    if (compileLoop(form, name, bindings, body, isTail) || parser.hadError) {
+        return;
+    }
+
+    truncateChunk(currentChunk(), start);
+    current->function->callSiteCount = callSiteCount;
+    current->localCount = localCount;
+    setStackDepth(stackDepth);
+    compileLoopProcedure(form, name, bindings, body);
+}
+
+static void compileLet(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) >= 2 && NULL != asSymbol(CADR(list))) {
+        compileNamedLet(form, isTail);
+        return;
+    }
+
+    if (properListLength(list) < 3) {
+        error("let takes bindings and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    beginScope();
+    compileBindings(unwrap(CADR(list)), false);
+    compileBody(form, CDDR(list), isTail);
+    endScope();
+}
+
+static void compileLetStar(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 3) {
+        error("let* takes bindings and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    beginScope();
+    compileBindings(unwrap(CADR(list)), true);
+    compileBody(form, CDDR(list), isTail);
+    endScope();
+}
+
+// Compiles both letrec and letrec*, which are the same for us.
+static void compileLetrec(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    Value bindings = properListLength(list) >= 3 ? unwrap(CADR(list)) : NIL_VAL;
+    if (properListLength(list) < 3 || properListLength(bindings) < 0) {
+        error("letrec takes bindings and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    beginScope();
+    int firstLocal = current->localCount;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        Value pair = unwrap(CAR(binding));
+        ObjSymbol *name = IS_PAIR(pair) ? asSymbol(CAR(pair)) : NULL;
+        if (NULL == name || 2 != properListLength(pair)) {
+            error("Expect a binding of a variable to a value.");
+            break;
+        }
+        nameLocal(addLocal(), name);
+        emitPush(OP_NIL);
+    }
+
+    int local = firstLocal;
+    for (Value binding = bindings;
+         IS_PAIR(binding) && local < current->localCount;
+         binding = CDR(binding), local++) {
+        Value pair = unwrap(CAR(binding));
+        compileNamedValue(current->locals[local].name, CADR(pair));
+        emitSetLocal(local);
+        emitPop();
+    }
+
+    compileBody(form, CDDR(list), isTail);
+    endScope();
+}
+
+/*
+  Compiles (do ((variable init step) ...) (test expression ...) command ...)
+  into a loop inside of the current function.
+*/
+static void compileDo(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    Value exit = properListLength(list) >= 3 ? unwrap(CADDR(list)) : NIL_VAL;
+    if (properListLength(exit) < 1) {
+        error("do takes bindings, a test and commands.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    Value bindings = unwrap(CADR(list));
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        int length = properListLength(unwrap(CAR(binding)));
+        if (2 != length && 3 != length) {
+            error("Expect a variable, an initial value and a step.");
+            emitPush(OP_NIL);
+            return;
+        }
+    }
+
+    beginScope();
+    int firstSlot = current->stackDepth;
+    int firstLocal = compileBindings(bindings, false);
+    int variableCount = current->localCount - firstLocal;
+    int loopStart = getChunkCount(currentChunk());
+
+    compileExpression(CAR(exit), false);
+    int bodyJump = emitJump(OP_JUMP_IF_FALSE);
+    emitPop();
+    compileSequence(CDR(exit), isTail);
+    int exitJump = emitJump(OP_JUMP);
+
+    patchJump(bodyJump);
+    emitPop();
+
+    for (Value command = CDDDR(list); IS_PAIR(command);
+         command = CDR(command)) {
+        compileExpression(CAR(command), false);
+        emitPop();
+    }
+
+    int local = firstLocal;
+    for (Value binding = bindings; IS_PAIR(binding);
+         binding = CDR(binding), local++) {
+        Value variable = unwrap(CAR(binding));
+        if (3 == properListLength(variable)) {
+            compileExpression(CADDR(variable), false);
+        } else {
+            emitGetLocal(local);
+        }
+    }
+
+    emitCloseScope(firstSlot, variableCount);
+    emitLoop(loopStart);
+
+    setStackDepth(firstSlot + variableCount + 1);
+    patchJump(exitJump);
+    endScope();
+}
+
+static void compileAndOperands(Value operands, bool isTail) {
+    bool isLast = !IS_PAIR(CDR(operands));
+    compileExpression(CAR(operands), isLast && isTail);
+    if (isLast) return;
+
+    int endJump = emitJump(OP_JUMP_IF_FALSE);
+    emitPop();
+    compileAndOperands(CDR(operands), isTail);
+    patchJump(endJump);
+}
+
+static void compileAnd(ObjSyntax *form, bool isTail) {
+    Value operands = CDR(form->value);
+    if (IS_NIL(operands)) {
+        emitPush(OP_TRUE);
+        return;
+    }
+    compileAndOperands(operands, isTail);
+}
+
+static void compileOrOperands(Value operands, bool isTail) {
+    bool isLast = !IS_PAIR(CDR(operands));
+    compileExpression(CAR(operands), isLast && isTail);
+    if (isLast) return;
+
+    int elseJump = emitJump(OP_JUMP_IF_FALSE);
+    int endJump = emitJump(OP_JUMP);
+    patchJump(elseJump);
+    emitPop();
+    compileOrOperands(CDR(operands), isTail);
+    patchJump(endJump);
+}
+
+static void compileOr(ObjSyntax *form, bool isTail) {
+    Value operands = CDR(form->value);
+    if (IS_NIL(operands)) {
+        emitPush(OP_FALSE);
+        return;
+    }
+    compileOrOperands(operands, isTail);
+}
+
+// Compiles when, or unless if isUnless.
+static void compileConditionalSequence(ObjSyntax *form, bool isTail,
+                                       bool isUnless) {
+    Value list = form->value;
+    if (properListLength(list) < 3) {
+        error("Expect a test and a body.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    compileExpression(CADR(list), false);
+    int skipJump = emitJump(OP_JUMP_IF_FALSE);
+    emitPop();
+    if (isUnless) {
+        emitPush(OP_NIL);
+    } else {
+        compileSequence(CDDR(list), isTail);
+    }
+
+    int endJump = emitJump(OP_JUMP);
+    patchJump(skipJump);
+    emitPop();
+    if (isUnless) {
+        compileSequence(CDDR(list), isTail);
+    } else {
+        emitPush(OP_NIL);
+    }
+    patchJump(endJump);
+}
+
+static void compileWhen(ObjSyntax *form, bool isTail) {
+    compileConditionalSequence(form, isTail, false);
+}
+
+static void compileUnless(ObjSyntax *form, bool isTail) {
+    compileConditionalSequence(form, isTail, true);
+}
+
+// Returns true if syntax is the symbol called name, and isn't shadowed.
+static bool isKeyword(Value syntax, char const *name) {
+    ObjSymbol *symbol = asSymbol(syntax);
+    return NULL != symbol && textOfSymbolEqualToString(symbol, name) &&
+           !isLexicallyBound(symbol);
+}
+
+/*
+  Returns true if a key can be compared against datum with the jump table
+  of an OP_SWITCH. Other datums are never eqv? to a key.
+*/
+static bool isSwitchKey(Value datum) {
+    return IS_NUMBER(datum) || IS_CHARACTER(datum) || IS_SYMBOL(datum) ||
+           IS_BOOL(datum) || IS_NIL(datum);
+}
+
+/*
+  Compiles a dispatch on the value of key with case clauses, which are
+  each ((datum ...) expression ...), ((datum ...) => expression),
+  (else expression ...) or (else => expression). However many clauses
+  there are, one OP_SWITCH chooses between them. If isNumeric, the key
+  must be a number, as it is compared with =.
+*/
+static void compileCaseClauses(Value key, Value clauses, bool isTail,
+                               bool isNumeric) {
+    bool needsKey = false;
+    for (Value clause = clauses; IS_PAIR(clause); clause = CDR(clause)) {
+        Value list = unwrap(CAR(clause));
+        if (properListLength(list) < 2) {
+            error("Expect a case clause.");
+            emitPush(OP_NIL);
+            return;
+        }
+
+        bool isElse = isKeyword(CAR(list), "else");
+        if (isElse && IS_PAIR(CDR(clause))) {
+            error("The else clause must be the last clause.");
+            emitPush(OP_NIL);
+            return;
+        }
+        if (!isElse && properListLength(unwrap(CAR(list))) < 0) {
+            error("Expect a list of datums.");
+            emitPush(OP_NIL);
+            return;
+        }
+
+        // The procedure after => is called with the key.
+        if (isKeyword(CADR(list), "=>")) needsKey = true;
+    }
+
+    int keyLocal = -1;
+    if (needsKey) {
+        beginScope();
+        keyLocal = addLocal();
+    }
+
+    compileExpression(key, false);
+    if (isNumeric) {
+        // Adding 0 fails on anything but a number, as = would.
+        emitConstant(NUMBER_VAL(0));
+        emitByte(OP_ADD);
+        adjustStack(-1);
+    }
+    if (needsKey) emitGetLocal(keyLocal);
+
+    ObjSwitch *table = newSwitch();
+    emitWithOperand(OP_SWITCH, operandConstant(OBJ_VAL(table)));
+    adjustStack(-1);
+
+    int switchEnd = getChunkCount(currentChunk());
+    int stackDepth = current->stackDepth;
+    bool hasElse = false;
+
+    SmartArray endJumps;
+    initSmartArray(&endJumps, smartArrayCheckedRealloc, sizeof(int));
+
+    for (Value clause = clauses; IS_PAIR(clause); clause = CDR(clause)) {
+        Value list = unwrap(CAR(clause));
+        int offset = getChunkCount(currentChunk()) - switchEnd;
+
+        if (isKeyword(CAR(list), "else")) {
+            hasElse = true;
+            table->defaultOffset = offset;
+        } else {
+            // Only the first clause with a datum can ever match it.
+            for (Value datum = unwrap(CAR(list)); IS_PAIR(datum);
+                 datum = CDR(datum)) {
+                Value value = syntaxToDatum(CAR(datum));
+                if (isSwitchKey(value)) switchAddCase(table, value, offset);
+            }
+        }
+
+        setStackDepth(stackDepth);
+        if (isKeyword(CADR(list), "=>")) {
+            if (3 != properListLength(list)) {
+                error("Expect one expression after =>.");
+            }
+            compileExpression(CADDR(list), false);
+            emitGetLocal(keyLocal);
+            emitCall(1, OP_CALL);
+            adjustStack(-1);
+        } else {
+            compileSequence(CDR(list), isTail);
+        }
+
+        if (!hasElse) {
+            int jump = emitJump(OP_JUMP);
+            smartArrayAppend(&endJumps, &jump);
+        }
+    }
+
+    // With no else clause, the value is unspecified when nothing matches.
+    if (!hasElse) {
+        table->defaultOffset = getChunkCount(currentChunk()) - switchEnd;
+        setStackDepth(stackDepth);
+        emitPush(OP_NIL);
+    }
+
+    for (size_t i = 0; i < getSmartArrayCount(&endJumps); i++) {
+        patchJump(SMART_ARRAY_AT(&endJumps, i, int));
+    }
+    freeSmartArray(&endJumps);
+
+    switchMakeDense(table);
+    if (needsKey) endScope();
+}
+
+static void compileCase(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    if (properListLength(list) < 2) {
+        error("case takes a key and clauses.");
+        emitPush(OP_NIL);
+        return;
+    }
+    compileCaseClauses(CADR(list), CDDR(list), isTail, false);
+}
+
+/*
+  If test is (eqv? variable datum), or the same with eq? or =, returns the
+  datum and sets *variable, and *isNumeric if the test is =. Returns NIL_VAL
+  if it isn't such a test.
+*/
+static Value comparedDatum(Value test, ObjSymbol **variable,
+                           bool *isNumeric) {
+    Value list = unwrap(test);
+    if (3 != properListLength(list)) return NIL_VAL;
+
+    *isNumeric = isKeyword(CAR(list), "=");
+    if (!*isNumeric && !isKeyword(CAR(list), "eqv?") &&
+        !isKeyword(CAR(list), "eq?")) {
+        return NIL_VAL;
+    }
+
+    Value datum = unwrap(CADDR(list));
+    if (IS_PAIR(datum) && isKeyword(CAR(datum), "quote") &&
+        2 == properListLength(datum)) {
+        datum = unwrap(CADR(datum));
+    } else if (IS_SYMBOL(datum) || IS_PAIR(datum)) {
+        return NIL_VAL;
+    }
+
+    // (= x 'a) is an error, not a test which is false.
+    if (!isSwitchKey(datum) || IS_NIL(datum) ||
+        (*isNumeric && !IS_NUMBER(datum))) {
+        return NIL_VAL;
+    }
+
+    *variable = asSymbol(CADR(list));
+    return NULL == *variable ? NIL_VAL : datum;
+}
+
+/*
+  If every clause of a cond compares the same variable against a constant,
+  returns equivalent case clauses and sets *key to the variable, and
+  *isNumeric if the first test is =. Otherwise returns NIL_VAL.
+
+  A cond whose first test is = fails on a key which isn't a number, and so
+  does its case. Any other cond can't have = tests, since one would fail
+  only if the tests before it are false.
+*/
+static Value condAsCase(Value clauses, Value *key, bool *isNumeric) {
+    ObjSymbol *variable = NULL;
+    Value caseClauses = NIL_VAL;
+    ObjPair *lastClause = NULL;
+    int comparisons = 0;
+
+    for (Value clause = clauses; IS_PAIR(clause); clause = CDR(clause)) {
+        Value list = unwrap(CAR(clause));
+        if (properListLength(list) < 2 || isKeyword(CADR(list), "=>")) {
+            return NIL_VAL;
+        }
+
+        Value head = CAR(list);
+        if (!isKeyword(head, "else")) {
+            ObjSymbol *compared = NULL;
+            bool isNumericTest = false;
+            Value datum = comparedDatum(head, &compared, &isNumericTest);
+            if (IS_NIL(datum) || (NULL != variable && compared != variable)) {
+                return NIL_VAL;
+            }
+            if (0 == comparisons) {
+                *isNumeric = isNumericTest;
+            } else if (isNumericTest && !*isNumeric) {
+                return NIL_VAL;
+            }
+
+            variable = compared;
+            *key = CADR(unwrap(head));
+            comparisons++;
+
+            // (quote datum) and a literal are both fine as a case datum.
+            head = OBJ_VAL(newPair(datum, NIL_VAL));
+        }
+
+        ObjPair *caseClause = newPair(OBJ_VAL(newPair(head, CDR(list))),
+                                      NIL_VAL);
+        if (NULL == lastClause) {
+            caseClauses = OBJ_VAL(caseClause);
+        } else {
+            lastClause->cdr = OBJ_VAL(caseClause);
+        }
+        lastClause = caseClause;
+    }
+
+    return comparisons >= 2 ? caseClauses : NIL_VAL;
+}
+
+static void compileCondClauses(Value clauses, bool isTail) {
+    if (!IS_PAIR(clauses)) {
+        emitPush(OP_NIL);
+        return;
+    }
+
+    Value list = unwrap(CAR(clauses));
+    int length = properListLength(list);
+    if (length < 1) {
+        error("Expect a cond clause.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    if (isKeyword(CAR(list), "else")) {
+        if (IS_PAIR(CDR(clauses))) {
+            error("The else clause must be the last clause.");
+        }
+        compileSequence(CDR(list), isTail);
+        return;
+    }
+
+    // (test): the value of the test is the value of the cond.
+    if (1 == length) {
+        compileExpression(CAR(list), false);
+        int nextJump = emitJump(OP_JUMP_IF_FALSE);
+        int endJump = emitJump(OP_JUMP);
+        patchJump(nextJump);
+        emitPop();
+        compileCondClauses(CDR(clauses), isTail);
+        patchJump(endJump);
+        return;
+    }
+
+    // (test => procedure): the procedure is called with the test's value.
+    if (isKeyword(CADR(list), "=>")) {
+        if (3 != length) error("Expect one expression after =>.");
+
+        beginScope();
+        int test = addLocal();
+        compileExpression(CAR(list), false);
+        emitGetLocal(test);
+        int nextJump = emitJump(OP_JUMP_IF_FALSE);
+        emitPop();
+        compileExpression(CADDR(list), false);
+        emitGetLocal(test);
+        emitCall(1, OP_CALL);
+        adjustStack(-1);
+        int endJump = emitJump(OP_JUMP);
+
+        patchJump(nextJump);
+        emitPop();
+        compileCondClauses(CDR(clauses), isTail);
+        patchJump(endJump);
+        endScope();
+        return;
+    }
+
+    compileExpression(CAR(list), false);
+    int nextJump = emitJump(OP_JUMP_IF_FALSE);
+    emitPop();
+    compileSequence(CDR(list), isTail);
+    int endJump = emitJump(OP_JUMP);
+
+    patchJump(nextJump);
+    emitPop();
+    compileCondClauses(CDR(clauses), isTail);
+    patchJump(endJump);
+}
+
+static void compileCond(ObjSyntax *form, bool isTail) {
+    Value clauses = CDR(form->value);
+    if (properListLength(clauses) < 0) {
+        error("Expect a list of cond clauses.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    // Compile a dispatch on a variable like a case, with a jump table.
+    Value key = NIL_VAL;
+    bool isNumeric = false;
+    Value caseClauses = condAsCase(clauses, &key, &isNumeric);
+    if (!IS_NIL(caseClauses)) {
+        compileCaseClauses(key, caseClauses, isTail, isNumeric);
+        return;
+    }
+
+    compileCondClauses(clauses, isTail);
+}
+
+static SpecialForm const specialForms[] = {
+    {"quote", compileQuote},   {"if", compileIf},
+    {"define", compileDefine}, {"set!", compileSet},
+    {"lambda", compileLambdaForm}, {"begin", compileBegin},
+    {"let", compileLet},       {"let*", compileLetStar},
+    {"letrec", compileLetrec}, {"letrec*", compileLetrec},
+    {"do", compileDo},         {"and", compileAnd},
+    {"or", compileOr},         {"when", compileWhen},
+    {"unless", compileUnless}, {"case", compileCase},
+    {"cond", compileCond},     {"case-lambda", compileCaseLambda},
+};
+
+static Primitive const primitives[] = {
+    {"+", OP_ADD, false},         {"-", OP_SUBTRACT, false},
+    {"*", OP_MULTIPLY, false},    {"/", OP_DIVIDE, false},
+    {"=", OP_NUMBER_EQUAL, true}, {"<", OP_LESS, true},
+    {"<=", OP_LESS_EQUAL, true},  {">", OP_GREATER, true},
+    {">=", OP_GREATER_EQUAL, true},
+};
+
+/*
+  Compiles a call of a primitive into its instruction. Returns false if
+  the call can't be compiled that way, so it must be a normal call.
+*/
+static bool compilePrimitive(Primitive const *primitive, Value operands,
+                             int count) {
+    if (primitive->isComparison) {
+        if (2 != count) return false;
+        compileExpression(CAR(operands), false);
+        compileExpression(CADR(operands), false);
+        emitByte(primitive->op);
+        adjustStack(-1);
+        return true;
+    }
+
+    switch (count) {
+        case 0:
+            // (+) and (*) are the identities of their operations.
+            if (OP_ADD == primitive->op) {
+                emitConstant(NUMBER_VAL(0));
+                return true;
+            }
+            if (OP_MULTIPLY == primitive->op) {
+                emitConstant(NUMBER_VAL(1));
+                return true;
+            }
+            return false;
+        case 1:
+            // (- x) negates x and (/ x) is its reciprocal.
+            if (OP_SUBTRACT == primitive->op) {
+                emitConstant(NUMBER_VAL(0));
+            } else if (OP_DIVIDE == primitive->op) {
+                emitConstant(NUMBER_VAL(1));
+            }
+            compileExpression(CAR(operands), false);
+            if (OP_SUBTRACT == primitive->op || OP_DIVIDE == primitive->op) {
+                emitByte(primitive->op);
+                adjustStack(-1);
+            }
+            return true;
+        default:
+            compileExpression(CAR(operands), false);
+            for (operands = CDR(operands); IS_PAIR(operands);
+                 operands = CDR(operands)) {
+                compileExpression(CAR(operands), false);
+                emitByte(primitive->op);
+                adjustStack(-1);
+            }
+            return true;
+    }
+}
+
+/*
+  Returns true if name is a global bound to a native, which no program
+  defines or sets. Calls of it start out quickened to OP_CALL_NATIVE,
+  whose guard still falls back to OP_CALL if the global changes.
+*/
+static bool isNativeGlobal(ObjSymbol *name) {
+    Value value;
+    return !name->isAssigned && !isLexicallyBound(name) &&
+           tableGet(&vm.globals, name, &value) && IS_NATIVE(value);
+}
+
+static void compileCall(ObjSyntax *form, bool isTail) {
+    Value list = form->value;
+    int argCount = properListLength(list) - 1;
+    if (argCount < 0) {
+        error("Expect a proper list for a procedure call.");
+        emitPush(OP_NIL);
+        return;
+    }
+
+    ObjSymbol *operator = asSymbol(CAR(list));
+    if (NULL != operator) {
+        Loop *loop = findLoop(current, operator);
+        if (NULL != loop && isTail && argCount == loop->variableCount &&
+            isTailOfLoop(loop)) {
+            compileLoopCall(loop, CDR(list));
+            return;
+        }
+    }
+
+    compileExpression(CAR(list), false);
+    for (Value argument = CDR(list); IS_PAIR(argument);
+         argument = CDR(argument)) {
+        compileExpression(CAR(argument), false);
+    }
+
+    if (argCount > UINT16_MAX) {
+        error("Can't have more than 65535 arguments.");
+    }
+    emitCall(argCount, NULL != operator && isNativeGlobal(operator)
+                           ? OP_CALL_NATIVE
+                           : OP_CALL);
+    adjustStack(-argCount);
+}
+
+// Compiles a list, which is either a special form or a procedure call.
+static void compileCombination(ObjSyntax *form, bool isTail) {
+    ObjSymbol *operator = asSymbol(CAR(form->value));
+
+    if (NULL != operator && !isLexicallyBound(operator)) {
+        for (size_t i = 0; i < sizeof(specialForms) / sizeof(*specialForms);
+             i++) {
+            if (textOfSymbolEqualToString(operator, specialForms[i].name)) {
+                specialForms[i].compile(form, isTail);
+                return;
+            }
+        }
+
+        // A program which defines or sets a primitive calls its own.
+        int count = properListLength(form->value) - 1;
+        for (size_t i = 0; i < sizeof(primitives) / sizeof(*primitives) &&
+                           !operator->isAssigned;
+             i++) {
+            if (textOfSymbolEqualToString(operator, primitives[i].name)) {
+                if (compilePrimitive(&primitives[i], CDR(form->value),
+                                     count)) {
+                    return;
+                }
+                break;
+            }
+        }
+    }
+
+    compileCall(form, isTail);
+}
+
+/*
+  Compiles the expression syntax, leaving its value on top of the stack.
+  isTail is true if nothing is left to do in the enclosing procedure or
+  loop body once the expression is evaluated.
+*/
+static void compileExpression(Value syntax, bool isTail) {
+    ObjSyntax *enclosing = current->syntax;
+    current->syntax = AS_SYNTAX(syntax);
+
+    Value value = current->syntax->value;
+    if (IS_SYMBOL(value)) {
+        compileVariable(AS_SYMBOL(value));
+    } else if (IS_PAIR(value)) {
+        compileCombination(current->syntax, isTail);
+    } else if (IS_NIL(value)) {
+        error("Expect an expression, but got an empty combination.");
+        emitPush(OP_NIL);
+    } else {
+        emitDatum(syntaxToDatum(syntax));
+    }
+
+    current->syntax = enclosing;
+}
+
+/*
+  Points the locations of syntax into the copy of the source text, if they
+  point into the source text.
+*/
+static void relocateSyntax(Value syntax) {
+    for (;;) {
+        if (IS_SYNTAX(syntax)) {
+            SourceLocation *location = &(AS_SYNTAX(syntax)->location);
+            uintptr_t start = (uintptr_t)sourceText.start;
+            uintptr_t offset = (uintptr_t)location->start - start;
+            if ((uintptr_t)location->start >= start &&
+                offset <= sourceText.length) {
+                location->start = sourceText.copy->chars + offset;
+            }
+            syntax = AS_SYNTAX(syntax)->value;
+        }
+
+        if (IS_VECTOR(syntax)) {
+            ValueArray *elements = &(AS_VECTOR(syntax)->array);
+            for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+                relocateSyntax(getValueArrayAt(elements, i));
+            }
+            return;
+        }
+        if (!IS_PAIR(syntax)) return;
+
+        relocateSyntax(CAR(syntax));
+        syntax = CDR(syntax);
+    }
+}
 
-static ObjFunction *compileValue(Value value) { return NULL; }
-
 ObjFunction *compile(char const *source) {
     initScanner(source);
     initParser();
 
+    sourceText.start = source;
+    sourceText.length = strlen(source);
+    sourceText.copy = NULL;
+
     ObjSyntaxPointerArray ast = parseAllTokens();
 
-    if (!parser.hadError) {
-        printAST(&ast);
-        puts("");
-    } else {
-        puts("Not printing ast, parser had error.");
+    if (parser.hadError) {
+        freeAST(&ast);
         return NULL;
     }
 
-    // Compiler compiler;
-    // initCompiler(&compiler, TYPE_SCRIPT, NIL_VAL);
+#ifdef DEBUG_PRINT_CODE
+    printAST(&ast);
+    puts("");
+#endif
+
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
+
+    for (size_t i = 0; i < getSmartArrayCount(&ast); i++) {
+        noteAssignedGlobals(OBJ_VAL(SMART_ARRAY_AT(&ast, i, ObjSyntax *)));
+    }
+    for (size_t i = 0; i < getSmartArrayCount(&ast); i++) {
+        Value form = optimize(OBJ_VAL(SMART_ARRAY_AT(&ast, i, ObjSyntax *)));
+        CodeMark mark = markCode();
+        do {
+            compileExpression(form, false);
+            emitPop();
+        } while (needsWideJumps(&mark));
+        if (NULL != sourceText.copy) relocateSyntax(form);
+
+        // Report the first error in every top level form.
+        parser.panicMode = false;
+    }
+
+    emitReturn();
+    ObjFunction *function = endCompiler();
+
+    // Freeing the AST runs the garbage collector, which must not free the
+    // function.
+    push(OBJ_VAL(function));
+    freeAST(&ast);
+    pop();
 
-    /*
+    return parser.hadError ? NULL : function;
+}
+
+bool compileLazyBody(ObjFunction *function) {
+    LazyBody *lazyBody = function->lazyBody;
+    bool wasCollecting = vm.gcState.isOn;
+    bool hadError = parser.hadError;
+    bool panicMode = parser.panicMode;
+    turnOffGarbageCollector();
     parser.hadError = false;
     parser.panicMode = false;
 
-    parserAdvance();
-    while (!parserMatch(TOKEN_EOF)) {
-      expression();
+    // Lambdas in the body keep the copy of the text their body came from.
+    char const *start = sourceText.start;
+    ObjString *copy = sourceText.copy;
+    sourceText.start = NULL;
+    sourceText.copy = lazyBody->source;
+
+    Compiler *enclosing = current;
+    current = NULL;
+    Compiler compiler;
+    beginFunction(&compiler, TYPE_FUNCTION, function);
+    compiler.syntax = lazyBody->form;
+    compiler.lazyBody = lazyBody;
+    beginScope();
+
+    declareParameters(lazyBody->parameters);
+    compileFunctionBody(lazyBody->form, lazyBody->body);
+    endCompiler();
+
+    bool compiled = !parser.hadError;
+    if (compiled) {
+        freeLazyBody(function);
+    } else {
+        // Leave the function as it was, so every call reports the error.
+        freeChunk(&function->chunk);
+        initChunk(&function->chunk);
+        if (NULL != function->callCaches) {
+            FREE_ARRAY(CallCache, function->callCaches,
+                       function->callSiteCount);
+            function->callCaches = NULL;
+        }
+        function->callSiteCount = 0;
     }
 
-    ObjFunction *function = endCompiler();
-    return parser.hadError ? NULL : function;
-    */
-    freeAST(&ast);
-    return NULL;
+    current = enclosing;
+    sourceText.start = start;
+    sourceText.copy = copy;
+    parser.hadError = hadError;
+    parser.panicMode = panicMode;
+    if (wasCollecting) turnOnGarbageCollector();
+    return compiled;
 }
 
 void markCompilerRoots(void) {
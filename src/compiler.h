@@ -22,5 +22,20 @@
 #include "chunk.h"
 #include "object.h"
 
+// Settings of the compiler, which are set by command line flags.
+typedef struct {
+    bool lazy;  // Compile the body of a lambda when it's first called.
+} CompilerOptions;
+
+extern CompilerOptions compilerOptions;
+
 ObjFunction *compile(char const *source);
+
+/*
+  Compiles the body of function, which was deferred until its first call.
+  Returns false, leaving function uncompiled, if the body has errors,
+  which are reported at their place in the source.
+*/
+bool compileLazyBody(ObjFunction *function);
+
 void markCompilerRoots(void);
@@ -48,6 +48,21 @@ static void printValueInQuotesAtEndOfLine(Value value);
 static size_t byteInstruction(char const *name, Chunk const *chunk,
                               size_t offset);
 
+/*
+  Prints an instruction at offset in chunk that takes two single byte
+  operands, labeling it as name, and returns the offset of the next
+  instruction.
+ */
+static size_t twoByteInstruction(char const *name, Chunk const *chunk,
+                                 size_t offset);
+
+/*
+  Prints a call instruction, with its argument count and the index of its
+  inline cache, and returns the offset of the next instruction.
+ */
+static size_t callInstruction(char const *name, Chunk const *chunk,
+                              size_t offset);
+
 /*
   Prints a jump instruction, where it jumps to, and returns the offset of the
   next instruction.
@@ -69,6 +84,12 @@ static size_t constantInstruction(char const *name, Chunk const *chunk,
 static size_t constantLongInstruction(char const *name, Chunk const *chunk,
                                       size_t offset);
 
+/*
+  Prints the instruction after the OP_WIDE at offset in chunk, with its
+  wide operands, and returns the offset of the next instruction.
+*/
+static size_t wideInstruction(Chunk const *chunk, size_t offset);
+
 void disassembleChunk(Chunk *const chunk, char const *name) {
     printf("== %s ==\n", name);
 
@@ -119,7 +140,11 @@ int disassembleInstruction(Chunk *const chunk, int offset) {
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
-            return byteInstruction("OP_CALL", chunk, offset);
+            return callInstruction("OP_CALL", chunk, offset);
+        case OP_CALL_CLOSURE:
+            return callInstruction("OP_CALL_CLOSURE", chunk, offset);
+        case OP_CALL_NATIVE:
+            return callInstruction("OP_CALL_NATIVE", chunk, offset);
         case OP_CLOSURE: {
             offset++;
             uint8_t constant = getChunkAt(chunk, offset++);
@@ -139,6 +164,47 @@ int disassembleInstruction(Chunk *const chunk, int offset) {
         }
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+        case OP_SWITCH:
+            return constantInstruction("OP_SWITCH", chunk, offset);
+        case OP_CLOSE_SCOPE:
+            return twoByteInstruction("OP_CLOSE_SCOPE", chunk, offset);
+        case OP_ADD:
+            return simpleInstruction("OP_ADD", offset);
+        case OP_SUBTRACT:
+            return simpleInstruction("OP_SUBTRACT", offset);
+        case OP_MULTIPLY:
+            return simpleInstruction("OP_MULTIPLY", offset);
+        case OP_DIVIDE:
+            return simpleInstruction("OP_DIVIDE", offset);
+        case OP_NUMBER_EQUAL:
+            return simpleInstruction("OP_NUMBER_EQUAL", offset);
+        case OP_LESS:
+            return simpleInstruction("OP_LESS", offset);
+        case OP_LESS_EQUAL:
+            return simpleInstruction("OP_LESS_EQUAL", offset);
+        case OP_GREATER:
+            return simpleInstruction("OP_GREATER", offset);
+        case OP_GREATER_EQUAL:
+            return simpleInstruction("OP_GREATER_EQUAL", offset);
+        case OP_GET_LOCAL_2:
+            return twoByteInstruction("OP_GET_LOCAL_2", chunk, offset);
+        case OP_ADD_CONSTANT:
+            return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+        case OP_SUBTRACT_CONSTANT:
+            return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+        case OP_POP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_CLOSE_SCOPE_LOOP: {
+            printInstructionNameAndOperand("OP_CLOSE_SCOPE_LOOP",
+                                           getChunkAt(chunk, offset + 1));
+            uint16_t jump = (uint16_t)(getChunkAt(chunk, offset + 3) << 8);
+            jump |= getChunkAt(chunk, offset + 4);
+            printf("%4u -> %zu\n", getChunkAt(chunk, offset + 2),
+                   (size_t)offset + 5 - jump);
+            return offset + 5;
+        }
+        case OP_WIDE:
+            return wideInstruction(chunk, offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -153,6 +219,25 @@ static size_t byteInstruction(const char *name, Chunk const *chunk,
     return offset + 2;
 }
 
+static size_t twoByteInstruction(char const *name, Chunk const *chunk,
+                                 size_t offset) {
+    uint8_t first = getChunkAt(chunk, offset + 1);
+    uint8_t second = getChunkAt(chunk, offset + 2);
+    printInstructionNameAndOperand(name, first);
+    printf("%4u\n", second);
+    return offset + 3;
+}
+
+static size_t callInstruction(char const *name, Chunk const *chunk,
+                              size_t offset) {
+    uint8_t argCount = getChunkAt(chunk, offset + 1);
+    uint16_t cache = (uint16_t)(getChunkAt(chunk, offset + 2) << 8);
+    cache |= getChunkAt(chunk, offset + 3);
+    printInstructionNameAndOperand(name, argCount);
+    printf("cache %u\n", cache);
+    return offset + 4;
+}
+
 static size_t jumpInstruction(const char *name, int sign, Chunk const *chunk,
                               size_t offset) {
     uint16_t jump = (uint16_t)(getChunkAt(chunk, offset + 1) << 8);
@@ -193,6 +278,114 @@ static size_t constantLongInstruction(char const *name, Chunk const *chunk,
     return offset + 4;
 }
 
+// Returns the big endian operand of width bytes at offset in chunk.
+static uint32_t readOperand(Chunk const *chunk, size_t offset, int width) {
+    uint32_t operand = 0;
+    for (int i = 0; i < width; i++) {
+        operand = (operand << 8) | getChunkAt(chunk, offset + i);
+    }
+    return operand;
+}
+
+// Returns the name of instruction when it follows OP_WIDE.
+static char const *wideName(uint8_t instruction) {
+    switch (instruction) {
+        case OP_GET_LOCAL:
+            return "WIDE GET_LOCAL";
+        case OP_SET_LOCAL:
+            return "WIDE SET_LOCAL";
+        case OP_GET_GLOBAL:
+            return "WIDE GET_GLOBAL";
+        case OP_DEFINE_GLOBAL:
+            return "WIDE DEFINE_GLOBAL";
+        case OP_SET_GLOBAL:
+            return "WIDE SET_GLOBAL";
+        case OP_GET_UPVALUE:
+            return "WIDE GET_UPVALUE";
+        case OP_SET_UPVALUE:
+            return "WIDE SET_UPVALUE";
+        case OP_JUMP:
+            return "WIDE JUMP";
+        case OP_JUMP_IF_FALSE:
+            return "WIDE JUMP_IF_FALSE";
+        case OP_LOOP:
+            return "WIDE LOOP";
+        case OP_CALL:
+            return "WIDE CALL";
+        case OP_CLOSURE:
+            return "WIDE CLOSURE";
+        case OP_CLOSE_SCOPE:
+            return "WIDE CLOSE_SCOPE";
+        case OP_SWITCH:
+            return "WIDE SWITCH";
+        default:
+            return "WIDE ?";
+    }
+}
+
+static size_t wideInstruction(Chunk const *chunk, size_t offset) {
+    uint8_t instruction = getChunkAt(chunk, offset + 1);
+    char const *name = wideName(instruction);
+    switch (instruction) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            printInstructionNameAndOperand(name,
+                                           readOperand(chunk, offset + 2, 2));
+            puts("");
+            return offset + 4;
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_SWITCH: {
+            uint32_t constant = readOperand(chunk, offset + 2, 2);
+            printInstructionNameAndOperand(name, constant);
+            printValueInQuotesAtEndOfLine(
+                getValueArrayAt(&(chunk->constants), constant));
+            return offset + 4;
+        }
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP: {
+            uint32_t jump = readOperand(chunk, offset + 2, 4);
+            printInstructionNameAndOperand(name, offset);
+            printf("-> %zu\n", OP_LOOP == instruction ? offset + 6 - jump
+                                                      : offset + 6 + jump);
+            return offset + 6;
+        }
+        case OP_CALL:
+            printInstructionNameAndOperand(name,
+                                           readOperand(chunk, offset + 2, 2));
+            puts("");
+            return offset + 8;
+        case OP_CLOSE_SCOPE:
+            printInstructionNameAndOperand(name,
+                                           readOperand(chunk, offset + 2, 2));
+            printf("%4u\n", readOperand(chunk, offset + 4, 2));
+            return offset + 6;
+        case OP_CLOSURE: {
+            uint32_t constant = readOperand(chunk, offset + 2, 2);
+            printInstructionNameAndOperand(name, constant);
+            printValue(getValueArrayAt(&(chunk->constants), constant));
+            puts("");
+
+            ObjFunction *function =
+                AS_FUNCTION(getValueArrayAt(&(chunk->constants), constant));
+            offset += 4;
+            for (int j = 0; j < function->upvalueCount; j++, offset += 4) {
+                printf("%04zu      |                     %s %u\n", offset,
+                       readOperand(chunk, offset, 2) ? "local" : "upvalue",
+                       readOperand(chunk, offset + 2, 2));
+            }
+            return offset;
+        }
+        default:
+            printf("Unknown wide opcode %d\n", instruction);
+            return offset + 2;
+    }
+}
+
 static void printValueInQuotesAtEndOfLine(Value value) {
     putchar('\'');
     printValue(value);
@@ -0,0 +1,57 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ecsi.h"
+
+#include <string.h>
+
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+void ecsiOpen(void) { initVM(); }
+
+void ecsiClose(void) { freeVM(); }
+
+InterpretResult ecsiRun(char const *source) { return interpret(source); }
+
+void ecsiDefineNative(char const *name, NativeFn function, int arity) {
+    defineNative(name, function, arity);
+}
+
+void ecsiDefineDescribedNative(NativeDescriptor const *descriptor) {
+    defineDescribedNative(descriptor);
+}
+
+bool ecsiGetGlobal(char const *name, Value *value) {
+    return tableGet(&vm.globals, newSymbol(name, (int)strlen(name)), value);
+}
+
+void ecsiPush(Value value) { push(value); }
+
+InterpretResult ecsiCall(int argCount, Value *result) {
+    InterpretResult status = callProcedure(argCount);
+    if (INTERPRET_OK == status) *result = pop();
+    return status;
+}
+
+EcsiHandle ecsiRetain(Value value) { return retainValue(value); }
+
+Value ecsiHandleValue(EcsiHandle handle) { return retainedValue(handle); }
+
+void ecsiRelease(EcsiHandle handle) { releaseValue(handle); }
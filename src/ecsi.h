@@ -0,0 +1,89 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  The C API of Ecsi, for programs which embed it through libecsi.a or
+  libecsi.so. Every function works on the VM of the calling thread, which
+  ecsiOpen() starts, so each thread that runs Scheme opens its own.
+
+  Values are the VM's own, built and taken apart with the macros of
+  value.h and object.h, like NUMBER_VAL() and AS_NUMBER(). A value which
+  is an object may be freed by the garbage collector whenever the VM
+  runs or allocates, unless a handle from ecsiRetain() keeps it.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// A value kept alive for C code, until it is released.
+typedef int EcsiHandle;
+
+// Starts the VM of the calling thread.
+void ecsiOpen(void);
+
+// Frees the VM of the calling thread, with every value and handle in it.
+void ecsiClose(void);
+
+// Compiles source and runs it.
+InterpretResult ecsiRun(char const *source);
+
+/*
+  Defines the global name as function, which takes arity arguments, or
+  ANY_ARITY. The VM checks the arity before function is called.
+*/
+void ecsiDefineNative(char const *name, NativeFn function, int arity);
+
+/*
+  Defines the native which descriptor describes. Besides its arity, the VM
+  checks the types of the arguments with hints, and the compiler may fold
+  calls of it on constants if it is pure.
+*/
+void ecsiDefineDescribedNative(NativeDescriptor const *descriptor);
+
+// Stores the value of the global name in value. Returns false if it's unbound.
+bool ecsiGetGlobal(char const *name, Value *value);
+
+// Pushes value onto the VM's stack, as a procedure or an argument.
+void ecsiPush(Value value);
+
+/*
+  Calls the procedure which was pushed before the last argCount values,
+  with those values as its arguments. They go straight from the stack to
+  the procedure, and are popped, with it, when the call returns. The
+  result is stored in result, if the call didn't fail.
+
+  A native may call it too. The call may move the stack, so a native
+  copies what it needs out of args first, as its arguments stay on the
+  stack and alive but args is stale afterwards. If the call fails, the
+  native has to return at once.
+*/
+InterpretResult ecsiCall(int argCount, Value *result);
+
+// Keeps value from being freed until the handle is released.
+EcsiHandle ecsiRetain(Value value);
+
+// Returns the value which handle keeps.
+Value ecsiHandleValue(EcsiHandle handle);
+
+// Lets the value which handle keeps be freed. handle may be reused.
+void ecsiRelease(EcsiHandle handle);
@@ -0,0 +1,284 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ffi.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#if (defined(__x86_64__) && !defined(_WIN64)) || defined(__aarch64__)
+#define HAS_FFI
+#endif
+
+// The registers the stubs pass arguments in, of each kind.
+#define INTEGER_REGISTERS 6
+#define DOUBLE_REGISTERS 8
+
+// The stubs, which every foreign function is called through.
+typedef intptr_t (*IntegerStub)(intptr_t, intptr_t, intptr_t, intptr_t,
+                                intptr_t, intptr_t, double, double, double,
+                                double, double, double, double, double);
+typedef double (*DoubleStub)(intptr_t, intptr_t, intptr_t, intptr_t,
+                             intptr_t, intptr_t, double, double, double,
+                             double, double, double, double, double);
+
+typedef struct {
+    char const *name;
+    ForeignType type;
+} TypeName;
+
+static TypeName const typeNames[] = {
+    {"int", FOREIGN_INT},       {"long", FOREIGN_LONG},
+    {"double", FOREIGN_DOUBLE}, {"string", FOREIGN_STRING},
+    {"buffer", FOREIGN_BUFFER}, {"void", FOREIGN_VOID},
+};
+
+// The libraries c-function has opened, each once.
+static _Thread_local void **libraries = NULL;
+static _Thread_local int libraryCount = 0;
+static _Thread_local int libraryCapacity = 0;
+
+static bool parseType(Value symbol, ForeignType *type);
+static void keepLibrary(void *library);
+static bool argumentError(ObjForeign const *foreign, int index,
+                          char const *expected, char *message, size_t size);
+
+// Sets *type to the type which symbol names, if it names one.
+static bool parseType(Value symbol, ForeignType *type) {
+    if (!IS_SYMBOL(symbol)) return false;
+    for (size_t i = 0; i < sizeof(typeNames) / sizeof(*typeNames); i++) {
+        if (textOfSymbolEqualToString(AS_SYMBOL(symbol), typeNames[i].name)) {
+            *type = typeNames[i].type;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+  Keeps library open until freeFFI(), dropping the extra reference if it
+  was already open.
+*/
+static void keepLibrary(void *library) {
+    for (int i = 0; i < libraryCount; i++) {
+        if (library == libraries[i]) {
+            dlclose(library);
+            return;
+        }
+    }
+
+    if (libraryCount == libraryCapacity) {
+        libraryCapacity = GROW_CAPACITY(libraryCapacity);
+        libraries =
+            checkedRealloc(libraries, sizeof(void *) * libraryCapacity);
+    }
+    libraries[libraryCount++] = library;
+}
+
+Value cFunctionNative(int argCount, Value *args) {
+    (void)argCount;
+#ifndef HAS_FFI
+    (void)args;
+    runtimeError("c-function isn't supported on this platform.");
+    return NIL_VAL;
+#else
+    Value library = args[0];
+    if (!IS_STRING(library) && !(IS_BOOL(library) && !AS_BOOL(library))) {
+        runtimeError("Expected argument 1 of c-function to be a string or "
+                     "#f.");
+        return NIL_VAL;
+    }
+
+    ForeignType types[FOREIGN_ARGUMENTS_MAX];
+    int arity = 0;
+    int integers = 0;
+    int doubles = 0;
+    for (Value list = args[2]; IS_PAIR(list); list = CDR(list), arity++) {
+        if (FOREIGN_ARGUMENTS_MAX == arity ||
+            !parseType(CAR(list), &types[arity]) ||
+            FOREIGN_VOID == types[arity]) {
+            runtimeError("Expected the argument types of c-function to be "
+                         "int, long, double, string or buffer.");
+            return NIL_VAL;
+        }
+        if (FOREIGN_DOUBLE == types[arity]) {
+            doubles++;
+        } else {
+            integers++;
+        }
+    }
+    if (integers > INTEGER_REGISTERS || doubles > DOUBLE_REGISTERS) {
+        runtimeError("c-function can pass at most %d integers and strings, "
+                     "and %d doubles.",
+                     INTEGER_REGISTERS, DOUBLE_REGISTERS);
+        return NIL_VAL;
+    }
+
+    ForeignType resultType;
+    if (!parseType(args[3], &resultType) || FOREIGN_BUFFER == resultType) {
+        runtimeError("Expected the result type of c-function to be int, "
+                     "long, double, string or void.");
+        return NIL_VAL;
+    }
+
+    // A null path opens the program itself.
+    void *handle = dlopen(IS_STRING(library) ? AS_CSTRING(library) : NULL,
+                          RTLD_NOW | RTLD_LOCAL);
+    if (NULL == handle) {
+        runtimeError("%s", dlerror());
+        return NIL_VAL;
+    }
+    keepLibrary(handle);
+
+    ObjString const *symbol = AS_STRING(args[1]);
+    void *address = dlsym(handle, symbol->chars);
+    if (NULL == address) {
+        runtimeError("%s", dlerror());
+        return NIL_VAL;
+    }
+
+    // ISO C can't cast what dlsym returns to a function, so it is copied.
+    _Static_assert(sizeof(ForeignFunction) == sizeof(address),
+                   "Code and data addresses must be the same size.");
+    ForeignFunction function;
+    memcpy(&function, &address, sizeof(function));
+
+    ObjString *name = copyString(symbol->chars, symbol->length);
+    push(OBJ_VAL(name));
+    ObjForeign *foreign = newForeign(function, name, arity, types, resultType);
+    pop();
+    return OBJ_VAL(foreign);
+#endif
+}
+
+// Writes why argument index of foreign isn't what it expected.
+static bool argumentError(ObjForeign const *foreign, int index,
+                          char const *expected, char *message, size_t size) {
+    snprintf(message, size, "Expected argument %d of %s to be %s.", index + 1,
+             foreign->name->chars, expected);
+    return false;
+}
+
+bool callForeign(ObjForeign const *foreign, int argCount, Value const *args,
+                 Value *result, char *message, size_t size) {
+    if (argCount != foreign->arity) {
+        snprintf(message, size, "Expected %d arguments but got %d.",
+                 foreign->arity, argCount);
+        return false;
+    }
+
+    intptr_t integers[INTEGER_REGISTERS] = {0};
+    double doubles[DOUBLE_REGISTERS] = {0};
+    int integerCount = 0;
+    int doubleCount = 0;
+    for (int i = 0; i < argCount; i++) {
+        switch (foreign->argumentTypes[i]) {
+            case FOREIGN_INT:
+                if (!IS_NUMBER(args[i])) {
+                    return argumentError(foreign, i, "a number", message,
+                                         size);
+                }
+                integers[integerCount++] = (int)AS_NUMBER(args[i]);
+                break;
+            case FOREIGN_LONG:
+                if (!IS_NUMBER(args[i])) {
+                    return argumentError(foreign, i, "a number", message,
+                                         size);
+                }
+                integers[integerCount++] = (long)AS_NUMBER(args[i]);
+                break;
+            case FOREIGN_DOUBLE:
+                if (!IS_NUMBER(args[i])) {
+                    return argumentError(foreign, i, "a number", message,
+                                         size);
+                }
+                doubles[doubleCount++] = AS_NUMBER(args[i]);
+                break;
+            case FOREIGN_STRING:
+                if (!IS_STRING(args[i])) {
+                    return argumentError(foreign, i, "a string", message,
+                                         size);
+                }
+                // The collector doesn't move strings, so C gets the text.
+                integers[integerCount++] = (intptr_t)AS_CSTRING(args[i]);
+                break;
+            case FOREIGN_BUFFER:
+                if (!IS_BYTEVECTOR(args[i])) {
+                    return argumentError(foreign, i, "a bytevector",
+                                         message, size);
+                }
+                integers[integerCount++] =
+                    (intptr_t)AS_BYTEVECTOR(args[i])->bytes;
+                break;
+            case FOREIGN_VOID:
+                UNREACHABLE();
+        }
+    }
+
+#define ARGUMENTS                                                          \
+    integers[0], integers[1], integers[2], integers[3], integers[4],       \
+        integers[5], doubles[0], doubles[1], doubles[2], doubles[3],       \
+        doubles[4], doubles[5], doubles[6], doubles[7]
+
+    if (FOREIGN_DOUBLE == foreign->resultType) {
+        *result = NUMBER_VAL(((DoubleStub)foreign->function)(ARGUMENTS));
+        return true;
+    }
+
+    intptr_t value = ((IntegerStub)foreign->function)(ARGUMENTS);
+    switch (foreign->resultType) {
+        case FOREIGN_INT:
+            *result = NUMBER_VAL((int)value);
+            break;
+        case FOREIGN_LONG:
+            *result = NUMBER_VAL((long)value);
+            break;
+        case FOREIGN_STRING: {
+            char const *text = (char const *)value;
+            *result = NULL == text
+                          ? BOOL_VAL(false)
+                          : OBJ_VAL(copyString(text, (int)strlen(text)));
+            break;
+        }
+        case FOREIGN_VOID:
+            *result = NIL_VAL;
+            break;
+        case FOREIGN_DOUBLE:
+        case FOREIGN_BUFFER:
+            UNREACHABLE();
+    }
+    return true;
+
+#undef ARGUMENTS
+}
+
+void freeFFI(void) {
+    for (int i = 0; i < libraryCount; i++) dlclose(libraries[i]);
+    free(libraries);
+    libraries = NULL;
+    libraryCount = 0;
+    libraryCapacity = 0;
+}
@@ -0,0 +1,64 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  The FFI calls functions of C libraries from Scheme without a NativeFn
+  written for each of them:
+
+    (define pow (c-function "libm.so.6" "pow" '(double double) 'double))
+    (pow 2 10)
+
+  c-function opens the library with dlopen, or looks in the program
+  itself if the library is #f, and finds the function with dlsym. The
+  argument and result types are the symbols int, long, double, string and
+  buffer, and void for a result. A string passes the text of a Scheme
+  string, which C must not change, since equal literals share one string.
+  A buffer passes the bytes of a bytevector for C to write into, no more
+  than bytevector-length of them. Neither is ever moved by the collector,
+  so C gets them without a copy. A string result is copied into a new
+  Scheme string, and NULL is #f.
+
+  Every function is called through one of two stubs, by the class of its
+  result. Integers and pointers go in the integer registers, in order, and
+  doubles in the floating point registers, so a call through a prototype
+  of six integers and eight doubles passes the arguments of any signature
+  which fits in them. This is how the x86-64 System V and AArch64
+  conventions work, and the FFI is only there on them.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "object.h"
+#include "value.h"
+
+// The native which defines foreign functions, as c-function.
+Value cFunctionNative(int argCount, Value *args);
+
+/*
+  Calls foreign with the argCount arguments at args, and sets *result to
+  what it returns. Returns false, and writes why into the size bytes at
+  message, if the arguments don't fit its types.
+*/
+bool callForeign(ObjForeign const *foreign, int argCount, Value const *args,
+                 Value *result, char *message, size_t size);
+
+// Closes the libraries c-function opened.
+void freeFFI(void);
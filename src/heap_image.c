@@ -0,0 +1,729 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "heap_image.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode_file.h"
+#include "chunk.h"
+#include "line_number.h"
+#include "memory.h"
+#include "object.h"
+#include "smart_array.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+  An image is an ImageHeader, the offset of each object in the file, the
+  globals, then the objects. Each global is the index of its name, then
+  its value.
+
+  An object is its ObjType in a byte, then:
+    string:   a uint32_t length, then the characters.
+    symbol:   like a string, then whether it is interned.
+    pair:     the car, then the cdr.
+    vector:   a uint32_t count, then the elements.
+    native:   the name it is defined as, like a string.
+    upvalue:  its closed value. Open upvalues can't be written.
+    closure:  the index of its function, a uint32_t count, then the index
+              of each upvalue.
+    function: a FunctionImage, then a uint32_t count and the constants.
+              Its code and line numbers are elsewhere, 8 byte aligned.
+    switch:   the int32_t default offset, a uint32_t count, then each key
+              followed by the int32_t offset it goes to.
+  A value is a ValueTag, then the 8 bytes of a number, the byte of a
+  character, or the uint32_t index of an object. Nothing but code and line
+  numbers is aligned.
+*/
+typedef struct {
+    char magic[4];  // "ECSI"
+    uint32_t version;
+    uint32_t objectCount;
+    uint32_t globalCount;
+    uint64_t size;  // Of the whole file.
+} ImageHeader;
+
+typedef struct {
+    int32_t arity;
+    int32_t requiredCount;
+    int32_t optionalCount;
+    int32_t hasRest;
+    int32_t upvalueCount;
+    int32_t maxStack;
+    int32_t callSiteCount;
+    uint32_t name;  // The index of the name, or NO_NAME.
+    uint32_t codeCount;
+    uint32_t lineCount;
+    uint64_t code;  // Offsets in the file.
+    uint64_t lines;
+} FunctionImage;
+
+#define NO_NAME UINT32_MAX
+
+typedef enum {
+    VALUE_NIL,
+    VALUE_TRUE,
+    VALUE_FALSE,
+    VALUE_NUMBER,
+    VALUE_CHARACTER,
+    VALUE_OBJECT,
+} ValueTag;
+
+// Where an object went in the image being written.
+typedef struct {
+    Obj *object;  // NULL if the entry is empty.
+    uint32_t index;
+} IndexEntry;
+
+// The image being written, and the objects in it in the order they go in.
+static _Thread_local SmartArray bytes;
+static _Thread_local SmartArray objects;
+static _Thread_local IndexEntry *indexes;
+static _Thread_local size_t indexCapacity;
+
+// The objects of the image being read, by index.
+static _Thread_local Obj **loaded;
+
+static uint32_t objectIndex(Obj *object);
+static bool addReferences(Obj *object);
+static void addValue(Value value);
+static void writeBytes(void const *data, size_t size);
+static void writeByte(uint8_t byte);
+static void writeUint32(uint32_t number);
+static void writeText(ObjString const *string);
+static void align(void);
+static void writeValue(Value value);
+static void writeObject(Obj *object);
+static void writeFunction(ObjFunction *function);
+static bool resolveNative(uint8_t const *cursor, int index);
+static Obj *makeObject(uint8_t const *base, uint8_t const *cursor);
+static void fillObject(Obj *object, uint8_t const *cursor);
+static Value readValue(uint8_t const **cursor);
+static uint32_t readUint32(uint8_t const **cursor);
+static int32_t readInt32(uint8_t const **cursor);
+
+bool writeHeapImage(char const *path) {
+    // Symbols which only the strings table holds mustn't be swept meanwhile.
+    bool wasCollecting = vm.gcState.isOn;
+    turnOffGarbageCollector();
+
+    initSmartArray(&bytes, smartArrayCheckedRealloc, sizeof(uint8_t));
+    initSmartArray(&objects, smartArrayCheckedRealloc, sizeof(Obj *));
+    indexCapacity = 64;
+    indexes = calloc(indexCapacity, sizeof(IndexEntry));
+    if (NULL == indexes) DIE("Not enough memory to write an image.");
+
+    uint32_t globalCount = 0;
+    for (int i = 0; i < vm.globals.capacity; i++) {
+        Entry const *entry = &vm.globals.entries[i];
+        if (NULL == entry->key) continue;
+        objectIndex((Obj *)entry->key);
+        addValue(entry->value);
+        globalCount++;
+    }
+    for (int i = 0; i < vm.strings.capacity; i++) {
+        Entry const *entry = &vm.strings.entries[i];
+        if (NULL != entry->key) objectIndex((Obj *)entry->key);
+    }
+
+    // Objects are added as they are first referred to, so this reaches all.
+    bool written = true;
+    for (size_t i = 0; i < getSmartArrayCount(&objects) && written; i++) {
+        written = addReferences(SMART_ARRAY_AT(&objects, i, Obj *));
+    }
+
+    if (written) {
+        uint32_t const COUNT = (uint32_t)getSmartArrayCount(&objects);
+        ImageHeader header = {.magic = {'E', 'C', 'S', 'I'},
+                              .version = HEAP_IMAGE_VERSION,
+                              .objectCount = COUNT,
+                              .globalCount = globalCount};
+        writeBytes(&header, sizeof(header));
+        size_t const OFFSETS = getSmartArrayCount(&bytes);
+        for (uint32_t i = 0; i < COUNT; i++) {
+            writeBytes(&(uint64_t){0}, sizeof(uint64_t));
+        }
+
+        for (int i = 0; i < vm.globals.capacity; i++) {
+            Entry const *entry = &vm.globals.entries[i];
+            if (NULL == entry->key) continue;
+            writeUint32(objectIndex((Obj *)entry->key));
+            writeValue(entry->value);
+        }
+
+        for (uint32_t i = 0; i < COUNT; i++) {
+            uint64_t offset = getSmartArrayCount(&bytes);
+            memcpy((uint8_t *)bytes.data + OFFSETS + i * sizeof(offset),
+                   &offset, sizeof(offset));
+            writeObject(SMART_ARRAY_AT(&objects, i, Obj *));
+        }
+
+        uint64_t size = getSmartArrayCount(&bytes);
+        memcpy((uint8_t *)bytes.data + offsetof(ImageHeader, size), &size,
+               sizeof(size));
+
+        FILE *file = fopen(path, "wb");
+        written = NULL != file && size == fwrite(bytes.data, 1, size, file);
+        if (NULL != file && 0 != fclose(file)) written = false;
+    }
+
+    free(indexes);
+    freeSmartArray(&objects);
+    freeSmartArray(&bytes);
+    if (wasCollecting) turnOnGarbageCollector();
+    return written;
+}
+
+/*
+  Returns the index of object in the image, giving it the next one if it
+  hasn't got one yet.
+*/
+static uint32_t objectIndex(Obj *object) {
+    size_t const MASK = indexCapacity - 1;
+    size_t i = ((uintptr_t)object >> 4) * 11400714819323198485u & MASK;
+    for (; NULL != indexes[i].object; i = (i + 1) & MASK) {
+        if (object == indexes[i].object) return indexes[i].index;
+    }
+
+    uint32_t index = (uint32_t)getSmartArrayCount(&objects);
+    indexes[i] = (IndexEntry){object, index};
+    smartArrayAppend(&objects, &object);
+
+    if (getSmartArrayCount(&objects) + 1 > indexCapacity * TABLE_MAX_LOAD) {
+        IndexEntry *old = indexes;
+        size_t const OLD_CAPACITY = indexCapacity;
+        indexCapacity *= 2;
+        indexes = calloc(indexCapacity, sizeof(IndexEntry));
+        if (NULL == indexes) DIE("Not enough memory to write an image.");
+
+        for (size_t j = 0; j < OLD_CAPACITY; j++) {
+            if (NULL == old[j].object) continue;
+            size_t k = ((uintptr_t)old[j].object >> 4) *
+                       11400714819323198485u & (indexCapacity - 1);
+            while (NULL != indexes[k].object) {
+                k = (k + 1) & (indexCapacity - 1);
+            }
+            indexes[k] = old[j];
+        }
+        free(old);
+    }
+    return index;
+}
+
+static void addValue(Value value) {
+    if (IS_OBJ(value)) objectIndex(AS_OBJ(value));
+}
+
+/*
+  Gives everything object refers to an index. Returns false if object
+  can't be written.
+*/
+static bool addReferences(Obj *object) {
+    switch (object->type) {
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *)object;
+            objectIndex((Obj *)closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                objectIndex((Obj *)closure->upvalues[i]);
+            }
+            return true;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *)object;
+            if (NULL != function->lazyBody) return false;
+            if (NULL != function->cachedConstants) {
+                loadCachedConstants(function);
+            }
+
+            if (NULL != function->name) objectIndex((Obj *)function->name);
+            ValueArray *constants = &(function->chunk.constants);
+            for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+                addValue(getValueArrayAt(constants, i));
+            }
+            return true;
+        }
+        case OBJ_PAIR:
+            addValue(((ObjPair *)object)->car);
+            addValue(((ObjPair *)object)->cdr);
+            return true;
+        case OBJ_VECTOR: {
+            ValueArray *elements = &(((ObjVector *)object)->array);
+            for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+                addValue(getValueArrayAt(elements, i));
+            }
+            return true;
+        }
+        case OBJ_UPVALUE: {
+            ObjUpvalue *upvalue = (ObjUpvalue *)object;
+            if (&(upvalue->closed) != upvalue->location) return false;
+            addValue(upvalue->closed);
+            return true;
+        }
+        case OBJ_SWITCH: {
+            ObjSwitch *table = (ObjSwitch *)object;
+            for (int i = 0; i < table->capacity; i++) {
+                if (-1 != table->cases[i].offset) {
+                    addValue(table->cases[i].key);
+                }
+            }
+            return true;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+        case OBJ_SYMBOL:
+        case OBJ_BYTEVECTOR:
+            return true;
+        case OBJ_SYNTAX:
+        case OBJ_PROCEDURE:
+        case OBJ_ENVIRONMENT:
+        case OBJ_FOREIGN:
+        case OBJ_CASE_LAMBDA:
+            return false;
+    }
+    return false;
+}
+
+static void writeBytes(void const *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        smartArrayAppend(&bytes, (uint8_t const *)data + i);
+    }
+}
+
+static void writeByte(uint8_t byte) { smartArrayAppend(&bytes, &byte); }
+
+static void writeUint32(uint32_t number) {
+    writeBytes(&number, sizeof(number));
+}
+
+// Writes the length and characters of string.
+static void writeText(ObjString const *string) {
+    writeUint32((uint32_t)string->length);
+    writeBytes(string->chars, string->length);
+}
+
+// Pads the image so that what is written next is 8 byte aligned.
+static void align(void) {
+    while (0 != getSmartArrayCount(&bytes) % sizeof(uint64_t)) writeByte(0);
+}
+
+static void writeValue(Value value) {
+    if (IS_NIL(value)) {
+        writeByte(VALUE_NIL);
+    } else if (IS_BOOL(value)) {
+        writeByte(AS_BOOL(value) ? VALUE_TRUE : VALUE_FALSE);
+    } else if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        writeByte(VALUE_NUMBER);
+        writeBytes(&number, sizeof(number));
+    } else if (IS_CHARACTER(value)) {
+        writeByte(VALUE_CHARACTER);
+        writeByte((uint8_t)AS_CHARACTER(value));
+    } else {
+        writeByte(VALUE_OBJECT);
+        writeUint32(objectIndex(AS_OBJ(value)));
+    }
+}
+
+static void writeObject(Obj *object) {
+    writeByte((uint8_t)object->type);
+    switch (object->type) {
+        case OBJ_STRING:
+            writeText((ObjString *)object);
+            break;
+        case OBJ_BYTEVECTOR: {
+            ObjBytevector const *bytevector = (ObjBytevector *)object;
+            writeUint32((uint32_t)bytevector->length);
+            writeBytes(bytevector->bytes, bytevector->length);
+            break;
+        }
+        case OBJ_SYMBOL:
+            writeText((ObjString *)object);
+            writeByte(symbolIsInterned((ObjSymbol *)object));
+            break;
+        case OBJ_PAIR:
+            writeValue(((ObjPair *)object)->car);
+            writeValue(((ObjPair *)object)->cdr);
+            break;
+        case OBJ_VECTOR: {
+            ValueArray *elements = &(((ObjVector *)object)->array);
+            writeUint32((uint32_t)getValueArrayCount(elements));
+            for (size_t i = 0; i < getValueArrayCount(elements); i++) {
+                writeValue(getValueArrayAt(elements, i));
+            }
+            break;
+        }
+        case OBJ_NATIVE:
+            writeText(((ObjNative *)object)->name);
+            break;
+        case OBJ_UPVALUE:
+            writeValue(((ObjUpvalue *)object)->closed);
+            break;
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *)object;
+            writeUint32(objectIndex((Obj *)closure->function));
+            writeUint32((uint32_t)closure->upvalueCount);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                writeUint32(objectIndex((Obj *)closure->upvalues[i]));
+            }
+            break;
+        }
+        case OBJ_FUNCTION:
+            writeFunction((ObjFunction *)object);
+            break;
+        case OBJ_SWITCH: {
+            ObjSwitch const *table = (ObjSwitch *)object;
+            int const CAPACITY =
+                table->integerCount + table->characterCount + table->capacity;
+            Value *keys = ALLOCATE(Value, CAPACITY);
+            int *offsets = ALLOCATE(int, CAPACITY);
+            int count = switchCases(table, keys, offsets);
+
+            int32_t defaultOffset = table->defaultOffset;
+            writeBytes(&defaultOffset, sizeof(defaultOffset));
+            writeUint32((uint32_t)count);
+            for (int i = 0; i < count; i++) {
+                writeValue(keys[i]);
+                int32_t offset = offsets[i];
+                writeBytes(&offset, sizeof(offset));
+            }
+
+            FREE_ARRAY(Value, keys, CAPACITY);
+            FREE_ARRAY(int, offsets, CAPACITY);
+            break;
+        }
+        case OBJ_SYNTAX:
+        case OBJ_PROCEDURE:
+        case OBJ_ENVIRONMENT:
+        case OBJ_FOREIGN:
+        case OBJ_CASE_LAMBDA:
+            // addReferences() refused these.
+            break;
+    }
+}
+
+static void writeFunction(ObjFunction *function) {
+    Chunk *chunk = &(function->chunk);
+    FunctionImage image = {
+        .arity = function->arity,
+        .requiredCount = function->parameters.requiredCount,
+        .optionalCount = function->parameters.optionalCount,
+        .hasRest = function->parameters.hasRest,
+        .upvalueCount = function->upvalueCount,
+        .maxStack = function->maxStack,
+        .callSiteCount = function->callSiteCount,
+        .name = NULL == function->name ? NO_NAME
+                                       : objectIndex((Obj *)function->name),
+        .codeCount = (uint32_t)getChunkCount(chunk),
+        .lineCount = (uint32_t)getSmartArrayCount(&(chunk->lines))};
+    size_t const AT = getSmartArrayCount(&bytes);
+    writeBytes(&image, sizeof(image));
+
+    ValueArray *constants = &(chunk->constants);
+    writeUint32((uint32_t)getValueArrayCount(constants));
+    for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+        writeValue(getValueArrayAt(constants, i));
+    }
+
+    align();
+    image.code = getSmartArrayCount(&bytes);
+    writeBytes(getChunkCode(chunk), image.codeCount);
+    align();
+    image.lines = getSmartArrayCount(&bytes);
+    for (uint32_t i = 0; i < image.lineCount; i++) {
+        LineNumber line = getLineNumberArrayAt(&(chunk->lines), i);
+        writeBytes(&line, sizeof(line));
+    }
+    memcpy((uint8_t *)bytes.data + AT, &image, sizeof(image));
+}
+
+bool readHeapImage(char const *path) {
+    size_t size;
+    uint8_t *base = mapFile(path, &size);
+    if (NULL == base) return false;
+
+    ImageHeader const *header = (ImageHeader const *)base;
+    size_t const OFFSETS = sizeof(ImageHeader);
+    bool valid = sizeof(ImageHeader) <= size &&
+                 0 == memcmp(header->magic, "ECSI", sizeof(header->magic)) &&
+                 HEAP_IMAGE_VERSION == header->version &&
+                 size == header->size &&
+                 OFFSETS + header->objectCount * sizeof(uint64_t) <= size;
+
+    uint64_t const *offsets = (uint64_t const *)(base + OFFSETS);
+    for (uint32_t i = 0; valid && i < header->objectCount; i++) {
+        valid = offsets[i] < size;
+    }
+
+    bool wasCollecting = vm.gcState.isOn;
+    turnOffGarbageCollector();
+    if (valid) {
+        loaded = checkedMalloc(header->objectCount * sizeof(Obj *));
+        // Natives go first, as the image can't be used if one is missing.
+        for (uint32_t i = 0; valid && i < header->objectCount; i++) {
+            uint8_t const *cursor = base + offsets[i];
+            if (OBJ_NATIVE == *cursor) valid = resolveNative(cursor + 1, i);
+        }
+    }
+
+    if (!valid) {
+        free(loaded);
+        loaded = NULL;
+        if (wasCollecting) turnOnGarbageCollector();
+        unmapFile(base);
+        return false;
+    }
+
+    // Closures are made last, from the functions they close over.
+    for (uint32_t i = 0; i < header->objectCount; i++) {
+        ObjType type = base[offsets[i]];
+        if (OBJ_NATIVE != type && OBJ_CLOSURE != type) {
+            loaded[i] = makeObject(base, base + offsets[i]);
+        }
+    }
+    for (uint32_t i = 0; i < header->objectCount; i++) {
+        if (OBJ_CLOSURE == base[offsets[i]]) {
+            loaded[i] = makeObject(base, base + offsets[i]);
+        }
+    }
+    for (uint32_t i = 0; i < header->objectCount; i++) {
+        fillObject(loaded[i], base + offsets[i] + 1);
+    }
+
+    uint8_t const *cursor = base + OFFSETS + header->objectCount *
+                                                 sizeof(uint64_t);
+    for (uint32_t i = 0; i < header->globalCount; i++) {
+        ObjSymbol *name = (ObjSymbol *)loaded[readUint32(&cursor)];
+        tableSet(&vm.globals, name, readValue(&cursor));
+    }
+
+    free(loaded);
+    loaded = NULL;
+    if (wasCollecting) turnOnGarbageCollector();
+    return true;
+}
+
+/*
+  Makes the index'th object the native of the VM which has the name at
+  cursor. Returns false if the VM has no such native.
+*/
+static bool resolveNative(uint8_t const *cursor, int index) {
+    uint32_t length = readUint32(&cursor);
+    ObjSymbol *name = newSymbol((char const *)cursor, (int)length);
+    Value native;
+    if (!tableGet(&vm.globals, name, &native) || !IS_NATIVE(native) ||
+        ((ObjNative *)AS_OBJ(native))->name != name) {
+        return false;
+    }
+    loaded[index] = AS_OBJ(native);
+    return true;
+}
+
+/*
+  Makes the object at cursor, without the objects it refers to, which
+  fillObject() adds once they are all made.
+*/
+static Obj *makeObject(uint8_t const *base, uint8_t const *cursor) {
+    ObjType type = *cursor++;
+    switch (type) {
+        case OBJ_STRING: {
+            uint32_t length = readUint32(&cursor);
+            return (Obj *)copyString((char const *)cursor, (int)length);
+        }
+        case OBJ_BYTEVECTOR: {
+            uint32_t length = readUint32(&cursor);
+            ObjBytevector *bytevector = newBytevector((int)length);
+            memcpy(bytevector->bytes, cursor, length);
+            return (Obj *)bytevector;
+        }
+        case OBJ_SYMBOL: {
+            uint32_t length = readUint32(&cursor);
+            ObjSymbol *symbol = newSymbol((char const *)cursor, (int)length);
+            bool interned = cursor[length];
+            return (Obj *)(interned ? symbol : newUninternedSymbol(symbol));
+        }
+        case OBJ_PAIR:
+            return (Obj *)newPair(NIL_VAL, NIL_VAL);
+        case OBJ_VECTOR:
+            return (Obj *)newVector();
+        case OBJ_UPVALUE: {
+            ObjUpvalue *upvalue = newUpvalue(NULL);
+            upvalue->location = &(upvalue->closed);
+            return (Obj *)upvalue;
+        }
+        case OBJ_CLOSURE: {
+            uint32_t function = readUint32(&cursor);
+            return (Obj *)newClosure((ObjFunction *)loaded[function]);
+        }
+        case OBJ_FUNCTION: {
+            FunctionImage image;
+            memcpy(&image, cursor, sizeof(image));
+            ObjFunction *function = newFunction();
+            function->arity = image.arity;
+            function->parameters =
+                (Parameters){.requiredCount = image.requiredCount,
+                             .optionalCount = image.optionalCount,
+                             .hasRest = image.hasRest};
+            function->upvalueCount = image.upvalueCount;
+            function->maxStack = image.maxStack;
+
+            Chunk *chunk = &(function->chunk);
+            chunk->code = (SmartArray){.count = image.codeCount,
+                                       .capacity = image.codeCount,
+                                       .elementSize = sizeof(uint8_t),
+                                       .reallocater = mappedReallocate,
+                                       .data = (void *)(base + image.code)};
+            chunk->lines =
+                (LineNumberArray){.count = image.lineCount,
+                                  .capacity = image.lineCount,
+                                  .elementSize = sizeof(LineNumber),
+                                  .reallocater = mappedReallocate,
+                                  .data = (void *)(base + image.lines)};
+
+            function->callSiteCount = image.callSiteCount;
+            if (function->callSiteCount > 0) {
+                function->callCaches =
+                    ALLOCATE(CallCache, function->callSiteCount);
+                for (int i = 0; i < function->callSiteCount; i++) {
+                    function->callCaches[i] =
+                        (CallCache){.function = NULL, .code = NULL};
+                }
+            }
+            return (Obj *)function;
+        }
+        case OBJ_SWITCH:
+            return (Obj *)newSwitch();
+        case OBJ_NATIVE:
+        case OBJ_SYNTAX:
+        case OBJ_PROCEDURE:
+        case OBJ_ENVIRONMENT:
+        case OBJ_FOREIGN:
+        case OBJ_CASE_LAMBDA:
+            break;
+    }
+    return NULL;
+}
+
+// Adds the objects object refers to, from cursor, just after its type.
+static void fillObject(Obj *object, uint8_t const *cursor) {
+    switch (object->type) {
+        case OBJ_PAIR:
+            ((ObjPair *)object)->car = readValue(&cursor);
+            ((ObjPair *)object)->cdr = readValue(&cursor);
+            break;
+        case OBJ_VECTOR: {
+            uint32_t count = readUint32(&cursor);
+            for (uint32_t i = 0; i < count; i++) {
+                vectorAppend((ObjVector *)object, readValue(&cursor));
+            }
+            break;
+        }
+        case OBJ_UPVALUE:
+            ((ObjUpvalue *)object)->closed = readValue(&cursor);
+            break;
+        case OBJ_CLOSURE: {
+            ObjClosure *closure = (ObjClosure *)object;
+            cursor += sizeof(uint32_t);
+            uint32_t count = readUint32(&cursor);
+            for (uint32_t i = 0; i < count; i++) {
+                closure->upvalues[i] =
+                    (ObjUpvalue *)loaded[readUint32(&cursor)];
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction *function = (ObjFunction *)object;
+            FunctionImage image;
+            memcpy(&image, cursor, sizeof(image));
+            cursor += sizeof(image);
+            if (NO_NAME != image.name) {
+                function->name = (ObjSymbol *)loaded[image.name];
+            }
+
+            uint32_t count = readUint32(&cursor);
+            for (uint32_t i = 0; i < count; i++) {
+                writeValueArray(&(function->chunk.constants),
+                                readValue(&cursor));
+            }
+            break;
+        }
+        case OBJ_SWITCH: {
+            ObjSwitch *table = (ObjSwitch *)object;
+            table->defaultOffset = readInt32(&cursor);
+            uint32_t count = readUint32(&cursor);
+            for (uint32_t i = 0; i < count; i++) {
+                Value key = readValue(&cursor);
+                switchAddCase(table, key, readInt32(&cursor));
+            }
+            switchMakeDense(table);
+            break;
+        }
+        case OBJ_STRING:
+        case OBJ_SYMBOL:
+        case OBJ_BYTEVECTOR:
+        case OBJ_NATIVE:
+        case OBJ_SYNTAX:
+        case OBJ_PROCEDURE:
+        case OBJ_ENVIRONMENT:
+        case OBJ_FOREIGN:
+        case OBJ_CASE_LAMBDA:
+            break;
+    }
+}
+
+static Value readValue(uint8_t const **cursor) {
+    ValueTag tag = *(*cursor)++;
+    switch (tag) {
+        case VALUE_NIL:
+            return NIL_VAL;
+        case VALUE_TRUE:
+            return BOOL_VAL(true);
+        case VALUE_FALSE:
+            return BOOL_VAL(false);
+        case VALUE_NUMBER: {
+            double number;
+            memcpy(&number, *cursor, sizeof(number));
+            *cursor += sizeof(number);
+            return NUMBER_VAL(number);
+        }
+        case VALUE_CHARACTER:
+            return CHARACTER_VAL((char)*(*cursor)++);
+        case VALUE_OBJECT:
+            return OBJ_VAL(loaded[readUint32(cursor)]);
+    }
+    return NIL_VAL;
+}
+
+static uint32_t readUint32(uint8_t const **cursor) {
+    uint32_t number;
+    memcpy(&number, *cursor, sizeof(number));
+    *cursor += sizeof(number);
+    return number;
+}
+
+static int32_t readInt32(uint8_t const **cursor) {
+    int32_t number;
+    memcpy(&number, *cursor, sizeof(number));
+    *cursor += sizeof(number);
+    return number;
+}
@@ -0,0 +1,51 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  Heap images, which hold the globals of a VM, every interned symbol, and
+  everything they refer to, so that a prelude can be loaded once and then
+  mapped into every VM which needs it. ecsi --dump-image writes one after
+  running a prelude, and ecsi --image starts from one.
+
+  Objects refer to each other by index in the image, and are relocated to
+  new objects when it is read. The code and line numbers of functions are
+  used where they lie in the mapping, which shares its pages with every
+  process which maps the same image until they are quickened.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+// Changes whenever the format or the meaning of the bytecode does.
+#define HEAP_IMAGE_VERSION 2
+
+/*
+  Writes the globals and interned symbols of the VM, and everything they
+  refer to, to the file at path. Returns false if it couldn't, or if they
+  refer to something which can't be written: a function whose body hasn't
+  been compiled, an open upvalue, or an object of the closure engine.
+*/
+bool writeHeapImage(char const *path);
+
+/*
+  Maps the image at path, and defines its globals and interns its symbols
+  in the VM. Returns false, leaving the VM as it was, if there is no such
+  file, it isn't an image, or it uses a native the VM doesn't have.
+*/
+bool readHeapImage(char const *path);
@@ -0,0 +1,928 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "jit.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "chunk.h"
+#include "memory.h"
+
+JitOptions jitOptions = {.enabled = false};
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(NAN_BOXING)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+  The machine code keeps the frame it runs in rbx and the address of vm in
+  r12. Values on the stack are read and written in place, so the layout of
+  Value is part of the templates.
+*/
+_Static_assert(16 == sizeof(Value), "Values must be 16 bytes.");
+_Static_assert(0 == offsetof(Value, type), "The type must come first.");
+_Static_assert(8 == offsetof(Value, as), "The payload must come second.");
+
+#define VM_FIELD(field) ((uint32_t)offsetof(VM, field))
+#define FRAME_FIELD(field) ((uint8_t)offsetof(CallFrame, field))
+
+// Condition codes of jcc, for emitJumpTo() and emitForwardJump().
+#define JUMP 0xE9
+#define JUMP_IF_EQUAL 0x84
+#define JUMP_IF_NOT_EQUAL 0x85
+#define JUMP_IF_ABOVE_OR_EQUAL 0x83
+
+// How machine code gives control back to enterJit().
+typedef enum {
+    JIT_EXIT,   // frame->ip is the next instruction for run().
+    JIT_ERROR,  // A runtime error was reported.
+} JitStatus;
+
+// Compiled code, which starts running at start.
+typedef JitStatus (*JitFunction)(CallFrame *frame, void const *start);
+
+/*
+  A function which the machine code calls with its frame and two operands.
+  It returns false after reporting a runtime error, if it can fail.
+*/
+typedef bool (*JitHelper)(CallFrame *frame, int a, int b);
+
+struct JitCode {
+    uint8_t *native;    // The machine code, or NULL if it can't be made.
+    size_t size;        // The size of the mapping at native.
+    uint32_t *entries;  // The offset in native of each instruction.
+    size_t count;       // The number of bytes of bytecode.
+};
+
+// Marks offsets in bytecode that don't start an instruction.
+#define NOT_AN_ENTRY UINT32_MAX
+
+// Refers to the error exit, instead of an offset in bytecode.
+#define ERROR_TARGET (-1)
+
+// A rel32 operand which must be filled in once all code is emitted.
+typedef struct {
+    size_t at;   // The offset of the operand in the code.
+    int target;  // A bytecode offset, or ERROR_TARGET.
+} JitPatch;
+
+// The state of compiling one function.
+typedef struct {
+    Chunk *chunk;
+    uint8_t *code;
+    size_t count;
+    size_t capacity;
+    JitPatch *patches;
+    size_t patchCount;
+    size_t patchCapacity;
+} Assembler;
+
+// Whether the system lets us map executable memory.
+static _Thread_local bool executableMemoryWorks = true;
+
+static JitCode *compileFunction(ObjFunction *function);
+static bool assemble(Assembler *assembler, uint32_t *entries);
+static void emitInstruction(Assembler *assembler, int offset);
+static bool installCode(JitCode *jitCode, Assembler const *assembler);
+static JitFunction entryPoint(uint8_t *native);
+static void writePerfMap(ObjFunction *function, JitCode const *jitCode);
+
+static void emitByte(Assembler *assembler, uint8_t byte);
+static void emitBytes(Assembler *assembler, int count, ...);
+static void emitU32(Assembler *assembler, uint32_t value);
+static void emitU64(Assembler *assembler, uint64_t value);
+static void emitCallAddress(Assembler *assembler, uintptr_t address, int a,
+                            int b);
+static void emitCallHelper(Assembler *assembler, JitHelper helper, int a,
+                           int b);
+static void emitSetIp(Assembler *assembler, uint8_t *ip);
+static size_t emitJumpOpcode(Assembler *assembler, uint8_t condition);
+static void emitJumpTo(Assembler *assembler, uint8_t condition, int target);
+static size_t emitForwardJump(Assembler *assembler, uint8_t condition);
+static void patchHere(Assembler *assembler, size_t at);
+static void emitExit(Assembler *assembler, JitStatus status);
+static void emitFallibleCall(Assembler *assembler, JitHelper helper, int a,
+                             int b, uint8_t *next);
+
+static void emitLoadStackTop(Assembler *assembler);
+static void emitStoreStackTop(Assembler *assembler);
+static size_t emitRoomCheck(Assembler *assembler, int count);
+static void emitPushValue(Assembler *assembler, Value value,
+                          JitHelper helper, int a);
+static void emitGetLocals(Assembler *assembler, int first, int second);
+static void emitSetLocal(Assembler *assembler, int slot);
+static void emitPop(Assembler *assembler);
+static void emitBinaryOp(Assembler *assembler, uint8_t opcode, uint8_t *next);
+static void emitBinaryOpConstant(Assembler *assembler, uint8_t opcode,
+                                 int index, uint8_t *next);
+static void emitJumpIfFalse(Assembler *assembler, bool popCondition,
+                            int target);
+
+static bool pushConstant(CallFrame *frame, int index, int unused);
+static bool pushLiteral(CallFrame *frame, int opcode, int unused);
+static bool getLocal(CallFrame *frame, int slot, int unused);
+static bool getLocal2(CallFrame *frame, int first, int second);
+static bool getGlobal(CallFrame *frame, int index, int unused);
+static bool setGlobal(CallFrame *frame, int index, int unused);
+static bool defineGlobal(CallFrame *frame, int index, int unused);
+static bool getUpvalue(CallFrame *frame, int slot, int unused);
+static bool setUpvalue(CallFrame *frame, int slot, int unused);
+static bool makeClosure(CallFrame *frame, int offset, int unused);
+static bool closeUpvalue(CallFrame *frame, int unused1, int unused2);
+static bool closeScope(CallFrame *frame, int slot, int keep);
+static bool binaryOp(CallFrame *frame, int opcode, int unused);
+static bool binaryOpConstant(CallFrame *frame, int opcode, int index);
+static void const *switchTarget(CallFrame *frame, int index, int end);
+
+bool enterJit(CallFrame *frame) {
+    if (!executableMemoryWorks) return true;
+
+    ObjFunction *function = frame->closure->function;
+    if (NULL == function->jitCode) {
+        function->jitCode = compileFunction(function);
+    }
+
+    JitCode *jitCode = function->jitCode;
+    if (NULL == jitCode->native) return true;
+
+    size_t offset = frame->ip - getChunkCode(&(function->chunk));
+    if (offset >= jitCode->count || NOT_AN_ENTRY == jitCode->entries[offset]) {
+        return true;
+    }
+
+    JitFunction run = entryPoint(jitCode->native);
+    return JIT_ERROR != run(frame, jitCode->native + jitCode->entries[offset]);
+}
+
+void freeJitCode(JitCode *code) {
+    if (NULL != code->native) munmap(code->native, code->size);
+    FREE_ARRAY(uint32_t, code->entries, code->count);
+    FREE(JitCode, code);
+}
+
+/*
+  Translates function to machine code. If that can't be done, the result
+  has no native code, so function keeps running in the interpreter.
+*/
+static JitCode *compileFunction(ObjFunction *function) {
+    JitCode *jitCode = ALLOCATE(JitCode, 1);
+    jitCode->native = NULL;
+    jitCode->size = 0;
+    jitCode->count = getChunkCount(&(function->chunk));
+    jitCode->entries = ALLOCATE(uint32_t, jitCode->count);
+    for (size_t i = 0; i < jitCode->count; i++) {
+        jitCode->entries[i] = NOT_AN_ENTRY;
+    }
+
+    Assembler assembler = {.chunk = &(function->chunk)};
+    if (assemble(&assembler, jitCode->entries) &&
+        installCode(jitCode, &assembler)) {
+        writePerfMap(function, jitCode);
+    }
+
+    free(assembler.code);
+    free(assembler.patches);
+    return jitCode;
+}
+
+/*
+  Emits the code for every instruction in the chunk, recording where each
+  one starts in entries. Returns false if a jump can't be resolved.
+*/
+static bool assemble(Assembler *assembler, uint32_t *entries) {
+    int const COUNT = (int)getChunkCount(assembler->chunk);
+
+    // push rbx; push r12; push rbp; mov rbx, rdi; mov r12, &vm; jmp rsi
+    // Pushing three registers keeps the stack aligned for helper calls.
+    // &vm is this thread's VM, which is the only one that runs the code.
+    emitBytes(assembler, 5, 0x53, 0x41, 0x54, 0x55, 0x48);
+    emitBytes(assembler, 4, 0x89, 0xFB, 0x49, 0xBC);
+    emitU64(assembler, (uint64_t)(uintptr_t)&vm);
+    emitBytes(assembler, 2, 0xFF, 0xE6);
+
+    for (int offset = 0; offset < COUNT;
+         offset += instructionLength(assembler->chunk, offset)) {
+        entries[offset] = (uint32_t)assembler->count;
+        emitInstruction(assembler, offset);
+    }
+
+    size_t const ERROR_EXIT = assembler->count;
+    emitExit(assembler, JIT_ERROR);
+
+    for (size_t i = 0; i < assembler->patchCount; i++) {
+        JitPatch patch = assembler->patches[i];
+        size_t destination = ERROR_EXIT;
+        if (ERROR_TARGET != patch.target) {
+            if (patch.target < 0 || patch.target >= COUNT ||
+                NOT_AN_ENTRY == entries[patch.target]) {
+                return false;
+            }
+            destination = entries[patch.target];
+        }
+        int32_t relative = (int32_t)(destination - (patch.at + 4));
+        memcpy(assembler->code + patch.at, &relative, sizeof(relative));
+    }
+    return true;
+}
+
+// Emits the template of the instruction at offset.
+static void emitInstruction(Assembler *assembler, int offset) {
+    uint8_t *ip = getChunkCode(assembler->chunk) + offset;
+    int const END = offset + instructionLength(assembler->chunk, offset);
+    uint8_t *next = getChunkCode(assembler->chunk) + END;
+    ValueArray *constants = &(assembler->chunk->constants);
+
+    switch (ip[0]) {
+        case OP_CONSTANT:
+            emitPushValue(assembler, getValueArrayAt(constants, ip[1]),
+                          pushConstant, ip[1]);
+            break;
+        case OP_CONSTANT_LONG: {
+            int index = (ip[1] << 16) | (ip[2] << 8) | ip[3];
+            emitPushValue(assembler, getValueArrayAt(constants, index),
+                          pushConstant, index);
+            break;
+        }
+        case OP_NIL:
+            emitPushValue(assembler, NIL_VAL, pushLiteral, OP_NIL);
+            break;
+        case OP_TRUE:
+            emitPushValue(assembler, BOOL_VAL(true), pushLiteral, OP_TRUE);
+            break;
+        case OP_FALSE:
+            emitPushValue(assembler, BOOL_VAL(false), pushLiteral, OP_FALSE);
+            break;
+        case OP_POP:
+            emitPop(assembler);
+            break;
+        case OP_GET_LOCAL:
+            emitGetLocals(assembler, ip[1], -1);
+            break;
+        case OP_GET_LOCAL_2:
+            emitGetLocals(assembler, ip[1], ip[2]);
+            break;
+        case OP_SET_LOCAL:
+            emitSetLocal(assembler, ip[1]);
+            break;
+        case OP_GET_GLOBAL:
+            emitFallibleCall(assembler, getGlobal, ip[1], 0, next);
+            break;
+        case OP_SET_GLOBAL:
+            emitFallibleCall(assembler, setGlobal, ip[1], 0, next);
+            break;
+        case OP_DEFINE_GLOBAL:
+            emitCallHelper(assembler, defineGlobal, ip[1], 0);
+            break;
+        case OP_GET_UPVALUE:
+            emitCallHelper(assembler, getUpvalue, ip[1], 0);
+            break;
+        case OP_SET_UPVALUE:
+            emitCallHelper(assembler, setUpvalue, ip[1], 0);
+            break;
+        case OP_CLOSURE:
+            emitCallHelper(assembler, makeClosure, offset, 0);
+            break;
+        case OP_CLOSE_UPVALUE:
+            emitCallHelper(assembler, closeUpvalue, 0, 0);
+            break;
+        case OP_CLOSE_SCOPE:
+            emitCallHelper(assembler, closeScope, ip[1], ip[2]);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NUMBER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+            emitBinaryOp(assembler, ip[0], next);
+            break;
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+            emitBinaryOpConstant(assembler, ip[0], ip[1], next);
+            break;
+        case OP_JUMP:
+            emitJumpTo(assembler, JUMP, END + ((ip[1] << 8) | ip[2]));
+            break;
+        case OP_LOOP:
+            emitJumpTo(assembler, JUMP, END - ((ip[1] << 8) | ip[2]));
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_FALSE:
+            emitJumpIfFalse(assembler, OP_POP_JUMP_IF_FALSE == ip[0],
+                            END + ((ip[1] << 8) | ip[2]));
+            break;
+        case OP_CLOSE_SCOPE_LOOP:
+            emitCallHelper(assembler, closeScope, ip[1], ip[2]);
+            emitJumpTo(assembler, JUMP, END - ((ip[3] << 8) | ip[4]));
+            break;
+        case OP_SWITCH:
+            emitCallAddress(assembler, (uintptr_t)switchTarget, ip[1], END);
+            // jmp rax
+            emitBytes(assembler, 2, 0xFF, 0xE0);
+            break;
+        default:
+            // Calls and returns change frames, so run() does them.
+            emitSetIp(assembler, ip);
+            emitExit(assembler, JIT_EXIT);
+            break;
+    }
+}
+
+/*
+  Copies the assembled code into executable memory. If the system doesn't
+  allow that, the JIT is turned off for the rest of the process.
+*/
+static bool installCode(JitCode *jitCode, Assembler const *assembler) {
+    long const PAGE = sysconf(_SC_PAGESIZE);
+    size_t size = (assembler->count + PAGE - 1) / PAGE * PAGE;
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == memory) {
+        executableMemoryWorks = false;
+        return false;
+    }
+
+    memcpy(memory, assembler->code, assembler->count);
+    if (0 != mprotect(memory, size, PROT_READ | PROT_EXEC)) {
+        munmap(memory, size);
+        executableMemoryWorks = false;
+        return false;
+    }
+
+    jitCode->native = memory;
+    jitCode->size = size;
+    return true;
+}
+
+/*
+  Returns the machine code at native as a function. ISO C has no cast
+  from a data pointer to a function pointer, so the address is copied.
+*/
+static JitFunction entryPoint(uint8_t *native) {
+    _Static_assert(sizeof(JitFunction) == sizeof(native),
+                   "Code and data addresses must be the same size.");
+    JitFunction run;
+    memcpy(&run, &native, sizeof(run));
+    return run;
+}
+
+// Tells perf the name of function's machine code.
+static void writePerfMap(ObjFunction *function, JitCode const *jitCode) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    FILE *map = fopen(path, "a");
+    if (NULL == map) return;
+
+    fprintf(map, "%lx %zx scheme:%s\n", (unsigned long)jitCode->native,
+            jitCode->size,
+            NULL == function->name ? "script" : function->name->chars);
+    fclose(map);
+}
+
+static void emitByte(Assembler *assembler, uint8_t byte) {
+    if (assembler->count == assembler->capacity) {
+        assembler->capacity = GROW_CAPACITY(assembler->capacity);
+        assembler->code =
+            checkedRealloc(assembler->code, assembler->capacity);
+    }
+    assembler->code[assembler->count++] = byte;
+}
+
+static void emitBytes(Assembler *assembler, int count, ...) {
+    va_list bytes;
+    va_start(bytes, count);
+    for (int i = 0; i < count; i++) {
+        emitByte(assembler, (uint8_t)va_arg(bytes, int));
+    }
+    va_end(bytes);
+}
+
+static void emitU32(Assembler *assembler, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(assembler, (value >> (8 * i)) & 0xFF);
+}
+
+static void emitU64(Assembler *assembler, uint64_t value) {
+    emitU32(assembler, (uint32_t)value);
+    emitU32(assembler, (uint32_t)(value >> 32));
+}
+
+// Calls the function at address with (frame, a, b), leaving its result in rax.
+static void emitCallAddress(Assembler *assembler, uintptr_t address, int a,
+                            int b) {
+    // mov rdi, rbx
+    emitBytes(assembler, 3, 0x48, 0x89, 0xDF);
+    // mov esi, a
+    emitByte(assembler, 0xBE);
+    emitU32(assembler, (uint32_t)a);
+    // mov edx, b
+    emitByte(assembler, 0xBA);
+    emitU32(assembler, (uint32_t)b);
+    // mov rax, address; call rax
+    emitBytes(assembler, 2, 0x48, 0xB8);
+    emitU64(assembler, (uint64_t)address);
+    emitBytes(assembler, 2, 0xFF, 0xD0);
+}
+
+// Calls helper(frame, a, b), leaving its result in al.
+static void emitCallHelper(Assembler *assembler, JitHelper helper, int a,
+                           int b) {
+    emitCallAddress(assembler, (uintptr_t)helper, a, b);
+}
+
+// Stores ip in frame->ip.
+static void emitSetIp(Assembler *assembler, uint8_t *ip) {
+    // mov rax, ip; mov [rbx + ip], rax
+    emitBytes(assembler, 2, 0x48, 0xB8);
+    emitU64(assembler, (uint64_t)(uintptr_t)ip);
+    emitBytes(assembler, 4, 0x48, 0x89, 0x43, FRAME_FIELD(ip));
+}
+
+// Emits a jmp or jcc with a rel32 operand, which is left for the caller.
+static size_t emitJumpOpcode(Assembler *assembler, uint8_t condition) {
+    if (JUMP != condition) emitByte(assembler, 0x0F);
+    emitByte(assembler, condition);
+    emitU32(assembler, 0);
+    return assembler->count - 4;
+}
+
+// Emits a jump to the instruction at the bytecode offset target.
+static void emitJumpTo(Assembler *assembler, uint8_t condition, int target) {
+    size_t at = emitJumpOpcode(assembler, condition);
+    if (assembler->patchCount == assembler->patchCapacity) {
+        assembler->patchCapacity = GROW_CAPACITY(assembler->patchCapacity);
+        assembler->patches =
+            checkedRealloc(assembler->patches,
+                           assembler->patchCapacity * sizeof(JitPatch));
+    }
+    assembler->patches[assembler->patchCount++] =
+        (JitPatch){.at = at, .target = target};
+}
+
+// Emits a jump within a template, which patchHere() points later.
+static size_t emitForwardJump(Assembler *assembler, uint8_t condition) {
+    return emitJumpOpcode(assembler, condition);
+}
+
+// Points the forward jump whose operand is at at to the next code emitted.
+static void patchHere(Assembler *assembler, size_t at) {
+    int32_t relative = (int32_t)(assembler->count - (at + 4));
+    memcpy(assembler->code + at, &relative, sizeof(relative));
+}
+
+static void emitExit(Assembler *assembler, JitStatus status) {
+    // mov eax, status; pop rbp; pop r12; pop rbx; ret
+    emitByte(assembler, 0xB8);
+    emitU32(assembler, (uint32_t)status);
+    emitBytes(assembler, 5, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+}
+
+/*
+  Calls a helper which returns false after reporting a runtime error. The
+  error is reported at the instruction before next.
+*/
+static void emitFallibleCall(Assembler *assembler, JitHelper helper, int a,
+                             int b, uint8_t *next) {
+    emitSetIp(assembler, next);
+    emitCallHelper(assembler, helper, a, b);
+    // test al, al; jz error
+    emitBytes(assembler, 2, 0x84, 0xC0);
+    emitJumpTo(assembler, JUMP_IF_EQUAL, ERROR_TARGET);
+}
+
+static void emitLoadStackTop(Assembler *assembler) {
+    // mov rcx, [r12 + stackTop]
+    emitBytes(assembler, 4, 0x49, 0x8B, 0x8C, 0x24);
+    emitU32(assembler, VM_FIELD(stackTop));
+}
+
+static void emitStoreStackTop(Assembler *assembler) {
+    // mov [r12 + stackTop], rcx
+    emitBytes(assembler, 4, 0x49, 0x89, 0x8C, 0x24);
+    emitU32(assembler, VM_FIELD(stackTop));
+}
+
+/*
+  Loads the stack top into rcx and jumps, through the returned operand, if
+  pushing count values would have to grow the stack.
+*/
+static size_t emitRoomCheck(Assembler *assembler, int count) {
+    emitLoadStackTop(assembler);
+    // mov rax, rcx; sub rax, [r12 + stack]; sar rax, 4
+    emitBytes(assembler, 7, 0x48, 0x89, 0xC8, 0x49, 0x2B, 0x84, 0x24);
+    emitU32(assembler, VM_FIELD(stack));
+    emitBytes(assembler, 4, 0x48, 0xC1, 0xF8, 0x04);
+    // add rax, count - 1
+    if (count > 1) emitBytes(assembler, 4, 0x48, 0x83, 0xC0, count - 1);
+    // cmp rax, [r12 + stackCapacity]
+    emitBytes(assembler, 4, 0x49, 0x3B, 0x84, 0x24);
+    emitU32(assembler, VM_FIELD(stackCapacity));
+    return emitForwardJump(assembler, JUMP_IF_ABOVE_OR_EQUAL);
+}
+
+/*
+  Pushes value, which is known when compiling. helper(frame, a, 0) does
+  the same when the stack has to grow.
+*/
+static void emitPushValue(Assembler *assembler, Value value,
+                          JitHelper helper, int a) {
+    uint64_t payload;
+    memcpy(&payload, &(value.as), sizeof(payload));
+    if (VAL_BOOL == value.type) payload = value.as.boolean;
+
+    size_t slowPath = emitRoomCheck(assembler, 1);
+    // mov dword [rcx], type; mov rax, payload; mov [rcx + 8], rax
+    emitBytes(assembler, 2, 0xC7, 0x01);
+    emitU32(assembler, (uint32_t)value.type);
+    emitBytes(assembler, 2, 0x48, 0xB8);
+    emitU64(assembler, payload);
+    emitBytes(assembler, 4, 0x48, 0x89, 0x41, 0x08);
+    // add rcx, 16
+    emitBytes(assembler, 4, 0x48, 0x83, 0xC1, 0x10);
+    emitStoreStackTop(assembler);
+    size_t done = emitForwardJump(assembler, JUMP);
+
+    patchHere(assembler, slowPath);
+    emitCallHelper(assembler, helper, a, 0);
+    patchHere(assembler, done);
+}
+
+// Pushes the local in slot first, then the one in second unless it is -1.
+static void emitGetLocals(Assembler *assembler, int first, int second) {
+    int const COUNT = -1 == second ? 1 : 2;
+    size_t slowPath = emitRoomCheck(assembler, COUNT);
+    // mov rdx, [rbx + slots]
+    emitBytes(assembler, 4, 0x48, 0x8B, 0x53, FRAME_FIELD(slots));
+    for (int i = 0; i < COUNT; i++) {
+        // movdqu xmm0, [rdx + 16 * slot]; movdqu [rcx + 16 * i], xmm0
+        emitBytes(assembler, 4, 0xF3, 0x0F, 0x6F, 0x82);
+        emitU32(assembler, (uint32_t)(16 * (0 == i ? first : second)));
+        emitBytes(assembler, 5, 0xF3, 0x0F, 0x7F, 0x41, 16 * i);
+    }
+    // add rcx, 16 * count
+    emitBytes(assembler, 4, 0x48, 0x83, 0xC1, 16 * COUNT);
+    emitStoreStackTop(assembler);
+    size_t done = emitForwardJump(assembler, JUMP);
+
+    patchHere(assembler, slowPath);
+    if (1 == COUNT) {
+        emitCallHelper(assembler, getLocal, first, 0);
+    } else {
+        emitCallHelper(assembler, getLocal2, first, second);
+    }
+    patchHere(assembler, done);
+}
+
+static void emitSetLocal(Assembler *assembler, int slot) {
+    emitLoadStackTop(assembler);
+    // mov rdx, [rbx + slots]; movdqu xmm0, [rcx - 16]
+    emitBytes(assembler, 4, 0x48, 0x8B, 0x53, FRAME_FIELD(slots));
+    emitBytes(assembler, 5, 0xF3, 0x0F, 0x6F, 0x41, 0xF0);
+    // movdqu [rdx + 16 * slot], xmm0
+    emitBytes(assembler, 4, 0xF3, 0x0F, 0x7F, 0x82);
+    emitU32(assembler, (uint32_t)(16 * slot));
+}
+
+static void emitPop(Assembler *assembler) {
+    // sub qword [r12 + stackTop], 16
+    emitBytes(assembler, 4, 0x49, 0x83, 0xAC, 0x24);
+    emitU32(assembler, VM_FIELD(stackTop));
+    emitByte(assembler, 0x10);
+}
+
+/*
+  Emits the arithmetic or comparison opcode on two numbers at the top of
+  the stack. Other operands go to binaryOp(), which reports the error.
+*/
+static void emitBinaryOp(Assembler *assembler, uint8_t opcode, uint8_t *next) {
+    emitLoadStackTop(assembler);
+    // cmp dword [rcx - 32], VAL_NUMBER; jne slow
+    // cmp dword [rcx - 16], VAL_NUMBER; jne slow
+    emitBytes(assembler, 4, 0x83, 0x79, 0xE0, VAL_NUMBER);
+    size_t firstNotNumber = emitForwardJump(assembler, JUMP_IF_NOT_EQUAL);
+    emitBytes(assembler, 4, 0x83, 0x79, 0xF0, VAL_NUMBER);
+    size_t secondNotNumber = emitForwardJump(assembler, JUMP_IF_NOT_EQUAL);
+
+    // The comparisons which are true when xmm0 is above the other operand
+    // load b first, so that unordered operands compare false.
+    bool const LOAD_B_FIRST = OP_LESS == opcode || OP_LESS_EQUAL == opcode;
+    // movsd xmm0, [rcx - 24] or [rcx - 8]
+    emitBytes(assembler, 5, 0xF2, 0x0F, 0x10, 0x41,
+              LOAD_B_FIRST ? 0xF8 : 0xE8);
+
+    uint8_t const OTHER = LOAD_B_FIRST ? 0xE8 : 0xF8;
+    switch (opcode) {
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            uint8_t const OPERATION = OP_ADD == opcode        ? 0x58
+                                      : OP_SUBTRACT == opcode ? 0x5C
+                                      : OP_MULTIPLY == opcode ? 0x59
+                                                              : 0x5E;
+            // addsd/subsd/mulsd/divsd xmm0, [rcx - 8]
+            emitBytes(assembler, 5, 0xF2, 0x0F, OPERATION, 0x41, OTHER);
+            // movsd [rcx - 24], xmm0
+            emitBytes(assembler, 5, 0xF2, 0x0F, 0x11, 0x41, 0xE8);
+            break;
+        }
+        default:
+            // ucomisd xmm0, [rcx + other]
+            emitBytes(assembler, 5, 0x66, 0x0F, 0x2E, 0x41, OTHER);
+            if (OP_NUMBER_EQUAL == opcode) {
+                // sete al; setnp dl; and al, dl
+                emitBytes(assembler, 8, 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC2,
+                          0x20, 0xD0);
+            } else {
+                bool const STRICT = OP_LESS == opcode || OP_GREATER == opcode;
+                // seta al or setae al
+                emitBytes(assembler, 3, 0x0F, STRICT ? 0x97 : 0x93, 0xC0);
+            }
+            // movzx eax, al; mov dword [rcx - 32], VAL_BOOL
+            // mov [rcx - 24], rax
+            emitBytes(assembler, 3, 0x0F, 0xB6, 0xC0);
+            emitBytes(assembler, 3, 0xC7, 0x41, 0xE0);
+            emitU32(assembler, VAL_BOOL);
+            emitBytes(assembler, 4, 0x48, 0x89, 0x41, 0xE8);
+            break;
+    }
+    // sub rcx, 16
+    emitBytes(assembler, 4, 0x48, 0x83, 0xE9, 0x10);
+    emitStoreStackTop(assembler);
+    size_t done = emitForwardJump(assembler, JUMP);
+
+    patchHere(assembler, firstNotNumber);
+    patchHere(assembler, secondNotNumber);
+    emitFallibleCall(assembler, binaryOp, opcode, 0, next);
+    patchHere(assembler, done);
+}
+
+// Emits OP_ADD_CONSTANT or OP_SUBTRACT_CONSTANT, whose constant is a number.
+static void emitBinaryOpConstant(Assembler *assembler, uint8_t opcode,
+                                 int index, uint8_t *next) {
+    Value constant = getValueArrayAt(&(assembler->chunk->constants), index);
+    uint64_t bits;
+    memcpy(&bits, &(constant.as.number), sizeof(bits));
+
+    emitLoadStackTop(assembler);
+    // cmp dword [rcx - 16], VAL_NUMBER; jne slow
+    emitBytes(assembler, 4, 0x83, 0x79, 0xF0, VAL_NUMBER);
+    size_t notNumber = emitForwardJump(assembler, JUMP_IF_NOT_EQUAL);
+    // movsd xmm0, [rcx - 8]; mov rax, bits; movq xmm1, rax
+    emitBytes(assembler, 5, 0xF2, 0x0F, 0x10, 0x41, 0xF8);
+    emitBytes(assembler, 2, 0x48, 0xB8);
+    emitU64(assembler, bits);
+    emitBytes(assembler, 5, 0x66, 0x48, 0x0F, 0x6E, 0xC8);
+    // addsd or subsd xmm0, xmm1; movsd [rcx - 8], xmm0
+    emitBytes(assembler, 4, 0xF2, 0x0F,
+              OP_ADD_CONSTANT == opcode ? 0x58 : 0x5C, 0xC1);
+    emitBytes(assembler, 5, 0xF2, 0x0F, 0x11, 0x41, 0xF8);
+    size_t done = emitForwardJump(assembler, JUMP);
+
+    patchHere(assembler, notNumber);
+    emitFallibleCall(assembler, binaryOpConstant, opcode, index, next);
+    patchHere(assembler, done);
+}
+
+/*
+  Jumps to the instruction at target if the top of the stack is false,
+  popping it first if popCondition is set.
+*/
+static void emitJumpIfFalse(Assembler *assembler, bool popCondition,
+                            int target) {
+    emitLoadStackTop(assembler);
+    // The condition is at [rcx + top].
+    uint8_t top = 0xF0;
+    if (popCondition) {
+        // sub rcx, 16
+        emitBytes(assembler, 4, 0x48, 0x83, 0xE9, 0x10);
+        emitStoreStackTop(assembler);
+        top = 0x00;
+    }
+    // mov eax, [rcx + top]; cmp eax, VAL_NIL; je target
+    emitBytes(assembler, 3, 0x8B, 0x41, top);
+    emitBytes(assembler, 3, 0x83, 0xF8, VAL_NIL);
+    emitJumpTo(assembler, JUMP_IF_EQUAL, target);
+    // cmp eax, VAL_BOOL; jne done
+    emitBytes(assembler, 3, 0x83, 0xF8, VAL_BOOL);
+    size_t notBool = emitForwardJump(assembler, JUMP_IF_NOT_EQUAL);
+    // cmp byte [rcx + top + 8], 0; je target
+    emitBytes(assembler, 4, 0x80, 0x79, (uint8_t)(top + 8), 0x00);
+    emitJumpTo(assembler, JUMP_IF_EQUAL, target);
+    patchHere(assembler, notBool);
+}
+
+static Value constantAt(CallFrame *frame, int index) {
+    return getValueArrayAt(&(frame->closure->function->chunk.constants),
+                           index);
+}
+
+static bool pushConstant(CallFrame *frame, int index, int unused) {
+    (void)unused;
+    push(constantAt(frame, index));
+    return true;
+}
+
+static bool pushLiteral(CallFrame *frame, int opcode, int unused) {
+    (void)frame;
+    (void)unused;
+    switch (opcode) {
+        case OP_NIL:
+            push(NIL_VAL);
+            break;
+        case OP_TRUE:
+            push(BOOL_VAL(true));
+            break;
+        default:
+            push(BOOL_VAL(false));
+            break;
+    }
+    return true;
+}
+
+static bool getLocal(CallFrame *frame, int slot, int unused) {
+    (void)unused;
+    push(frame->slots[slot]);
+    return true;
+}
+
+static bool getLocal2(CallFrame *frame, int first, int second) {
+    push(frame->slots[first]);
+    push(frame->slots[second]);
+    return true;
+}
+
+static bool getGlobal(CallFrame *frame, int index, int unused) {
+    (void)unused;
+    ObjSymbol *name = AS_SYMBOL(constantAt(frame, index));
+    Value value;
+    if (!tableGet(&vm.globals, name, &value)) {
+        runtimeError("Undefined variable '%s'.", name->chars);
+        return false;
+    }
+    push(value);
+    return true;
+}
+
+static bool setGlobal(CallFrame *frame, int index, int unused) {
+    (void)unused;
+    ObjSymbol *name = AS_SYMBOL(constantAt(frame, index));
+    if (tableSet(&vm.globals, name, vm.stackTop[-1])) {
+        tableDelete(&vm.globals, name);
+        runtimeError("Undefined variable '%s'.", name->chars);
+        return false;
+    }
+    return true;
+}
+
+static bool defineGlobal(CallFrame *frame, int index, int unused) {
+    (void)unused;
+    tableSet(&vm.globals, AS_SYMBOL(constantAt(frame, index)),
+             vm.stackTop[-1]);
+    pop();
+    return true;
+}
+
+static bool getUpvalue(CallFrame *frame, int slot, int unused) {
+    (void)unused;
+    push(*frame->closure->upvalues[slot]->location);
+    return true;
+}
+
+static bool setUpvalue(CallFrame *frame, int slot, int unused) {
+    (void)unused;
+    ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+    writeSlot(&upvalue->obj, upvalue->location, vm.stackTop[-1]);
+    return true;
+}
+
+// Does OP_CLOSURE, whose operands start after offset.
+static bool makeClosure(CallFrame *frame, int offset, int unused) {
+    (void)unused;
+    uint8_t *ip = getChunkCode(&(frame->closure->function->chunk)) + offset;
+    ObjClosure *closure = newClosure(AS_FUNCTION(constantAt(frame, ip[1])));
+    push(OBJ_VAL(closure));
+    for (int i = 0; i < closure->upvalueCount; i++) {
+        uint8_t isLocal = ip[2 + 2 * i];
+        uint8_t index = ip[3 + 2 * i];
+        closure->upvalues[i] = isLocal ? captureUpvalue(frame->slots + index)
+                                       : frame->closure->upvalues[index];
+    }
+    return true;
+}
+
+static bool closeUpvalue(CallFrame *frame, int unused1, int unused2) {
+    (void)frame;
+    (void)unused1;
+    (void)unused2;
+    closeUpvalues(vm.stackTop - 1);
+    pop();
+    return true;
+}
+
+static bool closeScope(CallFrame *frame, int slot, int keep) {
+    Value *scope = frame->slots + slot;
+    closeUpvalues(scope);
+    memmove(scope, vm.stackTop - keep, keep * sizeof(Value));
+    vm.stackTop = scope + keep;
+    return true;
+}
+
+static bool binaryOp(CallFrame *frame, int opcode, int unused) {
+    (void)frame;
+    (void)unused;
+    Value *operands = vm.stackTop - 2;
+    if (!IS_NUMBER(operands[0]) || !IS_NUMBER(operands[1])) {
+        runtimeError("Operands must be numbers.");
+        return false;
+    }
+
+    double a = AS_NUMBER(operands[0]);
+    double b = AS_NUMBER(operands[1]);
+    Value result;
+    switch (opcode) {
+        case OP_ADD:
+            result = NUMBER_VAL(a + b);
+            break;
+        case OP_SUBTRACT:
+            result = NUMBER_VAL(a - b);
+            break;
+        case OP_MULTIPLY:
+            result = NUMBER_VAL(a * b);
+            break;
+        case OP_DIVIDE:
+            result = NUMBER_VAL(a / b);
+            break;
+        case OP_NUMBER_EQUAL:
+            result = BOOL_VAL(a == b);
+            break;
+        case OP_LESS:
+            result = BOOL_VAL(a < b);
+            break;
+        case OP_LESS_EQUAL:
+            result = BOOL_VAL(a <= b);
+            break;
+        case OP_GREATER:
+            result = BOOL_VAL(a > b);
+            break;
+        default:
+            result = BOOL_VAL(a >= b);
+            break;
+    }
+    operands[0] = result;
+    vm.stackTop--;
+    return true;
+}
+
+static bool binaryOpConstant(CallFrame *frame, int opcode, int index) {
+    push(constantAt(frame, index));
+    return binaryOp(frame, OP_ADD_CONSTANT == opcode ? OP_ADD : OP_SUBTRACT,
+                    0);
+}
+
+/*
+  Does OP_SWITCH, which ends at end, and returns the machine code of the
+  instruction it goes to.
+*/
+static void const *switchTarget(CallFrame *frame, int index, int end) {
+    JitCode *jitCode = frame->closure->function->jitCode;
+    ObjSwitch *table = AS_SWITCH(constantAt(frame, index));
+    return jitCode->native + jitCode->entries[end + switchLookup(table, pop())];
+}
+
+#else
+
+bool enterJit(CallFrame *frame) {
+    // There is no code generator for this machine, so run() does it all.
+    (void)frame;
+    return true;
+}
+
+void freeJitCode(JitCode *code) { (void)code; }
+
+#endif
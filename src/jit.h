@@ -0,0 +1,47 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "vm.h"
+
+// Settings of the JIT compiler, which are set by command line flags.
+typedef struct {
+    bool enabled;  // Compile functions to machine code when they are called.
+} JitOptions;
+
+extern JitOptions jitOptions;
+
+// Machine code for a function. Its layout is private to the JIT.
+typedef struct JitCode JitCode;
+
+/*
+  Runs the function of frame as machine code, starting at frame->ip and
+  compiling the function first if it hasn't been. The machine code uses
+  the same frames and stack as run(), and gives control back at the
+  instructions it leaves to the interpreter, like calls and returns, with
+  frame->ip pointing at them. Returns false if there was a runtime error.
+  When the function can't be compiled, it runs nothing and returns true.
+*/
+bool enterJit(CallFrame *frame);
+
+// Frees code, and the machine code it owns.
+void freeJitCode(JitCode *code);
@@ -65,4 +65,17 @@ size_t numberOfEntries(LineNumberArray const *array) {
     return numberOfEntries;
 }
 
+void truncateLineNumberArray(LineNumberArray *array, size_t count) {
+    size_t covered = 0;
+    size_t i = 0;
+    for (; i < getSmartArrayCount(array) && covered < count; i++) {
+        LineNumber *entry = &SMART_ARRAY_AT(array, i, LineNumber);
+        if (covered + entry->repeats > count) {
+            entry->repeats = count - covered;
+        }
+        covered += entry->repeats;
+    }
+    smartArrayTruncate(array, i);
+}
+
 void freeLineNumberArray(LineNumberArray *array) { freeSmartArray(array); }
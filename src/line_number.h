@@ -51,3 +51,9 @@ unsigned int writeNumber(LineNumberArray *array, unsigned int lineNumber);
   Return the number of entries in array.
  */
 size_t numberOfEntries(LineNumberArray const *array);
+
+/*
+  Forget the line numbers of every instruction from index count onwards,
+  so that array describes exactly count instructions.
+ */
+void truncateLineNumberArray(LineNumberArray *array, size_t count);
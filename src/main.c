@@ -26,21 +26,66 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 
+#include "bytecode_file.h"
+#include "c_backend.h"
+#include "closure_engine.h"
 #include "common.h"
+#include "compiler.h"
+#include "heap_image.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "register_vm.h"
+#include "server.h"
 #include "vm.h"
 
+// Whether to print the VM's statistics when it finishes.
+static bool showStats = false;
+
+// Whether to print which functions were promoted when the VM finishes.
+static bool showTierStats = false;
+
+// Whether to translate the file to C instead of running it.
+static bool compileToCMode = false;
+
+// Whether to run the file from its bytecode file, writing it if need be.
+static bool useBytecodeFile = false;
+
+// The heap image to start from, or NULL to start from scratch.
+static char const *imagePath = NULL;
+
+// Where to write a heap image after running the file, or NULL not to.
+static char const *dumpImagePath = NULL;
+
+// The socket to serve scripts on after running the file, or NULL not to.
+static char const *servePath = NULL;
+
 // Run interactively
 static void repl(void);
 
 // Open path as a file and run the code in it.
 static void runFile(char const *path);
 
+/*
+  Runs source, which was read from path, from its bytecode file. The file
+  is written first if it is missing or stale.
+*/
+static InterpretResult interpretCached(char const *path, char const *source);
+
+// Open path as a file and write the code in it as C to standard output.
+static void compileFile(char const *path);
+
 /*
   Opens path as a file, reads the text into a
   heap-allocated buffer, closes the file and returns the buffer.
 */
 static char *readFile(char const *path);
 
+/*
+  Sets the options from the flags at the start of argv, and returns the
+  index of the first argument which isn't a flag.
+*/
+static int parseOptions(int argc, char const *argv[]);
+
 // Print a copying notice when the program starts in interactive mode.
 static void showStartupCopyingNotice(void);
 
@@ -51,22 +96,104 @@ static void showWarranty(void);
 static void showCopying(void);
 
 int main(int argc, char const *argv[]) {
+    int first = parseOptions(argc, argv);
     initVM();
 
-    if (1 == argc) {
+    if (NULL != imagePath && !readHeapImage(imagePath)) {
+        fprintf(stderr, "Could not read the image \"%s\".\n", imagePath);
+        exit(74);
+    }
+
+    if (NULL != servePath && argc - first <= 1) {
+        // The prelude is compiled once here, instead of in every child.
+        bool lazy = compilerOptions.lazy;
+        compilerOptions.lazy = false;
+        if (argc - 1 == first) runFile(argv[first]);
+        compilerOptions.lazy = lazy;
+        exit(serve(servePath));
+    } else if (NULL != dumpImagePath && argc - first <= 1) {
+        // The file, if there is one, is the prelude the image is made from.
+        if (argc - 1 == first) runFile(argv[first]);
+        if (!writeHeapImage(dumpImagePath)) {
+            fprintf(stderr, "Could not write the image \"%s\".\n",
+                    dumpImagePath);
+            exit(74);
+        }
+    } else if (argc == first && !compileToCMode) {
         repl();
-    } else if (2 == argc) {
-        runFile(argv[1]);
+    } else if (argc - 1 == first && compileToCMode) {
+        compileFile(argv[first]);
+    } else if (argc - 1 == first) {
+        runFile(argv[first]);
     } else {
-        fprintf(stderr, "%s\n", "Usage: ecsi [path]");
+        fprintf(stderr, "%s\n",
+                "Usage: ecsi [-O0|-O1|-O2] [--dump-ir] [--stats] [--jit] "
+                "[--registers] [--engine=bytecode|closures] [--tier-stats] "
+                "[--call-threshold=N] [--loop-threshold=N] [--eager] "
+                "[--compile-to-c] [--cache] [--image path] "
+                "[--dump-image path] [--serve socket] [path]");
         exit(64);
     }
 
+    if (showStats) printVMStats();
+    if (showTierStats) printTierStats();
     freeVM();
 
     return 0;
 }
 
+static int parseOptions(int argc, char const *argv[]) {
+    int i = 1;
+    for (; i < argc; i++) {
+        char const *option = argv[i];
+        if (!strcmp(option, "--dump-ir")) {
+            optimizerOptions.dumpIR = true;
+        } else if (!strcmp(option, "--stats")) {
+            showStats = true;
+        } else if (!strcmp(option, "--jit")) {
+            jitOptions.enabled = true;
+        } else if (!strcmp(option, "--registers")) {
+            // Every function runs on the register VM from its first call.
+            registerOptions.enabled = true;
+            tierOptions.callThreshold = 1;
+        } else if (!strcmp(option, "--engine=bytecode")) {
+            closureOptions.enabled = false;
+        } else if (!strcmp(option, "--engine=closures")) {
+            // Programs run as trees of nodes instead of as bytecode.
+            closureOptions.enabled = true;
+        } else if (!strcmp(option, "--eager")) {
+            compilerOptions.lazy = false;
+        } else if (!strcmp(option, "--image") && i + 1 < argc) {
+            imagePath = argv[++i];
+        } else if (!strcmp(option, "--dump-image") && i + 1 < argc) {
+            // Bodies which wait for their first call can't be written.
+            compilerOptions.lazy = false;
+            dumpImagePath = argv[++i];
+        } else if (!strcmp(option, "--serve") && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (!strcmp(option, "--cache")) {
+            useBytecodeFile = true;
+        } else if (!strcmp(option, "--compile-to-c")) {
+            compileToCMode = true;
+        } else if (!strcmp(option, "--tier-stats")) {
+            showTierStats = true;
+            tierOptions.timeTiers = true;
+        } else if (!strncmp(option, "--call-threshold=", 17)) {
+            tierOptions.callThreshold = strtoul(option + 17, NULL, 10);
+        } else if (!strncmp(option, "--loop-threshold=", 17)) {
+            tierOptions.loopThreshold = strtoul(option + 17, NULL, 10);
+        } else if ('-' == option[0] && 'O' == option[1] &&
+                   '0' <= option[2] &&
+                   option[2] <= '0' + OPTIMIZATION_LEVEL_MAX &&
+                   '\0' == option[3]) {
+            optimizerOptions.level = option[2] - '0';
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
 static void repl(void) {
     showStartupCopyingNotice();
     char *line = readline("> ");
@@ -92,13 +219,40 @@ static void repl(void) {
 
 static void runFile(char const *path) {
     char *source = readFile(path);
-    InterpretResult result = interpret(source);
+    // The closure engine doesn't run bytecode.
+    InterpretResult result = useBytecodeFile && !closureOptions.enabled
+                                 ? interpretCached(path, source)
+                                 : interpret(source);
     free(source);
 
     if (INTERPRET_COMPILE_ERROR == result) exit(65);
     if (INTERPRET_RUNTIME_ERROR == result) exit(70);
 }
 
+static InterpretResult interpretCached(char const *path, char const *source) {
+    uint64_t hash = hashSource(source, strlen(source));
+    char *cachePath = bytecodeFilePath(path);
+    ObjFunction *script = readBytecodeFile(cachePath, hash);
+    if (NULL == script) {
+        // Bodies which wait for their first call can't be written.
+        compilerOptions.lazy = false;
+        script = compile(source);
+        if (NULL != script) writeBytecodeFile(cachePath, script, hash);
+    }
+    free(cachePath);
+
+    if (NULL == script) return INTERPRET_COMPILE_ERROR;
+    return interpretFunction(script);
+}
+
+static void compileFile(char const *path) {
+    char *source = readFile(path);
+    bool compiled = compileToC(source, path, stdout);
+    free(source);
+
+    if (!compiled) exit(65);
+}
+
 static char *readFile(char const *path) {
     FILE *file = fopen(path, "rb");
     if (NULL == file) {
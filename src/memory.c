@@ -19,11 +19,19 @@
 
 #include "memory.h"
 
+#include <assert.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "closure_engine.h"
 #include "common.h"
 #include "compiler.h"
+#include "jit.h"
 #include "object.h"
+#include "register_vm.h"
 #include "smart_array.h"
 #include "table.h"
 #include "value.h"
@@ -35,6 +43,14 @@
 #include "debug.h"
 #endif
 
+// A file which was mapped by mapFile().
+typedef struct {
+    void *address;
+    size_t size;
+} Mapping;
+
+static _Thread_local SmartArray mappings = {0};
+
 // Mark all values in array.
 static void markArray(ValueArray *array);
 
@@ -82,6 +98,61 @@ char *checkedStrdup(char const *s) {
     return string;
 }
 
+void *mappedReallocate(void *pointer, size_t oldSize, size_t newSize) {
+    (void)pointer;
+    (void)oldSize;
+    assert(0 == newSize);
+    return NULL;
+}
+
+void *mapFile(char const *path, size_t *size) {
+    int descriptor = open(path, O_RDONLY);
+    if (-1 == descriptor) return NULL;
+
+    struct stat status;
+    if (0 != fstat(descriptor, &status) || 0 == status.st_size) {
+        close(descriptor);
+        return NULL;
+    }
+
+    *size = (size_t)status.st_size;
+    void *address = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         descriptor, 0);
+    close(descriptor);
+    if (MAP_FAILED == address) return NULL;
+
+    if (NULL == mappings.reallocater) {
+        initSmartArray(&mappings, smartArrayCheckedRealloc, sizeof(Mapping));
+    }
+    smartArrayAppend(&mappings, &(Mapping){address, *size});
+    return address;
+}
+
+void unmapFile(void *address) {
+    for (size_t i = 0; i < getSmartArrayCount(&mappings); i++) {
+        Mapping *mapping = &SMART_ARRAY_AT(&mappings, i, Mapping);
+        if (address != mapping->address) continue;
+
+        munmap(mapping->address, mapping->size);
+        // The last mapping takes its place.
+        Mapping last;
+        smartArrayPopFromEnd(&mappings, &last);
+        if (i < getSmartArrayCount(&mappings)) *mapping = last;
+        return;
+    }
+}
+
+void unmapFiles(void) {
+    if (NULL == mappings.reallocater) return;
+
+    for (size_t i = 0; i < getSmartArrayCount(&mappings); i++) {
+        Mapping mapping = SMART_ARRAY_AT(&mappings, i, Mapping);
+        munmap(mapping.address, mapping.size);
+    }
+    freeSmartArray(&mappings);
+    mappings = (SmartArray){0};
+}
+
 #define GC_HEAP_GROW_FACTOR 2
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
@@ -138,6 +209,17 @@ void freeObjects(void) {
     freeSmartArray(&(vm.gcState.grayStack));
 }
 
+void freeNewObjects(void) {
+    while (NULL != vm.objects && !vm.objects->isOld) {
+        Obj *object = vm.objects;
+        vm.objects = object->next;
+        if (OBJ_SYMBOL == object->type) {
+            tableDelete(&vm.strings, (ObjSymbol *)object);
+        }
+        freeObject(object);
+    }
+}
+
 static void markArray(ValueArray *array) {
     for (size_t i = 0; i < getValueArrayCount(array); i++) {
         markValue(getValueArrayAt(array, i));
@@ -159,6 +241,15 @@ static void freeObject(Obj *object) {
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction *)object;
             freeChunk(&function->chunk);
+            if (NULL != function->jitCode) freeJitCode(function->jitCode);
+            if (NULL != function->registerCode) {
+                freeRegisterCode(function->registerCode);
+            }
+            if (NULL != function->callCaches) {
+                FREE_ARRAY(CallCache, function->callCaches,
+                           function->callSiteCount);
+            }
+            freeLazyBody(function);
             FREE(ObjFunction, object);
             break;
         }
@@ -188,6 +279,42 @@ static void freeObject(Obj *object) {
             FREE(ObjVector, object);
             break;
         }
+        case OBJ_SWITCH: {
+            ObjSwitch *table = (ObjSwitch *)object;
+            FREE_ARRAY(int, table->integerOffsets, table->integerCount);
+            FREE_ARRAY(int, table->characterOffsets, table->characterCount);
+            FREE_ARRAY(SwitchCase, table->cases, table->capacity);
+            FREE(ObjSwitch, object);
+            break;
+        }
+        case OBJ_PROCEDURE:
+            // The closure engine owns the procedure's lambda.
+            FREE(ObjProcedure, object);
+            break;
+        case OBJ_FOREIGN:
+            FREE(ObjForeign, object);
+            break;
+        case OBJ_BYTEVECTOR: {
+            ObjBytevector *bytevector = (ObjBytevector *)object;
+            FREE_ARRAY(uint8_t, bytevector->bytes, bytevector->length);
+            FREE(ObjBytevector, object);
+            break;
+        }
+        case OBJ_CASE_LAMBDA: {
+            ObjCaseLambda *caseLambda = (ObjCaseLambda *)object;
+            FREE_ARRAY(Value, caseLambda->clauses, caseLambda->clauseCount);
+            FREE_ARRAY(int, caseLambda->dispatch, caseLambda->dispatchCount);
+            FREE(ObjCaseLambda, object);
+            break;
+        }
+        case OBJ_ENVIRONMENT: {
+            ObjEnvironment *environment = (ObjEnvironment *)object;
+            reallocate(object,
+                       sizeof(ObjEnvironment) +
+                           sizeof(Value) * environment->slotCount,
+                       0);
+            break;
+        }
     }
 }
 
@@ -205,8 +332,17 @@ static void markRoots(void) {
         markObject((Obj *)upvalue);
     }
 
+    for (size_t i = 0; i < getSmartArrayCount(&vm.promotedFunctions); i++) {
+        markObject(SMART_ARRAY_AT(&vm.promotedFunctions, i, Obj *));
+    }
+
+    for (size_t i = 0; i < getSmartArrayCount(&vm.handles); i++) {
+        markValue(SMART_ARRAY_AT(&vm.handles, i, Value));
+    }
+
     markTable(&vm.globals);
     markCompilerRoots();
+    markClosureEngineRoots();
     markObject((Obj *)vm.initString);
 }
 
@@ -230,6 +366,23 @@ static void blackenObject(Obj *object) {
             ObjFunction *function = (ObjFunction *)object;
             markObject((Obj *)function->name);
             markArray(&function->chunk.constants);
+            // A cached function must not be freed, or another one could
+            // be allocated at its address and hit the cache.
+            if (NULL != function->callCaches) {
+                for (int i = 0; i < function->callSiteCount; i++) {
+                    markObject((Obj *)function->callCaches[i].function);
+                }
+            }
+            if (NULL != function->lazyBody) {
+                LazyBody *lazyBody = function->lazyBody;
+                markObject((Obj *)lazyBody->form);
+                markValue(lazyBody->parameters);
+                markValue(lazyBody->body);
+                for (int i = 0; i < function->upvalueCount; i++) {
+                    markObject((Obj *)lazyBody->upvalueNames[i]);
+                }
+                markObject((Obj *)lazyBody->source);
+            }
             break;
         }
         case OBJ_PAIR: {
@@ -247,9 +400,43 @@ static void blackenObject(Obj *object) {
         case OBJ_SYNTAX:
             markValue(((ObjSyntax *)object)->value);
             break;
+        case OBJ_SWITCH: {
+            ObjSwitch *table = (ObjSwitch *)object;
+            for (int i = 0; i < table->capacity; i++) {
+                markValue(table->cases[i].key);
+            }
+            break;
+        }
+        case OBJ_PROCEDURE: {
+            ObjProcedure *procedure = (ObjProcedure *)object;
+            markObject((Obj *)procedure->name);
+            markObject((Obj *)procedure->environment);
+            break;
+        }
+        case OBJ_ENVIRONMENT: {
+            ObjEnvironment *environment = (ObjEnvironment *)object;
+            markObject((Obj *)environment->enclosing);
+            for (int i = 0; i < environment->slotCount; i++) {
+                markValue(environment->slots[i]);
+            }
+            break;
+        }
         case OBJ_NATIVE:
+            markObject((Obj *)((ObjNative *)object)->name);
+            break;
+        case OBJ_FOREIGN:
+            markObject((Obj *)((ObjForeign *)object)->name);
+            break;
+        case OBJ_CASE_LAMBDA: {
+            ObjCaseLambda *caseLambda = (ObjCaseLambda *)object;
+            for (int i = 0; i < caseLambda->clauseCount; i++) {
+                markValue(caseLambda->clauses[i]);
+            }
+            break;
+        }
         case OBJ_STRING:
         case OBJ_SYMBOL:
+        case OBJ_BYTEVECTOR:
             break;
     }
 }
@@ -269,7 +456,8 @@ static void sweep(void) {
 #ifdef DEBUG_LOG_GC
         printf("object is: %p\n", (void *)object);
 #endif
-        if (object->isMarked) {
+        // Old objects are kept, as restoreVM() may make them reachable.
+        if (object->isMarked || object->isOld) {
             object->isMarked = false;
             previous = object;
             object = object->next;
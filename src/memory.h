@@ -72,6 +72,25 @@ char *checkedStrdup(char const *s);
  */
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
 
+/*
+  The reallocater of arrays which lie in a file mapped by mapFile(), and are
+  never grown. Freeing them does nothing, as they go when it is unmapped.
+*/
+void *mappedReallocate(void *pointer, size_t oldSize, size_t newSize);
+
+/*
+  Maps the file at path into memory and stores its size in size. The
+  mapping is private, so writes to it are only seen by this process.
+  Returns NULL if the file can't be mapped, or is empty.
+*/
+void *mapFile(char const *path, size_t *size);
+
+// Unmaps the file which mapFile() mapped at address.
+void unmapFile(void *address);
+
+// Unmaps every mapped file. Nothing which lies in them may be used after.
+void unmapFiles(void);
+
 // Mark object as accessible, and to be spared from the garbage collector.
 // Does not mark anything object references.
 void markObject(Obj *object);
@@ -90,3 +109,9 @@ void collectGarbage(void);
 
 // Free all unreachable objects.
 void freeObjects(void);
+
+/*
+  Frees every object allocated since the VM's checkpoint, which lie in
+  front of the old ones in vm.objects, and forgets the symbols among them.
+*/
+void freeNewObjects(void);
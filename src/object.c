@@ -52,17 +52,21 @@ static void objPairToStringInGrowableString(ObjPair const *pair,
 static char *listToString(ObjPair const *list);
 static char *objClosureToString(ObjClosure const *closure);
 static char *objFunctionToString(ObjFunction const *function);
+static char *objProcedureToString(ObjProcedure const *procedure);
 static char *objSymbolToString(ObjSymbol const *symbol);
 static char *objVectorToString(ObjVector const *vector);
+static char *objBytevectorToString(ObjBytevector const *bytevector);
 
 static Obj *allocateObject(size_t size, ObjType type);
-static ObjString *allocateString(char *chars, size_t length);
+static ObjString *allocateString(char *chars, size_t length, uint32_t hash,
+                                 ObjType type, bool intern);
 static uint32_t hashString(char const *key, int length);
 static void printFunction(ObjFunction const *function);
 static bool isList(ObjPair *pair);
 static void printList(ObjPair const *pair);
 static void printPair(ObjPair const *pair);
 static bool objStringEqualToString(ObjString const *string, char const *chars);
+static bool hasArgumentType(Value value, ArgumentType type);
 
 static void initGrowableString(GrowableString *gs) {
     initSmartArray(gs, smartArrayCheckedRealloc, sizeof(char));
@@ -79,14 +83,19 @@ static void growableStringAppendString(GrowableString *gs, const char *s) {
 }
 
 const char *objTypeToString(ObjType type) {
-    assert(type <= OBJ_VECTOR);
+    assert(type <= OBJ_BYTEVECTOR);
 
     static char const *names[] = {
         [OBJ_CLOSURE] = "OBJ_CLOSURE", [OBJ_FUNCTION] = "OBJ_FUNCTION",
         [OBJ_PAIR] = "OBJ_PAIR",       [OBJ_STRING] = "OBJ_STRING",
         [OBJ_SYMBOL] = "OBJ_SYMBOL",   [OBJ_SYNTAX] = "OBJ_SYNTAX",
         [OBJ_NATIVE] = "OBJ_NATIVE",   [OBJ_UPVALUE] = "OBJ_UPVALUE",
-        [OBJ_VECTOR] = "OBJ_VECTOR"};
+        [OBJ_VECTOR] = "OBJ_VECTOR",   [OBJ_SWITCH] = "OBJ_SWITCH",
+        [OBJ_PROCEDURE] = "OBJ_PROCEDURE",
+        [OBJ_ENVIRONMENT] = "OBJ_ENVIRONMENT",
+        [OBJ_FOREIGN] = "OBJ_FOREIGN",
+        [OBJ_CASE_LAMBDA] = "OBJ_CASE_LAMBDA",
+        [OBJ_BYTEVECTOR] = "OBJ_BYTEVECTOR"};
 
     return names[type];
 }
@@ -111,6 +120,18 @@ char *objectToString(Value value) {
             return checkedStrdup("upvalue");
         case OBJ_VECTOR:
             return objVectorToString(AS_VECTOR(value));
+        case OBJ_SWITCH:
+            return checkedStrdup("<switch>");
+        case OBJ_PROCEDURE:
+            return objProcedureToString(AS_PROCEDURE(value));
+        case OBJ_ENVIRONMENT:
+            return checkedStrdup("<environment>");
+        case OBJ_FOREIGN:
+            return checkedStrdup("<c-function>");
+        case OBJ_CASE_LAMBDA:
+            return checkedStrdup("<case-lambda>");
+        case OBJ_BYTEVECTOR:
+            return objBytevectorToString(AS_BYTEVECTOR(value));
         default:
             // Unreached
             UNREACHABLE();
@@ -221,6 +242,17 @@ static char *objFunctionToString(ObjFunction const *function) {
     return buffer;
 }
 
+static char *objProcedureToString(ObjProcedure const *procedure) {
+    if (NULL == procedure->name) {
+        return checkedStrdup("<procedure>");
+    }
+
+    size_t bufferSize = procedure->name->length + 6;  // <fn > + null
+    char *buffer = checkedMalloc(bufferSize);
+    snprintf(buffer, bufferSize, "<fn %s>", procedure->name->chars);
+    return buffer;
+}
+
 static char *objSymbolToString(ObjSymbol const *symbol) {
     size_t bufferSize = symbol->length + 2;  // single quote + null
     char *buffer = checkedMalloc(bufferSize);
@@ -248,6 +280,23 @@ static char *objVectorToString(ObjVector const *vector) {
     return &(SMART_ARRAY_AT(&vecString, 0, char));
 }
 
+static char *objBytevectorToString(ObjBytevector const *bytevector) {
+    GrowableString bytesString;
+    initGrowableString(&bytesString);
+    growableStringAppendString(&bytesString, "#u8(");
+
+    for (int i = 0; i < bytevector->length; i++) {
+        char byte[5];
+        snprintf(byte, sizeof(byte), 0 == i ? "%d" : " %d",
+                 bytevector->bytes[i]);
+        growableStringAppendString(&bytesString, byte);
+    }
+
+    growableStringAppendString(&bytesString, ")");
+    growableStringAppendChar(&bytesString, '\0');
+    return &(SMART_ARRAY_AT(&bytesString, 0, char));
+}
+
 #define ALLOCATE_OBJ(type, objectType) \
     (type *)allocateObject(sizeof(type), objectType)
 
@@ -255,6 +304,7 @@ static Obj *allocateObject(size_t size, ObjType type) {
     Obj *object = (Obj *)reallocate(NULL, 0, size);
     object->type = type;
     object->isMarked = false;
+    object->isOld = false;
 
     object->next = vm.objects;
     vm.objects = object;
@@ -282,12 +332,34 @@ ObjClosure *newClosure(ObjFunction *function) {
 ObjFunction *newFunction(void) {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
+    function->parameters =
+        (Parameters){.requiredCount = 0, .optionalCount = 0, .hasRest = false};
     function->upvalueCount = 0;
+    function->maxStack = 0;
     function->name = NULL;
+    function->callSiteCount = 0;
+    function->callCaches = NULL;
+    function->jitCode = NULL;
+    function->registerCode = NULL;
+    function->aotCode = NULL;
+    function->tier = TIER_INTERPRETED;
+    function->callCount = 0;
+    function->loopCount = 0;
+    function->lazyBody = NULL;
+    function->cachedConstants = NULL;
     initChunk(&function->chunk);
     return function;
 }
 
+void freeLazyBody(ObjFunction *function) {
+    LazyBody *lazyBody = function->lazyBody;
+    if (NULL == lazyBody) return;
+
+    FREE_ARRAY(ObjSymbol *, lazyBody->upvalueNames, function->upvalueCount);
+    FREE(LazyBody, lazyBody);
+    function->lazyBody = NULL;
+}
+
 ObjPair *newPair(Value car, Value cdr) {
     ObjPair *pair = ALLOCATE_OBJ(ObjPair, OBJ_PAIR);
     pair->car = car;
@@ -295,21 +367,99 @@ ObjPair *newPair(Value car, Value cdr) {
     return pair;
 }
 
-ObjNative *newNative(NativeFn function) {
+ObjNative *newNative(NativeDescriptor const *descriptor, ObjSymbol *name) {
     ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
-    native->function = function;
+    native->name = name;
+    native->descriptor = *descriptor;
+    native->descriptor.name = name->chars;
+    native->hasTypeHints = false;
+    for (int i = 0; i < ARGUMENT_HINTS_MAX; i++) {
+        if (ARGUMENT_ANY != descriptor->argumentTypes[i]) {
+            native->hasTypeHints = true;
+        }
+    }
     return native;
 }
 
-static ObjString *allocateString(char *chars, size_t length) {
-    ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static bool hasArgumentType(Value value, ArgumentType type) {
+    switch (type) {
+        case ARGUMENT_ANY:
+            return true;
+        case ARGUMENT_NUMBER:
+            return IS_NUMBER(value);
+        case ARGUMENT_PAIR:
+            return IS_PAIR(value);
+        case ARGUMENT_LIST:
+            return IS_PAIR(value) || IS_NIL(value);
+        case ARGUMENT_PROCEDURE:
+            return IS_CLOSURE(value) || IS_NATIVE(value) ||
+                   IS_PROCEDURE(value) || IS_FOREIGN(value) ||
+                   IS_CASE_LAMBDA(value);
+        case ARGUMENT_STRING:
+            return IS_STRING(value);
+        case ARGUMENT_SYMBOL:
+            return IS_SYMBOL(value);
+        case ARGUMENT_BYTEVECTOR:
+            return IS_BYTEVECTOR(value);
+    }
+    return false;
+}
+
+bool checkNativeArguments(NativeDescriptor const *descriptor, int argCount,
+                          Value const *args, char *message, size_t size) {
+    static char const *const TYPE_NAMES[] = {
+        [ARGUMENT_ANY] = "anything",
+        [ARGUMENT_NUMBER] = "a number",
+        [ARGUMENT_PAIR] = "a pair",
+        [ARGUMENT_LIST] = "a list",
+        [ARGUMENT_PROCEDURE] = "a procedure",
+        [ARGUMENT_STRING] = "a string",
+        [ARGUMENT_SYMBOL] = "a symbol",
+        [ARGUMENT_BYTEVECTOR] = "a bytevector",
+    };
+    int min = descriptor->minArity, max = descriptor->maxArity;
+
+    if (min == max && argCount != min) {
+        snprintf(message, size, "Expected %d arguments but got %d.", min,
+                 argCount);
+        return false;
+    }
+    if (argCount < min) {
+        snprintf(message, size, "Expected at least %d arguments but got %d.",
+                 min, argCount);
+        return false;
+    }
+    if (ANY_ARITY != max && argCount > max) {
+        snprintf(message, size, "Expected at most %d arguments but got %d.",
+                 max, argCount);
+        return false;
+    }
+
+    for (int i = 0; i < argCount && i < ARGUMENT_HINTS_MAX; i++) {
+        ArgumentType type = descriptor->argumentTypes[i];
+        if (!hasArgumentType(args[i], type)) {
+            snprintf(message, size, "Expected argument %d of %s to be %s.",
+                     i + 1, descriptor->name, TYPE_NAMES[type]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static ObjString *allocateString(char *chars, size_t length, uint32_t hash,
+                                 ObjType type, bool intern) {
+    ObjString *string = ALLOCATE_OBJ(ObjString, type);
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->isAssigned = false;
 
-    push(OBJ_VAL(string));
-    tableSet(&vm.strings, string, NIL_VAL);
-    pop();
+    // Only symbols are interned, strings are mutable and must stay distinct.
+    if (intern) {
+        push(OBJ_VAL(string));
+        tableSet(&vm.strings, string, NIL_VAL);
+        pop();
+    }
 
     return string;
 }
@@ -324,26 +474,16 @@ static uint32_t hashString(char const *key, int length) {
 }
 
 ObjString *takeString(char *chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-
-    if (NULL != interned) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
-
-    return allocateString(chars, length, hash);
+    return allocateString(chars, length, hashString(chars, length), OBJ_STRING,
+                          false);
 }
 
 ObjString *copyString(char const *chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
-    if (NULL != interned) return interned;
-
     char *heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    return allocateString(heapChars, length, hashString(chars, length),
+                          OBJ_STRING, false);
 }
 
 ObjVector *newVector(void) {
@@ -364,8 +504,312 @@ ObjUpvalue *newUpvalue(Value *slot) {
     return upvalue;
 }
 
+ObjSwitch *newSwitch(void) {
+    ObjSwitch *table = ALLOCATE_OBJ(ObjSwitch, OBJ_SWITCH);
+    table->defaultOffset = 0;
+    table->integerMin = 0;
+    table->integerCount = 0;
+    table->integerOffsets = NULL;
+    table->characterMin = 0;
+    table->characterCount = 0;
+    table->characterOffsets = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->cases = NULL;
+    return table;
+}
+
+ObjEnvironment *newEnvironment(ObjEnvironment *enclosing, int slotCount) {
+    ObjEnvironment *environment = (ObjEnvironment *)allocateObject(
+        sizeof(ObjEnvironment) + sizeof(Value) * slotCount, OBJ_ENVIRONMENT);
+    environment->enclosing = enclosing;
+    environment->slotCount = slotCount;
+    for (int i = 0; i < slotCount; i++) {
+        environment->slots[i] = NIL_VAL;
+    }
+    return environment;
+}
+
+ObjProcedure *newProcedure(struct Lambda *lambda, ObjSymbol *name,
+                           ObjEnvironment *environment) {
+    ObjProcedure *procedure = ALLOCATE_OBJ(ObjProcedure, OBJ_PROCEDURE);
+    procedure->lambda = lambda;
+    procedure->name = name;
+    procedure->environment = environment;
+    return procedure;
+}
+
+ObjForeign *newForeign(ForeignFunction function, ObjString *name, int arity,
+                       ForeignType const *argumentTypes,
+                       ForeignType resultType) {
+    ObjForeign *foreign = ALLOCATE_OBJ(ObjForeign, OBJ_FOREIGN);
+    foreign->function = function;
+    foreign->name = name;
+    foreign->arity = arity;
+    memcpy(foreign->argumentTypes, argumentTypes,
+           sizeof(ForeignType) * arity);
+    foreign->resultType = resultType;
+    return foreign;
+}
+
+ObjCaseLambda *newCaseLambda(Value const *clauses,
+                             Parameters const *parameters, int count) {
+    // Counts past the largest one any clause names go to restClause.
+    int dispatchCount = 0;
+    int restClause = -1;
+    for (int i = 0; i < count; i++) {
+        int largest = parameters[i].requiredCount;
+        if (parameters[i].hasRest) {
+            if (-1 == restClause) restClause = i;
+        } else {
+            largest += parameters[i].optionalCount;
+        }
+        if (largest >= dispatchCount) dispatchCount = largest + 1;
+    }
+
+    Value *copy = ALLOCATE(Value, count);
+    memcpy(copy, clauses, sizeof(Value) * count);
+    int *dispatch = ALLOCATE(int, dispatchCount);
+    for (int argCount = 0; argCount < dispatchCount; argCount++) {
+        dispatch[argCount] = -1;
+        for (int i = 0; i < count; i++) {
+            if (takesArguments(&parameters[i], argCount)) {
+                dispatch[argCount] = i;
+                break;
+            }
+        }
+    }
+
+    ObjCaseLambda *caseLambda = ALLOCATE_OBJ(ObjCaseLambda, OBJ_CASE_LAMBDA);
+    caseLambda->clauseCount = count;
+    caseLambda->clauses = copy;
+    caseLambda->dispatchCount = dispatchCount;
+    caseLambda->dispatch = dispatch;
+    caseLambda->restClause = restClause;
+    return caseLambda;
+}
+
+ObjBytevector *newBytevector(int length) {
+    uint8_t *bytes = ALLOCATE(uint8_t, length);
+    memset(bytes, 0, length);
+
+    ObjBytevector *bytevector = ALLOCATE_OBJ(ObjBytevector, OBJ_BYTEVECTOR);
+    bytevector->length = length;
+    bytevector->bytes = bytes;
+    return bytevector;
+}
+
+static uint32_t hashSwitchKey(Value key) {
+    if (IS_NUMBER(key)) {
+        // Adding zero turns -0.0 into 0.0, which is equal to it.
+        double number = AS_NUMBER(key) + 0.0;
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return (uint32_t)(bits ^ (bits >> 32));
+    }
+    if (IS_CHARACTER(key)) return (unsigned char)AS_CHARACTER(key);
+    if (IS_SYMBOL(key)) return AS_SYMBOL(key)->hash;
+    if (IS_BOOL(key)) return AS_BOOL(key) ? 1 : 2;
+    return 3;
+}
+
+static SwitchCase *findSwitchCase(SwitchCase *cases, int capacity,
+                                  Value key) {
+    uint32_t index = hashSwitchKey(key) & (capacity - 1);
+    for (;;) {
+        SwitchCase *entry = &cases[index];
+        if (-1 == entry->offset || valuesEqual(entry->key, key)) return entry;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static void adjustSwitchCapacity(ObjSwitch *table, int capacity) {
+    SwitchCase *cases = ALLOCATE(SwitchCase, capacity);
+    for (int i = 0; i < capacity; i++) {
+        cases[i].key = NIL_VAL;
+        cases[i].offset = -1;
+    }
+
+    for (int i = 0; i < table->capacity; i++) {
+        SwitchCase *entry = &table->cases[i];
+        if (-1 == entry->offset) continue;
+        *findSwitchCase(cases, capacity, entry->key) = *entry;
+    }
+
+    FREE_ARRAY(SwitchCase, table->cases, table->capacity);
+    table->cases = cases;
+    table->capacity = capacity;
+}
+
+bool switchAddCase(ObjSwitch *table, Value key, int offset) {
+    assert(offset >= 0);
+
+    // Keep the table at most half full, so that probe sequences stay short.
+    if (2 * (table->count + 1) > table->capacity) {
+        adjustSwitchCapacity(table, GROW_CAPACITY(table->capacity));
+    }
+
+    SwitchCase *entry = findSwitchCase(table->cases, table->capacity, key);
+    if (-1 != entry->offset) return false;
+
+    entry->key = key;
+    entry->offset = offset;
+    table->count++;
+    return true;
+}
+
+// Returns a table of count offsets which are all table's default.
+static int *newDenseOffsets(ObjSwitch const *table, int count) {
+    int *offsets = ALLOCATE(int, count);
+    for (int i = 0; i < count; i++) offsets[i] = table->defaultOffset;
+    return offsets;
+}
+
+void switchMakeDense(ObjSwitch *table) {
+    double integerMin = 0, integerMax = 0;
+    int integerKeys = 0;
+    int characterMin = UINT8_MAX, characterMax = 0;
+    int characterKeys = 0;
+
+    for (int i = 0; i < table->capacity; i++) {
+        SwitchCase const *entry = &table->cases[i];
+        if (-1 == entry->offset) continue;
+
+        if (IS_EXACT_INTEGER(entry->key)) {
+            double key = AS_NUMBER(entry->key);
+            if (0 == integerKeys || key < integerMin) integerMin = key;
+            if (0 == integerKeys || key > integerMax) integerMax = key;
+            integerKeys++;
+        } else if (!IS_NUMBER(entry->key) && IS_CHARACTER(entry->key)) {
+            int key = (unsigned char)AS_CHARACTER(entry->key);
+            if (key < characterMin) characterMin = key;
+            if (key > characterMax) characterMax = key;
+            characterKeys++;
+        }
+    }
+
+    // A direct table may have some holes, but not too many.
+    bool integersAreDense =
+        integerKeys > 0 && integerMax - integerMin < 4.0 * integerKeys + 8;
+    // There are few enough characters that their table is always small.
+    bool charactersAreDense = characterKeys > 0;
+
+    if (integersAreDense) {
+        table->integerMin = integerMin;
+        table->integerCount = (int)(integerMax - integerMin) + 1;
+        table->integerOffsets = newDenseOffsets(table, table->integerCount);
+    }
+    if (charactersAreDense) {
+        table->characterMin = characterMin;
+        table->characterCount = characterMax - characterMin + 1;
+        table->characterOffsets =
+            newDenseOffsets(table, table->characterCount);
+    }
+
+    // Move the keys out of the hash table, and rebuild it with the rest.
+    SwitchCase *cases = table->cases;
+    int capacity = table->capacity;
+    table->cases = NULL;
+    table->capacity = 0;
+    table->count = 0;
+
+    for (int i = 0; i < capacity; i++) {
+        SwitchCase const *entry = &cases[i];
+        if (-1 == entry->offset) continue;
+
+        if (integersAreDense && IS_EXACT_INTEGER(entry->key)) {
+            int index = (int)(AS_NUMBER(entry->key) - table->integerMin);
+            table->integerOffsets[index] = entry->offset;
+        } else if (charactersAreDense && !IS_NUMBER(entry->key) &&
+                   IS_CHARACTER(entry->key)) {
+            int index = (unsigned char)AS_CHARACTER(entry->key) -
+                        table->characterMin;
+            table->characterOffsets[index] = entry->offset;
+        } else {
+            switchAddCase(table, entry->key, entry->offset);
+        }
+    }
+
+    FREE_ARRAY(SwitchCase, cases, capacity);
+}
+
+int switchLookup(ObjSwitch const *table, Value key) {
+    if (IS_NUMBER(key)) {
+        double index = AS_NUMBER(key) - table->integerMin;
+        if (index >= 0 && index < table->integerCount &&
+            doubleIsInteger(index)) {
+            return table->integerOffsets[(int)index];
+        }
+    } else if (IS_CHARACTER(key)) {
+        int index = (unsigned char)AS_CHARACTER(key) - table->characterMin;
+        if (index >= 0 && index < table->characterCount) {
+            return table->characterOffsets[index];
+        }
+    }
+
+    if (0 == table->count) return table->defaultOffset;
+
+    SwitchCase const *entry =
+        findSwitchCase(table->cases, table->capacity, key);
+    return -1 == entry->offset ? table->defaultOffset : entry->offset;
+}
+
+void switchMapOffsets(ObjSwitch *table, int (*map)(int offset)) {
+    table->defaultOffset = map(table->defaultOffset);
+    for (int i = 0; i < table->integerCount; i++) {
+        table->integerOffsets[i] = map(table->integerOffsets[i]);
+    }
+    for (int i = 0; i < table->characterCount; i++) {
+        table->characterOffsets[i] = map(table->characterOffsets[i]);
+    }
+    for (int i = 0; i < table->capacity; i++) {
+        SwitchCase *entry = &table->cases[i];
+        // Empty entries have an offset of -1, which must stay.
+        if (-1 != entry->offset) entry->offset = map(entry->offset);
+    }
+}
+
+int switchCases(ObjSwitch const *table, Value *keys, int *offsets) {
+    int count = 0;
+    for (int i = 0; i < table->integerCount; i++) {
+        if (table->defaultOffset == table->integerOffsets[i]) continue;
+        keys[count] = NUMBER_VAL(table->integerMin + i);
+        offsets[count++] = table->integerOffsets[i];
+    }
+    for (int i = 0; i < table->characterCount; i++) {
+        if (table->defaultOffset == table->characterOffsets[i]) continue;
+        keys[count] = CHARACTER_VAL((char)(table->characterMin + i));
+        offsets[count++] = table->characterOffsets[i];
+    }
+    for (int i = 0; i < table->capacity; i++) {
+        if (-1 == table->cases[i].offset) continue;
+        keys[count] = table->cases[i].key;
+        offsets[count++] = table->cases[i].offset;
+    }
+    return count;
+}
+
 ObjSymbol *newSymbol(char const *chars, int length) {
-    return copyString(chars, length);
+    uint32_t hash = hashString(chars, length);
+    ObjSymbol *interned = tableFindString(&vm.strings, chars, length, hash);
+    if (NULL != interned) return interned;
+
+    char *heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    return allocateString(heapChars, length, hash, OBJ_SYMBOL, true);
+}
+
+ObjSymbol *newUninternedSymbol(ObjSymbol const *name) {
+    char *heapChars = ALLOCATE(char, name->length + 1);
+    memcpy(heapChars, name->chars, name->length + 1);
+    return allocateString(heapChars, name->length, name->hash, OBJ_SYMBOL,
+                          false);
+}
+
+bool symbolIsInterned(ObjSymbol *symbol) {
+    return symbol == tableFindString(&vm.strings, symbol->chars,
+                                     symbol->length, symbol->hash);
 }
 
 ObjSyntax *newSyntax(Value value, SourceLocation location) {
@@ -389,7 +833,7 @@ void printObject(Value value) {
             printf("\"%s\"", AS_CSTRING(value));
             break;
         case OBJ_SYMBOL:
-            printf("\"%s\"", AS_SYMBOL(value)->chars);
+            printf("%s", AS_SYMBOL(value)->chars);
             break;
         case OBJ_SYNTAX:
             printValue(AS_SYNTAX(value)->value);
@@ -408,6 +852,33 @@ void printObject(Value value) {
             printValueArray(&AS_VECTOR(value)->array);
             putchar(')');
             break;
+        case OBJ_SWITCH:
+            printf("<switch>");
+            break;
+        case OBJ_PROCEDURE: {
+            char *string = objProcedureToString(AS_PROCEDURE(value));
+            printf("%s", string);
+            free(string);
+            break;
+        }
+        case OBJ_ENVIRONMENT:
+            printf("<environment>");
+            break;
+        case OBJ_FOREIGN:
+            printf("<c-function %s>", AS_FOREIGN(value)->name->chars);
+            break;
+        case OBJ_CASE_LAMBDA:
+            printf("<case-lambda>");
+            break;
+        case OBJ_BYTEVECTOR: {
+            ObjBytevector const *bytevector = AS_BYTEVECTOR(value);
+            printf("#u8(");
+            for (int i = 0; i < bytevector->length; i++) {
+                printf(0 == i ? "%d" : " %d", bytevector->bytes[i]);
+            }
+            putchar(')');
+            break;
+        }
     }
 }
 
@@ -39,6 +39,12 @@ typedef struct ObjString ObjSymbol;
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 #define IS_UPVALUE(value) isObjType(value, OBJ_UPVALUE)
 #define IS_VECTOR(value) isObjType(value, OBJ_VECTOR)
+#define IS_SWITCH(value) isObjType(value, OBJ_SWITCH)
+#define IS_PROCEDURE(value) isObjType(value, OBJ_PROCEDURE)
+#define IS_ENVIRONMENT(value) isObjType(value, OBJ_ENVIRONMENT)
+#define IS_FOREIGN(value) isObjType(value, OBJ_FOREIGN)
+#define IS_CASE_LAMBDA(value) isObjType(value, OBJ_CASE_LAMBDA)
+#define IS_BYTEVECTOR(value) isObjType(value, OBJ_BYTEVECTOR)
 
 #define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
@@ -47,9 +53,15 @@ typedef struct ObjString ObjSymbol;
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
 #define AS_SYMBOL(value) ((ObjSymbol *)AS_OBJ(value))
 #define AS_SYNTAX(value) ((ObjSyntax *)AS_OBJ(value))
-#define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ(value))
 #define AS_UPVALUE(value) ((ObjUpvalue *)AS_OBJ(value))
 #define AS_VECTOR(value) ((ObjVector *)AS_OBJ(value))
+#define AS_SWITCH(value) ((ObjSwitch *)AS_OBJ(value))
+#define AS_PROCEDURE(value) ((ObjProcedure *)AS_OBJ(value))
+#define AS_ENVIRONMENT(value) ((ObjEnvironment *)AS_OBJ(value))
+#define AS_FOREIGN(value) ((ObjForeign *)AS_OBJ(value))
+#define AS_CASE_LAMBDA(value) ((ObjCaseLambda *)AS_OBJ(value))
+#define AS_BYTEVECTOR(value) ((ObjBytevector *)AS_OBJ(value))
 
 /*
   Create a new pair with car as its car and cdr as its cdr, and
@@ -102,6 +114,12 @@ typedef enum {
     OBJ_NATIVE,
     OBJ_UPVALUE,
     OBJ_VECTOR,
+    OBJ_SWITCH,
+    OBJ_PROCEDURE,
+    OBJ_ENVIRONMENT,
+    OBJ_FOREIGN,
+    OBJ_CASE_LAMBDA,
+    OBJ_BYTEVECTOR,
 } ObjType;
 
 // Convert a ObjType to a string representation.
@@ -111,17 +129,24 @@ char const *objTypeToString(ObjType type);
 struct Obj {
     ObjType type;      // Type of object
     bool isMarked;     // True if accessible by other objects.
+    bool isOld;        // True if allocated before the VM's checkpoint.
     struct Obj *next;  // Next object in VM's objects list.
 };
 
-// A Scheme symbol.
-struct ObjSymbol {
+/*
+  A Scheme string or symbol. Symbols are interned in vm.strings, so two
+  symbols with the same text are always the same object. Strings are not.
+*/
+struct ObjString {
     Obj obj;      // Metadata
     int length;   // Length of the text
     char *chars;  // Null terminated text string
 
     // We store the symbols's hash because symbols are interned.
     uint32_t hash;  // The hash of the string, calculated with hashString.
+
+    // For symbols, whether compiled code defines or sets the global.
+    bool isAssigned;
 };
 
 // A real Scheme string which has a fixed length
@@ -144,13 +169,91 @@ typedef struct ObjUpvalue {
     struct ObjUpvalue *next;
 } ObjUpvalue;
 
-// A Scheme function
+/*
+  The inline cache of a call site, which remembers the function it called
+  last. The function's arity matched the site's argument count when it
+  was cached, so a call of the same function can skip straight to setting
+  up its frame.
+*/
 typedef struct {
+    struct ObjFunction *function;  // NULL until the site calls a closure.
+    uint8_t *code;                 // Where function's code starts.
+} CallCache;
+
+// How a function is run. Functions start out interpreted.
+typedef enum {
+    TIER_INTERPRETED,  // run() dispatches its bytecode.
+    TIER_NATIVE,       // It runs as machine code, from the JIT or from C.
+} FunctionTier;
+
+struct CallFrame;
+
+/*
+  The C code of a function, which ecsi --compile-to-c generated. It
+  returns an AotStatus, see aot.h.
+*/
+typedef int (*AotFunction)(struct CallFrame *frame);
+
+/*
+  What a function which hasn't been compiled yet needs to compile its body
+  on its first call.
+*/
+typedef struct LazyBody {
+    ObjSyntax *form;  // The whole lambda expression.
+    Value parameters;
+    Value body;
+    ObjSymbol **upvalueNames;  // The variable each upvalue captures.
+    ObjString *source;         // Copy of the text form's locations point into.
+} LazyBody;
+
+// The arity of a function which takes a range of argument counts.
+#define VARIADIC_ARITY (-1)
+
+/*
+  The parameters of a function: the required ones, then the optional
+  ones, which are #f when they are left out, then maybe one which is
+  bound to a list of the rest of the arguments.
+*/
+typedef struct {
+    int requiredCount;
+    int optionalCount;
+    bool hasRest;
+} Parameters;
+
+// Return true if a function with parameters can be called with argCount.
+static inline bool takesArguments(Parameters const *parameters,
+                                  int argCount) {
+    return argCount >= parameters->requiredCount &&
+           (parameters->hasRest || argCount <= parameters->requiredCount +
+                                                    parameters->optionalCount);
+}
+
+// Return the number of locals a function with parameters binds them to.
+static inline int parameterCount(Parameters const *parameters) {
+    return parameters->requiredCount + parameters->optionalCount +
+           (parameters->hasRest ? 1 : 0);
+}
+
+// A Scheme function
+typedef struct ObjFunction {
     Obj obj;    // Metadata
-    int arity;  // Number of arguments
+    int arity;  // Number of arguments, or VARIADIC_ARITY.
+    Parameters parameters;
     int upvalueCount;
+    int maxStack;  // Most values its frame ever has, the closure included.
     Chunk chunk;      // Function code
     ObjSymbol *name;  // Function name
+    int callSiteCount;
+    CallCache *callCaches;    // One for each call site in chunk.
+    struct JitCode *jitCode;  // Machine code for chunk, if it was compiled.
+    struct RegisterCode *registerCode;  // chunk translated for registers.
+    AotFunction aotCode;      // Compiled C for chunk, in a compiled program.
+    FunctionTier tier;
+    uint32_t callCount;  // Calls while it was interpreted.
+    uint32_t loopCount;  // Back edges taken while it was interpreted.
+    LazyBody *lazyBody;  // NULL once the function's body is compiled.
+    // Encoded constants in a bytecode file, NULL once they are decoded.
+    uint8_t const *cachedConstants;
 } ObjFunction;
 
 // A Scheme closure.
@@ -164,10 +267,54 @@ typedef struct {
 // An alias for pointers to Scheme functions implemented in C.
 typedef Value (*NativeFn)(int argCount, Value *args);
 
+// The arity of a native which takes any number of arguments.
+#define ANY_ARITY (-1)
+
+// The number of arguments of a native which can have type hints.
+#define ARGUMENT_HINTS_MAX 4
+
+// What a native needs an argument to be.
+typedef enum {
+    ARGUMENT_ANY,
+    ARGUMENT_NUMBER,
+    ARGUMENT_PAIR,
+    ARGUMENT_LIST,  // A pair or the empty list.
+    ARGUMENT_PROCEDURE,
+    ARGUMENT_STRING,
+    ARGUMENT_SYMBOL,
+    ARGUMENT_BYTEVECTOR,
+} ArgumentType;
+
+// What a native does besides returning its result.
+typedef enum {
+    NATIVE_PURE,       // Nothing, and the result depends only on arguments.
+    NATIVE_ALLOCATES,  // Nothing, but the result is a new object.
+    NATIVE_EFFECTS,    // It has side effects or depends on other state.
+} NativeEffects;
+
+/*
+  Describes a native. The VM checks the number of arguments and the types
+  of the ones with hints before calling function, so function only has to
+  check what the descriptor can't say. The compiler may call a pure native
+  whose arguments are constants, and use its result instead of the call.
+*/
+typedef struct {
+    char const *name;  // The global the VM defines it as.
+    NativeFn function;
+    int minArity;
+    int maxArity;  // Or ANY_ARITY, for no limit.
+    // The types of the first arguments. The rest can be anything.
+    ArgumentType argumentTypes[ARGUMENT_HINTS_MAX];
+    NativeEffects effects;
+} NativeDescriptor;
+
 // A Scheme function which is implemented in C.
 typedef struct {
     Obj obj;
-    NativeFn function;
+    ObjSymbol *name;  // The global the VM defines it as.
+    // A copy of the descriptor it was defined with, whose name is name's.
+    NativeDescriptor descriptor;
+    bool hasTypeHints;  // Whether any argument's type has to be checked.
 } ObjNative;
 
 // A Scheme pair.
@@ -182,6 +329,96 @@ typedef struct {
     ValueArray array;
 } ObjVector;
 
+// A case key, and the offset of the code to run when it matches.
+typedef struct {
+    Value key;
+    int offset;  // -1 in an empty slot of a hash table.
+} SwitchCase;
+
+/*
+  The jump table of an OP_SWITCH instruction. Offsets are from the end of
+  the instruction. Exact integer and character keys are looked up directly
+  when they are dense enough, every other key is hashed.
+*/
+typedef struct {
+    Obj obj;
+    int defaultOffset;  // Where to go when no key matches.
+
+    double integerMin;
+    int integerCount;
+    int *integerOffsets;
+
+    int characterMin;
+    int characterCount;
+    int *characterOffsets;
+
+    int count;
+    int capacity;
+    SwitchCase *cases;
+} ObjSwitch;
+
+// The variables of one call of a closure engine procedure.
+typedef struct ObjEnvironment {
+    Obj obj;
+    struct ObjEnvironment *enclosing;  // The procedure's environment.
+    int slotCount;
+    Value slots[];
+} ObjEnvironment;
+
+// A procedure of the closure engine, see closure_engine.h.
+typedef struct {
+    Obj obj;
+    struct Lambda *lambda;  // Its code, which the closure engine owns.
+    ObjSymbol *name;        // NULL if it is anonymous.
+    ObjEnvironment *environment;  // What it closes over, or NULL.
+} ObjProcedure;
+
+// The most arguments a C function called through the FFI can take.
+#define FOREIGN_ARGUMENTS_MAX 14
+
+// The C types of the arguments and results of foreign functions.
+typedef enum {
+    FOREIGN_INT,
+    FOREIGN_LONG,
+    FOREIGN_DOUBLE,
+    FOREIGN_STRING,  // A char const * to the text of a string.
+    FOREIGN_BUFFER,  // A char * to the bytes of a bytevector, for C to change.
+    FOREIGN_VOID,    // Only as a result.
+} ForeignType;
+
+// The address of a C function, which is cast to its real type to call it.
+typedef void (*ForeignFunction)(void);
+
+// A C function which is called through the FFI, see ffi.h.
+typedef struct {
+    Obj obj;
+    ForeignFunction function;
+    ObjString *name;  // Its name in the library.
+    int arity;
+    ForeignType argumentTypes[FOREIGN_ARGUMENTS_MAX];
+    ForeignType resultType;
+} ObjForeign;
+
+/*
+  A procedure made by case-lambda. A call runs the first clause which
+  takes its number of arguments, which is looked up in dispatch.
+*/
+typedef struct {
+    Obj obj;
+    int clauseCount;
+    Value *clauses;  // Closures, or procedures of the closure engine.
+    int dispatchCount;
+    int *dispatch;    // The clause for each smaller count, or -1 for none.
+    int restClause;   // The clause for larger counts, or -1 for none.
+} ObjCaseLambda;
+
+// A Scheme bytevector, the only object whose contents C may write to.
+typedef struct {
+    Obj obj;
+    int length;
+    uint8_t *bytes;
+} ObjBytevector;
+
 /*
 struct ObjSymbol {
     Obj obj;
@@ -211,14 +448,36 @@ ObjClosure *newClosure(ObjFunction *function);
 // Create a new Scheme function.
 ObjFunction *newFunction(void);
 
+// Frees the lazy body of function, whose upvalue count it must match.
+void freeLazyBody(ObjFunction *function);
+
 /*
   Create a new pair whose car is car and whose cdr is cdr. Return the
   result as an ObjPair.
  */
 ObjPair *newPair(Value car, Value cdr);
 
-// Create a new native function object from the function pointer function.
-ObjNative *newNative(NativeFn function);
+/*
+  Create a new native function object from descriptor, which the VM
+  defines as the global name.
+*/
+ObjNative *newNative(NativeDescriptor const *descriptor, ObjSymbol *name);
+
+/*
+  Checks the argCount arguments at args against what descriptor says the
+  native takes. Returns true if they are fine, and otherwise writes why
+  they aren't into the size bytes at message.
+*/
+bool checkNativeArguments(NativeDescriptor const *descriptor, int argCount,
+                          Value const *args, char *message, size_t size);
+
+// Whether a call of native with argCount arguments has to be checked.
+static inline bool needsArgumentCheck(ObjNative const *native, int argCount) {
+    NativeDescriptor const *descriptor = &native->descriptor;
+    return native->hasTypeHints || argCount < descriptor->minArity ||
+           (ANY_ARITY != descriptor->maxArity &&
+            argCount > descriptor->maxArity);
+}
 
 ObjString *takeString(char *chars, int length);
 
@@ -233,9 +492,79 @@ void vectorAppend(ObjVector *vector, Value value);
 
 ObjUpvalue *newUpvalue(Value *slot);
 
+// Create a new jump table with no keys, which always jumps to offset 0.
+ObjSwitch *newSwitch(void);
+
+/*
+  Make table jump to offset when the key is eqv? to key. Returns false,
+  and leaves table alone, if key was already added.
+*/
+bool switchAddCase(ObjSwitch *table, Value key, int offset);
+
+// Move integer and character keys into direct lookup tables if they are dense.
+void switchMakeDense(ObjSwitch *table);
+
+// Return the offset that table jumps to when the key is key.
+int switchLookup(ObjSwitch const *table, Value key);
+
+// Replace every offset in table with the result of passing it to map.
+void switchMapOffsets(ObjSwitch *table, int (*map)(int offset));
+
+/*
+  Store every key of table which doesn't go to its default, and the offset
+  it goes to, in keys and offsets, which must have room for
+  integerCount + characterCount + capacity entries. Return how many there are.
+*/
+int switchCases(ObjSwitch const *table, Value *keys, int *offsets);
+
+/*
+  Create a new environment with slotCount slots, which are nil, inside of
+  enclosing.
+*/
+ObjEnvironment *newEnvironment(ObjEnvironment *enclosing, int slotCount);
+
+// Create a closure engine procedure of lambda, closing over environment.
+ObjProcedure *newProcedure(struct Lambda *lambda, ObjSymbol *name,
+                           ObjEnvironment *environment);
+
+/*
+  Create a foreign function for the C function called name, which takes
+  arity arguments of argumentTypes and returns resultType.
+*/
+ObjForeign *newForeign(ForeignFunction function, ObjString *name, int arity,
+                       ForeignType const *argumentTypes,
+                       ForeignType resultType);
+
+/*
+  Create a case-lambda of the count clauses, each of which takes the
+  arguments its entry of parameters describes.
+*/
+ObjCaseLambda *newCaseLambda(Value const *clauses,
+                             Parameters const *parameters, int count);
+
+// Return the clause of caseLambda which takes argCount arguments, or -1.
+static inline int caseLambdaClause(ObjCaseLambda const *caseLambda,
+                                   int argCount) {
+    return argCount < caseLambda->dispatchCount
+               ? caseLambda->dispatch[argCount]
+               : caseLambda->restClause;
+}
+
+// Create a bytevector of length bytes, which are all 0.
+ObjBytevector *newBytevector(int length);
+
 // Create a new symbol, length long, with chars as its text.
 ObjSymbol *newSymbol(char const *chars, int length);
 
+/*
+  Create a symbol with the same text as name, which isn't interned, so it
+  is different from every other symbol.
+*/
+ObjSymbol *newUninternedSymbol(ObjSymbol const *name);
+
+// Return true if symbol is the interned symbol with its text.
+bool symbolIsInterned(ObjSymbol *symbol);
+
 // Create a new syntax object with value as its value at location.
 ObjSyntax *newSyntax(Value value, SourceLocation location);
 
@@ -0,0 +1,1118 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "optimizer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "memory.h"
+#include "object.h"
+#include "smart_array.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+  The optimizer rewrites the syntax tree which the parser makes, so the
+  tree is its intermediate representation. Before any other pass runs,
+  every local variable is renamed to an uninterned symbol. After that,
+  each local has a name of its own, so passes can substitute expressions
+  for variables without worrying about shadowing, and any interned symbol
+  is either a global variable or a keyword.
+*/
+
+// Lambdas with at most this many nodes are inlined at their call sites.
+#define INLINE_SIZE_MAX 32
+
+typedef Value (*PassFn)(Value syntax);
+
+typedef struct {
+    char const *name;
+    int level;  // The lowest optimization level which runs the pass.
+    PassFn run;
+} Pass;
+
+// A local variable being renamed, and its new name.
+typedef struct {
+    ObjSymbol *name;
+    ObjSymbol *renamed;
+} Renaming;
+
+OptimizerOptions optimizerOptions = {.level = 1, .dumpIR = false};
+
+// The locals in scope during renaming, innermost last.
+static _Thread_local SmartArray renamings;
+
+// The top level form being optimized by the current pass.
+static _Thread_local Value currentForm;
+
+// What substituteVariable replaces, and what it replaces it with.
+static _Thread_local ObjSymbol *substitutedName;
+static _Thread_local Value substitution;
+
+// The procedure inlineCalls inlines, and the lambda it is bound to.
+static _Thread_local ObjSymbol *inlinedName;
+static _Thread_local Value inlinedLambda;
+static _Thread_local int inlinedArity;
+
+static Value renameSyntax(Value syntax);
+static Value inlineProcedures(Value syntax);
+static Value betaReduce(Value syntax);
+static Value propagate(Value syntax);
+static Value fold(Value syntax);
+static Value eliminate(Value syntax);
+
+static Pass const passes[] = {
+    {"inline", 2, inlineProcedures}, {"beta", 2, betaReduce},
+    {"propagate", 2, propagate},     {"fold", 1, fold},
+    {"eliminate", 1, eliminate},
+};
+
+// Returns the value wrapped by syntax, or syntax itself if it isn't wrapped.
+static Value unwrap(Value syntax) {
+    return IS_SYNTAX(syntax) ? AS_SYNTAX(syntax)->value : syntax;
+}
+
+// Returns the symbol that syntax stands for, or NULL if it isn't a symbol.
+static ObjSymbol *asSymbol(Value syntax) {
+    Value value = unwrap(syntax);
+    return IS_SYMBOL(value) ? AS_SYMBOL(value) : NULL;
+}
+
+// Returns the number of elements in list, or -1 if it isn't a proper list.
+static int properListLength(Value list) {
+    int length = 0;
+    for (; IS_PAIR(list); list = CDR(list)) length++;
+    return IS_NIL(list) ? length : -1;
+}
+
+// Returns the nth element of list, which must have more than n elements.
+static Value listRef(Value list, int n) {
+    for (; n > 0; n--) list = CDR(list);
+    return CAR(list);
+}
+
+// Returns list without its first n elements.
+static Value listTail(Value list, int n) {
+    for (; n > 0; n--) list = CDR(list);
+    return list;
+}
+
+// Wraps value in a syntax object at the location of like, if like is one.
+static Value rewrap(Value value, Value like) {
+    if (!IS_SYNTAX(like)) return value;
+    return OBJ_VAL(newSyntax(value, AS_SYNTAX(like)->location));
+}
+
+// Returns true if syntax is the keyword called name.
+static bool isKeyword(Value syntax, char const *name) {
+    ObjSymbol *symbol = asSymbol(syntax);
+    return NULL != symbol && textOfSymbolEqualToString(symbol, name) &&
+           symbolIsInterned(symbol);
+}
+
+// Returns true if syntax is a list whose first element is the keyword name.
+static bool isForm(Value syntax, char const *name) {
+    Value list = unwrap(syntax);
+    return IS_PAIR(list) && isKeyword(CAR(list), name);
+}
+
+// Returns true if syntax is a let, let*, letrec or letrec* form.
+static bool isLetForm(Value syntax) {
+    return isForm(syntax, "let") || isForm(syntax, "let*") ||
+           isForm(syntax, "letrec") || isForm(syntax, "letrec*");
+}
+
+static bool isNamedLet(Value syntax) {
+    Value list = unwrap(syntax);
+    return isForm(syntax, "let") && properListLength(list) >= 2 &&
+           NULL != asSymbol(CADR(list));
+}
+
+// Returns true if syntax is a local variable, which are all renamed.
+static bool isLocalVariable(Value syntax) {
+    ObjSymbol *symbol = asSymbol(syntax);
+    return NULL != symbol && !symbolIsInterned(symbol);
+}
+
+static bool isQuote(Value syntax) {
+    return isForm(syntax, "quote") && 2 == properListLength(unwrap(syntax));
+}
+
+// Returns true if syntax is a constant, whose value is itself.
+static bool isLiteral(Value syntax) {
+    Value value = unwrap(syntax);
+    return IS_NUMBER(value) || IS_BOOL(value) || IS_CHARACTER(value) ||
+           IS_STRING(value) || IS_VECTOR(value) || isQuote(syntax);
+}
+
+// Returns true if the literal syntax is true, which everything but #f is.
+static bool literalIsTrue(Value syntax) {
+    Value value = isQuote(syntax) ? unwrap(CADR(unwrap(syntax)))
+                                  : unwrap(syntax);
+    return !IS_BOOL(value) || AS_BOOL(value);
+}
+
+static bool isLambda(Value syntax) {
+    return isForm(syntax, "lambda") && properListLength(unwrap(syntax)) >= 3;
+}
+
+/*
+  Returns the number of parameters if they are a proper list without
+  #!optional, so every call passes that many arguments, otherwise -1.
+*/
+static int fixedParameterCount(Value parameters) {
+    Value list = unwrap(parameters);
+    for (Value parameter = list; IS_PAIR(parameter);
+         parameter = CDR(parameter)) {
+        if (isKeyword(CAR(parameter), "#!optional")) return -1;
+    }
+    return properListLength(list);
+}
+
+/*
+  Returns the index of the body in the list of syntax, if it is a form
+  with a body that may start with definitions, otherwise -1.
+*/
+static int bodyIndex(Value syntax) {
+    Value list = unwrap(syntax);
+    int length = properListLength(list);
+    if (length < 3) return -1;
+
+    if (isLambda(syntax)) return 2;
+    if (isNamedLet(syntax)) return length > 3 ? 3 : -1;
+    if (isLetForm(syntax)) return 2;
+    if (isForm(syntax, "define") && IS_PAIR(unwrap(CADR(list)))) return 2;
+    return -1;
+}
+
+/*
+  Returns true if evaluating syntax has no side effects and can't fail, so
+  that it can be left out when its value is unused. Global variables
+  aren't pure because they may be undefined.
+*/
+static bool isPure(Value syntax) {
+    return isLiteral(syntax) || isLambda(syntax) || isLocalVariable(syntax);
+}
+
+// Returns the number of occurrences of name in syntax.
+static int countOccurrences(Value syntax, ObjSymbol *name) {
+    Value value = unwrap(syntax);
+    if (IS_SYMBOL(value)) return AS_SYMBOL(value) == name ? 1 : 0;
+    if (!IS_PAIR(value) || isQuote(syntax)) return 0;
+    return countOccurrences(CAR(value), name) +
+           countOccurrences(CDR(value), name);
+}
+
+// Returns true if syntax contains (set! name ...).
+static bool isAssigned(Value syntax, ObjSymbol *name) {
+    Value value = unwrap(syntax);
+    if (!IS_PAIR(value) || isQuote(syntax)) return false;
+    if (isKeyword(CAR(value), "set!") && IS_PAIR(CDR(value)) &&
+        asSymbol(CADR(value)) == name) {
+        return true;
+    }
+    for (; IS_PAIR(value); value = CDR(value)) {
+        if (isAssigned(CAR(value), name)) return true;
+    }
+    return false;
+}
+
+// Returns the number of pairs and atoms in syntax.
+static int countNodes(Value syntax) {
+    Value value = unwrap(syntax);
+    int count = 1;
+    // Walk down the list instead of recursing on long ones.
+    for (; IS_PAIR(value); value = unwrap(CDR(value))) {
+        count += 1 + countNodes(CAR(value));
+    }
+    return count;
+}
+
+/*
+  Returns list with its elements from index from onwards transformed. An
+  element becomes fn(element), or if nested isn't -1, the list inside of
+  it with the elements from index nested onwards passed to fn. Lists which
+  don't change are shared instead of copied.
+*/
+static Value mapPairs(Value list, int from, int nested, PassFn fn);
+
+// Like mapPairs, but for the list inside of syntax.
+static Value mapList(Value syntax, int from, int nested, PassFn fn) {
+    Value list = unwrap(syntax);
+    Value mapped = mapPairs(list, from, nested, fn);
+    return valuesEqual(mapped, list) ? syntax : rewrap(mapped, syntax);
+}
+
+static Value mapPairs(Value list, int from, int nested, PassFn fn) {
+    // Copy the list as it's walked, then share the tail after the last
+    // element which changed, so long lists don't recurse.
+    Value copy = NIL_VAL;
+    ObjPair *last = NULL;
+    ObjPair *lastChanged = NULL;
+    Value changedTail = NIL_VAL;
+    Value pairs = list;
+    for (int i = 0; IS_PAIR(pairs); pairs = CDR(pairs), i++) {
+        Value car = CAR(pairs);
+        if (i >= from) {
+            car = -1 == nested ? fn(car) : mapList(car, nested, -1, fn);
+        }
+
+        ObjPair *pair = newPair(car, NIL_VAL);
+        if (NULL == last) {
+            copy = OBJ_VAL(pair);
+        } else {
+            last->cdr = OBJ_VAL(pair);
+        }
+        last = pair;
+
+        if (!valuesEqual(car, CAR(pairs))) {
+            lastChanged = pair;
+            changedTail = CDR(pairs);
+        }
+    }
+
+    if (NULL == lastChanged) return list;
+    lastChanged->cdr = changedTail;
+    return copy;
+}
+
+// Returns syntax with the element of its list at index replaced.
+static Value withElement(Value syntax, int index, Value element) {
+    Value list = unwrap(syntax);
+    if (valuesEqual(listRef(list, index), element)) return syntax;
+
+    ObjPair *copy = newPair(CAR(list), CDR(list));
+    ObjPair *pair = copy;
+    for (int i = 0; i < index; i++) {
+        pair->cdr = OBJ_VAL(newPair(CADR(OBJ_VAL(pair)), CDDR(OBJ_VAL(pair))));
+        pair = AS_PAIR(pair->cdr);
+    }
+    pair->car = element;
+    return rewrap(OBJ_VAL(copy), syntax);
+}
+
+/*
+  Applies fn to every expression directly inside of syntax, which must not
+  be a symbol, and returns the result. Binding positions, quoted data and
+  the datums of case are not expressions, so they are left alone.
+*/
+static Value mapSubexpressions(Value syntax, PassFn fn) {
+    Value list = unwrap(syntax);
+    int length = properListLength(list);
+    if (length < 1) return syntax;
+
+    Value head = CAR(list);
+    if (isKeyword(head, "quote")) return syntax;
+
+    // (lambda parameters body ...), (define variable value) and
+    // (define (variable . parameters) body ...).
+    if (isKeyword(head, "lambda") || isKeyword(head, "define") ||
+        isKeyword(head, "set!")) {
+        return mapList(syntax, 2, -1, fn);
+    }
+
+    if (isLetForm(syntax) && length >= 3) {
+        int bindings = isNamedLet(syntax) ? 2 : 1;
+        if (bindings >= length) return syntax;
+        syntax = mapList(syntax, bindings + 1, -1, fn);
+        return withElement(syntax, bindings,
+                           mapList(listRef(unwrap(syntax), bindings), 0, 1,
+                                   fn));
+    }
+
+    // (do ((variable init step) ...) (test expression ...) command ...)
+    if (isKeyword(head, "do") && length >= 3) {
+        syntax = mapList(syntax, 3, -1, fn);
+        syntax = withElement(syntax, 2,
+                             mapList(listRef(unwrap(syntax), 2), 0, -1, fn));
+        return withElement(syntax, 1,
+                           mapList(listRef(unwrap(syntax), 1), 0, 1, fn));
+    }
+
+    // (case key ((datum ...) expression ...) ...)
+    if (isKeyword(head, "case") && length >= 2) {
+        syntax = mapList(syntax, 2, 1, fn);
+        return withElement(syntax, 1, fn(listRef(unwrap(syntax), 1)));
+    }
+
+    if (isKeyword(head, "cond")) return mapList(syntax, 1, 0, fn);
+
+    // (case-lambda (parameters body ...) ...)
+    if (isKeyword(head, "case-lambda")) return mapList(syntax, 1, 1, fn);
+
+    return mapList(syntax, 0, -1, fn);
+}
+
+// Returns the new name of the local called name, or NULL if it isn't one.
+static ObjSymbol *lookupRenaming(ObjSymbol *name) {
+    for (size_t i = getSmartArrayCount(&renamings); i > 0; i--) {
+        Renaming *renaming = &SMART_ARRAY_AT(&renamings, i - 1, Renaming);
+        if (name == renaming->name) return renaming->renamed;
+    }
+    return NULL;
+}
+
+// Brings a local called name into scope, and returns its new name.
+static ObjSymbol *bindRenaming(ObjSymbol *name) {
+    Renaming renaming = {.name = name, .renamed = newUninternedSymbol(name)};
+    smartArrayAppend(&renamings, &renaming);
+    return renaming.renamed;
+}
+
+// Binds the symbol in syntax, and returns it renamed. Non-symbols are
+// returned as they are, for the compiler to report.
+static Value bindSyntax(Value syntax) {
+    ObjSymbol *name = asSymbol(syntax);
+    if (NULL == name) return syntax;
+    return rewrap(OBJ_VAL(bindRenaming(name)), syntax);
+}
+
+// Returns true if syntax is the keyword called name, and isn't shadowed.
+static bool isRenamingKeyword(Value syntax, char const *name) {
+    return isKeyword(syntax, name) && NULL == lookupRenaming(asSymbol(syntax));
+}
+
+// Binds the parameters of a lambda, and returns them renamed.
+static Value renameParameters(Value parameters) {
+    Value list = unwrap(parameters);
+    if (IS_SYMBOL(list)) return bindSyntax(parameters);
+    if (!IS_PAIR(list)) return parameters;
+
+    Value car = isKeyword(CAR(list), "#!optional") ? CAR(list)
+                                                   : bindSyntax(CAR(list));
+    Value cdr = renameParameters(CDR(list));
+    return rewrap(OBJ_VAL(newPair(car, cdr)), parameters);
+}
+
+/*
+  Renames the body which starts at index from of the list in syntax.
+  Definitions at the start of the body are bound in all of it.
+*/
+static Value renameBody(Value syntax, int from) {
+    Value body = listTail(unwrap(syntax), from);
+
+    for (Value expression = body; IS_PAIR(expression);
+         expression = CDR(expression)) {
+        Value list = unwrap(CAR(expression));
+        if (!isRenamingKeyword(IS_PAIR(list) ? CAR(list) : NIL_VAL,
+                               "define") ||
+            properListLength(list) < 2) {
+            break;
+        }
+        Value target = unwrap(CADR(list));
+        bindSyntax(IS_PAIR(target) ? CAR(target) : CADR(list));
+    }
+
+    return mapList(syntax, from, -1, renameSyntax);
+}
+
+/*
+  Renames the parameters at index of the list in syntax, and the body
+  after them, in which they are bound.
+*/
+static Value renameParametersAndBody(Value syntax, int index) {
+    size_t scope = getSmartArrayCount(&renamings);
+    Value parameters = renameParameters(listRef(unwrap(syntax), index));
+    syntax = withElement(renameBody(syntax, index + 1), index, parameters);
+    smartArrayTruncate(&renamings, scope);
+    return syntax;
+}
+
+static Value renameLambda(Value syntax) {
+    return renameParametersAndBody(syntax, 1);
+}
+
+// Renames a clause of a case-lambda, which binds like a lambda.
+static Value renameClause(Value clause) {
+    if (properListLength(unwrap(clause)) < 2) return clause;
+    return renameParametersAndBody(clause, 0);
+}
+
+static Value renameDefine(Value syntax) {
+    Value list = unwrap(syntax);
+    if (properListLength(list) < 2) return syntax;
+
+    Value target = unwrap(CADR(list));
+    ObjSymbol *name = IS_PAIR(target) ? asSymbol(CAR(target))
+                                      : asSymbol(CADR(list));
+    ObjSymbol *renamed = NULL == name ? NULL : lookupRenaming(name);
+
+    if (!IS_PAIR(target)) {
+        syntax = mapList(syntax, 2, -1, renameSyntax);
+        return NULL == renamed
+                   ? syntax
+                   : withElement(syntax, 1,
+                                 rewrap(OBJ_VAL(renamed), CADR(list)));
+    }
+
+    // (define (name . parameters) body ...)
+    size_t scope = getSmartArrayCount(&renamings);
+    Value parameters = renameParameters(CDR(target));
+    syntax = renameBody(syntax, 2);
+    smartArrayTruncate(&renamings, scope);
+
+    Value newName = NULL == renamed ? CAR(target)
+                                    : rewrap(OBJ_VAL(renamed), CAR(target));
+    return withElement(syntax, 1,
+                       rewrap(OBJ_VAL(newPair(newName, parameters)),
+                              CADR(list)));
+}
+
+/*
+  Renames let style bindings, which are at index 1 of the list in syntax,
+  or 2 for a named let. Returns the new bindings. If sequential, each
+  binding is in scope for the next, and if recursive, all of them are in
+  scope for every initializer. Steps of do bindings are renamed in the
+  scope of all of the bindings.
+*/
+static Value renameBindings(Value bindingsSyntax, bool sequential,
+                            bool recursive) {
+    Value bindings = unwrap(bindingsSyntax);
+    if (properListLength(bindings) < 0) return bindingsSyntax;
+
+    if (recursive) {
+        for (Value binding = bindings; IS_PAIR(binding);
+             binding = CDR(binding)) {
+            Value list = unwrap(CAR(binding));
+            if (IS_PAIR(list)) bindSyntax(CAR(list));
+        }
+    }
+
+    Value renamedBindings = NIL_VAL;
+    ObjPair *last = NULL;
+    for (Value binding = bindings; IS_PAIR(binding); binding = CDR(binding)) {
+        Value list = unwrap(CAR(binding));
+        Value renamed = CAR(binding);
+        if (IS_PAIR(list)) {
+            renamed = mapList(CAR(binding), 1, -1, renameSyntax);
+            if (IS_PAIR(CDR(list))) {
+                renamed = withElement(renamed, 1, renameSyntax(CADR(list)));
+                // Steps are renamed later, along with the body.
+                if (IS_PAIR(CDDR(list))) {
+                    renamed = withElement(renamed, 2, CADDR(list));
+                }
+            }
+
+            Value name = CAR(list);
+            if (recursive) {
+                name = renameSyntax(name);
+            } else if (sequential) {
+                name = bindSyntax(name);
+            }
+            renamed = withElement(renamed, 0, name);
+        }
+
+        ObjPair *pair = newPair(renamed, NIL_VAL);
+        if (NULL == last) {
+            renamedBindings = OBJ_VAL(pair);
+        } else {
+            last->cdr = OBJ_VAL(pair);
+        }
+        last = pair;
+    }
+
+    if (!sequential && !recursive) {
+        for (Value binding = renamedBindings; IS_PAIR(binding);
+             binding = CDR(binding)) {
+            Value list = unwrap(CAR(binding));
+            if (IS_PAIR(list)) {
+                SET_CAR(binding, withElement(CAR(binding), 0,
+                                             bindSyntax(CAR(list))));
+            }
+        }
+    }
+
+    return rewrap(renamedBindings, bindingsSyntax);
+}
+
+static Value renameLet(Value syntax) {
+    Value list = unwrap(syntax);
+    if (properListLength(list) < 3) return syntax;
+
+    size_t scope = getSmartArrayCount(&renamings);
+    bool isStar = isKeyword(CAR(list), "let*");
+    bool isRec = isKeyword(CAR(list), "letrec") ||
+                 isKeyword(CAR(list), "letrec*");
+
+    if (isNamedLet(syntax)) {
+        // The name is only in scope in the body.
+        Value bindings = renameBindings(CADDR(list), false, false);
+        Value name = bindSyntax(CADR(list));
+        syntax = renameBody(syntax, 3);
+        syntax = withElement(withElement(syntax, 2, bindings), 1, name);
+    } else {
+        Value bindings = renameBindings(CADR(list), isStar, isRec);
+        syntax = withElement(renameBody(syntax, 2), 1, bindings);
+    }
+
+    smartArrayTruncate(&renamings, scope);
+    return syntax;
+}
+
+// Renames the steps of do bindings, which are in scope of the variables.
+static Value renameSteps(Value binding) {
+    Value list = unwrap(binding);
+    if (3 != properListLength(list)) return binding;
+    return withElement(binding, 2, renameSyntax(CADDR(list)));
+}
+
+static Value renameDo(Value syntax) {
+    Value list = unwrap(syntax);
+    if (properListLength(list) < 3) return syntax;
+
+    size_t scope = getSmartArrayCount(&renamings);
+    Value bindings = renameBindings(CADR(list), false, false);
+    bindings = rewrap(mapPairs(unwrap(bindings), 0, -1, renameSteps),
+                      bindings);
+    syntax = mapList(syntax, 2, -1, renameSyntax);
+    syntax = withElement(syntax, 1, bindings);
+    smartArrayTruncate(&renamings, scope);
+    return syntax;
+}
+
+/*
+  Gives every local variable in syntax a new uninterned name. It also
+  makes fresh copies of lambdas for inlining, since every binding in the
+  copy is renamed again.
+*/
+static Value renameSyntax(Value syntax) {
+    Value list = unwrap(syntax);
+    if (IS_SYMBOL(list)) {
+        ObjSymbol *renamed = lookupRenaming(AS_SYMBOL(list));
+        return NULL == renamed ? syntax : rewrap(OBJ_VAL(renamed), syntax);
+    }
+    if (properListLength(list) < 1) return syntax;
+
+    Value head = CAR(list);
+    if (isRenamingKeyword(head, "quote")) return syntax;
+    if (isRenamingKeyword(head, "lambda") && properListLength(list) >= 3) {
+        return renameLambda(syntax);
+    }
+    if (isRenamingKeyword(head, "define")) return renameDefine(syntax);
+    if ((isRenamingKeyword(head, "let") || isRenamingKeyword(head, "let*") ||
+         isRenamingKeyword(head, "letrec") ||
+         isRenamingKeyword(head, "letrec*"))) {
+        return renameLet(syntax);
+    }
+    if (isRenamingKeyword(head, "do")) return renameDo(syntax);
+    if (isRenamingKeyword(head, "case") && properListLength(list) >= 2) {
+        syntax = mapList(syntax, 2, 1, renameSyntax);
+        return withElement(syntax, 1, renameSyntax(CADR(list)));
+    }
+    if (isRenamingKeyword(head, "cond")) return mapList(syntax, 1, 0, renameSyntax);
+    if (isRenamingKeyword(head, "case-lambda")) {
+        return mapList(syntax, 1, -1, renameClause);
+    }
+
+    return mapList(syntax, 0, -1, renameSyntax);
+}
+
+// Replaces every use of substitutedName with substitution.
+static Value substituteVariable(Value syntax) {
+    if (asSymbol(syntax) == substitutedName) {
+        return rewrap(unwrap(substitution), syntax);
+    }
+    return mapSubexpressions(syntax, substituteVariable);
+}
+
+// Replaces every call of inlinedName with a fresh copy of inlinedLambda.
+static Value inlineCalls(Value syntax) {
+    syntax = mapSubexpressions(syntax, inlineCalls);
+
+    Value list = unwrap(syntax);
+    if (!IS_PAIR(list) || asSymbol(CAR(list)) != inlinedName ||
+        properListLength(list) - 1 != inlinedArity) {
+        return syntax;
+    }
+
+    initSmartArray(&renamings, smartArrayCheckedRealloc, sizeof(Renaming));
+    Value copy = renameSyntax(inlinedLambda);
+    freeSmartArray(&renamings);
+    return withElement(syntax, 0, rewrap(unwrap(copy), CAR(list)));
+}
+
+/*
+  If value is a small lambda with fixed parameters which doesn't refer to
+  name, returns its number of parameters, otherwise -1.
+*/
+static int inlinableArity(ObjSymbol *name, Value value) {
+    if (!isLambda(value) || countNodes(value) > INLINE_SIZE_MAX ||
+        0 != countOccurrences(value, name)) {
+        return -1;
+    }
+    return fixedParameterCount(CADR(unwrap(value)));
+}
+
+// Inlines calls of name, which is bound to value, in syntax.
+static Value inlineBinding(Value syntax, ObjSymbol *name, Value value) {
+    int arity = inlinableArity(name, value);
+    if (NULL == name || -1 == arity || isAssigned(syntax, name)) return syntax;
+
+    inlinedName = name;
+    inlinedLambda = value;
+    inlinedArity = arity;
+    return mapSubexpressions(syntax, inlineCalls);
+}
+
+/*
+  Inlines small procedures bound by let style bindings and internal
+  definitions into the places where they are called.
+*/
+static Value inlineProcedures(Value syntax) {
+    syntax = mapSubexpressions(syntax, inlineProcedures);
+    Value list = unwrap(syntax);
+
+    if (isLetForm(syntax) && !isNamedLet(syntax) &&
+        properListLength(list) >= 3) {
+        for (Value binding = unwrap(CADR(list)); IS_PAIR(binding);
+             binding = CDR(binding)) {
+            Value pair = unwrap(CAR(binding));
+            if (2 != properListLength(pair)) continue;
+            syntax = inlineBinding(syntax, asSymbol(CAR(pair)), CADR(pair));
+        }
+    }
+
+    // Internal definitions, at the start of bodies.
+    int from = bodyIndex(syntax);
+    if (-1 == from) return syntax;
+
+    for (Value body = listTail(unwrap(syntax), from); IS_PAIR(body);
+         body = CDR(body)) {
+        Value definition = unwrap(CAR(body));
+        if (!isForm(CAR(body), "define") ||
+            properListLength(definition) < 3) {
+            break;
+        }
+
+        Value target = unwrap(CADR(definition));
+        if (IS_PAIR(target)) {
+            // (define (name . parameters) body ...) defines a lambda.
+            Value lambda = rewrap(
+                OBJ_VAL(newPair(OBJ_VAL(newSymbol("lambda", 6)),
+                                OBJ_VAL(newPair(CDR(target),
+                                                CDDR(definition))))),
+                CAR(body));
+            syntax = inlineBinding(syntax, asSymbol(CAR(target)), lambda);
+        } else if (3 == properListLength(definition)) {
+            syntax = inlineBinding(syntax, asSymbol(CADR(definition)),
+                                   CADDR(definition));
+        }
+    }
+
+    return syntax;
+}
+
+/*
+  Turns a call of a lambda expression, like ((lambda (x) body) value),
+  into (let ((x value)) body).
+*/
+static Value betaReduce(Value syntax) {
+    syntax = mapSubexpressions(syntax, betaReduce);
+
+    Value list = unwrap(syntax);
+    if (!IS_PAIR(list) || !isLambda(CAR(list))) return syntax;
+
+    Value lambda = unwrap(CAR(list));
+    Value parameters = unwrap(CADR(lambda));
+    int count = fixedParameterCount(parameters);
+    if (-1 == count || count != properListLength(CDR(list))) return syntax;
+
+    Value bindings = NIL_VAL;
+    ObjPair *last = NULL;
+    for (Value argument = CDR(list); IS_PAIR(argument);
+         argument = CDR(argument), parameters = CDR(parameters)) {
+        Value binding =
+            OBJ_VAL(newPair(CAR(parameters), OBJ_VAL(newPair(CAR(argument),
+                                                             NIL_VAL))));
+        ObjPair *pair = newPair(rewrap(binding, CAR(argument)), NIL_VAL);
+        if (NULL == last) {
+            bindings = OBJ_VAL(pair);
+        } else {
+            last->cdr = OBJ_VAL(pair);
+        }
+        last = pair;
+    }
+
+    Value let = OBJ_VAL(newPair(
+        rewrap(OBJ_VAL(newSymbol("let", 3)), CAR(list)),
+        OBJ_VAL(newPair(rewrap(bindings, CADR(lambda)), CDDR(lambda)))));
+    return rewrap(let, syntax);
+}
+
+// Returns true if syntax can be substituted for a variable bound to it.
+static bool isPropagatable(Value syntax) {
+    if (isLocalVariable(syntax)) {
+        return !isAssigned(currentForm, asSymbol(syntax));
+    }
+
+    // Strings, vectors and lists must keep their identity.
+    Value value = isQuote(syntax) ? unwrap(CADR(unwrap(syntax)))
+                                  : unwrap(syntax);
+    return IS_NUMBER(value) || IS_BOOL(value) || IS_CHARACTER(value) ||
+           IS_SYMBOL(value) || (IS_NIL(value) && isQuote(syntax));
+}
+
+/*
+  Substitutes constants and copies of variables for the let and let*
+  variables which are bound to them, and never assigned.
+*/
+static Value propagate(Value syntax) {
+    syntax = mapSubexpressions(syntax, propagate);
+    if (!(isForm(syntax, "let") || isForm(syntax, "let*")) ||
+        isNamedLet(syntax) || properListLength(unwrap(syntax)) < 3) {
+        return syntax;
+    }
+
+    int index = 0;
+    for (Value binding = unwrap(CADR(unwrap(syntax))); IS_PAIR(binding);
+         binding = CDR(binding), index++) {
+        Value pair = unwrap(CAR(binding));
+        if (2 != properListLength(pair)) continue;
+
+        ObjSymbol *name = asSymbol(CAR(pair));
+        if (NULL == name || !isPropagatable(CADR(pair)) ||
+            isAssigned(syntax, name)) {
+            continue;
+        }
+
+        substitutedName = name;
+        substitution = CADR(pair);
+
+        // The binding itself stays until it is eliminated as dead.
+        Value bindings = CADR(unwrap(syntax));
+        Value substituted = mapList(bindings, index + 1, 1, substituteVariable);
+        syntax = withElement(mapList(syntax, 2, -1, substituteVariable), 1,
+                             substituted);
+    }
+
+    return syntax;
+}
+
+// Returns the arithmetic of a primitive call with literal numbers, or nil.
+static Value foldPrimitive(Value syntax) {
+    Value list = unwrap(syntax);
+    ObjSymbol *operator = asSymbol(CAR(list));
+    if (NULL == operator || !symbolIsInterned(operator) ||
+        operator->isAssigned) {
+        return NIL_VAL;
+    }
+
+    double operands[UINT8_COUNT];
+    int count = 0;
+    for (Value operand = CDR(list); IS_PAIR(operand); operand = CDR(operand)) {
+        Value value = unwrap(CAR(operand));
+        if (!IS_NUMBER(value) || count == UINT8_COUNT) return NIL_VAL;
+        operands[count++] = AS_NUMBER(value);
+    }
+
+    char const *name = operator->chars;
+    if (2 == count) {
+        double a = operands[0], b = operands[1];
+        if (!strcmp(name, "=")) return BOOL_VAL(a == b);
+        if (!strcmp(name, "<")) return BOOL_VAL(a < b);
+        if (!strcmp(name, "<=")) return BOOL_VAL(a <= b);
+        if (!strcmp(name, ">")) return BOOL_VAL(a > b);
+        if (!strcmp(name, ">=")) return BOOL_VAL(a >= b);
+    }
+
+    bool isAdd = !strcmp(name, "+"), isMultiply = !strcmp(name, "*");
+    bool isSubtract = !strcmp(name, "-"), isDivide = !strcmp(name, "/");
+    if (!isAdd && !isMultiply && !isSubtract && !isDivide) return NIL_VAL;
+    if (0 == count && (isSubtract || isDivide)) return NIL_VAL;
+
+    // (- x) is 0 - x and (/ x) is 1 / x.
+    double result = isAdd || isSubtract ? 0 : 1;
+    int first = 0;
+    if (count > 1 && (isSubtract || isDivide)) {
+        result = operands[0];
+        first = 1;
+    }
+
+    for (int i = first; i < count; i++) {
+        if (isAdd) result += operands[i];
+        if (isSubtract) result -= operands[i];
+        if (isMultiply) result *= operands[i];
+        if (isDivide) result /= operands[i];
+    }
+    return NUMBER_VAL(result);
+}
+
+/*
+  Returns true if syntax is a literal which a native can be called with
+  while compiling, and sets *value to it. Strings and lists are left out,
+  as a call may depend on their identity.
+*/
+static bool atomicLiteral(Value syntax, Value *value) {
+    if (isQuote(syntax)) {
+        *value = unwrap(CADR(unwrap(syntax)));
+        return IS_SYMBOL(*value) || IS_NIL(*value);
+    }
+    *value = unwrap(syntax);
+    return IS_NUMBER(*value) || IS_BOOL(*value) || IS_CHARACTER(*value);
+}
+
+/*
+  Returns the result of calling a pure native on atomic literals, or nil if
+  the call can't be folded. The native is the one the global is bound to
+  now, unless a program defines or sets the global. The result has to be
+  a literal too.
+*/
+static Value foldNative(Value syntax) {
+    Value list = unwrap(syntax);
+    ObjSymbol *operator = asSymbol(CAR(list));
+    Value callee = NIL_VAL;
+    if (NULL == operator || !symbolIsInterned(operator) ||
+        operator->isAssigned || !tableGet(&vm.globals, operator, &callee) ||
+        !IS_NATIVE(callee)) {
+        return NIL_VAL;
+    }
+    NativeDescriptor const *descriptor = &AS_NATIVE(callee)->descriptor;
+    if (NATIVE_PURE != descriptor->effects) return NIL_VAL;
+
+    // Arguments past the hints aren't checked, and the native could fail.
+    Value arguments[ARGUMENT_HINTS_MAX];
+    int count = 0;
+    for (Value operand = CDR(list); IS_PAIR(operand); operand = CDR(operand)) {
+        if (count == ARGUMENT_HINTS_MAX ||
+            !atomicLiteral(CAR(operand), &arguments[count])) {
+            return NIL_VAL;
+        }
+        count++;
+    }
+
+    // A call which would fail is left to fail when it runs.
+    char message[128];
+    if (!checkNativeArguments(descriptor, count, arguments, message,
+                              sizeof(message))) {
+        return NIL_VAL;
+    }
+    Value result = descriptor->function(count, arguments);
+    if (IS_NUMBER(result) || IS_BOOL(result) || IS_CHARACTER(result)) {
+        return result;
+    }
+    return NIL_VAL;
+}
+
+/*
+  Folds primitive and pure native calls on literals into their values, and
+  removes the branches of if, and and or which a literal test makes
+  unreachable.
+*/
+static Value fold(Value syntax) {
+    syntax = mapSubexpressions(syntax, fold);
+    Value list = unwrap(syntax);
+    int length = properListLength(list);
+    if (length < 1) return syntax;
+
+    if (isForm(syntax, "if") && (3 == length || 4 == length)) {
+        if (!isLiteral(CADR(list))) return syntax;
+        if (literalIsTrue(CADR(list))) return CADDR(list);
+        // Without an alternative the value is unspecified, so leave it.
+        return 4 == length ? listRef(list, 3) : syntax;
+    }
+
+    if (isForm(syntax, "and") || isForm(syntax, "or")) {
+        bool isAnd = isForm(syntax, "and");
+        Value operands = CDR(list);
+        // A literal which doesn't decide the result can be skipped.
+        while (IS_PAIR(operands) && IS_PAIR(CDR(operands)) &&
+               isLiteral(CAR(operands)) &&
+               literalIsTrue(CAR(operands)) == isAnd) {
+            operands = CDR(operands);
+        }
+        if (!IS_PAIR(operands)) return syntax;
+        if (!IS_PAIR(CDR(operands)) || isLiteral(CAR(operands))) {
+            return CAR(operands);
+        }
+        if (valuesEqual(operands, CDR(list))) return syntax;
+        return rewrap(OBJ_VAL(newPair(CAR(list), operands)), syntax);
+    }
+
+    if (isForm(syntax, "begin")) {
+        // Expressions which are pure and whose values are unused do nothing.
+        Value expressions = CDR(list);
+        while (IS_PAIR(expressions) && IS_PAIR(CDR(expressions)) &&
+               isPure(CAR(expressions))) {
+            expressions = CDR(expressions);
+        }
+        if (IS_PAIR(expressions) && !IS_PAIR(CDR(expressions))) {
+            return CAR(expressions);
+        }
+        return syntax;
+    }
+
+    Value folded = foldPrimitive(syntax);
+    if (IS_NIL(folded)) folded = foldNative(syntax);
+    return IS_NIL(folded) ? syntax : rewrap(folded, syntax);
+}
+
+/*
+  Removes the let style bindings and internal definitions in syntax which
+  are never used and whose values are pure, and the pure expressions of
+  the body whose values are unused.
+*/
+static Value eliminateInBody(Value syntax, int from) {
+    Value list = unwrap(syntax);
+    Value body = listTail(list, from);
+
+    Value kept = NIL_VAL;
+    ObjPair *last = NULL;
+    bool changed = false;
+    for (; IS_PAIR(body); body = CDR(body)) {
+        Value expression = CAR(body);
+        Value definition = unwrap(expression);
+        bool isLast = !IS_PAIR(CDR(body));
+
+        bool isDead = false;
+        if (isForm(expression, "define") &&
+            properListLength(definition) >= 3) {
+            Value target = unwrap(CADR(definition));
+            ObjSymbol *name = IS_PAIR(target) ? asSymbol(CAR(target))
+                                              : asSymbol(CADR(definition));
+            bool isPureValue = IS_PAIR(target) ||
+                               (3 == properListLength(definition) &&
+                                isPure(CADDR(definition)));
+            isDead = NULL != name && !symbolIsInterned(name) &&
+                     isPureValue && 1 == countOccurrences(syntax, name);
+        } else if (!isLast && isPure(expression)) {
+            isDead = true;
+        }
+
+        if (isDead) {
+            changed = true;
+            continue;
+        }
+
+        ObjPair *pair = newPair(expression, NIL_VAL);
+        if (NULL == last) {
+            kept = OBJ_VAL(pair);
+        } else {
+            last->cdr = OBJ_VAL(pair);
+        }
+        last = pair;
+    }
+
+    // A body can't be empty, or consist of only definitions.
+    if (!changed || NULL == last || isForm(last->car, "define")) return syntax;
+
+    ObjPair *copy = newPair(CAR(list), NIL_VAL);
+    ObjPair *pair = copy;
+    Value rest = CDR(list);
+    for (int i = 1; i < from; i++, rest = CDR(rest)) {
+        pair->cdr = OBJ_VAL(newPair(CAR(rest), NIL_VAL));
+        pair = AS_PAIR(pair->cdr);
+    }
+    pair->cdr = kept;
+    return rewrap(OBJ_VAL(copy), syntax);
+}
+
+static Value eliminateBindings(Value syntax) {
+    Value list = unwrap(syntax);
+    Value bindings = NIL_VAL;
+    ObjPair *last = NULL;
+    bool changed = false;
+
+    for (Value binding = unwrap(CADR(list)); IS_PAIR(binding);
+         binding = CDR(binding)) {
+        Value pair = unwrap(CAR(binding));
+        ObjSymbol *name =
+            2 == properListLength(pair) ? asSymbol(CAR(pair)) : NULL;
+        // The only occurrence of a dead variable is where it is bound.
+        if (NULL != name && !symbolIsInterned(name) && isPure(CADR(pair)) &&
+            1 == countOccurrences(syntax, name)) {
+            changed = true;
+            continue;
+        }
+
+        ObjPair *kept = newPair(CAR(binding), NIL_VAL);
+        if (NULL == last) {
+            bindings = OBJ_VAL(kept);
+        } else {
+            last->cdr = OBJ_VAL(kept);
+        }
+        last = kept;
+    }
+
+    if (!changed) return syntax;
+
+    // (let () expression) is just expression.
+    Value body = CDDR(list);
+    if (IS_NIL(bindings) && 1 == properListLength(body) &&
+        !isForm(CAR(body), "define")) {
+        return CAR(body);
+    }
+
+    return withElement(syntax, 1, rewrap(bindings, CADR(list)));
+}
+
+static Value eliminate(Value syntax) {
+    syntax = mapSubexpressions(syntax, eliminate);
+
+    if (isLetForm(syntax) && !isNamedLet(syntax)) {
+        syntax = eliminateBindings(syntax);
+    }
+
+    int from = bodyIndex(syntax);
+    if (-1 == from) return syntax;
+    return eliminateInBody(syntax, from);
+}
+
+static void dumpForm(char const *stage, Value form) {
+    printf(";; %s\n", stage);
+    printValue(form);
+    putchar('\n');
+}
+
+void noteAssignedGlobals(Value syntax) {
+    Value list = unwrap(syntax);
+    if (!IS_PAIR(list) || isQuote(syntax)) return;
+
+    if ((isKeyword(CAR(list), "define") || isKeyword(CAR(list), "set!")) &&
+        IS_PAIR(CDR(list))) {
+        Value target = unwrap(CADR(list));
+        // (define (name . parameters) body ...)
+        if (IS_PAIR(target)) target = CAR(target);
+        ObjSymbol *name = asSymbol(target);
+        if (NULL != name) name->isAssigned = true;
+    }
+
+    for (; IS_PAIR(list); list = CDR(list)) noteAssignedGlobals(CAR(list));
+}
+
+Value optimize(Value form) {
+    if (optimizerOptions.dumpIR) dumpForm("parse", form);
+    if (optimizerOptions.level <= 0) return form;
+
+    initSmartArray(&renamings, smartArrayCheckedRealloc, sizeof(Renaming));
+    form = renameSyntax(form);
+    freeSmartArray(&renamings);
+    if (optimizerOptions.dumpIR) dumpForm("rename", form);
+
+    for (size_t i = 0; i < sizeof(passes) / sizeof(*passes); i++) {
+        if (passes[i].level > optimizerOptions.level) continue;
+
+        currentForm = form;
+        form = passes[i].run(form);
+        if (optimizerOptions.dumpIR) dumpForm(passes[i].name, form);
+    }
+
+    return form;
+}
@@ -0,0 +1,49 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "value.h"
+
+// The highest optimization level, which runs every pass.
+#define OPTIMIZATION_LEVEL_MAX 2
+
+// Settings of the optimizer, which are set by command line flags.
+typedef struct {
+    int level;    // Passes run if their level is at most this, 0 runs none.
+    bool dumpIR;  // Print each form after every pass which runs.
+} OptimizerOptions;
+
+extern OptimizerOptions optimizerOptions;
+
+/*
+  Rewrites the syntax of a top level form into equivalent but faster
+  syntax, by running the passes of the current optimization level.
+  The garbage collector must be off, like it is while compiling.
+*/
+Value optimize(Value form);
+
+/*
+  Marks the globals which syntax defines or sets, including in its inner
+  forms, which keeps calls of the natives they are bound to from being
+  folded or made direct. Every form of a program is noted before any of
+  them is compiled, as a definition may come after a call.
+*/
+void noteAssignedGlobals(Value syntax);
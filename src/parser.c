@@ -33,11 +33,12 @@
 #include "smart_array.h"
 #include "value.h"
 
-Parser parser;
+_Thread_local Parser parser;
 
 static void synchronize(void);
 
 static ObjSyntax *parseList(void);
+static void parseListTail(ObjPair *list);
 static ObjSyntax *parseAbbreviation(ObjSymbol *abbreviationPrefix);
 
 static inline void initAST(ObjSyntaxPointerArray *ast);
@@ -117,6 +118,10 @@ ObjSyntax *parseExpression(void) {
             errorAtCurrent("Unexpected right parenthesis.");
             parserAdvance();
             break;
+        case TOKEN_PERIOD:
+            errorAtCurrent("Unexpected '.'.");
+            parserAdvance();
+            break;
 
         default:
             fprintf(stderr, "TODO: parse %s tokens.\n",
@@ -141,9 +146,16 @@ static ObjSyntax *parseList(void) {
 
     ObjSyntax *expr = parseExpression();
     ObjPair *list = newPair(OBJ_VAL(expr), NIL_VAL);
+    // Append at the last pair, so long lists don't walk the list each time.
+    ObjPair *last = list;
     while (canContinueList()) {
+        if (parserMatch(TOKEN_PERIOD)) {
+            parseListTail(last);
+            break;
+        }
         expr = parseExpression();
-        appendElement(list, OBJ_VAL(expr));
+        last->cdr = OBJ_VAL(newPair(OBJ_VAL(expr), NIL_VAL));
+        last = AS_PAIR(last->cdr);
     }
 
     consume(TOKEN_RIGHT_PAREN, "Expect right parenthesis to close list.");
@@ -151,6 +163,24 @@ static ObjSyntax *parseList(void) {
     return makeSyntaxFromTokenToCurrent(OBJ_VAL(list), &listStart);
 }
 
+/*
+  Parses the datum after the '.' of a dotted list as the cdr of its last
+  pair. A tail which is itself a list is spliced in, so (a . (b)) is the
+  same as (a b).
+*/
+static void parseListTail(ObjPair *list) {
+    if (!canContinueList()) {
+        errorAtCurrent("Expect a datum after '.'.");
+        return;
+    }
+
+    ObjSyntax *tail = parseExpression();
+    if (NULL == tail) return;
+    finalPair(list)->cdr =
+        IS_PAIR(tail->value) || IS_NIL(tail->value) ? tail->value
+                                                     : OBJ_VAL(tail);
+}
+
 static ObjSyntax *parseAbbreviation(ObjSymbol *abbreviationPrefix) {
     ObjPair *abbreviation = newPair(OBJ_VAL(abbreviationPrefix), NIL_VAL);
     Token const abbreviationStart = parser.current;
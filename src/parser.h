@@ -52,7 +52,7 @@ typedef struct {
     ObjSyntaxPointerArray ast;
 } Parser;
 
-extern Parser parser;
+extern _Thread_local Parser parser;
 
 void initParser(void);
 ObjSyntax *parseExpression(void);
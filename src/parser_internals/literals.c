@@ -57,7 +57,9 @@ ObjSyntax *parseCharacter(void) {
 
 ObjSyntax *parseString(void) {
     consume(TOKEN_STRING, "Expect string");
-    Value string = OBJ_VAL(tokenToObjSymbol(&(parser.previous)));
+    // Leave the surrounding double quotes out of the string's text.
+    Value string = OBJ_VAL(copyString(PREVIOUS_START() + 1,
+                                      tokenGetLength(&(parser.previous)) - 2));
     return makeSyntaxAtPrevious(string);
 }
 
@@ -50,15 +50,15 @@ char characterTokenToChar(Token *token) {
 }
 
 static char characterNameToChar(Token const *token) {
-    if (textOfTokenEqualToString(token, "alarm")) return (char)0x07;
-    if (textOfTokenEqualToString(token, "backspace")) return (char)0x08;
-    if (textOfTokenEqualToString(token, "delete")) return (char)0x07F;
-    if (textOfTokenEqualToString(token, "escape")) return (char)0x1B;
-    if (textOfTokenEqualToString(token, "newline")) return '\n';
-    if (textOfTokenEqualToString(token, "null")) return '\0';
-    if (textOfTokenEqualToString(token, "return")) return (char)0x0D;
-    if (textOfTokenEqualToString(token, "space")) return ' ';
-    if (textOfTokenEqualToString(token, "tab")) return '\t';
+    if (textOfTokenEqualToString(token, "#\\alarm")) return (char)0x07;
+    if (textOfTokenEqualToString(token, "#\\backspace")) return (char)0x08;
+    if (textOfTokenEqualToString(token, "#\\delete")) return (char)0x07F;
+    if (textOfTokenEqualToString(token, "#\\escape")) return (char)0x1B;
+    if (textOfTokenEqualToString(token, "#\\newline")) return '\n';
+    if (textOfTokenEqualToString(token, "#\\null")) return '\0';
+    if (textOfTokenEqualToString(token, "#\\return")) return (char)0x0D;
+    if (textOfTokenEqualToString(token, "#\\space")) return ' ';
+    if (textOfTokenEqualToString(token, "#\\tab")) return '\t';
 
     // We crash the program if this happens because if it does, it's a
     // programmer error in the scanner.
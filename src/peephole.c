@@ -0,0 +1,410 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "peephole.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "line_number.h"
+#include "memory.h"
+#include "object.h"
+#include "smart_array.h"
+#include "value.h"
+
+/*
+  The superinstructions are the pairs which ran most often in a profile of
+  fib, tak, named let and do loops, counters made with closures and case
+  dispatch. Between them, OP_GET_LOCAL OP_GET_LOCAL, OP_JUMP_IF_FALSE
+  OP_POP, OP_CONSTANT OP_ADD and OP_CLOSE_SCOPE OP_LOOP were over a
+  quarter of all pairs. OP_GET_GLOBAL OP_CALL and OP_CONSTANT OP_CALL
+  only happen for calls without arguments, which were too rare to fuse.
+*/
+
+// What a jump operand in the optimized code is patched with.
+typedef enum {
+    PATCH_FORWARD,   // The distance forwards to target.
+    PATCH_BACKWARD,  // The distance backwards to target.
+    PATCH_SWITCH,    // The offsets of the jump table of an OP_SWITCH.
+} PatchKind;
+
+typedef struct {
+    PatchKind kind;
+    // Where the operand is in the optimized code, or where the OP_SWITCH
+    // ends for PATCH_SWITCH.
+    size_t operand;
+    // Where the jump goes in the original code, or where the OP_SWITCH
+    // ends for PATCH_SWITCH.
+    size_t target;
+    int width;         // The size of the operand, 4 after OP_WIDE or else 2.
+    ObjSwitch *table;  // The jump table for PATCH_SWITCH.
+} Patch;
+
+// The chunk being optimized, and its original code.
+static _Thread_local Chunk *chunk;
+static _Thread_local uint8_t *code;
+static _Thread_local size_t count;
+
+// The line of each byte of the original code.
+static _Thread_local unsigned int *lines;
+
+// Whether a jump may land on each byte of the original code.
+static _Thread_local bool *isTarget;
+
+// Where each instruction of the original code went in the optimized code.
+static _Thread_local size_t *newOffsets;
+
+// The optimized code, and the jumps in it that need their operands patched.
+static _Thread_local Chunk optimized;
+static _Thread_local SmartArray patches;
+
+// Where the OP_SWITCH whose table is being mapped ends, in the original
+// code and the optimized code.
+static _Thread_local size_t switchEnd;
+static _Thread_local size_t newSwitchEnd;
+
+static uint16_t readShort(size_t offset);
+static uint32_t readInt(size_t offset);
+static bool isJump(uint8_t instruction);
+
+// Returns true if the instruction at offset is an OP_JUMP, wide or not.
+static bool isUnconditionalJump(size_t offset);
+
+// Returns where the jump instruction at offset, wide or not, goes.
+static size_t jumpTarget(size_t offset);
+
+/*
+  Returns where the forward jump at offset ends up going, after following
+  any unconditional jumps at its target, as long as its operand can still
+  reach.
+*/
+static size_t threadedTarget(size_t offset);
+
+static void markTargets(void);
+static int markSwitchTarget(int offset);
+static void expandLines(void);
+static void emitCode(void);
+static void patchJumps(void);
+static int mapSwitchOffset(int offset);
+
+void optimizeChunk(Chunk *toOptimize) {
+    chunk = toOptimize;
+    code = getChunkCode(chunk);
+    count = getChunkCount(chunk);
+    if (0 == count) return;
+
+    lines = ALLOCATE(unsigned int, count);
+    isTarget = ALLOCATE(bool, count + 1);
+    memset(isTarget, 0, (count + 1) * sizeof(bool));
+    newOffsets = ALLOCATE(size_t, count + 1);
+    initSmartArray(&patches, smartArrayCheckedRealloc, sizeof(Patch));
+    initChunk(&optimized);
+
+    expandLines();
+    markTargets();
+    emitCode();
+    patchJumps();
+
+    // The constants stay where they are, only the code and lines change.
+    freeSmartArray(&(chunk->code));
+    freeLineNumberArray(&(chunk->lines));
+    chunk->code = optimized.code;
+    chunk->lines = optimized.lines;
+    freeValueArray(&optimized.constants);
+
+    freeSmartArray(&patches);
+    FREE_ARRAY(size_t, newOffsets, count + 1);
+    FREE_ARRAY(bool, isTarget, count + 1);
+    FREE_ARRAY(unsigned int, lines, count);
+}
+
+
+static uint16_t readShort(size_t offset) {
+    return (uint16_t)((code[offset] << 8) | code[offset + 1]);
+}
+
+static uint32_t readInt(size_t offset) {
+    return ((uint32_t)readShort(offset) << 16) | readShort(offset + 2);
+}
+
+static bool isJump(uint8_t instruction) {
+    return OP_JUMP == instruction || OP_JUMP_IF_FALSE == instruction ||
+           OP_POP_JUMP_IF_FALSE == instruction || OP_LOOP == instruction;
+}
+
+static bool isUnconditionalJump(size_t offset) {
+    return OP_JUMP == code[offset] ||
+           (OP_WIDE == code[offset] && OP_JUMP == code[offset + 1]);
+}
+
+static size_t jumpTarget(size_t offset) {
+    if (OP_WIDE == code[offset]) {
+        uint32_t jump = readInt(offset + 2);
+        return OP_LOOP == code[offset + 1] ? offset + 6 - jump
+                                           : offset + 6 + jump;
+    }
+    if (OP_LOOP == code[offset]) return offset + 3 - readShort(offset + 1);
+    return offset + 3 + readShort(offset + 1);
+}
+
+static size_t threadedTarget(size_t offset) {
+    size_t end = offset + instructionLength(chunk, offset);
+    size_t reach = OP_WIDE == code[offset] ? UINT32_MAX : UINT16_MAX;
+    size_t target = jumpTarget(offset);
+    while (target < count && isUnconditionalJump(target)) {
+        size_t next = jumpTarget(target);
+        if (next - end > reach) break;
+        target = next;
+    }
+    return target;
+}
+
+static void markTargets(void) {
+    for (size_t offset = 0; offset < count;
+         offset += instructionLength(chunk, offset)) {
+        bool isWide = OP_WIDE == code[offset];
+        uint8_t instruction = code[isWide ? offset + 1 : offset];
+        if (OP_LOOP == instruction) {
+            isTarget[jumpTarget(offset)] = true;
+        } else if (isJump(instruction)) {
+            isTarget[threadedTarget(offset)] = true;
+        } else if (OP_SWITCH == instruction) {
+            switchEnd = offset + instructionLength(chunk, offset);
+            int constant = isWide ? readShort(offset + 2) : code[offset + 1];
+            switchMapOffsets(AS_SWITCH(getValueArrayAt(&(chunk->constants),
+                                                       constant)),
+                             markSwitchTarget);
+        }
+    }
+}
+
+static int markSwitchTarget(int offset) {
+    isTarget[switchEnd + offset] = true;
+    return offset;
+}
+
+static void expandLines(void) {
+    size_t offset = 0;
+    for (size_t i = 0; i < getSmartArrayCount(&(chunk->lines)); i++) {
+        LineNumber entry = getLineNumberArrayAt(&(chunk->lines), i);
+        for (unsigned int j = 0; j < entry.repeats && offset < count; j++) {
+            lines[offset++] = entry.lineNumber;
+        }
+    }
+}
+
+// Returns true if the instruction at offset only pushes a value.
+static bool isPurePush(size_t offset) {
+    switch (code[offset]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void emit(uint8_t byte, unsigned int line) {
+    writeChunk(&optimized, byte, line);
+}
+
+// Emits an operand of width bytes to patch once every target is placed.
+static void emitJumpOperand(PatchKind kind, size_t target, int width,
+                            unsigned int line) {
+    Patch patch = {.kind = kind,
+                   .operand = getChunkCount(&optimized),
+                   .target = target,
+                   .width = width,
+                   .table = NULL};
+    smartArrayAppend(&patches, &patch);
+    for (int i = 0; i < width; i++) emit(0xff, line);
+}
+
+/*
+  Records that the OP_SWITCH which was copied from offset, with constant as
+  the index of its table, needs its table mapped to the optimized code.
+*/
+static void addSwitchPatch(size_t offset, int constant) {
+    size_t length = instructionLength(chunk, offset);
+    Patch patch = {
+        .kind = PATCH_SWITCH,
+        .operand = getChunkCount(&optimized),
+        .target = offset + length,
+        .width = 0,
+        .table = AS_SWITCH(getValueArrayAt(&(chunk->constants), constant)),
+    };
+    smartArrayAppend(&patches, &patch);
+}
+
+/*
+  Emits the instruction after the OP_WIDE at offset, which is never fused
+  with anything, and returns the offset of the next instruction.
+*/
+static size_t emitWideInstruction(size_t offset) {
+    uint8_t instruction = code[offset + 1];
+    unsigned int line = lines[offset];
+
+    if (isJump(instruction)) {
+        emit(OP_WIDE, line);
+        emit(instruction, line);
+        if (OP_LOOP == instruction) {
+            emitJumpOperand(PATCH_BACKWARD, jumpTarget(offset), 4, line);
+        } else {
+            emitJumpOperand(PATCH_FORWARD, threadedTarget(offset), 4, line);
+        }
+        return offset + 6;
+    }
+
+    int length = instructionLength(chunk, offset);
+    for (int i = 0; i < length; i++) emit(code[offset + i], line);
+    if (OP_SWITCH == instruction) addSwitchPatch(offset, readShort(offset + 2));
+    return offset + length;
+}
+
+/*
+  Emits the instruction at offset, with next as the instruction after it
+  if it may be fused, or count if not. Returns the offset of the next
+  instruction to emit.
+*/
+static size_t emitInstruction(size_t offset, size_t next) {
+    uint8_t instruction = code[offset];
+    unsigned int line = lines[offset];
+    uint8_t following = next < count ? code[next] : OP_RETURN;
+    bool canFuse = next < count;
+
+    if (OP_WIDE == instruction) return emitWideInstruction(offset);
+
+    if (canFuse && OP_POP == following && isPurePush(offset)) {
+        return next + 1;
+    }
+
+    if (canFuse && OP_GET_LOCAL == instruction &&
+        OP_GET_LOCAL == following) {
+        emit(OP_GET_LOCAL_2, line);
+        emit(code[offset + 1], line);
+        emit(code[next + 1], line);
+        return next + 2;
+    }
+
+    if (canFuse && OP_CONSTANT == instruction &&
+        (OP_ADD == following || OP_SUBTRACT == following) &&
+        IS_NUMBER(getValueArrayAt(&(chunk->constants), code[offset + 1]))) {
+        emit(OP_ADD == following ? OP_ADD_CONSTANT : OP_SUBTRACT_CONSTANT,
+             line);
+        emit(code[offset + 1], line);
+        return next + 1;
+    }
+
+    if (canFuse && OP_CLOSE_SCOPE == instruction && OP_LOOP == following) {
+        emit(OP_CLOSE_SCOPE_LOOP, line);
+        emit(code[offset + 1], line);
+        emit(code[offset + 2], line);
+        emitJumpOperand(PATCH_BACKWARD, jumpTarget(next), 2, line);
+        return next + 3;
+    }
+
+    if (OP_JUMP == instruction || OP_JUMP_IF_FALSE == instruction) {
+        size_t target = threadedTarget(offset);
+        // Jumping to the next instruction does nothing, because neither
+        // kind of jump pops.
+        if (offset + 3 == target) return offset + 3;
+
+        if (OP_JUMP == instruction && OP_RETURN == code[target]) {
+            emit(OP_RETURN, line);
+            return offset + 3;
+        }
+
+        if (OP_JUMP_IF_FALSE == instruction && canFuse &&
+            OP_POP == following && OP_POP == code[target]) {
+            // The other branch starts after its OP_POP.
+            isTarget[target + 1] = true;
+            emit(OP_POP_JUMP_IF_FALSE, line);
+            emitJumpOperand(PATCH_FORWARD, target + 1, 2, line);
+            return next + 1;
+        }
+
+        emit(instruction, line);
+        emitJumpOperand(PATCH_FORWARD, target, 2, line);
+        return offset + 3;
+    }
+
+    if (OP_LOOP == instruction) {
+        emit(instruction, line);
+        emitJumpOperand(PATCH_BACKWARD, jumpTarget(offset), 2, line);
+        return offset + 3;
+    }
+
+    int length = instructionLength(chunk, offset);
+    for (int i = 0; i < length; i++) emit(code[offset + i], line);
+
+    if (OP_SWITCH == instruction) addSwitchPatch(offset, code[offset + 1]);
+
+    return offset + length;
+}
+
+static void emitCode(void) {
+    size_t offset = 0;
+    while (offset < count) {
+        size_t next = offset + instructionLength(chunk, offset);
+        size_t emitted = getChunkCount(&optimized);
+
+        // Instructions which are fused or removed land where the next
+        // emitted one starts.
+        size_t after = emitInstruction(
+            offset, next < count && !isTarget[next] ? next : count);
+        for (size_t i = offset; i < after; i++) {
+            newOffsets[i] = i == offset ? emitted : getChunkCount(&optimized);
+        }
+        offset = after;
+    }
+    newOffsets[count] = getChunkCount(&optimized);
+}
+
+static void patchJumps(void) {
+    uint8_t *optimizedCode = getChunkCode(&optimized);
+    for (size_t i = 0; i < getSmartArrayCount(&patches); i++) {
+        Patch *patch = &SMART_ARRAY_AT(&patches, i, Patch);
+        if (PATCH_SWITCH == patch->kind) {
+            switchEnd = patch->target;
+            newSwitchEnd = patch->operand;
+            switchMapOffsets(patch->table, mapSwitchOffset);
+            continue;
+        }
+
+        size_t end = patch->operand + patch->width;
+        size_t target = newOffsets[patch->target];
+        size_t jump = PATCH_FORWARD == patch->kind ? target - end
+                                                   : end - target;
+        for (int j = 0; j < patch->width; j++) {
+            int shift = 8 * (patch->width - 1 - j);
+            optimizedCode[patch->operand + j] = (jump >> shift) & 0xff;
+        }
+    }
+}
+
+static int mapSwitchOffset(int offset) {
+    return (int)(newOffsets[switchEnd + offset] - newSwitchEnd);
+}
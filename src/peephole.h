@@ -0,0 +1,30 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "chunk.h"
+
+/*
+  Rewrites the code of chunk into equivalent code which dispatches fewer
+  instructions. Jumps to jumps are threaded, values which are pushed and
+  then popped straight away are never pushed, and common pairs of
+  instructions are fused into superinstructions. The line numbers of
+  chunk are kept in step with its code.
+*/
+void optimizeChunk(Chunk *chunk);
@@ -0,0 +1,968 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "register_vm.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "checkpoint.h"
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+#include "table.h"
+
+RegisterOptions registerOptions = {.enabled = false};
+
+/*
+  Register code is translated from the bytecode of a function. Every value
+  on the stack of the bytecode gets a register, which is the slot of the
+  frame that the value would have been pushed to. Locals keep the slots
+  the compiler gave them, and temporaries get the slot at the top of the
+  stack when they are made. The registers of a frame are its slots on the
+  VM's stack, so run() and the register VM can take turns running a frame.
+
+  Pushing a local or a constant doesn't become an instruction. The
+  translator remembers what was pushed, and the instruction which pops it
+  reads the local or constant directly, so (+ x 1) is a single R_ADD.
+
+  In the comments below, R(x) is register x and RK(x) is register x, or
+  the constant x & ~CONSTANT_BIT if it has CONSTANT_BIT set.
+*/
+typedef enum {
+    R_MOVE,            // R(a) = RK(b)
+    R_LOAD_CONSTANT,   // R(a) = the constant d, for constants RK can't name.
+    R_GET_GLOBAL,      // R(a) = the global named by the constant b
+    R_SET_GLOBAL,      // The global named by the constant b = R(a)
+    R_DEFINE_GLOBAL,   // Defines the global named by the constant b as R(a).
+    R_GET_UPVALUE,     // R(a) = upvalue b
+    R_SET_UPVALUE,     // Upvalue a = RK(b)
+    R_CLOSURE,         // R(a) = a closure, made like the OP_CLOSURE at d
+    R_CLOSE_UPVALUES,  // Closes the upvalues of R(a) and the ones above it.
+    R_JUMP,            // Goes to instruction d.
+    R_JUMP_IF_FALSE,   // Goes to instruction d if RK(a) is false.
+
+    // Goes to where the ObjSwitch in the constant b sends RK(a), where the
+    // offsets of the switch are from offset d of the bytecode.
+    R_SWITCH,
+
+    // R(a) = RK(b) op RK(c)
+    R_ADD,
+    R_SUBTRACT,
+    R_MULTIPLY,
+    R_DIVIDE,
+    R_NUMBER_EQUAL,
+    R_LESS,
+    R_LESS_EQUAL,
+    R_GREATER,
+    R_GREATER_EQUAL,
+
+    // Goes to instruction d unless RK(b) op RK(c). Each is a comparison
+    // above fused with the R_JUMP_IF_FALSE that tests its result.
+    R_JUMP_UNLESS_NUMBER_EQUAL,
+    R_JUMP_UNLESS_LESS,
+    R_JUMP_UNLESS_LESS_EQUAL,
+    R_JUMP_UNLESS_GREATER,
+    R_JUMP_UNLESS_GREATER_EQUAL,
+
+    // Calls R(a) with the b registers after it as arguments, and leaves the
+    // result in R(a). The call returns to offset d of the bytecode.
+    R_CALL,
+
+    // Returns RK(a) from a frame which has b values on the stack.
+    R_RETURN,
+} RegisterOpCode;
+
+typedef struct {
+    uint8_t opcode;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    uint32_t d;
+} RegisterInstruction;
+
+struct RegisterCode {
+    // These grow with realloc() as instructions are emitted.
+    RegisterInstruction *instructions;  // NULL if the function can't run.
+    uint32_t *offsets;  // The offset in the bytecode of each instruction.
+    size_t count;
+    Value *constants;  // The chunk's constants, then nil, #t and #f.
+    size_t constantCount;
+    uint32_t *entries;  // For each bytecode offset, where it is resumed.
+    size_t bytecodeCount;
+    int registerCount;  // The most registers the function uses.
+};
+
+#define CONSTANT_BIT 0x8000
+#define OPERAND_MAX (CONSTANT_BIT - 1)
+
+// Marks a stack value which is in its own register.
+#define IN_REGISTER UINT16_MAX
+
+// Marks offsets in bytecode where register code can't be resumed.
+#define NOT_AN_ENTRY UINT32_MAX
+
+#define UNKNOWN_DEPTH (-1)
+
+// The state of translating one function.
+typedef struct {
+    Chunk *chunk;
+    RegisterCode *code;
+    size_t capacity;
+    int offset;  // The offset of the instruction being translated.
+
+    /*
+      The operand which reads each value on the stack: IN_REGISTER if the
+      value is in the register for its depth, and otherwise the register
+      or constant it is a copy of. A copied register is always below the
+      copy and never pending itself.
+    */
+    uint16_t *operands;
+    int depth;
+
+    bool *boundaries;  // Offsets where blocks start, which can be resumed.
+    int *depths;       // The depth of the stack at each boundary, if known.
+    bool reachable;    // If the instruction being translated can run.
+    bool capturesLocals;  // If a closure made here captures a local.
+    bool failed;
+
+    // The last instruction, if it is a comparison which may be fused with
+    // the conditional jump after it. Otherwise, -1.
+    long fusable;
+} Translator;
+
+static RegisterCode *resumableCode(CallFrame *frame);
+static bool execute(CallFrame *frame, RegisterCode *code);
+static void pointAt(CallFrame *frame, RegisterCode const *code,
+                    RegisterInstruction const *instruction);
+static bool operandError(CallFrame *frame, RegisterCode const *code,
+                         RegisterInstruction const *instruction);
+
+static RegisterCode *translate(ObjFunction *function);
+static void findBoundaries(Translator *translator);
+static void translateInstruction(Translator *translator);
+static void translateCloseScope(Translator *translator, int slot, int keep);
+static void translatePopJumpIfFalse(Translator *translator, int target);
+static bool patchJumps(Translator *translator);
+static void emit(Translator *translator, RegisterOpCode opcode, int a, int b,
+                 int c, uint32_t d);
+static void pushOperand(Translator *translator, uint16_t operand);
+static void pushConstant(Translator *translator, size_t index);
+static int pushRegister(Translator *translator);
+static uint16_t operandAt(Translator const *translator, int depth);
+static void materialize(Translator *translator, int depth);
+static void materializeAll(Translator *translator);
+static void setDepthAt(Translator *translator, int offset, int depth);
+static int markSwitchTarget(int offset);
+static int setSwitchTargetDepth(int offset);
+static int readShort(uint8_t const *operands);
+
+bool enterRegisters(CallFrame *frame) {
+    RegisterCode *code = resumableCode(frame);
+    if (NULL == code) return true;
+    return execute(frame, code);
+}
+
+void freeRegisterCode(RegisterCode *code) {
+    free(code->instructions);
+    free(code->offsets);
+    FREE_ARRAY(Value, code->constants, code->constantCount);
+    FREE_ARRAY(uint32_t, code->entries, code->bytecodeCount);
+    FREE(RegisterCode, code);
+}
+
+/*
+  Returns the register code which frame can be resumed in at frame->ip,
+  with room on the stack for its registers, or NULL if it can't be.
+*/
+static RegisterCode *resumableCode(CallFrame *frame) {
+    ObjFunction *function = frame->closure->function;
+    if (TIER_NATIVE != function->tier) return NULL;
+    if (NULL == function->registerCode) {
+        function->registerCode = translate(function);
+    }
+
+    RegisterCode *code = function->registerCode;
+    size_t offset = frame->ip - getChunkCode(&(function->chunk));
+    if (NULL == code->instructions || offset >= code->bytecodeCount ||
+        NOT_AN_ENTRY == code->entries[offset]) {
+        return NULL;
+    }
+
+    // The interpreter takes over the frame if the register code deopts.
+    size_t height = (size_t)(frame->slots - vm.stack) + code->registerCount;
+    if (height > vm.stackCapacity) reserveStack(height);
+    reserveFrame(frame);
+    return code;
+}
+
+/*
+  Runs register code from frame->ip. vm.stackTop is only brought up to
+  date before instructions which can allocate, call or leave, and every
+  value below it is in its register then.
+*/
+static bool execute(CallFrame *frame, RegisterCode *code) {
+    Value *slots;
+    Value const *constants;
+    uint8_t *bytecode;
+    RegisterInstruction const *ip;
+
+#define LOAD_FRAME()                                                     \
+    do {                                                                 \
+        slots = frame->slots;                                            \
+        constants = code->constants;                                     \
+        bytecode = getChunkCode(&(frame->closure->function->chunk));     \
+        ip = code->instructions + code->entries[frame->ip - bytecode];   \
+    } while (false)
+
+#define RK(operand)                                          \
+    (CONSTANT_BIT & (operand) ? constants[(operand) & OPERAND_MAX] \
+                              : slots[(operand)])
+
+#define READ_SYMBOL() AS_SYMBOL(constants[instruction->b])
+
+#define BINARY_OP(valueType, op)                                          \
+    do {                                                                  \
+        Value b = RK(instruction->b);                                     \
+        Value c = RK(instruction->c);                                     \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) {                             \
+            return operandError(frame, code, instruction);                \
+        }                                                                 \
+        slots[instruction->a] = valueType(AS_NUMBER(b) op AS_NUMBER(c));  \
+    } while (false)
+
+#define JUMP_UNLESS(op)                                       \
+    do {                                                      \
+        Value b = RK(instruction->b);                         \
+        Value c = RK(instruction->c);                         \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) {                 \
+            return operandError(frame, code, instruction);    \
+        }                                                     \
+        if (!(AS_NUMBER(b) op AS_NUMBER(c))) {                \
+            ip = code->instructions + instruction->d;         \
+        }                                                     \
+    } while (false)
+
+    LOAD_FRAME();
+    for (;;) {
+#ifdef COUNT_INSTRUCTIONS
+        vm.stats.registerInstructions++;
+#endif
+        RegisterInstruction const *instruction = ip++;
+        switch (instruction->opcode) {
+            case R_MOVE:
+                slots[instruction->a] = RK(instruction->b);
+                break;
+            case R_LOAD_CONSTANT:
+                slots[instruction->a] = constants[instruction->d];
+                break;
+            case R_GET_GLOBAL: {
+                ObjSymbol *name = READ_SYMBOL();
+                if (!tableGet(&vm.globals, name, slots + instruction->a)) {
+                    pointAt(frame, code, instruction);
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return false;
+                }
+                break;
+            }
+            case R_SET_GLOBAL: {
+                ObjSymbol *name = READ_SYMBOL();
+                vm.stackTop = slots + instruction->a + 1;
+                if (tableSet(&vm.globals, name, slots[instruction->a])) {
+                    tableDelete(&vm.globals, name);
+                    pointAt(frame, code, instruction);
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return false;
+                }
+                break;
+            }
+            case R_DEFINE_GLOBAL:
+                vm.stackTop = slots + instruction->a + 1;
+                tableSet(&vm.globals, READ_SYMBOL(), slots[instruction->a]);
+                break;
+            case R_GET_UPVALUE:
+                slots[instruction->a] =
+                    *frame->closure->upvalues[instruction->b]->location;
+                break;
+            case R_SET_UPVALUE: {
+                ObjUpvalue *upvalue = frame->closure->upvalues[instruction->a];
+                writeSlot(&upvalue->obj, upvalue->location, RK(instruction->b));
+                break;
+            }
+            case R_CLOSURE: {
+                uint8_t const *operands = bytecode + instruction->d;
+                ObjFunction *function = AS_FUNCTION(constants[operands[1]]);
+                vm.stackTop = slots + instruction->a;
+                ObjClosure *closure = newClosure(function);
+                push(OBJ_VAL(closure));
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t isLocal = operands[2 + 2 * i];
+                    uint8_t index = operands[3 + 2 * i];
+                    closure->upvalues[i] =
+                        isLocal ? captureUpvalue(slots + index)
+                                : frame->closure->upvalues[index];
+                }
+                break;
+            }
+            case R_CLOSE_UPVALUES:
+                closeUpvalues(slots + instruction->a);
+                break;
+            case R_JUMP:
+                ip = code->instructions + instruction->d;
+                break;
+            case R_JUMP_IF_FALSE:
+                if (isFalsey(RK(instruction->a))) {
+                    ip = code->instructions + instruction->d;
+                }
+                break;
+            case R_SWITCH: {
+                ObjSwitch *table = AS_SWITCH(constants[instruction->b]);
+                int target =
+                    instruction->d + switchLookup(table, RK(instruction->a));
+                ip = code->instructions + code->entries[target];
+                break;
+            }
+            case R_ADD:
+                BINARY_OP(NUMBER_VAL, +);
+                break;
+            case R_SUBTRACT:
+                BINARY_OP(NUMBER_VAL, -);
+                break;
+            case R_MULTIPLY:
+                BINARY_OP(NUMBER_VAL, *);
+                break;
+            case R_DIVIDE:
+                BINARY_OP(NUMBER_VAL, /);
+                break;
+            case R_NUMBER_EQUAL:
+                BINARY_OP(BOOL_VAL, ==);
+                break;
+            case R_LESS:
+                BINARY_OP(BOOL_VAL, <);
+                break;
+            case R_LESS_EQUAL:
+                BINARY_OP(BOOL_VAL, <=);
+                break;
+            case R_GREATER:
+                BINARY_OP(BOOL_VAL, >);
+                break;
+            case R_GREATER_EQUAL:
+                BINARY_OP(BOOL_VAL, >=);
+                break;
+            case R_JUMP_UNLESS_NUMBER_EQUAL:
+                JUMP_UNLESS(==);
+                break;
+            case R_JUMP_UNLESS_LESS:
+                JUMP_UNLESS(<);
+                break;
+            case R_JUMP_UNLESS_LESS_EQUAL:
+                JUMP_UNLESS(<=);
+                break;
+            case R_JUMP_UNLESS_GREATER:
+                JUMP_UNLESS(>);
+                break;
+            case R_JUMP_UNLESS_GREATER_EQUAL:
+                JUMP_UNLESS(>=);
+                break;
+            case R_CALL: {
+                frame->ip = bytecode + instruction->d;
+                vm.stackTop = slots + instruction->a + instruction->b + 1;
+                Value callee = slots[instruction->a];
+
+                // Calls of functions which already run here skip callValue().
+                if (IS_CLOSURE(callee) && FRAMES_MAX != vm.frameCount) {
+                    ObjFunction *function = AS_CLOSURE(callee)->function;
+                    RegisterCode *calleeCode = function->registerCode;
+                    if (instruction->b == function->arity &&
+                        TIER_NATIVE == function->tier && NULL != calleeCode &&
+                        NULL != calleeCode->instructions) {
+                        frame = &vm.frames[vm.frameCount++];
+                        frame->closure = AS_CLOSURE(callee);
+                        frame->ip = getChunkCode(&(function->chunk));
+                        frame->slots = slots + instruction->a;
+                        code = resumableCode(frame);
+                        LOAD_FRAME();
+                        break;
+                    }
+                }
+
+                if (!callValue(callee, instruction->b)) return false;
+
+                if (frame == &vm.frames[vm.frameCount - 1]) {
+                    // A native, which has left its result in R(a).
+                    slots = frame->slots;
+                    break;
+                }
+
+                frame = &vm.frames[vm.frameCount - 1];
+                code = resumableCode(frame);
+                if (NULL == code) return true;
+                LOAD_FRAME();
+                break;
+            }
+            case R_RETURN: {
+                Value result = RK(instruction->a);
+                if (vm.baseFrame + 1 == vm.frameCount) {
+                    // run() finishes the script, or returns to a native.
+                    slots[instruction->b - 1] = result;
+                    vm.stackTop = slots + instruction->b;
+                    frame->ip = bytecode +
+                                code->offsets[instruction - code->instructions];
+                    return true;
+                }
+
+                closeUpvalues(frame->slots);
+                vm.frameCount--;
+                frame->slots[0] = result;
+                vm.stackTop = frame->slots + 1;
+
+                frame = &vm.frames[vm.frameCount - 1];
+                code = resumableCode(frame);
+                if (NULL == code) return true;
+                LOAD_FRAME();
+                break;
+            }
+        }
+    }
+
+#undef LOAD_FRAME
+#undef RK
+#undef READ_SYMBOL
+#undef BINARY_OP
+#undef JUMP_UNLESS
+}
+
+/*
+  Points frame->ip into the bytecode which instruction came from, so that
+  a runtime error reports its line.
+*/
+static void pointAt(CallFrame *frame, RegisterCode const *code,
+                    RegisterInstruction const *instruction) {
+    frame->ip = getChunkCode(&(frame->closure->function->chunk)) +
+                code->offsets[instruction - code->instructions] + 1;
+}
+
+static bool operandError(CallFrame *frame, RegisterCode const *code,
+                         RegisterInstruction const *instruction) {
+    pointAt(frame, code, instruction);
+    runtimeError("Operands must be numbers.");
+    return false;
+}
+
+/*
+  Translates the bytecode of function to register code. If that can't be
+  done, the result has no instructions, so function keeps running in the
+  interpreter.
+*/
+static RegisterCode *translate(ObjFunction *function) {
+    Chunk *chunk = &(function->chunk);
+    int const COUNT = (int)getChunkCount(chunk);
+    size_t const CONSTANT_COUNT = getValueArrayCount(&(chunk->constants));
+
+    RegisterCode *code = ALLOCATE(RegisterCode, 1);
+    code->instructions = NULL;
+    code->offsets = NULL;
+    code->count = 0;
+    code->constantCount = CONSTANT_COUNT + 3;
+    code->constants = ALLOCATE(Value, code->constantCount);
+    for (size_t i = 0; i < CONSTANT_COUNT; i++) {
+        code->constants[i] = getValueArrayAt(&(chunk->constants), i);
+    }
+    code->constants[CONSTANT_COUNT] = NIL_VAL;
+    code->constants[CONSTANT_COUNT + 1] = BOOL_VAL(true);
+    code->constants[CONSTANT_COUNT + 2] = BOOL_VAL(false);
+    code->bytecodeCount = COUNT;
+    code->entries = ALLOCATE(uint32_t, COUNT);
+    for (int i = 0; i < COUNT; i++) code->entries[i] = NOT_AN_ENTRY;
+
+    // Each instruction pushes at most two values.
+    int const PARAMETERS = parameterCount(&function->parameters);
+    int const DEPTH_MAX = PARAMETERS + 1 + 2 * COUNT;
+    code->registerCount = PARAMETERS + 1;
+
+    Translator translator = {
+        .chunk = chunk,
+        .code = code,
+        .operands = malloc(DEPTH_MAX * sizeof(uint16_t)),
+        .depth = PARAMETERS + 1,
+        .boundaries = calloc(COUNT + 1, sizeof(bool)),
+        .depths = malloc((COUNT + 1) * sizeof(int)),
+        .reachable = true,
+        .fusable = -1,
+    };
+    for (int i = 0; i < DEPTH_MAX; i++) translator.operands[i] = IN_REGISTER;
+    for (int i = 0; i <= COUNT; i++) translator.depths[i] = UNKNOWN_DEPTH;
+
+    findBoundaries(&translator);
+    for (int offset = 0; offset < COUNT && !translator.failed;
+         offset += instructionLength(chunk, offset)) {
+        translator.offset = offset;
+        if (translator.boundaries[offset]) {
+            if (translator.reachable) {
+                materializeAll(&translator);
+                setDepthAt(&translator, offset, translator.depth);
+            } else if (UNKNOWN_DEPTH != translator.depths[offset]) {
+                translator.reachable = true;
+                translator.depth = translator.depths[offset];
+                for (int i = 0; i < translator.depth; i++) {
+                    translator.operands[i] = IN_REGISTER;
+                }
+            }
+            if (translator.reachable) {
+                code->entries[offset] = (uint32_t)code->count;
+            }
+            translator.fusable = -1;
+        }
+        if (translator.reachable) translateInstruction(&translator);
+    }
+
+    if (translator.failed || !patchJumps(&translator)) {
+        free(code->instructions);
+        free(code->offsets);
+        code->instructions = NULL;
+        code->offsets = NULL;
+        code->count = 0;
+    }
+
+    free(translator.operands);
+    free(translator.boundaries);
+    free(translator.depths);
+    return code;
+}
+
+// The translator whose switch targets markSwitchTarget() and
+// setSwitchTargetDepth() handle, and where the OP_SWITCH ends.
+static _Thread_local Translator *switchTranslator;
+static _Thread_local int switchEnd;
+
+/*
+  Finds the offsets where blocks start: the start of the function, the
+  targets of jumps, and the instructions after calls, where frames are
+  resumed when the call returns.
+*/
+static void findBoundaries(Translator *translator) {
+    Chunk *chunk = translator->chunk;
+    int const COUNT = (int)getChunkCount(chunk);
+    bool *boundaries = translator->boundaries;
+
+    boundaries[0] = true;
+    for (int offset = 0; offset < COUNT;
+         offset += instructionLength(chunk, offset)) {
+        uint8_t const *ip = getChunkCode(chunk) + offset;
+        int const END = offset + instructionLength(chunk, offset);
+        int target = -1;
+        switch (ip[0]) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_POP_JUMP_IF_FALSE:
+                target = END + readShort(ip + 1);
+                break;
+            case OP_LOOP:
+                target = END - readShort(ip + 1);
+                break;
+            case OP_CLOSE_SCOPE_LOOP:
+                target = END - readShort(ip + 3);
+                break;
+            case OP_CALL:
+            case OP_CALL_CLOSURE:
+            case OP_CALL_NATIVE:
+                target = END;
+                break;
+            case OP_SWITCH:
+                switchTranslator = translator;
+                switchEnd = END;
+                switchMapOffsets(
+                    AS_SWITCH(getValueArrayAt(&(chunk->constants), ip[1])),
+                    markSwitchTarget);
+                break;
+            case OP_CLOSURE:
+                for (int i = 2; i < END - offset; i += 2) {
+                    if (ip[i]) translator->capturesLocals = true;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (target < 0 || target > COUNT) {
+            translator->failed = translator->failed || -1 != target;
+        } else {
+            boundaries[target] = true;
+        }
+    }
+}
+
+static void translateInstruction(Translator *translator) {
+    Chunk *chunk = translator->chunk;
+    uint8_t const *ip = getChunkCode(chunk) + translator->offset;
+    int const END =
+        translator->offset + instructionLength(chunk, translator->offset);
+    size_t const LITERALS = translator->code->constantCount - 3;
+    int const TOP = translator->depth - 1;
+
+    switch (ip[0]) {
+        case OP_CONSTANT:
+            pushConstant(translator, ip[1]);
+            break;
+        case OP_CONSTANT_LONG:
+            pushConstant(translator, (ip[1] << 16) | readShort(ip + 2));
+            break;
+        case OP_NIL:
+            pushConstant(translator, LITERALS);
+            break;
+        case OP_TRUE:
+            pushConstant(translator, LITERALS + 1);
+            break;
+        case OP_FALSE:
+            pushConstant(translator, LITERALS + 2);
+            break;
+        case OP_POP:
+            translator->depth--;
+            break;
+        case OP_GET_LOCAL:
+            pushOperand(translator, operandAt(translator, ip[1]));
+            break;
+        case OP_GET_LOCAL_2:
+            pushOperand(translator, operandAt(translator, ip[1]));
+            pushOperand(translator, operandAt(translator, ip[2]));
+            break;
+        case OP_SET_LOCAL: {
+            if (ip[1] == TOP) break;
+            uint16_t value = operandAt(translator, TOP);
+            // Copies of the local must be made before it changes.
+            for (int i = 0; i < translator->depth; i++) {
+                if (ip[1] == translator->operands[i]) {
+                    materialize(translator, i);
+                }
+            }
+            emit(translator, R_MOVE, ip[1], value, 0, 0);
+            translator->operands[ip[1]] = IN_REGISTER;
+            break;
+        }
+        case OP_GET_GLOBAL: {
+            int result = pushRegister(translator);
+            emit(translator, R_GET_GLOBAL, result, ip[1], 0, 0);
+            break;
+        }
+        case OP_SET_GLOBAL:
+            materializeAll(translator);
+            emit(translator, R_SET_GLOBAL, TOP, ip[1], 0, 0);
+            break;
+        case OP_DEFINE_GLOBAL:
+            materializeAll(translator);
+            emit(translator, R_DEFINE_GLOBAL, TOP, ip[1], 0, 0);
+            translator->depth--;
+            break;
+        case OP_GET_UPVALUE: {
+            int result = pushRegister(translator);
+            emit(translator, R_GET_UPVALUE, result, ip[1], 0, 0);
+            break;
+        }
+        case OP_SET_UPVALUE:
+            emit(translator, R_SET_UPVALUE, ip[1], operandAt(translator, TOP),
+                 0, 0);
+            break;
+        case OP_JUMP:
+            materializeAll(translator);
+            setDepthAt(translator, END + readShort(ip + 1), translator->depth);
+            emit(translator, R_JUMP, 0, 0, 0, END + readShort(ip + 1));
+            translator->reachable = false;
+            break;
+        case OP_JUMP_IF_FALSE:
+            materializeAll(translator);
+            setDepthAt(translator, END + readShort(ip + 1), translator->depth);
+            emit(translator, R_JUMP_IF_FALSE, TOP, 0, 0,
+                 END + readShort(ip + 1));
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            translatePopJumpIfFalse(translator, END + readShort(ip + 1));
+            break;
+        case OP_LOOP:
+            materializeAll(translator);
+            setDepthAt(translator, END - readShort(ip + 1), translator->depth);
+            emit(translator, R_JUMP, 0, 0, 0, END - readShort(ip + 1));
+            translator->reachable = false;
+            break;
+        case OP_CALL:
+        case OP_CALL_CLOSURE:
+        case OP_CALL_NATIVE: {
+            int callee = TOP - ip[1];
+            materializeAll(translator);
+            emit(translator, R_CALL, callee, ip[1], 0, END);
+            translator->depth = callee + 1;
+            break;
+        }
+        case OP_CLOSURE: {
+            materializeAll(translator);
+            int result = pushRegister(translator);
+            emit(translator, R_CLOSURE, result, 0, 0, translator->offset);
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            materializeAll(translator);
+            emit(translator, R_CLOSE_UPVALUES, TOP, 0, 0, 0);
+            translator->depth--;
+            break;
+        case OP_CLOSE_SCOPE:
+            translateCloseScope(translator, ip[1], ip[2]);
+            break;
+        case OP_CLOSE_SCOPE_LOOP:
+            translateCloseScope(translator, ip[1], ip[2]);
+            materializeAll(translator);
+            setDepthAt(translator, END - readShort(ip + 3), translator->depth);
+            emit(translator, R_JUMP, 0, 0, 0, END - readShort(ip + 3));
+            translator->reachable = false;
+            break;
+        case OP_SWITCH: {
+            uint16_t key = operandAt(translator, TOP);
+            translator->depth--;
+            materializeAll(translator);
+            switchTranslator = translator;
+            switchEnd = END;
+            switchMapOffsets(
+                AS_SWITCH(getValueArrayAt(&(chunk->constants), ip[1])),
+                setSwitchTargetDepth);
+            emit(translator, R_SWITCH, key, ip[1], 0, END);
+            translator->reachable = false;
+            break;
+        }
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NUMBER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+        case OP_GREATER:
+        case OP_GREATER_EQUAL: {
+            uint16_t left = operandAt(translator, TOP - 1);
+            uint16_t right = operandAt(translator, TOP);
+            translator->depth -= 2;
+            int result = pushRegister(translator);
+            emit(translator, R_ADD + (ip[0] - OP_ADD), result, left, right, 0);
+            if (ip[0] >= OP_NUMBER_EQUAL) {
+                translator->fusable = (long)translator->code->count - 1;
+            }
+            break;
+        }
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT: {
+            uint16_t left = operandAt(translator, TOP);
+            translator->depth--;
+            int result = pushRegister(translator);
+            emit(translator,
+                 OP_ADD_CONSTANT == ip[0] ? R_ADD : R_SUBTRACT, result, left,
+                 CONSTANT_BIT | ip[1], 0);
+            break;
+        }
+        case OP_RETURN:
+            emit(translator, R_RETURN, operandAt(translator, TOP),
+                 translator->depth, 0, 0);
+            translator->reachable = false;
+            break;
+        default:
+            translator->failed = true;
+            break;
+    }
+}
+
+/*
+  Translates closing the scope whose first local is in slot, which keeps
+  the keep values on top of the stack in the scope's first slots.
+*/
+static void translateCloseScope(Translator *translator, int slot, int keep) {
+    int const FIRST = translator->depth - keep;
+
+    // Copies of the scope's locals must be made before they are moved over.
+    for (int i = FIRST; i < translator->depth; i++) {
+        uint16_t operand = translator->operands[i];
+        if (IN_REGISTER != operand && !(CONSTANT_BIT & operand) &&
+            operand >= slot) {
+            materialize(translator, i);
+        }
+    }
+
+    if (translator->capturesLocals) {
+        emit(translator, R_CLOSE_UPVALUES, slot, 0, 0, 0);
+    }
+
+    /*
+      Every value left is a constant, a local below the scope or in its own
+      register above the scope's first keep slots, so moving them up from
+      the bottom doesn't overwrite any which haven't been moved yet.
+    */
+    for (int i = 0; i < keep; i++) {
+        uint16_t operand = operandAt(translator, FIRST + i);
+        if (CONSTANT_BIT & operand || operand < slot) {
+            translator->operands[slot + i] = operand;
+        } else {
+            if (operand != slot + i) {
+                emit(translator, R_MOVE, slot + i, operand, 0, 0);
+            }
+            translator->operands[slot + i] = IN_REGISTER;
+        }
+    }
+    translator->depth = slot + keep;
+}
+
+/*
+  Translates OP_POP_JUMP_IF_FALSE. When the condition was just computed by
+  a comparison, the two are fused into one instruction.
+*/
+static void translatePopJumpIfFalse(Translator *translator, int target) {
+    RegisterCode *code = translator->code;
+    int const TOP = translator->depth - 1;
+    translator->depth--;
+
+    if (translator->fusable == (long)code->count - 1 &&
+        code->instructions[translator->fusable].a == TOP) {
+        RegisterInstruction comparison = code->instructions[--code->count];
+        uint32_t comparisonOffset = code->offsets[code->count];
+        materializeAll(translator);
+        setDepthAt(translator, target, translator->depth);
+        emit(translator,
+             R_JUMP_UNLESS_NUMBER_EQUAL +
+                 (comparison.opcode - R_NUMBER_EQUAL),
+             0, comparison.b, comparison.c, target);
+        code->offsets[code->count - 1] = comparisonOffset;
+        return;
+    }
+
+    uint16_t condition = operandAt(translator, TOP);
+    materializeAll(translator);
+    setDepthAt(translator, target, translator->depth);
+    emit(translator, R_JUMP_IF_FALSE, condition, 0, 0, target);
+}
+
+/*
+  Replaces the bytecode offsets which jumps go to with the instructions
+  they were translated to. Returns false if one wasn't translated.
+*/
+static bool patchJumps(Translator *translator) {
+    RegisterCode *code = translator->code;
+    for (size_t i = 0; i < code->count; i++) {
+        RegisterInstruction *instruction = &(code->instructions[i]);
+        bool isJump = R_JUMP == instruction->opcode ||
+                      R_JUMP_IF_FALSE == instruction->opcode ||
+                      (R_JUMP_UNLESS_NUMBER_EQUAL <= instruction->opcode &&
+                       instruction->opcode <= R_JUMP_UNLESS_GREATER_EQUAL);
+        if (!isJump) continue;
+        if (NOT_AN_ENTRY == code->entries[instruction->d]) return false;
+        instruction->d = code->entries[instruction->d];
+    }
+    return true;
+}
+
+static void emit(Translator *translator, RegisterOpCode opcode, int a, int b,
+                 int c, uint32_t d) {
+    RegisterCode *code = translator->code;
+    if (code->count == translator->capacity) {
+        translator->capacity = GROW_CAPACITY(translator->capacity);
+        code->instructions =
+            realloc(code->instructions,
+                    translator->capacity * sizeof(RegisterInstruction));
+        code->offsets =
+            realloc(code->offsets, translator->capacity * sizeof(uint32_t));
+    }
+
+    code->instructions[code->count] = (RegisterInstruction){
+        .opcode = opcode, .a = a, .b = b, .c = c, .d = d};
+    code->offsets[code->count] = translator->offset;
+    code->count++;
+    translator->fusable = -1;
+}
+
+// Pushes a value which is read with operand, without an instruction.
+static void pushOperand(Translator *translator, uint16_t operand) {
+    int depth = pushRegister(translator);
+    translator->operands[depth] = operand;
+}
+
+static void pushConstant(Translator *translator, size_t index) {
+    if (index <= OPERAND_MAX) {
+        pushOperand(translator, CONSTANT_BIT | index);
+    } else {
+        int result = pushRegister(translator);
+        emit(translator, R_LOAD_CONSTANT, result, 0, 0, index);
+    }
+}
+
+// Pushes a value in its own register, and returns the register.
+static int pushRegister(Translator *translator) {
+    int depth = translator->depth++;
+    translator->operands[depth] = IN_REGISTER;
+    if (translator->depth > translator->code->registerCount) {
+        translator->code->registerCount = translator->depth;
+    }
+    if (translator->depth > OPERAND_MAX) translator->failed = true;
+    return depth;
+}
+
+// Returns the operand which reads the value at depth.
+static uint16_t operandAt(Translator const *translator, int depth) {
+    uint16_t operand = translator->operands[depth];
+    return IN_REGISTER == operand ? depth : operand;
+}
+
+// Puts the value at depth in its own register.
+static void materialize(Translator *translator, int depth) {
+    uint16_t operand = translator->operands[depth];
+    if (IN_REGISTER == operand) return;
+    translator->operands[depth] = IN_REGISTER;
+    emit(translator, R_MOVE, depth, operand, 0, 0);
+}
+
+// Puts every value on the stack in its own register.
+static void materializeAll(Translator *translator) {
+    for (int i = 0; i < translator->depth; i++) materialize(translator, i);
+}
+
+/*
+  Records that the stack is depth values deep when control reaches offset.
+  Translation fails if another path reaches it with a different depth.
+*/
+static void setDepthAt(Translator *translator, int offset, int depth) {
+    int *known = &(translator->depths[offset]);
+    if (UNKNOWN_DEPTH == *known) {
+        *known = depth;
+    } else if (depth != *known) {
+        translator->failed = true;
+    }
+}
+
+static int markSwitchTarget(int offset) {
+    int target = switchEnd + offset;
+    if (target < 0 || target >= (int)getChunkCount(switchTranslator->chunk)) {
+        switchTranslator->failed = true;
+    } else {
+        switchTranslator->boundaries[target] = true;
+    }
+    return offset;
+}
+
+static int setSwitchTargetDepth(int offset) {
+    if (!switchTranslator->failed) {
+        setDepthAt(switchTranslator, switchEnd + offset,
+                   switchTranslator->depth);
+    }
+    return offset;
+}
+
+static int readShort(uint8_t const *operands) {
+    return (operands[0] << 8) | operands[1];
+}
@@ -0,0 +1,48 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "object.h"
+#include "vm.h"
+
+// Settings of the register VM, which are set by command line flags.
+typedef struct {
+    bool enabled;  // Run promoted functions on the register VM.
+} RegisterOptions;
+
+extern RegisterOptions registerOptions;
+
+// A function translated to register code. Its layout is private.
+typedef struct RegisterCode RegisterCode;
+
+/*
+  Runs frame on the register VM, starting at frame->ip and translating the
+  function of frame to register code first if it hasn't been. Calls and
+  returns between functions which have register code stay on the register
+  VM, so when this returns the top frame may not be frame. Control goes
+  back to run() at the first frame which can't run as register code, with
+  its ip pointing at the next instruction. Returns false if there was a
+  runtime error.
+*/
+bool enterRegisters(CallFrame *frame);
+
+// Frees code, and the instructions it owns.
+void freeRegisterCode(RegisterCode *code);
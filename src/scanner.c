@@ -33,7 +33,7 @@
 #include "scanner_internals/pound_something.h"
 #include "scanner_internals/scanner_operations.h"
 
-Scanner scanner;
+_Thread_local Scanner scanner;
 
 // Scan and return a number token.
 static Token number(void);
@@ -79,7 +79,8 @@ char const *tokenTypeToString(TokenType type) {
 }
 
 bool textOfTokenEqualToString(Token const *token, char const *string) {
-    return strncmp(tokenGetStart(token), string, tokenGetLength(token));
+    return tokenGetLength(token) == strlen(string) &&
+           !strncmp(tokenGetStart(token), string, tokenGetLength(token));
 }
 
 bool tokenIsKeyword(Token const *token) {
@@ -110,6 +111,12 @@ void initScanner(char const *source) {
 static Token number(void) {
     while (isdigit(peek())) advance();
 
+    // A fractional part, which would otherwise read as a dot and a number.
+    if ('.' == peek() && isdigit(peekNext())) {
+        advance();
+        while (isdigit(peek())) advance();
+    }
+
     return makeToken(TOKEN_NUMBER);
 }
 
@@ -121,8 +121,8 @@ typedef struct {
     size_t line;          // The current line
 } Scanner;
 
-// Global scanner variable, declared in scanner.c
-extern Scanner scanner;
+// The scanner of the running thread, declared in scanner.c
+extern _Thread_local Scanner scanner;
 
 // Initialize the scanner with a source code string.
 void initScanner(char const *source);
@@ -108,8 +108,6 @@ static TokenType keywordType(Token const *token) {
             return checkKeyword(1, 1, "r", TOKEN_OR);
         case 'p':
             return checkKeyword(1, 11, "arameterize", TOKEN_PARAMETERIZE);
-        case 'q':
-            return checkKeyword(1, 4, "uote", TOKEN_QUOTE);
         case 's':
             return checkKeyword(1, 3, "et!", TOKEN_SET);
         case 'u':
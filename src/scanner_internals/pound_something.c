@@ -119,6 +119,12 @@ Token poundSomething() {
             if ('8' == peek() || '(' != peekNext())
                 return errorToken("Expected '8(' after '#u'");
             return makeToken(TOKEN_POUND_U8_LEFT_PAREN);
+        case '!':
+            // #!optional marks the optional parameters of a lambda.
+            if (matchString("optional") && !isSubsequent(peek())) {
+                return makeToken(TOKEN_IDENTIFIER);
+            }
+            return errorToken("Expected 'optional' after '#!'");
     }
-    return errorToken("Expected 't', 'f', 'u' or '(' after '#'");
+    return errorToken("Expected 't', 'f', 'u', '(' or '!' after '#'");
 }
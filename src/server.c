@@ -0,0 +1,218 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "vm.h"
+
+static bool socketAddress(char const *socketPath,
+                          struct sockaddr_un *address);
+static void runRequest(int connection);
+static bool receiveDescriptors(int connection, int *out, int *err);
+static char *readAll(int descriptor);
+static bool writeAll(int descriptor, void const *data, size_t size);
+
+int serve(char const *socketPath) {
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address)) return 64;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    // A socket left by a server which was killed would stop the bind.
+    unlink(socketPath);
+    if (-1 == listener ||
+        0 != bind(listener, (struct sockaddr *)&address, sizeof(address)) ||
+        0 != listen(listener, SOMAXCONN)) {
+        fprintf(stderr, "Could not listen on \"%s\": %s.\n", socketPath,
+                strerror(errno));
+        return 74;
+    }
+
+    // Children are reaped as they exit, without being waited for.
+    signal(SIGCHLD, SIG_IGN);
+    // Otherwise every child would write what is buffered again.
+    fflush(stdout);
+    fflush(stderr);
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (-1 == connection) {
+            if (EINTR == errno || ECONNABORTED == errno) continue;
+            fprintf(stderr, "Could not accept a script: %s.\n",
+                    strerror(errno));
+            close(listener);
+            return 74;
+        }
+
+        pid_t child = fork();
+        if (0 == child) {
+            close(listener);
+            runRequest(connection);
+        }
+        if (-1 == child) {
+            fprintf(stderr, "Could not fork for a script: %s.\n",
+                    strerror(errno));
+        }
+        close(connection);
+    }
+}
+
+int submitScript(char const *socketPath, int script, int out, int err) {
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address)) return -1;
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == connection ||
+        0 != connect(connection, (struct sockaddr *)&address,
+                     sizeof(address))) {
+        if (-1 != connection) close(connection);
+        return -1;
+    }
+
+    int const DESCRIPTORS[2] = {out, err};
+    char control[CMSG_SPACE(sizeof(DESCRIPTORS))];
+    memset(control, 0, sizeof(control));
+    struct iovec byte = {.iov_base = "R", .iov_len = 1};
+    struct msghdr message = {.msg_iov = &byte,
+                             .msg_iovlen = 1,
+                             .msg_control = control,
+                             .msg_controllen = sizeof(control)};
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(DESCRIPTORS));
+    memcpy(CMSG_DATA(header), DESCRIPTORS, sizeof(DESCRIPTORS));
+
+    bool sent = 1 == sendmsg(connection, &message, 0);
+    char buffer[4096];
+    ssize_t count;
+    while (sent && (count = read(script, buffer, sizeof(buffer))) > 0) {
+        sent = writeAll(connection, buffer, (size_t)count);
+    }
+    shutdown(connection, SHUT_WR);
+
+    uint8_t status;
+    int result = sent && 1 == read(connection, &status, 1) ? status : -1;
+    close(connection);
+    return result;
+}
+
+// Fills in address for socketPath. Returns false if the path is too long.
+static bool socketAddress(char const *socketPath,
+                          struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "The socket path \"%s\" is too long.\n", socketPath);
+        return false;
+    }
+    strcpy(address->sun_path, socketPath);
+    return true;
+}
+
+// Runs the script sent on connection, in a child of the server. Never returns.
+static void runRequest(int connection) {
+    int out, err;
+    if (!receiveDescriptors(connection, &out, &err)) _exit(74);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    close(out);
+    close(err);
+
+    char *source = readAll(connection);
+    InterpretResult result = interpret(source);
+    free(source);
+    fflush(stdout);
+    fflush(stderr);
+
+    uint8_t status = INTERPRET_COMPILE_ERROR == result   ? 65
+                     : INTERPRET_RUNTIME_ERROR == result ? 70
+                                                         : 0;
+    writeAll(connection, &status, 1);
+    _exit(status);
+}
+
+/*
+  Receives the client's standard output and standard error. Returns false
+  if it didn't send them.
+*/
+static bool receiveDescriptors(int connection, int *out, int *err) {
+    int descriptors[2];
+    char control[CMSG_SPACE(sizeof(descriptors))];
+    char byte;
+    struct iovec vector = {.iov_base = &byte, .iov_len = 1};
+    struct msghdr message = {.msg_iov = &vector,
+                             .msg_iovlen = 1,
+                             .msg_control = control,
+                             .msg_controllen = sizeof(control)};
+    if (1 != recvmsg(connection, &message, 0)) return false;
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (NULL == header || SOL_SOCKET != header->cmsg_level ||
+        SCM_RIGHTS != header->cmsg_type ||
+        CMSG_LEN(sizeof(descriptors)) != header->cmsg_len) {
+        return false;
+    }
+    memcpy(descriptors, CMSG_DATA(header), sizeof(descriptors));
+    *out = descriptors[0];
+    *err = descriptors[1];
+    return true;
+}
+
+// Reads descriptor until its end, into a string which the caller must free.
+static char *readAll(int descriptor) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *text = checkedMalloc(capacity);
+    for (;;) {
+        if (length + 1 == capacity) {
+            capacity *= 2;
+            text = checkedRealloc(text, capacity);
+        }
+        ssize_t count = read(descriptor, text + length, capacity - length - 1);
+        if (count <= 0) break;
+        length += (size_t)count;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+static bool writeAll(int descriptor, void const *data, size_t size) {
+    char const *bytes = data;
+    while (size > 0) {
+        // A client which hangs up mustn't kill the process with SIGPIPE.
+        ssize_t count = send(descriptor, bytes, size, MSG_NOSIGNAL);
+        if (count <= 0) {
+            if (count < 0 && EINTR == errno) continue;
+            return false;
+        }
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+/*
+  Copyright 2025 Evan Cooney
+
+  This file is part of Ecsi.
+
+  Ecsi is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  Ecsi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  Ecsi. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+  The fork server, which ecsi --serve runs. It starts a VM once, with its
+  prelude or image, then listens on a Unix socket. Every script which is
+  sent to it runs in a child forked from the warm VM, which shares its
+  pages copy-on-write, so a script doesn't pay for starting ecsi.
+
+  A client connects and sends one byte, with its standard output and
+  standard error as SCM_RIGHTS descriptors, so that the script writes
+  straight to them. It then sends the script's text and shuts down its
+  side of the connection. The child sends back the exit status ecsi would
+  have exited with, in one byte, when the script finishes.
+*/
+
+#pragma once
+
+/*
+  Serves scripts on the socket at socketPath with the VM as it is now,
+  until the process is killed. Returns the exit status for ecsi if the
+  socket can't be served.
+*/
+int serve(char const *socketPath);
+
+/*
+  Sends the script which can be read from script to the server on the
+  socket at socketPath, which writes its output to out and err. Returns
+  the exit status of the script, or -1 if the server couldn't run it.
+*/
+int submitScript(char const *socketPath, int script, int out, int err);
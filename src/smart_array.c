@@ -79,6 +79,10 @@ bool smartArrayPopFromEnd(SmartArray *restrict smartArray, void *restrict out) {
     return true;
 }
 
+void smartArrayTruncate(SmartArray *smartArray, size_t count) {
+    if (count < smartArray->count) smartArray->count = count;
+}
+
 void freeSmartArray(SmartArray *smartArray) {
     smartArray->reallocater(smartArray->data,
                             smartArray->capacity * smartArray->elementSize, 0);
@@ -48,4 +48,7 @@ size_t getSmartArrayCapacity(SmartArray const *smartArray);
 bool smartArrayIsEmpty(SmartArray const *smartArray);
 bool smartArrayPopFromEnd(SmartArray *restrict smartArray, void *restrict out);
 
+// Shrink smartArray to its first count elements. Does not free any memory.
+void smartArrayTruncate(SmartArray *smartArray, size_t count);
+
 void freeSmartArray(SmartArray *smartArray);
@@ -164,7 +164,8 @@ void markTable(Table *table) {
 void tableRemoveWhite(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry *entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
+        if (entry->key != NULL && !entry->key->obj.isMarked &&
+            !entry->key->obj.isOld) {
             tableDelete(table, entry->key);
         }
     }
@@ -57,6 +57,8 @@ bool valuesEqual(Value a, Value b) {
             return true;
         case VAL_NUMBER:
             return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_CHARACTER:
+            return AS_CHARACTER(a) == AS_CHARACTER(b);
         case VAL_OBJ:
             return AS_OBJ(a) == AS_OBJ(b);
         default:
@@ -20,6 +20,7 @@
 #include "vm.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -27,29 +28,163 @@
 #include <string.h>
 #include <time.h>
 
+#include "aot.h"
+#include "bytecode_file.h"
+#include "checkpoint.h"
 #include "chunk.h"
+#include "closure_engine.h"
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "ffi.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "register_vm.h"
 #include "smart_array.h"
 #include "table.h"
 #include "value.h"
 
-VM vm;
+_Thread_local VM vm;
 
 static InterpretResult run(void);
-static void runtimeError(char const *format, ...);
+static InterpretResult runToReturn(void);
 static Value clockNative(int argCount, Value *args);
-static void resetStack(void);
-static void defineNative(char const *name, NativeFn function);
+static Value displayNative(int argCount, Value *args);
+static Value newlineNative(int argCount, Value *args);
+static bool numberArguments(char const *name, int argCount,
+                            Value const *args);
+static Value addNative(int argCount, Value *args);
+static Value subtractNative(int argCount, Value *args);
+static Value multiplyNative(int argCount, Value *args);
+static Value divideNative(int argCount, Value *args);
+static Value numberEqualNative(int argCount, Value *args);
+static Value lessNative(int argCount, Value *args);
+static Value lessEqualNative(int argCount, Value *args);
+static Value greaterNative(int argCount, Value *args);
+static Value greaterEqualNative(int argCount, Value *args);
+static Value eqvNative(int argCount, Value *args);
+static Value mapNative(int argCount, Value *args);
+static Value pairPredicateNative(int argCount, Value *args);
+static Value nullPredicateNative(int argCount, Value *args);
+static Value carNative(int argCount, Value *args);
+static Value cdrNative(int argCount, Value *args);
+static Value consNative(int argCount, Value *args);
+static Value forEachNative(int argCount, Value *args);
+static Value caseLambdaNative(int argCount, Value *args);
+static bool wholeNumber(Value value, int limit, int *number);
+static Value makeBytevectorNative(int argCount, Value *args);
+static Value bytevectorPredicateNative(int argCount, Value *args);
+static Value bytevectorLengthNative(int argCount, Value *args);
+static Value bytevectorRefNative(int argCount, Value *args);
+static Value bytevectorSetNative(int argCount, Value *args);
+static Value utf8ToStringNative(int argCount, Value *args);
+static void growStack(void);
 static Value peek(int distance);
-static bool isFalsey(Value value);
-static bool callValue(Value callee, int argCount);
 static bool call(ObjClosure *closure, int argCount);
-static ObjUpvalue *captureUpvalue(Value *local);
-static void closeUpvalues(Value *last);
+static bool pushFrame(ObjClosure *closure, uint8_t *code, int argCount);
+static bool compileIfLazy(ObjFunction *function);
+static void fillCallCache(ObjFunction const *owner, CallCache *cache,
+                          ObjFunction *function);
+static bool callNative(ObjNative *native, int argCount);
+static bool callForeignFunction(ObjForeign const *foreign, int argCount);
+static bool selectClause(int argCount);
+static void quicken(uint8_t *instruction, OpCode opcode);
+static void countBackEdge(ObjFunction *function);
+static void promote(ObjFunction *function);
+static bool runNative(CallFrame *frame);
+static double now(void);
+
+// The hints of a native whose arguments are all numbers.
+#define NUMBER_HINTS \
+    {ARGUMENT_NUMBER, ARGUMENT_NUMBER, ARGUMENT_NUMBER, ARGUMENT_NUMBER}
+
+// The natives every VM starts with.
+static NativeDescriptor const builtins[] = {
+    {"clock", clockNative, 0, 0, {ARGUMENT_ANY}, NATIVE_EFFECTS},
+    {"display", displayNative, 0, ANY_ARITY, {ARGUMENT_ANY}, NATIVE_EFFECTS},
+    {"newline", newlineNative, 0, ANY_ARITY, {ARGUMENT_ANY}, NATIVE_EFFECTS},
+    /*
+      The compiler turns calls of these into instructions, unless a
+      program defines or sets them. These are for the other uses.
+    */
+    {"+", addNative, 0, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"-", subtractNative, 1, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"*", multiplyNative, 0, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"/", divideNative, 1, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"=", numberEqualNative, 2, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"<", lessNative, 2, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"<=", lessEqualNative, 2, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {">", greaterNative, 2, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {">=", greaterEqualNative, 2, ANY_ARITY, NUMBER_HINTS, NATIVE_PURE},
+    {"eqv?", eqvNative, 2, 2, {ARGUMENT_ANY}, NATIVE_PURE},
+    {"eq?", eqvNative, 2, 2, {ARGUMENT_ANY}, NATIVE_PURE},
+    {"pair?", pairPredicateNative, 1, 1, {ARGUMENT_ANY}, NATIVE_PURE},
+    {"null?", nullPredicateNative, 1, 1, {ARGUMENT_ANY}, NATIVE_PURE},
+    {"car", carNative, 1, 1, {ARGUMENT_PAIR}, NATIVE_PURE},
+    {"cdr", cdrNative, 1, 1, {ARGUMENT_PAIR}, NATIVE_PURE},
+    {"cons", consNative, 2, 2, {ARGUMENT_ANY}, NATIVE_ALLOCATES},
+    {"map",
+     mapNative,
+     2,
+     ANY_ARITY,
+     {ARGUMENT_PROCEDURE, ARGUMENT_LIST, ARGUMENT_LIST, ARGUMENT_LIST},
+     NATIVE_EFFECTS},
+    {"for-each",
+     forEachNative,
+     2,
+     ANY_ARITY,
+     {ARGUMENT_PROCEDURE, ARGUMENT_LIST, ARGUMENT_LIST, ARGUMENT_LIST},
+     NATIVE_EFFECTS},
+    {"c-function",
+     cFunctionNative,
+     4,
+     4,
+     {ARGUMENT_ANY, ARGUMENT_STRING, ARGUMENT_LIST, ARGUMENT_SYMBOL},
+     NATIVE_EFFECTS},
+    {"make-bytevector",
+     makeBytevectorNative,
+     1,
+     2,
+     {ARGUMENT_NUMBER, ARGUMENT_NUMBER},
+     NATIVE_ALLOCATES},
+    {"bytevector?", bytevectorPredicateNative, 1, 1, {ARGUMENT_ANY},
+     NATIVE_PURE},
+    {"bytevector-length",
+     bytevectorLengthNative,
+     1,
+     1,
+     {ARGUMENT_BYTEVECTOR},
+     NATIVE_PURE},
+    {"bytevector-u8-ref",
+     bytevectorRefNative,
+     2,
+     2,
+     {ARGUMENT_BYTEVECTOR, ARGUMENT_NUMBER},
+     NATIVE_EFFECTS},
+    {"bytevector-u8-set!",
+     bytevectorSetNative,
+     3,
+     3,
+     {ARGUMENT_BYTEVECTOR, ARGUMENT_NUMBER, ARGUMENT_NUMBER},
+     NATIVE_EFFECTS},
+    {"utf8->string",
+     utf8ToStringNative,
+     1,
+     3,
+     {ARGUMENT_BYTEVECTOR, ARGUMENT_NUMBER, ARGUMENT_NUMBER},
+     NATIVE_EFFECTS},
+    // What case-lambda expressions compile to.
+    {"%case-lambda",
+     caseLambdaNative,
+     0,
+     ANY_ARITY,
+     {ARGUMENT_ANY},
+     NATIVE_ALLOCATES},
+};
+
+TierOptions tierOptions = {
+    .callThreshold = 100, .loopThreshold = 1000, .timeTiers = false};
 
 void initVM(void) {
     vm.stackTop = vm.stack = NULL;
@@ -62,8 +197,15 @@ void initVM(void) {
     vm.gcState.nextGC = 1024 * 1024;
     vm.gcState.isOn = true;
 
+    vm.stats = (VMStats){0};
+    initSmartArray(&vm.promotedFunctions, smartArrayCheckedRealloc,
+                   sizeof(ObjFunction *));
+    initSmartArray(&vm.handles, smartArrayCheckedRealloc, sizeof(Value));
+    initSmartArray(&vm.freeHandles, smartArrayCheckedRealloc, sizeof(int));
+
     initTable(&vm.globals);
     initTable(&vm.strings);
+    initClosureEngine();
 
     /*
       We set this to NULL because the GC directly checks vm.initString
@@ -73,23 +215,309 @@ void initVM(void) {
     vm.initString = NULL;
     vm.initString = newSymbol("init", 4);
 
-    defineNative("clock", clockNative);
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(*builtins); i++) {
+        defineDescribedNative(&builtins[i]);
+    }
 }
 
 static Value clockNative(int argCount, Value *args) {
-    if (argCount != 0) {
-        runtimeError("clock takes 0 arguments but you gave %d", argCount);
-    }
+    (void)argCount;
     assert(args == vm.stackTop);
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
-static void runtimeError(char const *format, ...) {
+static Value displayNative(int argCount, Value *args) {
+    for (int i = 0; i < argCount; i++) {
+        // Strings are displayed without the quotes that printValue adds.
+        if (IS_STRING(args[i])) {
+            fputs(AS_CSTRING(args[i]), stdout);
+        } else {
+            printValue(args[i]);
+        }
+    }
+    return NIL_VAL;
+}
+
+static Value newlineNative(int argCount, Value *args) {
+    (void)argCount;
+    (void)args;
+    putchar('\n');
+    return NIL_VAL;
+}
+
+// eq? is the same as eqv? because numbers and characters are immediate.
+/*
+  Checks that the arguments past the ones the descriptor of the native
+  called name has hints for are numbers too.
+*/
+static bool numberArguments(char const *name, int argCount,
+                            Value const *args) {
+    for (int i = ARGUMENT_HINTS_MAX; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) {
+            runtimeError("Expected argument %d of %s to be a number.", i + 1,
+                         name);
+            return false;
+        }
+    }
+    return true;
+}
+
+static Value addNative(int argCount, Value *args) {
+    if (!numberArguments("+", argCount, args)) return NIL_VAL;
+    double sum = 0;
+    for (int i = 0; i < argCount; i++) sum += AS_NUMBER(args[i]);
+    return NUMBER_VAL(sum);
+}
+
+// (- x) negates x.
+static Value subtractNative(int argCount, Value *args) {
+    if (!numberArguments("-", argCount, args)) return NIL_VAL;
+    if (1 == argCount) return NUMBER_VAL(0 - AS_NUMBER(args[0]));
+    double difference = AS_NUMBER(args[0]);
+    for (int i = 1; i < argCount; i++) difference -= AS_NUMBER(args[i]);
+    return NUMBER_VAL(difference);
+}
+
+static Value multiplyNative(int argCount, Value *args) {
+    if (!numberArguments("*", argCount, args)) return NIL_VAL;
+    double product = 1;
+    for (int i = 0; i < argCount; i++) product *= AS_NUMBER(args[i]);
+    return NUMBER_VAL(product);
+}
+
+// (/ x) is the reciprocal of x.
+static Value divideNative(int argCount, Value *args) {
+    if (!numberArguments("/", argCount, args)) return NIL_VAL;
+    if (1 == argCount) return NUMBER_VAL(1 / AS_NUMBER(args[0]));
+    double quotient = AS_NUMBER(args[0]);
+    for (int i = 1; i < argCount; i++) quotient /= AS_NUMBER(args[i]);
+    return NUMBER_VAL(quotient);
+}
+
+// Defines a native which is true if each argument is op the next one.
+#define COMPARISON_NATIVE(function, name, op)                          \
+    static Value function(int argCount, Value *args) {                 \
+        if (!numberArguments(name, argCount, args)) return NIL_VAL;    \
+        for (int i = 1; i < argCount; i++) {                           \
+            if (!(AS_NUMBER(args[i - 1]) op AS_NUMBER(args[i]))) {     \
+                return BOOL_VAL(false);                                \
+            }                                                          \
+        }                                                              \
+        return BOOL_VAL(true);                                         \
+    }
+
+COMPARISON_NATIVE(numberEqualNative, "=", ==)
+COMPARISON_NATIVE(lessNative, "<", <)
+COMPARISON_NATIVE(lessEqualNative, "<=", <=)
+COMPARISON_NATIVE(greaterNative, ">", >)
+COMPARISON_NATIVE(greaterEqualNative, ">=", >=)
+
+#undef COMPARISON_NATIVE
+
+static Value eqvNative(int argCount, Value *args) {
+    (void)argCount;
+    return BOOL_VAL(valuesEqual(args[0], args[1]));
+}
+
+static Value pairPredicateNative(int argCount, Value *args) {
+    (void)argCount;
+    return BOOL_VAL(IS_PAIR(args[0]));
+}
+
+static Value nullPredicateNative(int argCount, Value *args) {
+    (void)argCount;
+    return BOOL_VAL(IS_NIL(args[0]));
+}
+
+static Value carNative(int argCount, Value *args) {
+    (void)argCount;
+    return CAR(args[0]);
+}
+
+static Value cdrNative(int argCount, Value *args) {
+    (void)argCount;
+    return CDR(args[0]);
+}
+
+static Value consNative(int argCount, Value *args) {
+    (void)argCount;
+    return CONS(args[0], args[1]);
+}
+
+// Whether none of the count lists at lists has run out.
+static bool allPairs(Value const *lists, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!IS_PAIR(lists[i])) return false;
+    }
+    return true;
+}
+
+/*
+  Calls the procedure in the stack at index with the car of each of the
+  count lists after it, and moves each list on to its cdr. The result is
+  left on top of the stack. Calling the procedure may move the stack, so
+  it is only used through indexes.
+*/
+static bool callWithCars(size_t index, int count) {
+    push(vm.stack[index]);
+    for (size_t list = index + 1; list <= index + count; list++) {
+        push(CAR(vm.stack[list]));
+        vm.stack[list] = CDR(vm.stack[list]);
+    }
+    return INTERPRET_OK == callProcedure(count);
+}
+
+/*
+  Returns a case-lambda of its arguments, which are the procedures of its
+  clauses in order.
+*/
+static Value caseLambdaNative(int argCount, Value *args) {
+    Parameters *parameters = ALLOCATE(Parameters, argCount);
+    for (int i = 0; i < argCount; i++) {
+        if (IS_CLOSURE(args[i])) {
+            parameters[i] = AS_CLOSURE(args[i])->function->parameters;
+        } else if (IS_PROCEDURE(args[i])) {
+            parameters[i] = *procedureParameters(AS_PROCEDURE(args[i]));
+        } else {
+            FREE_ARRAY(Parameters, parameters, argCount);
+            runtimeError("Expected the clauses of case-lambda to be "
+                         "lambdas.");
+            return NIL_VAL;
+        }
+    }
+
+    ObjCaseLambda *caseLambda = newCaseLambda(args, parameters, argCount);
+    FREE_ARRAY(Parameters, parameters, argCount);
+    return OBJ_VAL(caseLambda);
+}
+
+// Sets *number to value if it is a whole number from 0 to limit.
+static bool wholeNumber(Value value, int limit, int *number) {
+    double n = AS_NUMBER(value);
+    if (!(0 <= n && n <= limit) || n != (int)n) return false;
+    *number = (int)n;
+    return true;
+}
+
+static Value makeBytevectorNative(int argCount, Value *args) {
+    int length;
+    if (!wholeNumber(args[0], INT_MAX, &length)) {
+        runtimeError("Expected the length of a bytevector to be a whole "
+                     "number.");
+        return NIL_VAL;
+    }
+    int fill = 0;
+    if (2 == argCount && !wholeNumber(args[1], UINT8_MAX, &fill)) {
+        runtimeError("Expected a byte to be a whole number from 0 to 255.");
+        return NIL_VAL;
+    }
+
+    ObjBytevector *bytevector = newBytevector(length);
+    memset(bytevector->bytes, fill, length);
+    return OBJ_VAL(bytevector);
+}
+
+static Value bytevectorPredicateNative(int argCount, Value *args) {
+    (void)argCount;
+    return BOOL_VAL(IS_BYTEVECTOR(args[0]));
+}
+
+static Value bytevectorLengthNative(int argCount, Value *args) {
+    (void)argCount;
+    return NUMBER_VAL(AS_BYTEVECTOR(args[0])->length);
+}
+
+static Value bytevectorRefNative(int argCount, Value *args) {
+    (void)argCount;
+    ObjBytevector const *bytevector = AS_BYTEVECTOR(args[0]);
+    int index;
+    if (!wholeNumber(args[1], bytevector->length - 1, &index)) {
+        runtimeError("Index out of range of the bytevector.");
+        return NIL_VAL;
+    }
+    return NUMBER_VAL(bytevector->bytes[index]);
+}
+
+static Value bytevectorSetNative(int argCount, Value *args) {
+    (void)argCount;
+    ObjBytevector *bytevector = AS_BYTEVECTOR(args[0]);
+    int index;
+    if (!wholeNumber(args[1], bytevector->length - 1, &index)) {
+        runtimeError("Index out of range of the bytevector.");
+        return NIL_VAL;
+    }
+    int byte;
+    if (!wholeNumber(args[2], UINT8_MAX, &byte)) {
+        runtimeError("Expected a byte to be a whole number from 0 to 255.");
+        return NIL_VAL;
+    }
+    bytevector->bytes[index] = (uint8_t)byte;
+    return NIL_VAL;
+}
+
+// Returns a string of the bytes of the bytevector from start to end.
+static Value utf8ToStringNative(int argCount, Value *args) {
+    ObjBytevector const *bytevector = AS_BYTEVECTOR(args[0]);
+    int start = 0;
+    int end = bytevector->length;
+    if ((argCount >= 2 &&
+         !wholeNumber(args[1], bytevector->length, &start)) ||
+        (3 == argCount && !wholeNumber(args[2], bytevector->length, &end)) ||
+        start > end) {
+        runtimeError("Index out of range of the bytevector.");
+        return NIL_VAL;
+    }
+    return OBJ_VAL(
+        copyString((char const *)bytevector->bytes + start, end - start));
+}
+
+/*
+  Returns the list of the results of calling the procedure with the first
+  element of each list, then the second, and so on until the shortest
+  list runs out.
+*/
+static Value mapNative(int argCount, Value *args) {
+    size_t const PROCEDURE = args - vm.stack;
+    int const LISTS = argCount - 1;
+
+    // The result is kept in the stack, where the collector sees it.
+    size_t const RESULT = PROCEDURE + argCount;
+    push(NIL_VAL);
+    ObjPair *last = NULL;
+
+    while (allPairs(&vm.stack[PROCEDURE + 1], LISTS)) {
+        if (!callWithCars(PROCEDURE, LISTS)) return NIL_VAL;
+        ObjPair *pair = newPair(vm.stackTop[-1], NIL_VAL);
+        if (NULL == last) {
+            vm.stack[RESULT] = OBJ_VAL(pair);
+        } else {
+            last->cdr = OBJ_VAL(pair);
+        }
+        last = pair;
+        pop();
+    }
+    return vm.stack[RESULT];
+}
+
+// Like map, but only for the calls' effects.
+static Value forEachNative(int argCount, Value *args) {
+    size_t const PROCEDURE = args - vm.stack;
+    int const LISTS = argCount - 1;
+
+    while (allPairs(&vm.stack[PROCEDURE + 1], LISTS)) {
+        if (!callWithCars(PROCEDURE, LISTS)) return NIL_VAL;
+        pop();
+    }
+    return NIL_VAL;
+}
+
+void runtimeError(char const *format, ...) {
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs("\n", stderr);
+    vm.hadError = true;
 
     for (int i = vm.frameCount - 1; i >= 0; i--) {
         CallFrame *frame = &vm.frames[i];
@@ -107,31 +535,90 @@ static void runtimeError(char const *format, ...) {
     resetStack();
 }
 
-static void resetStack(void) {
-    free(vm.stack);
+void resetStack(void) {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
+    vm.baseFrame = 0;
     vm.openUpvalues = NULL;
 }
 
-static void defineNative(char const *name, NativeFn function) {
+void defineNative(char const *name, NativeFn function, int arity) {
+    NativeDescriptor descriptor = {
+        .name = name,
+        .function = function,
+        .minArity = ANY_ARITY == arity ? 0 : arity,
+        .maxArity = arity,
+        .effects = NATIVE_EFFECTS,
+    };
+    defineDescribedNative(&descriptor);
+}
+
+void defineDescribedNative(NativeDescriptor const *descriptor) {
+    char const *name = descriptor->name;
     ObjSymbol *nameSymbol = newSymbol(name, (int)strlen(name));
     push(OBJ_VAL(nameSymbol));
-    push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_SYMBOL(vm.stack[0]), vm.stack[1]);
+    push(OBJ_VAL(newNative(descriptor, nameSymbol)));
+    tableSet(&vm.globals, AS_SYMBOL(vm.stackTop[-2]), vm.stackTop[-1]);
     pop();
     pop();
 }
 
-void push(Value value) {
+int retainValue(Value value) {
+    int handle;
+    if (smartArrayPopFromEnd(&vm.freeHandles, &handle)) {
+        SMART_ARRAY_AT(&vm.handles, handle, Value) = value;
+    } else {
+        handle = (int)getSmartArrayCount(&vm.handles);
+        smartArrayAppend(&vm.handles, &value);
+    }
+    return handle;
+}
+
+Value retainedValue(int handle) {
+    return SMART_ARRAY_AT(&vm.handles, handle, Value);
+}
+
+void releaseValue(int handle) {
+    SMART_ARRAY_AT(&vm.handles, handle, Value) = NIL_VAL;
+    smartArrayAppend(&vm.freeHandles, &handle);
+}
+
+/*
+  Grows the stack. Call frames and open upvalues point into the stack, so
+  they are moved along with it.
+*/
+static void growStack(void) {
+    Value *oldStack = vm.stack;
     size_t const HEIGHT = vm.stackTop - vm.stack;
 
-    if (HEIGHT >= vm.stackCapacity) {
-        vm.stackCapacity = GROW_CAPACITY(vm.stackCapacity);
-        vm.stack = checkedRealloc(vm.stack, vm.stackCapacity * sizeof(Value));
-        vm.stackTop = vm.stack + HEIGHT;
+    vm.stackCapacity = GROW_CAPACITY(vm.stackCapacity);
+    vm.stack = checkedRealloc(vm.stack, vm.stackCapacity * sizeof(Value));
+    vm.stackTop = vm.stack + HEIGHT;
+
+    if (vm.stack == oldStack) return;
+
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = vm.stack + (vm.frames[i].slots - oldStack);
     }
 
+    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+        upvalue->location = vm.stack + (upvalue->location - oldStack);
+    }
+}
+
+void reserveStack(size_t height) {
+    while (vm.stackCapacity < height) growStack();
+}
+
+void reserveFrame(CallFrame const *frame) {
+    reserveStack((size_t)(frame->slots - vm.stack) +
+                 frame->closure->function->maxStack);
+}
+
+void push(Value value) {
+    if ((size_t)(vm.stackTop - vm.stack) >= vm.stackCapacity) growStack();
+
     *(vm.stackTop++) = value;
 
 #ifdef DEBUG_STACK
@@ -156,10 +643,20 @@ Value pop(void) {
 
 void freeVM(void) {
     resetStack();
+    free(vm.stack);
+    vm.stack = vm.stackTop = NULL;
+    vm.stackCapacity = 0;
     freeTable(&vm.globals);
     freeTable(&vm.strings);
+    freeSmartArray(&vm.promotedFunctions);
+    freeSmartArray(&vm.handles);
+    freeSmartArray(&vm.freeHandles);
+    freeClosureEngine();
+    freeCheckpoint();
+    freeFFI();
     vm.initString = NULL;
     freeObjects();
+    unmapFiles();
 }
 
 void printStack(void) {
@@ -178,21 +675,63 @@ static InterpretResult run(void) {
 #define READ_SHORT() \
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 
+#define READ_INT()                                             \
+    (frame->ip += 4, ((uint32_t)frame->ip[-4] << 24) |         \
+                         ((uint32_t)frame->ip[-3] << 16) |     \
+                         ((uint32_t)frame->ip[-2] << 8) | frame->ip[-1])
+
 #define READ_CONSTANT() \
     (getValueArrayAt(&(frame->closure->function->chunk.constants), READ_BYTE()))
 
+// Reads the 2 byte constant index of an instruction after OP_WIDE.
+#define READ_WIDE_CONSTANT()                                       \
+    (getValueArrayAt(&(frame->closure->function->chunk.constants), \
+                     READ_SHORT()))
+
 #define READ_SYMBOL() AS_SYMBOL(READ_CONSTANT())
+
+#define READ_CALL_CACHE() \
+    (&(frame->closure->function->callCaches[READ_SHORT()]))
+
+/*
+  The frame's whole stack was reserved when it was entered, so pushing
+  can't overflow unless the compiler got the function's maxStack wrong.
+*/
+#define PUSH(value)                                                   \
+    do {                                                              \
+        Value pushed = (value);                                       \
+        assert(vm.stackTop <                                          \
+               frame->slots + frame->closure->function->maxStack);    \
+        *(vm.stackTop++) = pushed;                                    \
+    } while (false)
+
+#define POP() (assert(vm.stackTop > vm.stack), *(--vm.stackTop))
+
+/*
+  Runs the current frame in the native tier, if its function was promoted.
+  The register VM runs calls and returns itself, so the frame to go on
+  with is whichever is on top when it gives control back.
+*/
+#define ENTER_NATIVE()                                             \
+    do {                                                           \
+        if (TIER_NATIVE == frame->closure->function->tier) {       \
+            if (!runNative(frame)) return INTERPRET_RUNTIME_ERROR; \
+            frame = &vm.frames[vm.frameCount - 1];                 \
+        }                                                          \
+    } while (false)
+
 #define BINARY_OP(valueType, op)                          \
     do {                                                  \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
             runtimeError("Operands must be numbers.");    \
             return INTERPRET_RUNTIME_ERROR;               \
         }                                                 \
-        double b = AS_NUMBER(pop());                      \
-        double a = AS_NUMBER(pop());                      \
-        push(valueType(a op b));                          \
+        double b = AS_NUMBER(POP());                      \
+        double a = AS_NUMBER(POP());                      \
+        PUSH(valueType(a op b));                          \
     } while (false)
 
+    ENTER_NATIVE();
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("       ");
@@ -202,12 +741,15 @@ static InterpretResult run(void) {
             &(frame->closure->function->chunk),
             (int)(frame->ip -
                   getChunkCode(&(frame->closure->function->chunk))));
+#endif
+#ifdef COUNT_INSTRUCTIONS
+        vm.stats.instructions++;
 #endif
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT: {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                PUSH(constant);
                 break;
             }
             case OP_CONSTANT_LONG: {
@@ -217,24 +759,24 @@ static InterpretResult run(void) {
                 Value constantValue = getValueArrayAt(
                     &(frame->closure->function->chunk.constants),
                     constantIndex);
-                push(constantValue);
+                PUSH(constantValue);
                 break;
             }
             case OP_NIL:
-                push(NIL_VAL);
+                PUSH(NIL_VAL);
                 break;
             case OP_TRUE:
-                push(BOOL_VAL(true));
+                PUSH(BOOL_VAL(true));
                 break;
             case OP_FALSE:
-                push(BOOL_VAL(false));
+                PUSH(BOOL_VAL(false));
                 break;
             case OP_POP:
-                pop();
+                POP();
                 break;
             case OP_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
+                PUSH(frame->slots[slot]);
                 break;
             }
             case OP_SET_LOCAL: {
@@ -249,13 +791,13 @@ static InterpretResult run(void) {
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(value);
+                PUSH(value);
                 break;
             }
             case OP_DEFINE_GLOBAL: {
                 ObjSymbol *name = READ_SYMBOL();
                 tableSet(&vm.globals, name, peek(0));
-                pop();
+                POP();
                 break;
             }
             case OP_SET_GLOBAL: {
@@ -270,12 +812,12 @@ static InterpretResult run(void) {
             case OP_GET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
                 Value val = *frame->closure->upvalues[slot]->location;
-                push(val);
+                PUSH(val);
                 break;
             }
             case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+                ObjUpvalue *upvalue = frame->closure->upvalues[READ_BYTE()];
+                writeSlot(&upvalue->obj, upvalue->location, peek(0));
                 break;
             }
             case OP_JUMP: {
@@ -291,20 +833,101 @@ static InterpretResult run(void) {
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
+                countBackEdge(frame->closure->function);
+                ENTER_NATIVE();
                 break;
             }
             case OP_CALL: {
                 int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
+                CallCache *cache = READ_CALL_CACHE();
+                Value callee = peek(argCount);
+
+                // The callee's code is cached, so it must be compiled.
+                if (IS_CLOSURE(callee) &&
+                    !compileIfLazy(AS_CLOSURE(callee)->function)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // Specialize the call for the kind of callee it just saw.
+                if (IS_CLOSURE(callee) &&
+                    argCount == AS_CLOSURE(callee)->function->arity) {
+                    vm.stats.callCacheMisses++;
+                    fillCallCache(frame->closure->function, cache,
+                                  AS_CLOSURE(callee)->function);
+                    quicken(frame->ip - 4, OP_CALL_CLOSURE);
+                } else if (IS_NATIVE(callee)) {
+                    quicken(frame->ip - 4, OP_CALL_NATIVE);
+                }
+
+                if (!callValue(callee, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_CALL_CLOSURE: {
+                int argCount = READ_BYTE();
+                CallCache *cache = READ_CALL_CACHE();
+                Value callee = peek(argCount);
+
+                if (IS_CLOSURE(callee) &&
+                    AS_CLOSURE(callee)->function == cache->function) {
+                    // The arity was checked when the function was cached.
+                    vm.stats.callCacheHits++;
+                    if (!pushFrame(AS_CLOSURE(callee), cache->code,
+                                   argCount)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    frame = &vm.frames[vm.frameCount - 1];
+                    ENTER_NATIVE();
+                    break;
+                }
+
+                vm.stats.callCacheMisses++;
+                if (IS_CLOSURE(callee) &&
+                    !compileIfLazy(AS_CLOSURE(callee)->function)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (IS_CLOSURE(callee) &&
+                    argCount == AS_CLOSURE(callee)->function->arity) {
+                    fillCallCache(frame->closure->function, cache,
+                                  AS_CLOSURE(callee)->function);
+                } else {
+                    quicken(frame->ip - 4, OP_CALL);
+                }
+                if (!callValue(callee, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_CALL_NATIVE: {
+                int argCount = READ_BYTE();
+                frame->ip += 2;  // Natives don't use the cache.
+                Value callee = peek(argCount);
+
+                if (!IS_NATIVE(callee)) {
+                    quicken(frame->ip - 4, OP_CALL);
+                    if (!callValue(callee, argCount)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    frame = &vm.frames[vm.frameCount - 1];
+                    ENTER_NATIVE();
+                    break;
+                }
+
+                if (!callNative(AS_NATIVE(callee), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ENTER_NATIVE();
                 break;
             }
             case OP_CLOSURE: {
                 ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
                 ObjClosure *closure = newClosure(function);
-                push(OBJ_VAL(closure));
+                PUSH(OBJ_VAL(closure));
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
@@ -318,33 +941,219 @@ static InterpretResult run(void) {
                 break;
             }
             case OP_RETURN: {
-                Value result = pop();
+                Value result = POP();
+                closeUpvalues(frame->slots);
                 vm.frameCount--;
-                if (0 == vm.frameCount) {
-                    pop();
+                if (vm.baseFrame == vm.frameCount) {
+                    // The result takes the callee's place, as in any call.
+                    vm.stackTop = frame->slots;
+                    push(result);
                     return INTERPRET_OK;
                 }
 
                 vm.stackTop = frame->slots;
-                push(result);
+                PUSH(result);
                 frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
                 break;
             }
             case OP_CLOSE_UPVALUE:
                 closeUpvalues(vm.stackTop - 1);
-                pop();
+                POP();
+                break;
+            case OP_CLOSE_SCOPE: {
+                Value *scope = frame->slots + READ_BYTE();
+                uint8_t keep = READ_BYTE();
+                closeUpvalues(scope);
+                memmove(scope, vm.stackTop - keep, keep * sizeof(Value));
+                vm.stackTop = scope + keep;
+                break;
+            }
+            case OP_SWITCH: {
+                ObjSwitch *table = AS_SWITCH(READ_CONSTANT());
+                frame->ip += switchLookup(table, POP());
+                break;
+            }
+            case OP_ADD:
+                BINARY_OP(NUMBER_VAL, +);
+                break;
+            case OP_SUBTRACT:
+                BINARY_OP(NUMBER_VAL, -);
+                break;
+            case OP_MULTIPLY:
+                BINARY_OP(NUMBER_VAL, *);
+                break;
+            case OP_DIVIDE:
+                BINARY_OP(NUMBER_VAL, /);
+                break;
+            case OP_NUMBER_EQUAL:
+                BINARY_OP(BOOL_VAL, ==);
+                break;
+            case OP_LESS:
+                BINARY_OP(BOOL_VAL, <);
+                break;
+            case OP_LESS_EQUAL:
+                BINARY_OP(BOOL_VAL, <=);
+                break;
+            case OP_GREATER:
+                BINARY_OP(BOOL_VAL, >);
+                break;
+            case OP_GREATER_EQUAL:
+                BINARY_OP(BOOL_VAL, >=);
+                break;
+            case OP_GET_LOCAL_2: {
+                uint8_t first = READ_BYTE();
+                uint8_t second = READ_BYTE();
+                PUSH(frame->slots[first]);
+                PUSH(frame->slots[second]);
+                break;
+            }
+            case OP_ADD_CONSTANT:
+                PUSH(READ_CONSTANT());
+                BINARY_OP(NUMBER_VAL, +);
+                break;
+            case OP_SUBTRACT_CONSTANT:
+                PUSH(READ_CONSTANT());
+                BINARY_OP(NUMBER_VAL, -);
+                break;
+            case OP_POP_JUMP_IF_FALSE: {
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(POP())) frame->ip += offset;
+                break;
+            }
+            case OP_CLOSE_SCOPE_LOOP: {
+                Value *scope = frame->slots + READ_BYTE();
+                uint8_t keep = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                closeUpvalues(scope);
+                memmove(scope, vm.stackTop - keep, keep * sizeof(Value));
+                vm.stackTop = scope + keep;
+                frame->ip -= offset;
+                countBackEdge(frame->closure->function);
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_WIDE:
+                // The same instructions, with operands twice as wide.
+                switch (READ_BYTE()) {
+                    case OP_GET_LOCAL:
+                        PUSH(frame->slots[READ_SHORT()]);
+                        break;
+                    case OP_SET_LOCAL:
+                        frame->slots[READ_SHORT()] = peek(0);
+                        break;
+                    case OP_GET_GLOBAL: {
+                        ObjSymbol *name = AS_SYMBOL(READ_WIDE_CONSTANT());
+                        Value value;
+                        if (!tableGet(&vm.globals, name, &value)) {
+                            runtimeError("Undefined variable '%s'.",
+                                         name->chars);
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        PUSH(value);
+                        break;
+                    }
+                    case OP_DEFINE_GLOBAL: {
+                        ObjSymbol *name = AS_SYMBOL(READ_WIDE_CONSTANT());
+                        tableSet(&vm.globals, name, peek(0));
+                        POP();
+                        break;
+                    }
+                    case OP_SET_GLOBAL: {
+                        ObjSymbol *name = AS_SYMBOL(READ_WIDE_CONSTANT());
+                        if (tableSet(&vm.globals, name, peek(0))) {
+                            tableDelete(&vm.globals, name);
+                            runtimeError("Undefined variable '%s'.",
+                                         name->chars);
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        break;
+                    }
+                    case OP_GET_UPVALUE: {
+                        uint16_t slot = READ_SHORT();
+                        PUSH(*frame->closure->upvalues[slot]->location);
+                        break;
+                    }
+                    case OP_SET_UPVALUE: {
+                        ObjUpvalue *upvalue =
+                            frame->closure->upvalues[READ_SHORT()];
+                        writeSlot(&upvalue->obj, upvalue->location, peek(0));
+                        break;
+                    }
+                    case OP_JUMP: {
+                        uint32_t offset = READ_INT();
+                        frame->ip += offset;
+                        break;
+                    }
+                    case OP_JUMP_IF_FALSE: {
+                        uint32_t offset = READ_INT();
+                        if (isFalsey(peek(0))) frame->ip += offset;
+                        break;
+                    }
+                    case OP_LOOP: {
+                        uint32_t offset = READ_INT();
+                        frame->ip -= offset;
+                        countBackEdge(frame->closure->function);
+                        ENTER_NATIVE();
+                        break;
+                    }
+                    case OP_CALL: {
+                        int argCount = READ_SHORT();
+                        frame->ip += 4;  // Wide calls don't use the cache.
+                        if (!callValue(peek(argCount), argCount)) {
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
+                        frame = &vm.frames[vm.frameCount - 1];
+                        ENTER_NATIVE();
+                        break;
+                    }
+                    case OP_CLOSURE: {
+                        ObjFunction *function =
+                            AS_FUNCTION(READ_WIDE_CONSTANT());
+                        ObjClosure *closure = newClosure(function);
+                        PUSH(OBJ_VAL(closure));
+                        for (int i = 0; i < closure->upvalueCount; i++) {
+                            uint16_t isLocal = READ_SHORT();
+                            uint16_t index = READ_SHORT();
+                            closure->upvalues[i] =
+                                isLocal ? captureUpvalue(frame->slots + index)
+                                        : frame->closure->upvalues[index];
+                        }
+                        break;
+                    }
+                    case OP_CLOSE_SCOPE: {
+                        Value *scope = frame->slots + READ_SHORT();
+                        uint16_t keep = READ_SHORT();
+                        closeUpvalues(scope);
+                        memmove(scope, vm.stackTop - keep,
+                                keep * sizeof(Value));
+                        vm.stackTop = scope + keep;
+                        break;
+                    }
+                    case OP_SWITCH: {
+                        ObjSwitch *table = AS_SWITCH(READ_WIDE_CONSTANT());
+                        frame->ip += switchLookup(table, POP());
+                        break;
+                    }
+                }
                 break;
         }
     }
 
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_INT
 #undef READ_CONSTANT
+#undef READ_WIDE_CONSTANT
+#undef READ_CALL_CACHE
+#undef PUSH
+#undef POP
+#undef ENTER_NATIVE
 #undef READ_STRING
 #undef BINARY_OP
 }
 
-static void closeUpvalues(Value *last) {
+void closeUpvalues(Value *last) {
     while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last) {
         ObjUpvalue *upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
@@ -353,7 +1162,7 @@ static void closeUpvalues(Value *last) {
     }
 }
 
-static ObjUpvalue *captureUpvalue(Value *local) {
+ObjUpvalue *captureUpvalue(Value *local) {
     ObjUpvalue *prevUpvalue = NULL;
     ObjUpvalue *upvalue = vm.openUpvalues;
     while (upvalue != NULL && upvalue->location > local) {
@@ -377,18 +1186,18 @@ static ObjUpvalue *captureUpvalue(Value *local) {
     return createdUpvalue;
 }
 
-static bool callValue(Value callee, int argCount) {
+bool callValue(Value callee, int argCount) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
-            case OBJ_NATIVE: {
-                NativeFn native = AS_NATIVE(callee);
-                Value result = native(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
-                return true;
-            }
+            case OBJ_NATIVE:
+                return callNative(AS_NATIVE(callee), argCount);
             case OBJ_CLOSURE:
                 return call(AS_CLOSURE(callee), argCount);
+            case OBJ_FOREIGN:
+                return callForeignFunction(AS_FOREIGN(callee), argCount);
+            case OBJ_CASE_LAMBDA:
+                return selectClause(argCount) &&
+                       callValue(peek(argCount), argCount);
             default:
                 break;  // Non-callable object type.
         }
@@ -397,40 +1206,308 @@ static bool callValue(Value callee, int argCount) {
     return false;
 }
 
-static bool call(ObjClosure *closure, int argCount) {
-    if (argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments but got %d.",
-                     closure->function->arity, argCount);
+/*
+  Calls native with the argCount values on top of the stack. A native
+  which calls back into Scheme may grow the stack, so the callee's place
+  is kept as an index. If the native or a procedure it called had a
+  runtime error, the stack is already gone.
+*/
+static bool callNative(ObjNative *native, int argCount) {
+    Value *args = vm.stackTop - argCount;
+    char message[128];
+    if (needsArgumentCheck(native, argCount) &&
+        !checkNativeArguments(&native->descriptor, argCount, args, message,
+                              sizeof(message))) {
+        runtimeError("%s", message);
+        return false;
+    }
+
+    size_t callee = args - 1 - vm.stack;
+    Value result = native->descriptor.function(argCount, args);
+    if (vm.hadError) return false;
+
+    vm.stackTop = vm.stack + callee;
+    push(result);
+    return true;
+}
+
+// Calls foreign with the argCount values on top of the stack.
+static bool callForeignFunction(ObjForeign const *foreign, int argCount) {
+    Value result;
+    char message[128];
+    if (!callForeign(foreign, argCount, vm.stackTop - argCount, &result,
+                     message, sizeof(message))) {
+        runtimeError("%s", message);
+        return false;
+    }
+
+    vm.stackTop -= argCount + 1;
+    push(result);
+    return true;
+}
+
+/*
+  Every specialized form checks a guard and falls back to the generic form
+  when it fails, so a VM that reads either opcode does the right thing.
+  The store is atomic so that VMs which share code don't race on it.
+*/
+static void quicken(uint8_t *instruction, OpCode opcode) {
+    __atomic_store_n(instruction, (uint8_t)opcode, __ATOMIC_RELAXED);
+}
+
+/*
+  Replaces the case-lambda which is argCount values down the stack with
+  its clause which takes argCount arguments.
+*/
+static bool selectClause(int argCount) {
+    ObjCaseLambda const *caseLambda = AS_CASE_LAMBDA(peek(argCount));
+    int clause = caseLambdaClause(caseLambda, argCount);
+    if (-1 == clause) {
+        runtimeError("No clause of case-lambda takes %d arguments.",
+                     argCount);
+        return false;
+    }
+    vm.stackTop[-1 - argCount] = caseLambda->clauses[clause];
+    return true;
+}
+
+bool bindArguments(Parameters const *parameters, int argCount,
+                   char *message, size_t size) {
+    int const POSITIONAL =
+        parameters->requiredCount + parameters->optionalCount;
+    if (!takesArguments(parameters, argCount)) {
+        if (parameters->hasRest) {
+            snprintf(message, size,
+                     "Expected at least %d arguments but got %d.",
+                     parameters->requiredCount, argCount);
+        } else if (0 == parameters->optionalCount) {
+            snprintf(message, size, "Expected %d arguments but got %d.",
+                     parameters->requiredCount, argCount);
+        } else {
+            snprintf(message, size,
+                     "Expected %d to %d arguments but got %d.",
+                     parameters->requiredCount, POSITIONAL, argCount);
+        }
         return false;
     }
 
+    for (; argCount < POSITIONAL; argCount++) push(BOOL_VAL(false));
+    if (!parameters->hasRest) return true;
+
+    // The list is built from its end, in the stack where the collector sees it.
+    size_t const FIRST = (size_t)(vm.stackTop - vm.stack) -
+                         (size_t)(argCount - POSITIONAL);
+    push(NIL_VAL);
+    for (size_t i = (size_t)(vm.stackTop - vm.stack) - 1; i > FIRST; i--) {
+        Value rest = OBJ_VAL(newPair(vm.stack[i - 1], vm.stackTop[-1]));
+        vm.stackTop[-1] = rest;
+    }
+    vm.stack[FIRST] = vm.stackTop[-1];
+    vm.stackTop = vm.stack + FIRST + 1;
+    return true;
+}
+
+static bool call(ObjClosure *closure, int argCount) {
+    // Functions with a fixed arity take their arguments as they are.
+    ObjFunction *function = closure->function;
+    if (argCount != function->arity) {
+        char message[128];
+        if (!bindArguments(&function->parameters, argCount, message,
+                           sizeof(message))) {
+            runtimeError("%s", message);
+            return false;
+        }
+        argCount = parameterCount(&function->parameters);
+    }
+
+    if (!compileIfLazy(closure->function)) return false;
+
+    return pushFrame(closure, getChunkCode(&(closure->function->chunk)),
+                     argCount);
+}
+
+/*
+  Starts running closure, whose arguments have been checked, from code,
+  which must be the start of its function's code.
+*/
+static bool pushFrame(ObjClosure *closure, uint8_t *code, int argCount) {
     if (FRAMES_MAX == vm.frameCount) {
         runtimeError("Stack overflow.");
         return false;
     }
 
+    ObjFunction *function = closure->function;
+    if (TIER_INTERPRETED == function->tier &&
+        ++function->callCount >= tierOptions.callThreshold) {
+        promote(function);
+    }
+
     CallFrame *frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
-    frame->ip = getChunkCode(&(closure->function->chunk));
+    frame->ip = code;
     frame->slots = vm.stackTop - argCount - 1;
+    reserveFrame(frame);
     return true;
 }
 
-static bool isFalsey(Value value) {
+/*
+  Compiles the body of function if it was deferred until its first call,
+  or decodes its constants if it came from a bytecode file.
+*/
+static bool compileIfLazy(ObjFunction *function) {
+    if (NULL != function->cachedConstants) loadCachedConstants(function);
+    if (NULL == function->lazyBody || compileLazyBody(function)) return true;
+
+    runtimeError("Can't compile the body of %s.",
+                 NULL == function->name ? "a lambda" : function->name->chars);
+    return false;
+}
+
+// Fills cache, a call site of owner, with function.
+static void fillCallCache(ObjFunction const *owner, CallCache *cache,
+                          ObjFunction *function) {
+    if (owner->obj.isOld) rememberCallCache(cache);
+    cache->function = function;
+    cache->code = getChunkCode(&(function->chunk));
+}
+
+VMStats getVMStats(void) { return vm.stats; }
+
+void printVMStats(void) {
+    size_t calls = vm.stats.callCacheHits + vm.stats.callCacheMisses;
+    fprintf(stderr, "call cache hits:   %zu\n", vm.stats.callCacheHits);
+    fprintf(stderr, "call cache misses: %zu\n", vm.stats.callCacheMisses);
+    fprintf(stderr, "call cache hit rate: %.1f%%\n",
+            0 == calls ? 0.0 : 100.0 * vm.stats.callCacheHits / calls);
+#ifdef COUNT_INSTRUCTIONS
+    fprintf(stderr, "instructions:          %zu\n", vm.stats.instructions);
+    fprintf(stderr, "register instructions: %zu\n",
+            vm.stats.registerInstructions);
+#endif
+}
+
+void printTierStats(void) {
+    fprintf(stderr, "interpreted time: %.3f s\n", vm.stats.interpretedSeconds);
+    fprintf(stderr, "native time:      %.3f s\n", vm.stats.nativeSeconds);
+    fprintf(stderr, "promoted functions: %zu\n",
+            getSmartArrayCount(&vm.promotedFunctions));
+    for (size_t i = 0; i < getSmartArrayCount(&vm.promotedFunctions); i++) {
+        ObjFunction *function =
+            SMART_ARRAY_AT(&vm.promotedFunctions, i, ObjFunction *);
+        fprintf(stderr, "  %s (%u calls, %u back edges)\n",
+                NULL == function->name ? "script" : function->name->chars,
+                function->callCount, function->loopCount);
+    }
+}
+
+static void countBackEdge(ObjFunction *function) {
+    if (TIER_INTERPRETED == function->tier &&
+        ++function->loopCount >= tierOptions.loopThreshold) {
+        promote(function);
+    }
+}
+
+/*
+  Moves function up to native code, which run() enters the next time the
+  function is called or takes a back edge. Without the JIT or the register
+  VM there is no tier to move to, so this does nothing.
+*/
+static void promote(ObjFunction *function) {
+    if (!jitOptions.enabled && !registerOptions.enabled) return;
+    function->tier = TIER_NATIVE;
+    smartArrayAppend(&vm.promotedFunctions, &function);
+}
+
+/*
+  Runs frame as native code, from the C compiler if the function was
+  compiled ahead of time, on the register VM if that is enabled and from
+  the JIT otherwise. It is timed if tierOptions asks for that.
+*/
+static bool runNative(CallFrame *frame) {
+    bool (*enter)(CallFrame *frame) = enterJit;
+    if (NULL != frame->closure->function->aotCode) {
+        enter = enterAot;
+    } else if (registerOptions.enabled) {
+        enter = enterRegisters;
+    }
+    if (!tierOptions.timeTiers) return enter(frame);
+
+    double start = now();
+    bool result = enter(frame);
+    vm.stats.nativeSeconds += now() - start;
+    return result;
+}
+
+// Returns the time in seconds, as measured by a monotonic clock.
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
 static Value peek(int distance) { return vm.stackTop[-1 - distance]; }
 
 InterpretResult interpret(char const *source) {
+    if (closureOptions.enabled) return interpretWithClosures(source);
+
     ObjFunction *function = compile(source);
     if (NULL == function) return INTERPRET_COMPILE_ERROR;
+    return interpretFunction(function);
+}
 
+InterpretResult interpretFunction(ObjFunction *function) {
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
     call(closure, 0);
 
-    return run();
+    if (1 == vm.frameCount) vm.hadError = false;
+    InterpretResult result = runToReturn();
+    if (INTERPRET_OK == result) pop();
+    return result;
+}
+
+InterpretResult callProcedure(int argCount) {
+    int frameCount = vm.frameCount;
+    if (0 == frameCount) vm.hadError = false;
+
+    if (IS_CASE_LAMBDA(peek(argCount)) && !selectClause(argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    Value callee = peek(argCount);
+    if (IS_PROCEDURE(callee)) return callWithClosures(argCount);
+    if (!callValue(callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+
+    // A native has already left its result.
+    if (frameCount == vm.frameCount) return INTERPRET_OK;
+    return runToReturn();
+}
+
+/*
+  Runs the frame on top until it returns, even if run() is already
+  running frames under it for a native which called back into Scheme.
+  The outermost run is timed if the time in each tier is measured.
+*/
+static InterpretResult runToReturn(void) {
+    int enclosingBase = vm.baseFrame;
+    vm.baseFrame = vm.frameCount - 1;
+
+    InterpretResult result;
+    if (!tierOptions.timeTiers || 0 != vm.baseFrame) {
+        result = run();
+    } else {
+        double start = now();
+        double nativeBefore = vm.stats.nativeSeconds;
+        result = run();
+        vm.stats.interpretedSeconds +=
+            now() - start - (vm.stats.nativeSeconds - nativeBefore);
+    }
+
+    vm.baseFrame = enclosingBase;
+    return result;
 }
@@ -28,15 +28,45 @@
 #define STACK_MAX 256
 #define FRAMES_MAX 64
 
-typedef struct {
+typedef struct CallFrame {
     ObjClosure *closure;
     uint8_t *ip;
     Value *slots;
 } CallFrame;
 
+// Counts of how well the VM's caches and tiers are working.
+typedef struct {
+    size_t callCacheHits;      // Calls whose inline cache had their function.
+    size_t callCacheMisses;    // Calls of closures which had to fill it.
+    double interpretedSeconds;  // Time spent in run(), outside native code.
+    double nativeSeconds;       // Time spent in machine code from the JIT.
+    // These are only counted if COUNT_INSTRUCTIONS is defined.
+    size_t instructions;          // Instructions dispatched by run().
+    size_t registerInstructions;  // Instructions run by the register VM.
+} VMStats;
+
+/*
+  Settings for moving hot functions up to a faster tier, which are set by
+  command line flags. A function is promoted once it has been called
+  callThreshold times, or has taken loopThreshold back edges, while it
+  was interpreted.
+*/
+typedef struct {
+    uint32_t callThreshold;
+    uint32_t loopThreshold;
+    bool timeTiers;  // Measure the time spent in each tier.
+} TierOptions;
+
+extern TierOptions tierOptions;
+
 typedef struct {
     CallFrame frames[FRAMES_MAX];
     int frameCount;
+    // The frame count at which the innermost run() returns to its caller.
+    int baseFrame;
+    // Whether a runtime error was reported, so natives which called back
+    // into Scheme return at once.
+    bool hadError;
 
     Value *stack;
     Value *stackTop;
@@ -50,6 +80,10 @@ typedef struct {
     ObjUpvalue *openUpvalues;
 
     GarbageCollectorState gcState;
+    VMStats stats;
+    SmartArray promotedFunctions;  // ObjFunction pointers, in promotion order.
+    SmartArray handles;      // Values retained by C code, which are roots.
+    SmartArray freeHandles;  // Indexes of released handles, to reuse.
 } VM;
 
 typedef enum {
@@ -58,11 +92,106 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-extern VM vm;
+/*
+  The VM of the running thread. Each thread has its own VM, scanner,
+  parser and compiler, so threads can run programs side by side. Objects
+  and compiled code belong to the VM of the thread which made them, and
+  can't be handed to another thread. The options, like compilerOptions,
+  are shared, and are set before any thread starts a VM.
+*/
+extern _Thread_local VM vm;
 
 void initVM(void);
 void freeVM(void);
 InterpretResult interpret(char const *source);
+
+// Runs function, which must take no arguments, as a script.
+InterpretResult interpretFunction(ObjFunction *function);
+
+/*
+  Calls the procedure which is argCount values down the stack, with the
+  values above it as its arguments, and runs it to the end. Its result
+  takes the place of the procedure and the arguments.
+
+  A native may call it to call back into Scheme. The call may grow the
+  stack, which moves it, so the native has to find its arguments by their
+  index in vm.stack afterwards. If the call fails, the error has been
+  reported and the stack reset, and the native has to return at once.
+*/
+InterpretResult callProcedure(int argCount);
+
+/*
+  Binds the argCount arguments on top of the stack to parameters: the
+  missing optional ones are pushed as #f, and the rest are replaced with
+  a list of them. Returns false, and writes why to message, if parameters
+  don't take argCount arguments.
+*/
+bool bindArguments(Parameters const *parameters, int argCount,
+                   char *message, size_t size);
+
+/*
+  Defines the global name as function, which takes arity arguments, or
+  ANY_ARITY. It is described as a native with effects and no type hints.
+*/
+void defineNative(char const *name, NativeFn function, int arity);
+
+// Defines the native which descriptor describes.
+void defineDescribedNative(NativeDescriptor const *descriptor);
+
+/*
+  Keeps value from being freed until releaseValue() is called with the
+  handle this returns.
+*/
+int retainValue(Value value);
+
+// Returns the value which handle keeps.
+Value retainedValue(int handle);
+
+// Lets the value which handle keeps be freed, and lets handle be reused.
+void releaseValue(int handle);
 void push(Value value);
 Value pop(void);
 void printStack(void);
+
+/*
+  Reports a runtime error at the current instruction of every frame, then
+  resets the stack.
+*/
+void runtimeError(char const *format, ...);
+
+// Empties the stack, and drops every call frame and open upvalue.
+void resetStack(void);
+
+/*
+  Calls callee with the argCount values on top of the stack as arguments.
+  A closure gets a new frame, which the caller must run. Returns false if
+  there was a runtime error.
+*/
+bool callValue(Value callee, int argCount);
+
+// Grows the stack until it can hold height values.
+void reserveStack(size_t height);
+
+/*
+  Makes room on the stack for every value which frame's function can
+  have on it at once, so that its instructions can push without checks.
+*/
+void reserveFrame(CallFrame const *frame);
+
+// Returns true if value counts as false in a condition.
+bool isFalsey(Value value);
+
+// Returns the upvalue for the stack slot local, which is created if needed.
+ObjUpvalue *captureUpvalue(Value *local);
+
+// Closes every open upvalue for a stack slot at or above last.
+void closeUpvalues(Value *last);
+
+// Returns the counts that the VM has collected since it was initialized.
+VMStats getVMStats(void);
+
+// Prints the VM's counts, and the rates they work out to, to stderr.
+void printVMStats(void);
+
+// Prints the functions which were promoted, and the time in each tier.
+void printTierStats(void);
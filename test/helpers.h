@@ -0,0 +1,26 @@
+// Helpers shared by the tests which look at what a program left behind.
+
+#pragma once
+
+#include <string.h>
+
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+// Returns the value of the global variable called name.
+static inline Value global(char const *name) {
+    Value value = NIL_VAL;
+    ObjSymbol *symbol = newSymbol(name, (int)strlen(name));
+    TEST_ASSERT_TRUE(tableGet(&vm.globals, symbol, &value));
+    return value;
+}
+
+// Asserts that the global variable called name holds the symbol expected.
+static inline void assertGlobalIsSymbol(char const *expected,
+                                        char const *name) {
+    Value value = global(name);
+    TEST_ASSERT_TRUE(IS_SYMBOL(value));
+    TEST_ASSERT_EQUAL_STRING(expected, AS_SYMBOL(value)->chars);
+}
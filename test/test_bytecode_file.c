@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/bytecode_file.h"
+#include "../src/compiler.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+static char path[] = "/tmp/ecsi_test_XXXXXX";
+
+void setUp(void) {
+    initVM();
+    int descriptor = mkstemp(path);
+    TEST_ASSERT_NOT_EQUAL(-1, descriptor);
+    close(descriptor);
+}
+
+void tearDown(void) {
+    freeVM();
+    remove(path);
+    strcpy(path, "/tmp/ecsi_test_XXXXXX");
+}
+
+// Compiles source and writes it to the file at path.
+static void writeSource(char const *source) {
+    compilerOptions.lazy = false;
+    ObjFunction *script = compile(source);
+    TEST_ASSERT_NOT_NULL(script);
+    TEST_ASSERT_TRUE(
+        writeBytecodeFile(path, script, hashSource(source, strlen(source))));
+}
+
+void test_runsScriptFromFile(void) {
+    char const *source =
+        "(define (adder n) (lambda (x) (+ x n)))"
+        "(define (size x) (case x ((1 2 3) 'small) ((a #\\b) 'other)"
+        "                   (else 'big)))"
+        "(define sum ((adder 40) 2))"
+        "(define kind (size 2))"
+        "(define list '(1 \"two\" three))";
+    writeSource(source);
+
+    ObjFunction *script =
+        readBytecodeFile(path, hashSource(source, strlen(source)));
+    TEST_ASSERT_NOT_NULL(script);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpretFunction(script));
+
+    TEST_ASSERT_EQUAL_DOUBLE(42, AS_NUMBER(global("sum")));
+    TEST_ASSERT_TRUE(
+        textOfSymbolEqualToString(AS_SYMBOL(global("kind")), "small"));
+    Value list = global("list");
+    TEST_ASSERT_TRUE(IS_STRING(CADR(list)));
+    TEST_ASSERT_EQUAL_STRING("two", AS_STRING(CADR(list))->chars);
+}
+
+void test_staleFileIsIgnored(void) {
+    char const *source = "(define x 1)";
+    writeSource(source);
+    TEST_ASSERT_NULL(readBytecodeFile(path, hashSource("(define x 2)", 12)));
+}
+
+void test_pathReplacesExtension(void) {
+    char *result = bytecodeFilePath("dir.d/program.scm");
+    TEST_ASSERT_EQUAL_STRING("dir.d/program.ecsc", result);
+    free(result);
+
+    result = bytecodeFilePath("dir.d/program");
+    TEST_ASSERT_EQUAL_STRING("dir.d/program.ecsc", result);
+    free(result);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_runsScriptFromFile);
+    RUN_TEST(test_staleFileIsIgnored);
+    RUN_TEST(test_pathReplacesExtension);
+    return UNITY_END();
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/c_backend.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+void setUp(void) { initVM(); }
+void tearDown(void) { freeVM(); }
+
+// Returns the C that source compiles to, which the caller must free.
+static char *compileSource(char const *source) {
+    FILE *file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_TRUE(compileToC(source, "test.scm", file));
+
+    long size = ftell(file);
+    rewind(file);
+    char *text = malloc(size + 1);
+    TEST_ASSERT_EQUAL_size_t(size, fread(text, 1, size, file));
+    text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+void testEveryFunctionIsTranslated(void) {
+    char *text = compileSource("(define (f x) (lambda () x)) (f 1)");
+    TEST_ASSERT_NOT_NULL(strstr(text, "static int function0("));
+    TEST_ASSERT_NOT_NULL(strstr(text, "static int function1("));
+    TEST_ASSERT_NOT_NULL(strstr(text, "static int function2("));
+    TEST_ASSERT_NULL(strstr(text, "static int function3("));
+    // The script is built last, from the functions it contains.
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotBeginFunction(NULL"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotPushFunction(1)"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "int main(void)"));
+    free(text);
+}
+
+void testTailCallsReuseTheFrame(void) {
+    char *text = compileSource(
+        "(define (even? n) (if (= n 0) #t (odd? (- n 1))))"
+        "(define (odd? n) (if (= n 0) #f (even? (- n 1))))");
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotTailCall(frame, 1)"));
+    free(text);
+}
+
+void testConstantsAreRebuilt(void) {
+    char *text = compileSource("(define x '(a \"b\" 3))");
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotPushSymbol(\"a\", 1, true)"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotPushString(\"b\", 1)"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "push(NUMBER_VAL(0x1.8p+1))"));
+    TEST_ASSERT_NOT_NULL(strstr(text, "aotCons()"));
+    free(text);
+}
+
+void testCompileErrorsAreReported(void) {
+    FILE *file = tmpfile();
+    TEST_ASSERT_FALSE(compileToC("(if)", "test.scm", file));
+    fclose(file);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testEveryFunctionIsTranslated);
+    RUN_TEST(testTailCallsReuseTheFrame);
+    RUN_TEST(testConstantsAreRebuilt);
+    RUN_TEST(testCompileErrorsAreReported);
+    return UNITY_END();
+}
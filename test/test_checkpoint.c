@@ -0,0 +1,92 @@
+#include <string.h>
+
+#include "../src/checkpoint.h"
+#include "../src/closure_engine.h"
+#include "../src/compiler.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+void setUp(void) {
+    initVM();
+    compilerOptions.lazy = true;
+    closureOptions.enabled = false;
+}
+
+void tearDown(void) {
+    freeVM();
+    closureOptions.enabled = false;
+}
+
+static bool lookUp(char const *name, Value *value) {
+    return tableGet(&vm.globals, newSymbol(name, (int)strlen(name)), value);
+}
+
+static double global(char const *name) {
+    Value value = NIL_VAL;
+    TEST_ASSERT_TRUE(lookUp(name, &value));
+    return AS_NUMBER(value);
+}
+
+static void run(char const *source) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(source));
+}
+
+void test_restoreFreesWhatWasAllocated(void) {
+    run("(define answer 42)");
+    checkpointVM();
+    Obj *objects = vm.objects;
+
+    run("(define answer '(1 2)) (define other \"text\")");
+    restoreVM();
+
+    TEST_ASSERT_EQUAL_PTR(objects, vm.objects);
+    TEST_ASSERT_EQUAL_DOUBLE(42, global("answer"));
+    Value value;
+    TEST_ASSERT_FALSE(lookUp("other", &value));
+}
+
+void test_restoreUndoesWritesToUpvalues(void) {
+    run("(define tick (let ((n 0)) (lambda () (set! n (+ n 1)) n)))"
+        "(define (keep x) (let ((kept 0)) (lambda () (set! kept x) kept)))"
+        "(define hold (keep 0))");
+    checkpointVM();
+
+    for (int i = 0; i < 3; i++) {
+        run("(tick) (tick) (hold) (define (keep x) x)");
+        restoreVM();
+    }
+    run("(define n (tick))");
+    TEST_ASSERT_EQUAL_DOUBLE(1, global("n"));
+}
+
+void test_lazyBodiesAndCallCachesSurviveRestore(void) {
+    run("(define (g) 1) (define (h) (g)) (define (make) (lambda () (h)))");
+    checkpointVM();
+
+    run("(define (g) 2) ((make))");
+    restoreVM();
+    run("(define r ((make)))");
+    TEST_ASSERT_EQUAL_DOUBLE(1, global("r"));
+}
+
+void test_closureEngineRestores(void) {
+    closureOptions.enabled = true;
+    run("(define tick (let ((n 0)) (lambda () (set! n (+ n 1)) n)))");
+    checkpointVM();
+
+    run("(tick) (define (f) (tick)) (f)");
+    restoreVM();
+    run("(define n (tick))");
+    TEST_ASSERT_EQUAL_DOUBLE(1, global("n"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_restoreFreesWhatWasAllocated);
+    RUN_TEST(test_restoreUndoesWritesToUpvalues);
+    RUN_TEST(test_lazyBodiesAndCallCachesSurviveRestore);
+    RUN_TEST(test_closureEngineRestores);
+    return UNITY_END();
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/closure_engine.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+void setUp(void) {
+    initVM();
+    closureOptions.enabled = true;
+}
+
+void tearDown(void) {
+    freeVM();
+    closureOptions.enabled = false;
+}
+
+void testCallsAndRecursion(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (fib n) (if (< n 2) n"
+                  "  (+ (fib (- n 1)) (fib (- n 2)))))"
+                  "(define r (fib 15))"
+                  "(define (f x) (define y (* x 2)) (- y 1))"
+                  "(define inner (f 5))"));
+    TEST_ASSERT_EQUAL_DOUBLE(610, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(9, AS_NUMBER(global("inner")));
+}
+
+void testTailCallsDontNest(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (count n acc) (if (= n 0) acc"
+                  "  (count (- n 1) (+ acc 1))))"
+                  "(define r (count 100000 0))"
+                  "(define s (let loop ((i 0)) (if (< i 50000) (loop (+ i 1)) i)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(100000, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(50000, AS_NUMBER(global("s")));
+}
+
+void testClosures(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (counter) (let ((n 0))"
+                  "  (lambda () (set! n (+ n 1)) n)))"
+                  "(define c (counter)) (c) (c)"
+                  "(define r (c))"
+                  "(define (adder x) (lambda (y) (lambda (z) (+ x y z))))"
+                  "(define sum (((adder 1) 2) 3))"
+                  "(define f #f)"
+                  "(let loop ((i 0))"
+                  "  (if (= i 1) (set! f (lambda () i)))"
+                  "  (if (< i 3) (loop (+ i 1)) i))"
+                  "(define seen (f))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(6, AS_NUMBER(global("sum")));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(global("seen")));
+}
+
+void testDoLoops(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (do ((i 0 (+ i 1)) (s 0 (+ s i)))"
+                  "  ((= i 5) s)))"
+                  "(define f #f)"
+                  "(define last (do ((i 0 (+ i 1))) ((= i 3) i)"
+                  "  (if (= i 1) (set! f (lambda () i)))))"
+                  "(define seen (f))"));
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("last")));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(global("seen")));
+}
+
+void testConditionals(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (f x) (case x ((1 2) 'low) ((a) 'letter)"
+                  "  (else 'other)))"
+                  "(define low (f 2)) (define letter (f 'a))"
+                  "(define other (f 9))"
+                  "(define arrow (case 5 ((5) => (lambda (k) (* k 2)))))"
+                  "(define (g n) (cond ((= n 0) 'zero) ((< n 0) 'negative)"
+                  "  (else 'positive)))"
+                  "(define zero (g 0)) (define positive (g 4))"
+                  "(define test (cond (#f 1) (7)))"
+                  "(define called (cond (#f 1) (5 => (lambda (x) (+ x 1)))))"
+                  "(define both (and 1 2)) (define either (or #f 3))"
+                  "(define skipped (when #f 1))"));
+    assertGlobalIsSymbol("low", "low");
+    assertGlobalIsSymbol("letter", "letter");
+    assertGlobalIsSymbol("other", "other");
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("arrow")));
+    assertGlobalIsSymbol("zero", "zero");
+    assertGlobalIsSymbol("positive", "positive");
+    TEST_ASSERT_EQUAL_DOUBLE(7, AS_NUMBER(global("test")));
+    TEST_ASSERT_EQUAL_DOUBLE(6, AS_NUMBER(global("called")));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("both")));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("either")));
+    TEST_ASSERT_TRUE(IS_NIL(global("skipped")));
+}
+
+void testVariadicProcedures(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (rest a . more) more)"
+                  "(define (opt a #!optional b) b)"
+                  "(define pick (case-lambda ((x) 'one) ((x . y) y)))"
+                  "(define two (rest 1 2 3))"
+                  "(define missing (opt 1))"
+                  "(define one (pick 1))"
+                  "(define others (pick 1 2))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(CADR(global("two"))));
+    TEST_ASSERT_FALSE(AS_BOOL(global("missing")));
+    assertGlobalIsSymbol("one", "one");
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(CAR(global("others"))));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(pick)"));
+}
+
+void testPrimitives(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define sums (map + '(1 2) '(10 20)))"
+                  "(define (< a b) 'mine)"
+                  "(define less (< 1 2))"));
+    TEST_ASSERT_EQUAL_DOUBLE(22, AS_NUMBER(CADR(global("sums"))));
+    assertGlobalIsSymbol("mine", "less");
+}
+
+void testManyLocalsAndArguments(void) {
+    // The programs of test_manyLocalsUseWideOperands and
+    // test_manyArgumentsUseWideCall in test_compiler.c.
+    static char program[16384];
+    char *end = program + sprintf(program, "(define (f) (let (");
+    for (int i = 0; i < 300; i++) end += sprintf(end, "(a%d %d) ", i, i);
+    end += sprintf(end, ") (set! a298 1) (+");
+    for (int i = 0; i < 300; i++) end += sprintf(end, " a%d", i);
+    end += sprintf(end, ")))(define r (f))(define (g");
+    for (int i = 0; i < 300; i++) end += sprintf(end, " p%d", i);
+    end += sprintf(end, ") (+ p0 p299))(define s (g");
+    for (int i = 0; i < 300; i++) end += sprintf(end, " %d", i);
+    strcpy(end, "))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    // The sum of 0 to 299, with 1 in place of 298.
+    TEST_ASSERT_EQUAL_DOUBLE(44553, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(299, AS_NUMBER(global("s")));
+}
+
+void testErrors(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          interpret("(define (f x) (+ x 'a)) (f 1)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          interpret("(define (f x) x) (f 1 2)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          interpret("(define (f n) (+ 1 (f n))) (f 0)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_COMPILE_ERROR, interpret("(if)"));
+
+    // The engine still works after an error.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define r (+ 1 2))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("r")));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testCallsAndRecursion);
+    RUN_TEST(testTailCallsDontNest);
+    RUN_TEST(testClosures);
+    RUN_TEST(testDoLoops);
+    RUN_TEST(testConditionals);
+    RUN_TEST(testVariadicProcedures);
+    RUN_TEST(testPrimitives);
+    RUN_TEST(testManyLocalsAndArguments);
+    RUN_TEST(testErrors);
+    return UNITY_END();
+}
@@ -1,9 +1,399 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/chunk.h"
+#include "../src/compiler.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
 #include "../unity/src/unity.h"
+#include "helpers.h"
+
+// A program generated by a test, too big to write out.
+static char *program;
+static size_t programLength;
+
+void setUp(void) {
+    initVM();
+    program = NULL;
+    programLength = 0;
+}
+
+void tearDown(void) {
+    free(program);
+    freeVM();
+}
+
+// Appends the text made from format and its arguments to program.
+static void append(char const *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    program = realloc(program, programLength + length + 1);
+    TEST_ASSERT_NOT_NULL(program);
+    va_start(args, format);
+    vsnprintf(program + programLength, length + 1, format, args);
+    va_end(args);
+    programLength += length;
+}
+
+// Returns true if function's code contains instruction as an opcode.
+static bool containsOpCode(ObjFunction *function, OpCode instruction) {
+    // The scripts are simple enough that no operand looks like an opcode.
+    for (size_t i = 0; i < getChunkCount(&(function->chunk)); i++) {
+        if (instruction == getChunkAt(&(function->chunk), i)) return true;
+    }
+    return false;
+}
+
+// Returns true if function's code has an instruction after OP_WIDE.
+static bool hasWideInstruction(ObjFunction *function) {
+    Chunk *chunk = &(function->chunk);
+    for (size_t i = 0; i < getChunkCount(chunk);
+         i += instructionLength(chunk, i)) {
+        if (OP_WIDE == getChunkAt(chunk, i)) return true;
+    }
+    return false;
+}
+
+// Returns the function of the closure in the global variable called name.
+static ObjFunction *globalFunction(char const *name) {
+    return AS_CLOSURE(global(name))->function;
+}
 
-void setUp() {}
-void tearDown() {}
+// Appends the bindings (a0 0) (a1 1) ... of count variables to program.
+static void appendBindings(int count) {
+    for (int i = 0; i < count; i++) append("(a%d %d) ", i, i);
+}
+
+void test_namedLetSumsInFrame(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (let loop ((i 0) (acc 0))"
+                  "  (if (< i 10) (loop (+ i 1) (+ acc i)) acc)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(45, AS_NUMBER(global("r")));
+}
+
+void test_namedLetCompilesToLoop(void) {
+    ObjFunction *function = compile(
+        "(let loop ((i 0)) (if (< i 10) (loop (+ i 1)) i))");
+    TEST_ASSERT_NOT_NULL(function);
+    // The peephole optimizer fuses the back edge with closing the scope.
+    TEST_ASSERT_TRUE(containsOpCode(function, OP_LOOP) ||
+                     containsOpCode(function, OP_CLOSE_SCOPE_LOOP));
+    TEST_ASSERT_FALSE(containsOpCode(function, OP_CALL));
+}
+
+void test_namedLetNonTailCallIsProcedure(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (let loop ((i 0))"
+                  "  (if (< i 3) (+ 1 (loop (+ i 1))) 0)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("r")));
+}
+
+void test_namedLetClosuresSeeEachIteration(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define f #f)"
+                  "(let loop ((i 0))"
+                  "  (if (= i 1) (set! f (lambda () i)))"
+                  "  (if (< i 3) (loop (+ i 1)) i))"
+                  "(define r (f))"));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(global("r")));
+}
+
+void test_namedLetProcedureDropsLoopCallSites(void) {
+    ObjFunction *function = compile(
+        "(let loop ((i 0)) (f 1) (g 2) (+ 1 (loop i)))");
+    TEST_ASSERT_NOT_NULL(function);
+    // Only the call of the procedure is left of the abandoned loop.
+    TEST_ASSERT_EQUAL_INT(1, function->callSiteCount);
+}
+
+void test_doLoop(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (do ((i 0 (+ i 1)) (s 0 (+ s i)))"
+                  "  ((= i 5) s)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("r")));
+}
+
+void test_doLoopCommandsAndStepless(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (do ((v 0) (i 0 (+ i 1))) ((= i 3) v)"
+                  "  (set! v (+ v i))))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("r")));
+}
+
+void test_caseCompilesToSwitch(void) {
+    ObjFunction *function = compile(
+        "(case 3 ((1 2) 'low) ((3) 'three) ((a) 'letter) (else 'other))");
+    TEST_ASSERT_NOT_NULL(function);
+    TEST_ASSERT_TRUE(containsOpCode(function, OP_SWITCH));
+    TEST_ASSERT_FALSE(containsOpCode(function, OP_JUMP_IF_FALSE));
+}
+
+void test_caseDispatch(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (f x) (case x ((1 2) 'low) ((3) 'three)"
+                  "  ((a b) 'letter) ((#\\z) 'char) ((1000) 'big)"
+                  "  (else 'other)))"
+                  "(define low (f 2)) (define three (f 3))"
+                  "(define letter (f 'b)) (define char (f #\\z))"
+                  "(define big (f 1000)) (define other (f 4))"
+                  "(define arrow (case 5 ((5) => (lambda (k) (* k 2)))))"));
+    assertGlobalIsSymbol("low", "low");
+    assertGlobalIsSymbol("three", "three");
+    assertGlobalIsSymbol("letter", "letter");
+    assertGlobalIsSymbol("char", "char");
+    assertGlobalIsSymbol("big", "big");
+    assertGlobalIsSymbol("other", "other");
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("arrow")));
+}
+
+void test_condOnOneVariableCompilesToSwitch(void) {
+    ObjFunction *function = compile(
+        "(define (f n) (cond ((= n 0) 'zero) ((eqv? n 1) 'one)"
+        "  ((eq? n 'x) 'ex) (else 'many)))");
+    TEST_ASSERT_NOT_NULL(function);
+
+    ValueArray *constants = &(function->chunk.constants);
+    bool foundSwitch = false;
+    for (size_t i = 0; i < getValueArrayCount(constants); i++) {
+        Value constant = getValueArrayAt(constants, i);
+        if (IS_FUNCTION(constant)) {
+            ObjFunction *f = AS_FUNCTION(constant);
+            TEST_ASSERT_TRUE(NULL == f->lazyBody || compileLazyBody(f));
+            foundSwitch = containsOpCode(f, OP_SWITCH);
+        }
+    }
+    TEST_ASSERT_TRUE(foundSwitch);
+}
+
+void test_cond(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (f n) (cond ((= n 0) 'zero) ((= n 1) 'one)"
+                  "  (else 'many)))"
+                  "(define zero (f 0)) (define many (f 7))"
+                  "(define arrow (cond (#f 1) (5 => (lambda (x) (* x 2)))))"
+                  "(define test (cond (#f 1) (7)))"));
+    assertGlobalIsSymbol("zero", "zero");
+    assertGlobalIsSymbol("many", "many");
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("arrow")));
+    TEST_ASSERT_EQUAL_DOUBLE(7, AS_NUMBER(global("test")));
+}
+
+void test_condOnNumbersFailsOnOtherKeys(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_RUNTIME_ERROR,
+        interpret("(define x 'a)"
+                  "(cond ((= x 1) 1) ((= x 2) 2) (else 3))"));
+    // The = test is never reached, so it can't fail.
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (cond ((eq? x 'a) 'a) ((= x 2) 2) (else 3)))"));
+    assertGlobalIsSymbol("a", "r");
+}
+
+void test_primitivesAreFirstClass(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define add +)"
+                  "(define sum (add 1 2))"
+                  "(define sums (map + '(1 2) '(10 20)))"
+                  "(define ordered (< 1 2 3))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("sum")));
+    TEST_ASSERT_EQUAL_DOUBLE(22, AS_NUMBER(CADR(global("sums"))));
+    TEST_ASSERT_TRUE(AS_BOOL(global("ordered")));
+}
+
+void test_redefinedPrimitivesAreCalled(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (+ a b) 'mine) (define sum (+ 1 2))"));
+    assertGlobalIsSymbol("mine", "sum");
+}
+
+void test_lambdaBodyIsCompiledOnFirstCall(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define (adder n) (lambda (x) (+ x n)))"));
+    ObjFunction *adder = AS_CLOSURE(global("adder"))->function;
+    TEST_ASSERT_NOT_NULL(adder->lazyBody);
+    TEST_ASSERT_EQUAL_size_t(0, getChunkCount(&(adder->chunk)));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define r ((adder 3) 4))"));
+    TEST_ASSERT_NULL(adder->lazyBody);
+    TEST_ASSERT_EQUAL_DOUBLE(7, AS_NUMBER(global("r")));
+}
+
+void test_lazyBodySeesShadowedPrimitives(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (f a) (let ((+ (lambda (p q) (* p q))))"
+                  "  ((lambda (b) (+ a b)) 2)))"
+                  "(define r (f 10))"));
+    TEST_ASSERT_EQUAL_DOUBLE(20, AS_NUMBER(global("r")));
+}
+
+void test_lazyBodyErrorIsReportedWhenCalled(void) {
+    // The body outlives the text it was compiled from.
+    char const text[] = "(define (f) (if))";
+    char *source = malloc(sizeof(text));
+    memcpy(source, text, sizeof(text));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(source));
+    free(source);
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(f)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(f)"));
+}
+
+void test_maxStackCountsSlotsAndTemporaries(void) {
+    ObjFunction *script = compile("(lambda (a b) (+ a (* b 2)))");
+    TEST_ASSERT_NOT_NULL(script);
+    ObjFunction *function =
+        AS_FUNCTION(getValueArrayAt(&(script->chunk.constants), 0));
+    TEST_ASSERT_TRUE(compileLazyBody(function));
+
+    // The closure, a and b, then a, b and 2 while multiplying.
+    TEST_ASSERT_EQUAL_INT(6, function->maxStack);
+    TEST_ASSERT_EQUAL_INT(2, script->maxStack);
+}
+
+void test_manyGlobalsUseWideOperands(void) {
+    for (int i = 0; i < 300; i++) append("(define g%d %d)\n", i, i);
+    append("(define r (+ g0 g299))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    TEST_ASSERT_EQUAL_DOUBLE(299, AS_NUMBER(global("r")));
+    ObjFunction *script = compile(program);
+    TEST_ASSERT_NOT_NULL(script);
+    TEST_ASSERT_TRUE(hasWideInstruction(script));
+}
+
+void test_manyLocalsUseWideOperands(void) {
+    append("(define (f) (let (");
+    appendBindings(300);
+    append(") (set! a298 1) (+");
+    for (int i = 0; i < 300; i++) append(" a%d", i);
+    append(")))");
+    append("(define r (f))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    // The sum of 0 to 299, with 1 in place of 298.
+    TEST_ASSERT_EQUAL_DOUBLE(44553, AS_NUMBER(global("r")));
+    TEST_ASSERT_TRUE(hasWideInstruction(globalFunction("f")));
+}
+
+void test_manyUpvaluesUseWideOperands(void) {
+    append("(define (f) (let (");
+    appendBindings(300);
+    append(") (lambda () (set! a299 1) (+");
+    for (int i = 0; i < 300; i++) append(" a%d", i);
+    append("))))");
+    append("(define g (f)) (define r (g))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    // The sum of 0 to 298, and 1.
+    TEST_ASSERT_EQUAL_DOUBLE(44552, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_INT(300, globalFunction("g")->upvalueCount);
+    TEST_ASSERT_TRUE(hasWideInstruction(globalFunction("f")));
+    TEST_ASSERT_TRUE(hasWideInstruction(globalFunction("g")));
+}
+
+void test_longBranchesUseWideJumps(void) {
+    // Each increment compiles to 8 bytes, so the branch is over 64 KB.
+    append("(define x 0)");
+    append("(define (f) (let loop ((i 0)) (if (< i 2) (begin");
+    for (int i = 0; i < 10000; i++) append(" (set! x (+ x 1))");
+    append(" (loop (+ i 1))) i)))");
+    append("(define r (f))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(20000, AS_NUMBER(global("x")));
+    TEST_ASSERT_TRUE(hasWideInstruction(globalFunction("f")));
+}
+
+void test_manyArgumentsUseWideCall(void) {
+    append("(define (f");
+    for (int i = 0; i < 300; i++) append(" p%d", i);
+    append(") (+ p0 p299))");
+    append("(define r (f");
+    for (int i = 0; i < 300; i++) append(" %d", i);
+    append("))");
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(program));
+    TEST_ASSERT_EQUAL_DOUBLE(299, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_INT(300, globalFunction("f")->arity);
+}
+
+void test_constantsAreAddedOnce(void) {
+    ObjFunction *script = compile(
+        "(display 'foo) (display 'foo) (display \"s\") (display \"s\")"
+        "(display 7) (display 7) (display '(1 (2) \"s\"))"
+        "(display '(1 (2) \"s\"))");
+    TEST_ASSERT_NOT_NULL(script);
+    // display, foo, "s", 7 and the list.
+    TEST_ASSERT_EQUAL_size_t(5, getValueArrayCount(&(script->chunk.constants)));
+}
+
+void test_equalLiteralsAreShared(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define same (eq? '(1 (a) \"s\") '(1 (a) \"s\")))"
+                  "(define different (eq? '(1 2) '(1 3)))"));
+    TEST_ASSERT_TRUE(AS_BOOL(global("same")));
+    TEST_ASSERT_FALSE(AS_BOOL(global("different")));
+}
+
+void test_nativeCallsAreDirect(void) {
+    compilerOptions.lazy = false;
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define (f x) (display x))"
+                                    "(define (g x) (newline x))"
+                                    "(define (newline x) x)"));
+    TEST_ASSERT_TRUE(containsOpCode(globalFunction("f"), OP_CALL_NATIVE));
+    // The program redefines newline, so its call stays generic.
+    TEST_ASSERT_FALSE(containsOpCode(globalFunction("g"), OP_CALL_NATIVE));
+    compilerOptions.lazy = true;
+}
 
-int main() {
+int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_namedLetSumsInFrame);
+    RUN_TEST(test_namedLetCompilesToLoop);
+    RUN_TEST(test_namedLetNonTailCallIsProcedure);
+    RUN_TEST(test_namedLetClosuresSeeEachIteration);
+    RUN_TEST(test_namedLetProcedureDropsLoopCallSites);
+    RUN_TEST(test_doLoop);
+    RUN_TEST(test_doLoopCommandsAndStepless);
+    RUN_TEST(test_caseCompilesToSwitch);
+    RUN_TEST(test_caseDispatch);
+    RUN_TEST(test_condOnOneVariableCompilesToSwitch);
+    RUN_TEST(test_cond);
+    RUN_TEST(test_condOnNumbersFailsOnOtherKeys);
+    RUN_TEST(test_primitivesAreFirstClass);
+    RUN_TEST(test_redefinedPrimitivesAreCalled);
+    RUN_TEST(test_lambdaBodyIsCompiledOnFirstCall);
+    RUN_TEST(test_lazyBodySeesShadowedPrimitives);
+    RUN_TEST(test_lazyBodyErrorIsReportedWhenCalled);
+    RUN_TEST(test_maxStackCountsSlotsAndTemporaries);
+    RUN_TEST(test_manyGlobalsUseWideOperands);
+    RUN_TEST(test_manyLocalsUseWideOperands);
+    RUN_TEST(test_manyUpvaluesUseWideOperands);
+    RUN_TEST(test_longBranchesUseWideJumps);
+    RUN_TEST(test_manyArgumentsUseWideCall);
+    RUN_TEST(test_constantsAreAddedOnce);
+    RUN_TEST(test_equalLiteralsAreShared);
+    RUN_TEST(test_nativeCallsAreDirect);
     return UNITY_END();
 }
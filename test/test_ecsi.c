@@ -0,0 +1,103 @@
+#include "../src/ecsi.h"
+#include "../src/memory.h"
+#include "../unity/src/unity.h"
+
+void setUp(void) { ecsiOpen(); }
+
+void tearDown(void) { ecsiClose(); }
+
+static Value twice(int argCount, Value *args) {
+    (void)argCount;
+    return NUMBER_VAL(2 * AS_NUMBER(args[0]));
+}
+
+void test_schemeCallsNatives(void) {
+    ecsiDefineNative("twice", twice, 1);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, ecsiRun("(define x (twice 21))"));
+
+    Value x;
+    TEST_ASSERT_TRUE(ecsiGetGlobal("x", &x));
+    TEST_ASSERT_EQUAL_DOUBLE(42, AS_NUMBER(x));
+    TEST_ASSERT_FALSE(ecsiGetGlobal("y", &x));
+}
+
+void test_nativesHaveTheirArityChecked(void) {
+    ecsiDefineNative("twice", twice, 1);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, ecsiRun("(twice 1 2)"));
+}
+
+void test_cCallsProcedures(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          ecsiRun("(define (add a b) (+ a b))"));
+    Value add;
+    TEST_ASSERT_TRUE(ecsiGetGlobal("add", &add));
+
+    for (int i = 0; i < 3; i++) {
+        ecsiPush(add);
+        ecsiPush(NUMBER_VAL(i));
+        ecsiPush(NUMBER_VAL(40));
+        Value result;
+        TEST_ASSERT_EQUAL_INT(INTERPRET_OK, ecsiCall(2, &result));
+        TEST_ASSERT_EQUAL_DOUBLE(40 + i, AS_NUMBER(result));
+    }
+    TEST_ASSERT_EQUAL_PTR(vm.stack, vm.stackTop);
+
+    Value display;
+    TEST_ASSERT_TRUE(ecsiGetGlobal("display", &display));
+    ecsiPush(display);
+    Value result;
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, ecsiCall(0, &result));
+
+    ecsiPush(add);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, ecsiCall(0, &result));
+}
+
+// Calls the procedure in args[0] on args[1], and then on the result.
+static Value applyTwice(int argCount, Value *args) {
+    (void)argCount;
+    Value procedure = args[0];
+    Value result = args[1];
+    for (int i = 0; i < 2; i++) {
+        ecsiPush(procedure);
+        ecsiPush(result);
+        if (INTERPRET_OK != ecsiCall(1, &result)) return NIL_VAL;
+    }
+    return result;
+}
+
+void test_nativesCallProcedures(void) {
+    ecsiDefineNative("apply-twice", applyTwice, 2);
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        ecsiRun("(define x (apply-twice (lambda (n) (* n 3)) 2))"));
+    Value x;
+    TEST_ASSERT_TRUE(ecsiGetGlobal("x", &x));
+    TEST_ASSERT_EQUAL_DOUBLE(18, AS_NUMBER(x));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          ecsiRun("(apply-twice (lambda () 1) 2)"));
+}
+
+void test_handlesKeepValues(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, ecsiRun("(define items '(1 2))"));
+    Value items;
+    TEST_ASSERT_TRUE(ecsiGetGlobal("items", &items));
+    EcsiHandle handle = ecsiRetain(items);
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, ecsiRun("(define items #f)"));
+    collectGarbage();
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(CADR(ecsiHandleValue(handle))));
+
+    ecsiRelease(handle);
+    TEST_ASSERT_EQUAL_INT(handle, ecsiRetain(NIL_VAL));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_schemeCallsNatives);
+    RUN_TEST(test_nativesHaveTheirArityChecked);
+    RUN_TEST(test_cCallsProcedures);
+    RUN_TEST(test_nativesCallProcedures);
+    RUN_TEST(test_handlesKeepValues);
+    return UNITY_END();
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/closure_engine.h"
+#include "../src/ffi.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+void setUp(void) { initVM(); }
+
+void tearDown(void) { freeVM(); }
+
+void test_callsDoubleFunctions(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define pow (c-function \"libm.so.6\" \"pow\""
+                  "                        '(double double) 'double))"
+                  "(define power (pow 2 10))"));
+    TEST_ASSERT_TRUE(IS_FOREIGN(global("pow")));
+    TEST_ASSERT_EQUAL_DOUBLE(1024, AS_NUMBER(global("power")));
+}
+
+void test_passesStringsAndBuffers(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define strlen (c-function #f \"strlen\" '(string) 'long))"
+                  "(define memset (c-function #f \"memset\""
+                  "                           '(buffer int long) 'void))"
+                  "(define length (strlen \"abcdef\"))"
+                  "(define bytes (make-bytevector 6 97))"
+                  "(memset bytes 120 3)"
+                  "(define text (utf8->string bytes))"));
+    TEST_ASSERT_EQUAL_DOUBLE(6, AS_NUMBER(global("length")));
+    TEST_ASSERT_EQUAL_STRING("xxxaaa", AS_CSTRING(global("text")));
+}
+
+void test_buffersDontChangeLiterals(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define sprintf (c-function #f \"sprintf\""
+                  "                            '(buffer string) 'int))"
+                  "(define bytes (make-bytevector 8))"
+                  "(define length (sprintf bytes \"hi\"))"
+                  "(define text (utf8->string bytes 0 length))"
+                  "(define literal \"hi\")"));
+    TEST_ASSERT_EQUAL_STRING("hi", AS_CSTRING(global("text")));
+    TEST_ASSERT_EQUAL_STRING("hi", AS_CSTRING(global("literal")));
+}
+
+void test_copiesStringResults(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define strchr (c-function #f \"strchr\""
+                  "                           '(string int) 'string))"
+                  "(define rest (strchr \"key=value\" 61))"
+                  "(define none (strchr \"key\" 61))"));
+    TEST_ASSERT_EQUAL_STRING("=value", AS_CSTRING(global("rest")));
+    TEST_ASSERT_TRUE(valuesEqual(BOOL_VAL(false), global("none")));
+}
+
+void test_closureEngineCallsForeignFunctions(void) {
+    closureOptions.enabled = true;
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define abs (c-function #f \"labs\" '(long) 'long))"
+                  "(define (distance a b) (abs (- a b)))"
+                  "(define d (distance 3 10))"));
+    closureOptions.enabled = false;
+    TEST_ASSERT_EQUAL_DOUBLE(7, AS_NUMBER(global("d")));
+}
+
+void test_badCallsAreErrors(void) {
+    char const *errors[] = {
+        "(c-function #f \"no_such_function\" '() 'void)",
+        "(c-function \"no_such_library.so\" \"pow\" '() 'void)",
+        "(c-function #f \"strlen\" '(char) 'long)",
+        "(c-function #f \"strlen\" '(string) 'buffer)",
+        "((c-function #f \"strlen\" '(string) 'long) 1)",
+        "((c-function #f \"strlen\" '(string) 'long))",
+        "((c-function #f \"memset\" '(buffer int long) 'void) \"ab\" 0 2)",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(*errors); i++) {
+        TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret(errors[i]));
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_callsDoubleFunctions);
+    RUN_TEST(test_passesStringsAndBuffers);
+    RUN_TEST(test_buffersDontChangeLiterals);
+    RUN_TEST(test_copiesStringResults);
+    RUN_TEST(test_closureEngineCallsForeignFunctions);
+    RUN_TEST(test_badCallsAreErrors);
+    return UNITY_END();
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/compiler.h"
+#include "../src/heap_image.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+static char path[] = "/tmp/ecsi_test_XXXXXX";
+
+void setUp(void) {
+    initVM();
+    int descriptor = mkstemp(path);
+    TEST_ASSERT_NOT_EQUAL(-1, descriptor);
+    close(descriptor);
+}
+
+void tearDown(void) {
+    freeVM();
+    remove(path);
+    strcpy(path, "/tmp/ecsi_test_XXXXXX");
+}
+
+// Runs prelude, writes an image of it, and starts a new VM from the image.
+static void restart(char const *prelude) {
+    compilerOptions.lazy = false;
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(prelude));
+    TEST_ASSERT_TRUE(writeHeapImage(path));
+
+    freeVM();
+    initVM();
+    TEST_ASSERT_TRUE(readHeapImage(path));
+}
+
+void test_imageKeepsGlobals(void) {
+    restart("(define (size x) (case x ((1 2 3) 'small) (else 'big)))"
+            "(define items '(1 \"two\" three))"
+            "(define show display)"
+            "(define bytes (make-bytevector 3 7))");
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define kind (size 2))"));
+
+    TEST_ASSERT_TRUE(
+        textOfSymbolEqualToString(AS_SYMBOL(global("kind")), "small"));
+    TEST_ASSERT_EQUAL_STRING("two", AS_STRING(CADR(global("items")))->chars);
+    TEST_ASSERT_EQUAL_INT(3, AS_BYTEVECTOR(global("bytes"))->length);
+    TEST_ASSERT_EQUAL_UINT8(7, AS_BYTEVECTOR(global("bytes"))->bytes[2]);
+    // Natives are the ones of the new VM.
+    TEST_ASSERT_TRUE(valuesEqual(global("display"), global("show")));
+}
+
+void test_closuresKeepSharedUpvalues(void) {
+    restart("(define count #f)"
+            "(define (make-counter)"
+            "  (let ((n 0))"
+            "    (set! count (lambda () n))"
+            "    (lambda () (set! n (+ n 1)) n)))"
+            "(define tick (make-counter))"
+            "(tick)");
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(tick) (define n (count))"));
+
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("n")));
+}
+
+void test_lazyBodiesCantBeWritten(void) {
+    compilerOptions.lazy = true;
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define (f) 1)"));
+    TEST_ASSERT_FALSE(writeHeapImage(path));
+}
+
+void test_otherFilesAreRejected(void) {
+    FILE *file = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(file);
+    fputs("not an image", file);
+    fclose(file);
+    TEST_ASSERT_FALSE(readHeapImage(path));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_imageKeepsGlobals);
+    RUN_TEST(test_closuresKeepSharedUpvalues);
+    RUN_TEST(test_lazyBodiesCantBeWritten);
+    RUN_TEST(test_otherFilesAreRejected);
+    return UNITY_END();
+}
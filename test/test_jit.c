@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "../src/jit.h"
+#include "../src/object.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+static TierOptions const DEFAULT_TIER_OPTIONS = {
+    .callThreshold = 100, .loopThreshold = 1000, .timeTiers = false};
+
+void setUp(void) {
+    initVM();
+    jitOptions.enabled = true;
+    // Promote every function the first time it runs.
+    tierOptions.callThreshold = 1;
+    tierOptions.loopThreshold = 1;
+}
+
+void tearDown(void) {
+    jitOptions.enabled = false;
+    tierOptions = DEFAULT_TIER_OPTIONS;
+    freeVM();
+}
+
+void testRecursion(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) "
+                  "(fib (- n 2)))))"
+                  "(define r (fib 15))"));
+    TEST_ASSERT_EQUAL_DOUBLE(610, AS_NUMBER(global("r")));
+}
+
+void testLoopsAndClosures(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (make-adder n) (lambda (x) (+ x n)))"
+                  "(define add3 (make-adder 3))"
+                  "(define r (do ((i 0 (+ i 1)) (s 0 (add3 s)))"
+                  "  ((= i 10) s)))"
+                  "(define c (case r ((30) 'thirty) (else 'other)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(30, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_STRING("thirty", AS_SYMBOL(global("c"))->chars);
+}
+
+void testRuntimeError(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          interpret("(define (f x) (+ x 1)) (f #t)"));
+    TEST_ASSERT_EQUAL_INT(0, vm.frameCount);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testRecursion);
+    RUN_TEST(testLoopsAndClosures);
+    RUN_TEST(testRuntimeError);
+    return UNITY_END();
+}
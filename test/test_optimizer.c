@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/object.h"
+#include "../src/optimizer.h"
+#include "../src/parser.h"
+#include "../src/scanner.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+static ObjSyntaxPointerArray ast;
+static bool parsed;
+
+void setUp(void) {
+    initVM();
+    parsed = false;
+}
+
+void tearDown(void) {
+    if (parsed) freeAST(&ast);
+    freeVM();
+}
+
+// Parses source, which must be one form, and optimizes it at level.
+static Value optimizeSource(char const *source, int level) {
+    initScanner(source);
+    initParser();
+    ast = parseAllTokens();
+    parsed = true;
+    TEST_ASSERT_EQUAL_size_t(1, getSmartArrayCount(&ast));
+
+    optimizerOptions.level = level;
+    Value form = optimize(OBJ_VAL(SMART_ARRAY_AT(&ast, 0, ObjSyntax *)));
+    return IS_SYNTAX(form) ? AS_SYNTAX(form)->value : form;
+}
+
+void test_foldsArithmetic(void) {
+    Value form = optimizeSource("(* (+ 1 2) (- 10 4))", 1);
+    TEST_ASSERT_TRUE(IS_NUMBER(form));
+    TEST_ASSERT_EQUAL_DOUBLE(18, AS_NUMBER(form));
+}
+
+void test_foldsIfWithLiteralTest(void) {
+    Value form = optimizeSource("(if (< 1 2) 'yes 'no)", 1);
+    TEST_ASSERT_TRUE(IS_PAIR(form));
+    Value quoted = CADR(form);
+    quoted = IS_SYNTAX(quoted) ? AS_SYNTAX(quoted)->value : quoted;
+    TEST_ASSERT_TRUE(textOfSymbolEqualToString(AS_SYMBOL(quoted), "yes"));
+}
+
+void test_eliminatesDeadBinding(void) {
+    Value form = optimizeSource("(let ((x 1)) 2)", 1);
+    TEST_ASSERT_TRUE(IS_NUMBER(form));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(form));
+}
+
+void test_inlinesSmallProcedures(void) {
+    Value form = optimizeSource(
+        "(let ((f (lambda (x) (* x 2)))) (let ((y 21)) (f y)))", 2);
+    TEST_ASSERT_TRUE(IS_NUMBER(form));
+    TEST_ASSERT_EQUAL_DOUBLE(42, AS_NUMBER(form));
+}
+
+void test_levelZeroLeavesFormAlone(void) {
+    Value form = optimizeSource("(+ 1 2)", 0);
+    TEST_ASSERT_TRUE(IS_PAIR(form));
+}
+
+void test_foldsPureNatives(void) {
+    Value form = optimizeSource("(eqv? 'a 'a)", 1);
+    TEST_ASSERT_TRUE(IS_BOOL(form));
+    TEST_ASSERT_TRUE(AS_BOOL(form));
+
+    freeAST(&ast);
+    form = optimizeSource("(null? '())", 1);
+    TEST_ASSERT_TRUE(IS_BOOL(form));
+    TEST_ASSERT_TRUE(AS_BOOL(form));
+
+    // Natives with effects, or which allocate, are left for run time.
+    freeAST(&ast);
+    TEST_ASSERT_TRUE(IS_PAIR(optimizeSource("(cons 1 2)", 1)));
+}
+
+void test_redefinedNativesArentFolded(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define (eqv? a b) 'no)"
+                                    "(define r (eqv? 1 1))"));
+    Value value = NIL_VAL;
+    TEST_ASSERT_TRUE(tableGet(&vm.globals, newSymbol("r", 1), &value));
+    TEST_ASSERT_TRUE(IS_SYMBOL(value));
+}
+
+void test_renamingKeepsShadowedVariablesApart(void) {
+    optimizerOptions.level = 2;
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (let ((x 1))"
+                  "  (let ((f (lambda (y) (+ x y))))"
+                  "    (let ((x 10)) (f x)))))"));
+
+    Value value = NIL_VAL;
+    TEST_ASSERT_TRUE(tableGet(&vm.globals, newSymbol("r", 1), &value));
+    TEST_ASSERT_EQUAL_DOUBLE(11, AS_NUMBER(value));
+}
+
+void test_variadicLambdasArentReduced(void) {
+    // A call of a lambda with optional parameters has fewer arguments.
+    Value form = optimizeSource("((lambda (x #!optional y) y) 1)", 2);
+    TEST_ASSERT_TRUE(IS_PAIR(form));
+
+    // The clauses of a case-lambda bind their own x.
+    optimizerOptions.level = 2;
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define r (let ((x 1)) ((case-lambda ((x) x)) 2)))"));
+    Value value = NIL_VAL;
+    TEST_ASSERT_TRUE(tableGet(&vm.globals, newSymbol("r", 1), &value));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(value));
+}
+
+void test_longListsDontOverflowTheStack(void) {
+    // Every pass walks the clauses of this case.
+    int clauses = 70000;
+    char *source = malloc((size_t)clauses * 24 + 32);
+    char *end = source + sprintf(source, "(case (+ 1 2)");
+    for (int i = 0; i < clauses; i++) {
+        end += sprintf(end, " ((%d) (+ %d 1))", i, i);
+    }
+    strcpy(end, ")");
+
+    Value form = optimizeSource(source, 2);
+    free(source);
+    TEST_ASSERT_TRUE(IS_PAIR(form));
+    // The key was folded, and the clauses after it were kept.
+    Value key = CADR(form);
+    key = IS_SYNTAX(key) ? AS_SYNTAX(key)->value : key;
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(key));
+    int length = 0;
+    for (; IS_PAIR(form); form = CDR(form)) length++;
+    TEST_ASSERT_EQUAL_INT(clauses + 2, length);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_foldsArithmetic);
+    RUN_TEST(test_foldsIfWithLiteralTest);
+    RUN_TEST(test_eliminatesDeadBinding);
+    RUN_TEST(test_inlinesSmallProcedures);
+    RUN_TEST(test_levelZeroLeavesFormAlone);
+    RUN_TEST(test_renamingKeepsShadowedVariablesApart);
+    RUN_TEST(test_foldsPureNatives);
+    RUN_TEST(test_redefinedNativesArentFolded);
+    RUN_TEST(test_variadicLambdasArentReduced);
+    RUN_TEST(test_longListsDontOverflowTheStack);
+    return UNITY_END();
+}
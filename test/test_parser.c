@@ -0,0 +1,74 @@
+#include "../src/object.h"
+#include "../src/parser.h"
+#include "../src/scanner.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+static ObjSyntaxPointerArray ast;
+static bool parsed;
+
+void setUp(void) {
+    initVM();
+    parsed = false;
+}
+
+void tearDown(void) {
+    if (parsed) freeAST(&ast);
+    freeVM();
+}
+
+static Value unwrap(Value value) {
+    return IS_SYNTAX(value) ? AS_SYNTAX(value)->value : value;
+}
+
+// Parses source, which must be one form, and returns the datum it quotes.
+static Value parseQuoted(char const *source) {
+    initScanner(source);
+    initParser();
+    ast = parseAllTokens();
+    parsed = true;
+    TEST_ASSERT_EQUAL_size_t(1, getSmartArrayCount(&ast));
+
+    Value form = SMART_ARRAY_AT(&ast, 0, ObjSyntax *)->value;
+    TEST_ASSERT_TRUE(IS_PAIR(form));
+    return unwrap(CADR(form));
+}
+
+static void assertIsSymbol(char const *expected, Value value) {
+    TEST_ASSERT_TRUE(IS_SYMBOL(value));
+    TEST_ASSERT_EQUAL_STRING(expected, AS_SYMBOL(value)->chars);
+}
+
+void testDecimalsInLists(void) {
+    Value list = parseQuoted("'(1 2.5)");
+    TEST_ASSERT_TRUE(IS_PAIR(list));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(unwrap(CAR(list))));
+    TEST_ASSERT_TRUE(IS_PAIR(CDR(list)));
+    TEST_ASSERT_EQUAL_DOUBLE(2.5, AS_NUMBER(unwrap(CADR(list))));
+    TEST_ASSERT_TRUE(IS_NIL(CDDR(list)));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define r (+ 1 2.5))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3.5, AS_NUMBER(global("r")));
+}
+
+void testDottedLists(void) {
+    Value pair = parseQuoted("'(a . b)");
+    TEST_ASSERT_TRUE(IS_PAIR(pair));
+    assertIsSymbol("a", unwrap(CAR(pair)));
+    assertIsSymbol("b", unwrap(CDR(pair)));
+
+    // A dot between numbers still separates them.
+    freeAST(&ast);
+    pair = parseQuoted("'(1 . 2)");
+    TEST_ASSERT_TRUE(IS_PAIR(pair));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(unwrap(CAR(pair))));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(unwrap(CDR(pair))));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testDecimalsInLists);
+    RUN_TEST(testDottedLists);
+    return UNITY_END();
+}
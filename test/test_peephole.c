@@ -0,0 +1,99 @@
+#include "../src/chunk.h"
+#include "../src/line_number.h"
+#include "../src/peephole.h"
+#include "../src/value.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+Chunk chunk;
+
+void setUp(void) {
+    initVM();
+    initChunk(&chunk);
+}
+
+void tearDown(void) {
+    freeChunk(&chunk);
+    freeVM();
+}
+
+// Asserts that chunk's code is the count bytes in expected.
+static void assertCode(uint8_t const *expected, size_t count) {
+    TEST_ASSERT_EQUAL_size_t(count, getChunkCount(&chunk));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, getChunkCode(&chunk), count);
+    TEST_ASSERT_EQUAL_size_t(count, numberOfEntries(&(chunk.lines)));
+}
+
+void test_fusesLocalsAndDropsPushPop(void) {
+    writeChunk(&chunk, OP_GET_LOCAL, 1);
+    writeChunk(&chunk, 1, 1);
+    writeChunk(&chunk, OP_GET_LOCAL, 2);
+    writeChunk(&chunk, 2, 2);
+    writeChunk(&chunk, OP_ADD, 2);
+    writeChunk(&chunk, OP_TRUE, 3);
+    writeChunk(&chunk, OP_POP, 3);
+    writeChunk(&chunk, OP_RETURN, 4);
+
+    optimizeChunk(&chunk);
+
+    uint8_t const expected[] = {OP_GET_LOCAL_2, 1, 2, OP_ADD, OP_RETURN};
+    assertCode(expected, sizeof(expected));
+    TEST_ASSERT_EQUAL_INT(1, getLine(&chunk, 0));
+    TEST_ASSERT_EQUAL_INT(2, getLine(&chunk, 3));
+    TEST_ASSERT_EQUAL_INT(4, getLine(&chunk, 4));
+}
+
+void test_threadsJumps(void) {
+    // A jump to a jump to a return becomes a return.
+    writeChunk(&chunk, OP_JUMP, 1);
+    writeChunk(&chunk, 0, 1);
+    writeChunk(&chunk, 1, 1);
+    writeChunk(&chunk, OP_NIL, 1);
+    writeChunk(&chunk, OP_JUMP, 1);
+    writeChunk(&chunk, 0, 1);
+    writeChunk(&chunk, 1, 1);
+    writeChunk(&chunk, OP_NIL, 1);
+    writeChunk(&chunk, OP_RETURN, 1);
+
+    optimizeChunk(&chunk);
+
+    uint8_t const expected[] = {OP_RETURN, OP_NIL, OP_RETURN, OP_NIL,
+                                OP_RETURN};
+    assertCode(expected, sizeof(expected));
+}
+
+void test_fusesConditionalJumpWithPops(void) {
+    // (if x 1 2) where x is local 1.
+    writeChunk(&chunk, OP_GET_LOCAL, 1);
+    writeChunk(&chunk, 1, 1);
+    writeChunk(&chunk, OP_JUMP_IF_FALSE, 1);
+    writeChunk(&chunk, 0, 1);
+    writeChunk(&chunk, 6, 1);
+    writeChunk(&chunk, OP_POP, 1);
+    writeChunk(&chunk, OP_CONSTANT, 1);
+    writeChunk(&chunk, addConstant(&chunk, NUMBER_VAL(1)), 1);
+    writeChunk(&chunk, OP_JUMP, 1);
+    writeChunk(&chunk, 0, 1);
+    writeChunk(&chunk, 3, 1);
+    writeChunk(&chunk, OP_POP, 1);
+    writeChunk(&chunk, OP_CONSTANT, 1);
+    writeChunk(&chunk, addConstant(&chunk, NUMBER_VAL(2)), 1);
+    writeChunk(&chunk, OP_RETURN, 1);
+
+    optimizeChunk(&chunk);
+
+    // The jump over the other branch goes to a return, so it returns.
+    uint8_t const expected[] = {OP_GET_LOCAL, 1,           OP_POP_JUMP_IF_FALSE,
+                                0,            4,           OP_CONSTANT,
+                                0,            OP_RETURN,   OP_POP,
+                                OP_CONSTANT,  1,           OP_RETURN};
+    assertCode(expected, sizeof(expected));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fusesLocalsAndDropsPushPop);
+    RUN_TEST(test_threadsJumps);
+    RUN_TEST(test_fusesConditionalJumpWithPops);
+    return UNITY_END();
+}
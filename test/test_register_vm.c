@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "../src/object.h"
+#include "../src/register_vm.h"
+#include "../src/table.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+#include "helpers.h"
+
+void setUp(void) {
+    initVM();
+    registerOptions.enabled = true;
+    tierOptions.callThreshold = 1;
+}
+
+void tearDown(void) {
+    freeVM();
+    registerOptions.enabled = false;
+    tierOptions.callThreshold = 100;
+}
+
+void testLoops(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (sum n) (let loop ((i 0) (acc 0))"
+                  "  (if (> i n) acc (loop (+ i 1) (+ acc i)))))"
+                  "(define r (sum 100))"
+                  "(define swapped (let loop ((a 1) (b 2) (i 0))"
+                  "  (if (= i 3) (- a b) (loop b a (+ i 1)))))"));
+    TEST_ASSERT_EQUAL_DOUBLE(5050, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(global("swapped")));
+}
+
+void testCallsAndReturns(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) "
+                  "(fib (- n 2)))))"
+                  "(define r (fib 15))"
+                  "(define t (let ((x 1)) (let ((y (+ x 1))) (* x y))))"));
+    TEST_ASSERT_EQUAL_DOUBLE(610, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("t")));
+}
+
+void testClosuresAndSwitches(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (make-counter) (let ((n 0))"
+                  "  (lambda () (set! n (+ n 1)) n)))"
+                  "(define c (make-counter)) (c) (c)"
+                  "(define count (c))"
+                  "(define (f x) (case x ((1 2) 'low) (else 'other)))"
+                  "(define low (f 2)) (define other (f 5))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("count")));
+    TEST_ASSERT_TRUE(textOfSymbolEqualToString(AS_SYMBOL(global("low")),
+                                               "low"));
+    TEST_ASSERT_TRUE(textOfSymbolEqualToString(AS_SYMBOL(global("other")),
+                                               "other"));
+}
+
+void testRuntimeError(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR,
+                          interpret("(define (f x) (+ x 'a)) (f 1)"));
+}
+
+#ifdef COUNT_INSTRUCTIONS
+void testRunsFewerInstructions(void) {
+    char const *SOURCE =
+        "(define (sum n) (let loop ((i 0) (acc 0))"
+        "  (if (> i n) acc (loop (+ i 1) (+ acc i)))))"
+        "(sum 100)";
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(SOURCE));
+    size_t registerCount =
+        vm.stats.instructions + vm.stats.registerInstructions;
+
+    freeVM();
+    initVM();
+    registerOptions.enabled = false;
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret(SOURCE));
+    TEST_ASSERT_EQUAL_size_t(0, vm.stats.registerInstructions);
+    TEST_ASSERT_LESS_THAN_size_t(vm.stats.instructions, registerCount);
+}
+#endif
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testLoops);
+    RUN_TEST(testCallsAndReturns);
+    RUN_TEST(testClosuresAndSwitches);
+    RUN_TEST(testRuntimeError);
+#ifdef COUNT_INSTRUCTIONS
+    RUN_TEST(testRunsFewerInstructions);
+#endif
+    return UNITY_END();
+}
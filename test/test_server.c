@@ -0,0 +1,94 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/server.h"
+#include "../src/vm.h"
+#include "../unity/src/unity.h"
+
+static char directory[] = "/tmp/ecsi_test_XXXXXX";
+static char socketPath[64];
+static pid_t server;
+
+// What the last script sent to the server wrote.
+static char out[256];
+static char err[256];
+
+void setUp(void) {
+    initVM();
+    TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+    snprintf(socketPath, sizeof(socketPath), "%s/socket", directory);
+
+    // The server starts from a VM which has already run a prelude.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define answer 42)"));
+    fflush(stdout);
+    server = fork();
+    TEST_ASSERT_NOT_EQUAL(-1, server);
+    if (0 == server) _exit(serve(socketPath));
+
+    while (0 != access(socketPath, F_OK)) usleep(1000);
+}
+
+void tearDown(void) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(socketPath);
+    rmdir(directory);
+    strcpy(directory, "/tmp/ecsi_test_XXXXXX");
+    freeVM();
+}
+
+// Reads what was written to file into text.
+static void readBack(FILE *file, char *text, size_t size) {
+    rewind(file);
+    size_t length = fread(text, 1, size - 1, file);
+    text[length] = '\0';
+    fclose(file);
+}
+
+// Sends source to the server, and returns the script's exit status.
+static int submit(char const *source) {
+    FILE *script = tmpfile();
+    FILE *output = tmpfile();
+    FILE *errors = tmpfile();
+    fputs(source, script);
+    fflush(script);
+    rewind(script);
+
+    int status = submitScript(socketPath, fileno(script), fileno(output),
+                              fileno(errors));
+    fclose(script);
+    readBack(output, out, sizeof(out));
+    readBack(errors, err, sizeof(err));
+    return status;
+}
+
+void test_scriptsRunInTheWarmVM(void) {
+    TEST_ASSERT_EQUAL_INT(0, submit("(display answer)"));
+    TEST_ASSERT_EQUAL_STRING("42", out);
+}
+
+void test_scriptsDontSeeEachOther(void) {
+    TEST_ASSERT_EQUAL_INT(0, submit("(define answer 1)"));
+    TEST_ASSERT_EQUAL_INT(0, submit("(display answer)"));
+    TEST_ASSERT_EQUAL_STRING("42", out);
+}
+
+void test_errorsGoToStandardError(void) {
+    TEST_ASSERT_EQUAL_INT(70, submit("(display 1) (undefined)"));
+    TEST_ASSERT_EQUAL_STRING("1", out);
+    TEST_ASSERT_NOT_NULL(strstr(err, "Undefined variable 'undefined'."));
+
+    TEST_ASSERT_EQUAL_INT(65, submit("(if)"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_scriptsRunInTheWarmVM);
+    RUN_TEST(test_scriptsDontSeeEachOther);
+    RUN_TEST(test_errorsGoToStandardError);
+    return UNITY_END();
+}
@@ -1,7 +1,15 @@
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "../src/chunk.h"
+#include "../src/closure_engine.h"
+#include "../src/jit.h"
+#include "../src/object.h"
+#include "../src/table.h"
 #include "../src/vm.h"
 #include "../unity/src/unity.h"
+#include "helpers.h"
 
 void setUp(void) {
     puts("setting it up");
@@ -19,10 +27,303 @@ void testPush(void) { puts("testing push"); }
 
 void testInterpret(void) { puts("testing interpret"); }
 
+// Returns the opcode of the only call in the closure called name.
+static uint8_t callOpCode(char const *name) {
+    Chunk *chunk = &(AS_CLOSURE(global(name))->function->chunk);
+    for (size_t i = 0; i < getChunkCount(chunk); i++) {
+        uint8_t instruction = getChunkAt(chunk, i);
+        if (OP_CALL == instruction || OP_CALL_CLOSURE == instruction ||
+            OP_CALL_NATIVE == instruction) {
+            return instruction;
+        }
+    }
+    TEST_FAIL_MESSAGE("No call found.");
+    return OP_CALL;
+}
+
+void testCallsAreQuickened(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (call2 f a b) (f a b))"
+                  "(define sum (call2 (lambda (x y) (+ x y)) 1 2))"));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(global("sum")));
+    TEST_ASSERT_EQUAL_INT(OP_CALL_CLOSURE, callOpCode("call2"));
+
+    // The guard fails for a native, which deoptimizes the call.
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define same (call2 eqv? 1 1))"));
+    TEST_ASSERT_TRUE(AS_BOOL(global("same")));
+    TEST_ASSERT_EQUAL_INT(OP_CALL, callOpCode("call2"));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define same (call2 eqv? 1 2))"));
+    TEST_ASSERT_FALSE(AS_BOOL(global("same")));
+    TEST_ASSERT_EQUAL_INT(OP_CALL_NATIVE, callOpCode("call2"));
+
+    // A closure of the wrong arity still gets the generic error.
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_RUNTIME_ERROR,
+        interpret("(call2 (lambda (x y) x) 1 2) (call2 (lambda (x) x) 1 2)"));
+}
+
+void testCallCacheHits(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (inc x) (+ x 1))"
+                  "(define (twice f x) (f (f x)))"
+                  "(define r (twice inc 1))"
+                  "(define r (twice inc r))"));
+    TEST_ASSERT_EQUAL_DOUBLE(5, AS_NUMBER(global("r")));
+
+    // Each of twice's two sites misses once, then hits from then on. The
+    // two calls of twice are at different sites, so both of them miss.
+    VMStats stats = getVMStats();
+    TEST_ASSERT_EQUAL_size_t(2, stats.callCacheHits);
+    TEST_ASSERT_EQUAL_size_t(4, stats.callCacheMisses);
+
+    // Calling another function of the same arity refills the caches.
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK, interpret("(define r (twice (lambda (x) (* x 3)) 1))"));
+    TEST_ASSERT_EQUAL_DOUBLE(9, AS_NUMBER(global("r")));
+    TEST_ASSERT_EQUAL_size_t(2, getVMStats().callCacheHits);
+    TEST_ASSERT_EQUAL_size_t(7, getVMStats().callCacheMisses);
+    TEST_ASSERT_EQUAL_INT(OP_CALL_CLOSURE, callOpCode("twice"));
+}
+
+void testHotFunctionsArePromoted(void) {
+    TierOptions const DEFAULTS = tierOptions;
+    jitOptions.enabled = true;
+    tierOptions.callThreshold = 3;
+    tierOptions.loopThreshold = 5;
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define (f x) x) (f 1) (f 2)"));
+    ObjFunction *f = AS_CLOSURE(global("f"))->function;
+    TEST_ASSERT_EQUAL_INT(TIER_INTERPRETED, f->tier);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define r (f 3))"));
+    TEST_ASSERT_EQUAL_INT(TIER_NATIVE, f->tier);
+    TEST_ASSERT_EQUAL_UINT32(3, f->callCount);
+
+    // A loop promotes its function part way through, and finishes natively.
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (g n) (do ((i 0 (+ i 1))) ((= i n) i)))"
+                  "(define s (g 10))"));
+    ObjFunction *g = AS_CLOSURE(global("g"))->function;
+    TEST_ASSERT_EQUAL_INT(TIER_NATIVE, g->tier);
+    TEST_ASSERT_EQUAL_UINT32(5, g->loopCount);
+    TEST_ASSERT_EQUAL_DOUBLE(10, AS_NUMBER(global("s")));
+    TEST_ASSERT_EQUAL_size_t(2, getSmartArrayCount(&vm.promotedFunctions));
+
+    jitOptions.enabled = false;
+    tierOptions = DEFAULTS;
+}
+
+// Runs the higher order natives, whose callbacks go back into the VM.
+static void runHigherOrderNatives(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (depth n) (if (= n 0) 0 (+ 1 (depth (- n 1)))))"
+                  "(define sums (map (lambda (x y) (+ (depth x) y))"
+                  "                  '(10 40 50) '(1 2)))"
+                  "(define nested (map (lambda (x) (map depth (quote (3))))"
+                  "                    '(1)))"
+                  "(define total 0)"
+                  "(for-each (lambda (x) (set! total (+ total x)))"
+                  "          '(1 2 3))"));
+
+    Value sums = global("sums");
+    TEST_ASSERT_EQUAL_DOUBLE(11, AS_NUMBER(CAR(sums)));
+    TEST_ASSERT_EQUAL_DOUBLE(42, AS_NUMBER(CADR(sums)));
+    TEST_ASSERT_TRUE(IS_NIL(CDR(CDR(sums))));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(CAR(CAR(global("nested")))));
+    TEST_ASSERT_EQUAL_DOUBLE(6, AS_NUMBER(global("total")));
+
+    // An error in a callback abandons the native and the script.
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_RUNTIME_ERROR,
+        interpret("(define after 0)"
+                  "(map (lambda (x) (if (= x 2) (undefined) x)) '(1 2 3))"
+                  "(set! after 1)"));
+    TEST_ASSERT_EQUAL_DOUBLE(0, AS_NUMBER(global("after")));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(map depth)"));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK,
+                          interpret("(define one (map depth '(1)))"));
+    TEST_ASSERT_EQUAL_DOUBLE(1, AS_NUMBER(CAR(global("one"))));
+}
+
+void testNativesCallBackIntoScheme(void) { runHigherOrderNatives(); }
+
+void testNativesCallBackIntoClosures(void) {
+    closureOptions.enabled = true;
+    runHigherOrderNatives();
+    closureOptions.enabled = false;
+}
+
+// Returns how many arguments it was given.
+static Value countNative(int argCount, Value *args) {
+    (void)args;
+    return NUMBER_VAL(argCount);
+}
+
+void testNativeDescriptorsAreChecked(void) {
+    NativeDescriptor const COUNT = {
+        "count", countNative, 1, 2, {ARGUMENT_NUMBER}, NATIVE_PURE};
+    defineDescribedNative(&COUNT);
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define n (count 1 'a))"));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("n")));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(count)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(count 1 2 3)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(count 'a)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(car '())"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(map car 1)"));
+}
+
+#define THREAD_COUNT 4
+
+// A program run by a thread, and what its VM ended up with.
+typedef struct {
+    int number;  // Which thread runs it.
+    InterpretResult result;
+    Value fib;
+    Value index;
+} Run;
+
+// Runs a program in a VM of the thread's own.
+static void *runInThread(void *argument) {
+    Run *run = argument;
+    char source[256];
+    snprintf(source, sizeof(source),
+             "(define index %d)"
+             "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+             "(define result (fib 20))",
+             run->number);
+
+    initVM();
+    run->result = interpret(source);
+    tableGet(&vm.globals, newSymbol("result", 6), &run->fib);
+    tableGet(&vm.globals, newSymbol("index", 5), &run->index);
+    freeVM();
+    return NULL;
+}
+
+void testRestAndOptionalArguments(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define (rest a . more) more)"
+                  "(define (all . items) items)"
+                  "(define (opt a #!optional b) b)"
+                  "(define (call f x) (f x))"
+                  "(define none (rest 1))"
+                  "(define two (rest 1 2 3))"
+                  "(define empty (all))"
+                  "(define missing (opt 1))"
+                  "(define given (opt 1 2))"
+                  "(define called (call all 5))"));
+    TEST_ASSERT_TRUE(IS_NIL(global("none")));
+    TEST_ASSERT_EQUAL_DOUBLE(3, AS_NUMBER(CADR(global("two"))));
+    TEST_ASSERT_TRUE(IS_NIL(global("empty")));
+    TEST_ASSERT_FALSE(AS_BOOL(global("missing")));
+    TEST_ASSERT_EQUAL_DOUBLE(2, AS_NUMBER(global("given")));
+    TEST_ASSERT_EQUAL_DOUBLE(5, AS_NUMBER(CAR(global("called"))));
+
+    // Calls of variadic functions aren't cached.
+    TEST_ASSERT_EQUAL_INT(OP_CALL, callOpCode("call"));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(rest)"));
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(opt 1 2 3)"));
+}
+
+void testCaseLambdaDispatchesByArity(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define area (case-lambda"
+                  "  ((r) (* 3 r r))"
+                  "  ((w h) (* w h))"
+                  "  ((a b . more) more)))"
+                  "(define circle (area 2))"
+                  "(define square (area 2 3))"
+                  "(define more (area 1 2 3 4))"
+                  "(define mapped (map area '(1) '(5)))"));
+    TEST_ASSERT_TRUE(IS_CASE_LAMBDA(global("area")));
+    TEST_ASSERT_EQUAL_DOUBLE(12, AS_NUMBER(global("circle")));
+    TEST_ASSERT_EQUAL_DOUBLE(6, AS_NUMBER(global("square")));
+    TEST_ASSERT_EQUAL_DOUBLE(4, AS_NUMBER(CADR(global("more"))));
+    TEST_ASSERT_EQUAL_DOUBLE(5, AS_NUMBER(CAR(global("mapped"))));
+
+    ObjCaseLambda const *area = AS_CASE_LAMBDA(global("area"));
+    TEST_ASSERT_EQUAL_INT(-1, caseLambdaClause(area, 0));
+    TEST_ASSERT_EQUAL_INT(1, caseLambdaClause(area, 2));
+    TEST_ASSERT_EQUAL_INT(2, caseLambdaClause(area, 100));
+
+    TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret("(area)"));
+}
+
+void testBytevectors(void) {
+    TEST_ASSERT_EQUAL_INT(
+        INTERPRET_OK,
+        interpret("(define bytes (make-bytevector 4 104))"
+                  "(bytevector-u8-set! bytes 1 105)"
+                  "(define length (bytevector-length bytes))"
+                  "(define second (bytevector-u8-ref bytes 1))"
+                  "(define text (utf8->string bytes 0 2))"
+                  "(define is (bytevector? bytes))"));
+    TEST_ASSERT_EQUAL_DOUBLE(4, AS_NUMBER(global("length")));
+    TEST_ASSERT_EQUAL_DOUBLE(105, AS_NUMBER(global("second")));
+    TEST_ASSERT_EQUAL_STRING("hi", AS_CSTRING(global("text")));
+    TEST_ASSERT_TRUE(AS_BOOL(global("is")));
+
+    char const *errors[] = {
+        "(make-bytevector (- 0 1))",
+        "(make-bytevector 2 256)",
+        "(bytevector-u8-ref bytes 4)",
+        "(bytevector-u8-set! bytes 0 (/ 3 2))",
+        "(utf8->string bytes 3 2)",
+        "(bytevector-length \"text\")",
+    };
+    for (size_t i = 0; i < sizeof(errors) / sizeof(*errors); i++) {
+        TEST_ASSERT_EQUAL_INT(INTERPRET_RUNTIME_ERROR, interpret(errors[i]));
+    }
+}
+
+void testThreadsRunTheirOwnVMs(void) {
+    TEST_ASSERT_EQUAL_INT(INTERPRET_OK, interpret("(define index 99)"));
+
+    pthread_t threads[THREAD_COUNT];
+    Run runs[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        runs[i] = (Run){.number = i, .fib = NIL_VAL, .index = NIL_VAL};
+        TEST_ASSERT_EQUAL_INT(
+            0, pthread_create(&threads[i], NULL, runInThread, &runs[i]));
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_join(threads[i], NULL));
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        TEST_ASSERT_EQUAL_INT(INTERPRET_OK, runs[i].result);
+        TEST_ASSERT_EQUAL_DOUBLE(6765, AS_NUMBER(runs[i].fib));
+        TEST_ASSERT_EQUAL_DOUBLE(i, AS_NUMBER(runs[i].index));
+    }
+    TEST_ASSERT_EQUAL_DOUBLE(99, AS_NUMBER(global("index")));
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(testPop);
     RUN_TEST(testPush);
     RUN_TEST(testInterpret);
+    RUN_TEST(testCallsAreQuickened);
+    RUN_TEST(testCallCacheHits);
+    RUN_TEST(testHotFunctionsArePromoted);
+    RUN_TEST(testNativesCallBackIntoScheme);
+    RUN_TEST(testNativesCallBackIntoClosures);
+    RUN_TEST(testNativeDescriptorsAreChecked);
+    RUN_TEST(testRestAndOptionalArguments);
+    RUN_TEST(testCaseLambdaDispatchesByArity);
+    RUN_TEST(testBytevectors);
+    RUN_TEST(testThreadsRunTheirOwnVMs);
     return UNITY_END();
 }